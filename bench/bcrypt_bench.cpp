@@ -0,0 +1,257 @@
+// bcrypt_bench: checks bcrypt::eks against the scalar Blowfish key schedule
+// it replaced, then times both.
+//
+//   bcrypt_bench [cost]        (default 10)
+//
+// the reference below is node_bcrypt as it was before eks: the OpenBSD
+// Blowfish_expandstate/expand0state/blf_enc sequence, one byte at a time.
+// Every minor version ($2$, $2a$, $2b$) and key length is hashed with it and
+// compared against eks::run with 1 to 4 lanes, and against node_bcrypt via
+// bcrypt::validatePasswords, which batches by cost. Published $2a$ vectors
+// pin the reference itself. Exits non-zero on any mismatch.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bcrypt/bcrypt.h"
+#include "bcrypt/eksblowfish.h"
+#include "bcrypt/node_blf.h"
+
+namespace {
+  constexpr uint8_t CHECK_COST = 4;
+  // only 72 key bytes are ever read; past that the minors differ in how the
+  // length wraps: 300 is 44 bytes for $2$, 45 for $2a$ and 73 for $2b$
+  const size_t KEY_LENGTHS[] = {0, 1, 5, 55, 71, 72, 73, 300};
+  const char MINORS[] = {0, 'a', 'b'};
+
+  // jBCrypt's test vectors
+  const std::pair<const char *, const char *> PUBLISHED[] = {
+    {"", "$2a$06$DCq7YPn5Rq63x1Lad4cll.TV4S6ytwfsfvkgY8jIucDrjc8deX1s."},
+    {"a", "$2a$06$m0CrhHm10qJ3lXRY.5zDGO3rS2KdeeWLuGmsfGlMfOxih58VYVfxe"},
+    {"abc", "$2a$06$If6bvum7DFjUnE9p2uDeDu0YHzrHM6tf.iqN8.yx.jNN1ILEf7h0i"},
+    {"abcdefghijklmnopqrstuvwxyz", "$2a$06$.rCVZVOThsIa97pEDOxvGuRRgzG64bvtJ0938xuqzv18d3ZpQhstC"},
+    {"~!@#$%^&*()      ~!@#$%^&*()PNBFRD", "$2a$06$fPIsBO8qRqkjj273rfaOI.HtSV9jLDpTbZn782DC6/t7qT67P6FfO"},
+  };
+
+  struct Case {
+    char minor;
+    std::string key;
+    uint8_t salt[BCRYPT_MAXSALT];
+  };
+
+  size_t effective_key_len(size_t key_len, char minor) {
+    if (minor == 0)
+      return static_cast<uint8_t>(key_len);
+    if (minor == 'a')
+      return static_cast<uint8_t>(key_len + 1);
+    return std::min<size_t>(key_len, 72) + 1;
+  }
+
+  void reference_cdata(const uint8_t *key, size_t key_len, const uint8_t *salt, uint8_t cost, uint32_t *cdata) {
+    static const uint8_t magic[] = "OrpheanBeholderScryDoubt";
+    blf_ctx state;
+
+    Blowfish_initstate(&state);
+    Blowfish_expandstate(&state, salt, BCRYPT_MAXSALT, key, key_len);
+    for (uint32_t k = 0; k < (1u << cost); k++) {
+      Blowfish_expand0state(&state, key, key_len);
+      Blowfish_expand0state(&state, salt, BCRYPT_MAXSALT);
+    }
+
+    uint16_t j = 0;
+    for (int i = 0; i < BCRYPT_BLOCKS; i++)
+      cdata[i] = Blowfish_stream2word(magic, 4 * BCRYPT_BLOCKS, &j);
+    for (int k = 0; k < 64; k++)
+      blf_enc(&state, cdata, BCRYPT_BLOCKS / 2);
+  }
+
+  // bcrypt's own base64 alphabet, no padding
+  std::string encode_base64(const uint8_t *data, size_t len) {
+    static const char alphabet[] = "./ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+    std::string out;
+    for (size_t i = 0; i < len; i += 3) {
+      const uint32_t c1 = data[i];
+      const uint32_t c2 = i + 1 < len ? data[i + 1] : 0;
+      const uint32_t c3 = i + 2 < len ? data[i + 2] : 0;
+      out += alphabet[c1 >> 2];
+      out += alphabet[((c1 & 0x03) << 4) | (c2 >> 4)];
+      if (i + 1 >= len)
+        break;
+      out += alphabet[((c2 & 0x0f) << 2) | (c3 >> 6)];
+      if (i + 2 >= len)
+        break;
+      out += alphabet[c3 & 0x3f];
+    }
+    return out;
+  }
+
+  std::string format_hash(char minor, uint8_t cost, const uint8_t *salt, const uint32_t *cdata) {
+    uint8_t ciphertext[4 * BCRYPT_BLOCKS];
+    for (int i = 0; i < BCRYPT_BLOCKS; i++) {
+      ciphertext[4 * i + 0] = cdata[i] >> 24;
+      ciphertext[4 * i + 1] = cdata[i] >> 16;
+      ciphertext[4 * i + 2] = cdata[i] >> 8;
+      ciphertext[4 * i + 3] = cdata[i];
+    }
+
+    char head[8];
+    snprintf(head, sizeof(head), "%02u$", cost);
+    std::string out = "$2";
+    if (minor)
+      out += minor;
+    out += "$";
+    out += head;
+    out += encode_base64(salt, BCRYPT_MAXSALT);
+    out += encode_base64(ciphertext, 4 * BCRYPT_BLOCKS - 1);
+    return out;
+  }
+
+  std::vector<Case> make_cases() {
+    std::vector<Case> cases;
+    unsigned seed = 1;
+    for (const char minor : MINORS) {
+      for (const size_t len : KEY_LENGTHS) {
+        // an empty $2$ key has no bytes to cycle through
+        if (minor == 0 && len == 0)
+          continue;
+        Case c;
+        c.minor = minor;
+        for (size_t i = 0; i < len; i++)
+          c.key += static_cast<char>('!' + (seed * 7 + i * 13) % 94);
+        for (unsigned char &b : c.salt)
+          b = static_cast<uint8_t>((seed = seed * 1103515245u + 12345u) >> 16);
+        cases.push_back(std::move(c));
+      }
+    }
+    return cases;
+  }
+
+  int check(const std::vector<Case> &cases) {
+    int mismatches = 0;
+
+    std::vector<std::string> expected;
+    std::vector<std::vector<uint32_t>> words;
+    for (const Case &c : cases) {
+      uint32_t cdata[BCRYPT_BLOCKS];
+      reference_cdata(reinterpret_cast<const uint8_t *>(c.key.data()), effective_key_len(c.key.size(), c.minor),
+                      c.salt, CHECK_COST, cdata);
+      words.emplace_back(cdata, cdata + BCRYPT_BLOCKS);
+      expected.push_back(format_hash(c.minor, CHECK_COST, c.salt, cdata));
+    }
+
+    // eks::run directly, every lane count, each batch mixing minors and
+    // key lengths
+    for (int lanes = 1; lanes <= bcrypt::eks::LANES; lanes++) {
+      for (size_t first = 0; first < cases.size(); first += lanes) {
+        bcrypt::eks::Job jobs[bcrypt::eks::LANES];
+        const int count = static_cast<int>(std::min<size_t>(lanes, cases.size() - first));
+        for (int i = 0; i < count; i++) {
+          const Case &c = cases[first + i];
+          jobs[i].key = reinterpret_cast<const uint8_t *>(c.key.data());
+          jobs[i].key_len = effective_key_len(c.key.size(), c.minor);
+          jobs[i].salt = c.salt;
+        }
+        bcrypt::eks::run(jobs, count, CHECK_COST);
+
+        for (int i = 0; i < count; i++) {
+          if (std::equal(jobs[i].cdata, jobs[i].cdata + BCRYPT_BLOCKS, words[first + i].begin()))
+            continue;
+          const Case &c = cases[first + i];
+          fprintf(stderr, "eks::run, %d lanes: $2%s$ with a %zu byte key differs\n", lanes,
+                  c.minor ? std::string(1, c.minor).c_str() : "", c.key.size());
+          mismatches++;
+        }
+      }
+    }
+
+    // node_bcrypt through the library, one hash at a time and batched
+    for (size_t i = 0; i < cases.size(); i++) {
+      if (bcrypt::validatePassword(cases[i].key, expected[i]))
+        continue;
+      fprintf(stderr, "node_bcrypt: %s does not verify\n", expected[i].c_str());
+      mismatches++;
+    }
+    std::vector<std::pair<std::string, std::string>> batch;
+    for (size_t i = 0; i < cases.size(); i++)
+      batch.emplace_back(cases[i].key, expected[i]);
+    const std::vector<bool> results = bcrypt::validatePasswords(batch);
+    for (size_t i = 0; i < results.size(); i++) {
+      if (results[i])
+        continue;
+      fprintf(stderr, "validatePasswords: %s does not verify\n", expected[i].c_str());
+      mismatches++;
+    }
+
+    for (const auto &[password, hash] : PUBLISHED) {
+      if (bcrypt::validatePassword(password, hash))
+        continue;
+      fprintf(stderr, "published vector %s does not verify\n", hash);
+      mismatches++;
+    }
+
+    return mismatches;
+  }
+
+  template <typename F>
+  double per_hash_ms(const int hashes, F &&run) {
+    const auto start = std::chrono::steady_clock::now();
+    run();
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / hashes;
+  }
+
+  void bench(const std::vector<Case> &cases, const uint8_t cost) {
+    const int hashes = 12;  // whole batches at every lane count
+    const Case &c = cases[2];
+    const auto *key = reinterpret_cast<const uint8_t *>(c.key.data());
+    const size_t key_len = effective_key_len(c.key.size(), c.minor);
+
+    const double scalar = per_hash_ms(hashes, [&] {
+      uint32_t cdata[BCRYPT_BLOCKS];
+      for (int i = 0; i < hashes; i++)
+        reference_cdata(key, key_len, c.salt, cost, cdata);
+    });
+
+    auto lanes = [&](const int count) {
+      return per_hash_ms(hashes, [&] {
+        bcrypt::eks::Job jobs[bcrypt::eks::LANES];
+        for (int i = 0; i < count; i++) {
+          jobs[i].key = key;
+          jobs[i].key_len = key_len;
+          jobs[i].salt = c.salt;
+        }
+        for (int done = 0; done < hashes; done += count)
+          bcrypt::eks::run(jobs, count, cost);
+      });
+    };
+
+    printf("cost %u, ms per hash:\n", cost);
+    printf("  scalar reference  %8.2f\n", scalar);
+    for (int count = 1; count <= bcrypt::eks::LANES; count++) {
+      const double ms = lanes(count);
+      printf("  eks, %d lane%s      %8.2f  (%.2fx)\n", count, count > 1 ? "s" : " ", ms, scalar / ms);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const int cost = argc > 1 ? atoi(argv[1]) : 10;
+  if (cost < 4 || cost > 31) {
+    fprintf(stderr, "usage: %s [cost 4-31]\n", argv[0]);
+    return 2;
+  }
+
+  const std::vector<Case> cases = make_cases();
+  const int mismatches = check(cases);
+  printf("known-answer check: %zu cases, 1-%d lanes, %d mismatches\n", cases.size(), bcrypt::eks::LANES, mismatches);
+  if (mismatches > 0)
+    return 1;
+
+  bench(cases, static_cast<uint8_t>(cost));
+  return 0;
+}
@@ -2,16 +2,18 @@
 #include <QHostAddress>
 #include <QDateTime>
 
-#include "bcrypt/bcrypt.h"
 #include "lib/globals.h"
 #include "core/qtypes.h"
 #include "account.h"
 #include "channel.h"
 #include "ctx.h"
+#include "irc/fanout.h"
+#include "irc/utils.h"
 
-Account::Account(const QByteArray& account_name, QObject* parent) : m_nick(account_name), m_name(account_name) ,QObject(parent) {
+Account::Account(const QByteArray& account_name, QObject* parent) : m_nick(account_name), m_name(account_name) ,QObject(parent), m_backlog(g::backlogSize) {
   qDebug() << "new account" << account_name;
   m_host = g::defaultHost;
+  m_handle = g::accountSlab.insert(this);
 }
 
 void Account::setRandomUID() {
@@ -23,13 +25,16 @@ void Account::setRandomUID() {
   m_uid_str = m_uid.toString(QUuid::WithoutBraces).toUtf8();
 }
 
-QSharedPointer<QEventAuthUser> Account::verifyPassword(const QSharedPointer<QEventAuthUser> &auth) const {
+bool Account::verifyPassword(const QSharedPointer<QEventAuthUser> &auth, const VerifyDone &done) const {
   QReadLocker locker(&mtx_lock);
+  const QByteArray hash = m_password;
+  locker.unlock();
 
-  if (auth->password.isEmpty() || m_password.isEmpty()) {
+  if (auth->password.isEmpty() || hash.isEmpty()) {
     auth->reason = "password cannot be empty";
     auth->_cancel = true;
-    return auth;
+    done(auth);
+    return true;
   }
 
   if (g::ctx->snakepit->hasEventHandler(QEnums::QIRCEvent::AUTH_SASL_PLAIN)) {
@@ -38,20 +43,21 @@ QSharedPointer<QEventAuthUser> Account::verifyPassword(const QSharedPointer<QEve
       auth);
 
     if (result.canConvert<QSharedPointer<QEventAuthUser>>()) {
-      auto resPtr = result.value<QSharedPointer<QEventAuthUser>>();
-      return resPtr;
+      done(result.value<QSharedPointer<QEventAuthUser>>());
+      return true;
     }
 
     auth->reason = "application error";
     auth->_cancel = true;
-    return auth;
+    done(auth);
+    return true;
   }
 
-  const std::string candidateStr = auth->password.toStdString();
-  const std::string pw = m_password.toStdString();
-  auth->_cancel = !bcrypt::validatePassword(candidateStr, pw);
-  auth->reason = auth->cancelled() ? "bad password" : "";
-  return auth;
+  return g::ctx->password_verifier->submit(auth->password, hash, [auth, done](const bool valid) {
+    auth->_cancel = !valid;
+    auth->reason = valid ? "" : "bad password";
+    done(auth);
+  });
 }
 
 QSharedPointer<Account> Account::create() {
@@ -62,9 +68,20 @@ QSharedPointer<Account> Account::create() {
 }
 
 QSharedPointer<Account> Account::create_from_db(const QUuid &id, const QByteArray &username, const QByteArray &password, const QDateTime &creation) {
-  if (const auto ptr = get_by_name(username); !ptr.isNull())
+  // cache only; get_by_name() may fault in through the lazy loader
+  QReadLocker rlock(&g::ctx->mtx_cache);
+  if (const auto ptr = g::ctx->accounts_lookup_name.value(username); !ptr.isNull())
     return ptr;
+  rlock.unlock();
+
+  auto account = from_db_row(id, username, password, creation);
+  g::ctx->account_insert_cache(account);
+  g::ctx->irc_nicks_insert_cache(account->nick(), account);
+
+  return account;
+}
 
+QSharedPointer<Account> Account::from_db_row(const QUuid &id, const QByteArray &username, const QByteArray &password, const QDateTime &creation) {
   auto account = QSharedPointer<Account>(new Account(username));
   if (g::mainThread != QThread::currentThread())
     account->moveToThread(g::mainThread);
@@ -73,10 +90,6 @@ QSharedPointer<Account> Account::create_from_db(const QUuid &id, const QByteArra
   account->setName(username);
   account->setPassword(password);
   account->creation_date = creation;
-
-  g::ctx->account_insert_cache(account);
-  g::ctx->irc_nicks_insert_cache(account->nick(), account);
-
   return account;
 }
 
@@ -86,8 +99,32 @@ QByteArray Account::name() {
 }
 
 void Account::setHost(const QByteArray &host) {
+  const QByteArray old_prefix = prefix();
+
   QWriteLocker locker(&mtx_lock);
+  if (m_host == host)
+    return;
   m_host = host;
+  const QByteArray user = m_name.isEmpty() ? QByteArray("user") : m_name;
+  locker.unlock();
+
+  const QByteArray line = ":" + old_prefix + " CHGHOST " + user + " " + host + "\r\n";
+  irc::Fanout::neighbours(this, [line](irc::client_connection *conn) {
+    conn->send_if_capable(irc::PROTOCOL_CAPABILITY::CHGHOST, line);
+  });
+}
+
+void Account::setAway(const QByteArray &message) {
+  QWriteLocker locker(&mtx_lock);
+  if (m_away == message)
+    return;
+  m_away = message;
+  locker.unlock();
+
+  const QByteArray line = ":" + prefix() + " AWAY" + (message.isEmpty() ? QByteArray() : " :" + message) + "\r\n";
+  irc::Fanout::neighbours(this, [line](irc::client_connection *conn) {
+    conn->send_if_capable(irc::PROTOCOL_CAPABILITY::AWAY_NOTIFY, line);
+  }, false);
 }
 
 void Account::setName(const QByteArray &name) {
@@ -163,41 +200,22 @@ bool Account::setNick(const QSharedPointer<QEventNickChange> &event, bool broadc
   m_nick = event->new_nick;
   wlock.unlock();
 
-  // gather accounts that need to be notified
-  QSet<QSharedPointer<Account>> l;
-  l << self;
-
-  {
-    QReadLocker rlock(&mtx_lock);
-    for (auto it = channels.begin(); it != channels.end(); ++it) {
-      // QByteArray key = it.key();
-      const QSharedPointer<Channel> &channel = it.value();
-      for (const auto& acc: channel->members()) {
-        l.insert(acc);
-      }
-    }
-
-    for (const auto& channel: channels) {
-      for (const auto& acc: channel->members()) {
-        l.insert(acc);
-      }
-    }
-
-    // broadcast
-    for (const auto& acc: l) {
-      for (const auto&conn : acc->connections) {
-        QMetaObject::invokeMethod(conn,
-          [conn, event] {
-            conn->change_nick(event);
-          }, Qt::QueuedConnection);
-      }
-    }
+  for (const auto& channel_handle: channel_handles()) {
+    if (Channel *channel = g::channelSlab.get(channel_handle))
+      channel->invalidate_roster();
   }
 
+  // broadcast to ourselves and everyone sharing a channel with us
+  irc::Fanout::neighbours(this, [event](irc::client_connection *conn) {
+    conn->change_nick(event);
+  });
+
   return true;
 }
 
 void Account::message(QSharedPointer<QEventMessage> &message) {
+  message->stamp();
+
   // @TODO: deal with history when we are offline
   auto ev_type = QEnums::QIRCEvent::PRIVATE_MSG;
   if (message->tag_msg)
@@ -215,28 +233,63 @@ void Account::message(QSharedPointer<QEventMessage> &message) {
     }
   }
 
-  QReadLocker locker(&mtx_lock);
-  for (const auto& _conn: message->dest->connections)
-    _conn->message(message);
+  if (!message->tag_msg && message->dest->is_logged_in()) {
+    // bouncer backlog; the recipient may be offline, our other devices too
+    g::ctx->queueMessageForInsert(message);
+
+    HistoryEntry entry;
+    entry.key = {message->server_time, message->msgid.toRfc4122()};
+    entry.msgid = message->id;
+    entry.time = message->server_time_str;
+    entry.account = message->account.isNull() ? QByteArray() : message->account->name();
+    entry.tags = irc::encodeTags(message->tags);
+    entry.line = ":" + (message->account.isNull() ? message->nick : message->account->prefix()) +
+                 " PRIVMSG " + message->dest->nick() + " :" + message->text;
+
+    // each side files it under the other one
+    if (!message->account.isNull() && message->account != message->dest && message->account->is_logged_in()) {
+      HistoryEntry sent = entry;
+      sent.peer = message->dest->uid();
+      message->account->backlog().append(std::move(sent));
+    }
+    entry.peer = message->account.isNull() ? QUuid() : message->account->uid();
+    message->dest->backlog().append(std::move(entry));
+  }
+
+  message->dest->for_each_connection([&message](irc::client_connection *conn) {
+    conn->message(message);
+  });
 
   // send to ourselves (other connected clients)
-  for (const auto& _conn: connections) {
-    _conn->message(message);
-  }
+  for_each_connection([&message](irc::client_connection *conn) {
+    conn->message(message);
+  });
 }
 
 void Account::broadcast_nick_changed(const QByteArray& msg) const {
-  QReadLocker locker(&mtx_lock);
-  for (const auto& conn: connections) {
+  for_each_connection([&msg](const irc::client_connection *conn) {
     conn->m_socket->write(msg);
-  }
+  });
 }
 
 void Account::onConnectionDisconnected(irc::client_connection *conn, const QByteArray& nick_to_delete) {
   QWriteLocker locker(&mtx_lock);
-  connections.removeAll(conn);
+  connections.removeAll(conn->handle());
+  const bool last = connections.isEmpty();
   locker.unlock();
 
+  // bouncer; remember where every target stood, replayed on reconnect
+  if (last && is_logged_in() && g::backlogReplay > 0) {
+    const auto cursor = history::key_max(QDateTime::currentMSecsSinceEpoch());
+    QHash<QByteArray, HistoryKey> cursors;
+    cursors.insert(Backlog::PRIVATE, cursor);
+    for (const auto& channel_handle: channel_handles()) {
+      if (const Channel *channel = g::channelSlab.get(channel_handle))
+        cursors.insert("#" + channel->name(), cursor);
+    }
+    m_backlog.park(uid(), cursors);
+  }
+
   // when unregistered, we need to clean the global account roster
   if (!is_logged_in()) {
     g::ctx->irc_nicks_remove_cache(nick_to_delete);
@@ -250,33 +303,59 @@ void Account::onConnectionDisconnected(irc::client_connection *conn, const QByte
 }
 
 void Account::add_connection(irc::client_connection *ptr) {
-  connections << ptr;
+  QWriteLocker locker(&mtx_lock);
+  if (!connections.contains(ptr->handle()))
+    connections << ptr->handle();
+}
+
+bool Account::hasConnections() const {
+  QReadLocker locker(&mtx_lock);
+  for (const auto& h: connections) {
+    if (g::connectionSlab.alive(h))
+      return true;
+  }
+  return false;
 }
 
 void Account::clearConnections() {
+  QWriteLocker locker(&mtx_lock);
   connections.clear();
 }
 
 QSharedPointer<Account> Account::get_by_uid(const QUuid &uid) {
   QReadLocker locker(&g::ctx->mtx_cache);
-  return g::ctx->accounts_lookup_uuid.value(uid);
+  auto ptr = g::ctx->accounts_lookup_uuid.value(uid);
+  locker.unlock();
+
+  if (ptr.isNull() && g::lazyLoad)
+    ptr = g::ctx->lazy->account_by_uid(uid);
+  if (!ptr.isNull())
+    ptr->touch();
+  return ptr;
 }
 
 QSharedPointer<Account> Account::get_by_name(const QByteArray &name) {
   QReadLocker locker(&g::ctx->mtx_cache);
-  return g::ctx->accounts_lookup_name.value(name);
+  auto ptr = g::ctx->accounts_lookup_name.value(name);
+  locker.unlock();
+
+  if (ptr.isNull() && g::lazyLoad)
+    ptr = g::ctx->lazy->account_by_name(name);
+  if (!ptr.isNull())
+    ptr->touch();
+  return ptr;
 }
 
 // account merging; we consume account `from` and adopt its connections
 void Account::merge(const QSharedPointer<Account> &from) {
-  QWriteLocker locker(&mtx_lock);
   if (from->is_logged_in()) {
     qCritical() << "cannot merge 2 logged in accounts";
     return;
   }
 
-  for (const auto& conn: from->connections)
+  from->for_each_connection([this](irc::client_connection *conn) {
     add_connection(conn);
+  });
 
   from->clearConnections();
   g::ctx->account_remove_cache(from);
@@ -285,11 +364,18 @@ void Account::merge(const QSharedPointer<Account> &from) {
 }
 
 Account::~Account() {
+  g::accountSlab.release(m_handle);
   qDebug() << "RIP account";
 }
 
-void Account::add_channel(const QByteArray& channel) {
-  qDebug() << "account" << m_name << "add channel" << channel;
+void Account::add_channel(const ChannelHandle channel) {
+  QWriteLocker locker(&mtx_lock);
+  channels.insert(channel);
+}
+
+void Account::remove_channel(const ChannelHandle channel) {
+  QWriteLocker locker(&mtx_lock);
+  channels.remove(channel);
 }
 
 QVariantMap Account::to_variantmap() const {
@@ -304,9 +390,9 @@ QVariantMap Account::to_variantmap() const {
 
   // Channels: store only the channel names the account is part of
   QVariantList channelList;
-  for (auto it = channels.begin(); it != channels.end(); ++it) {
-    if (it.value()) {
-      channelList.append(it.value()->uid);
+  for (const auto& channel_handle: channels) {
+    if (const Channel *channel = g::channelSlab.get(channel_handle)) {
+      channelList.append(channel->uid);
     }
   }
 
@@ -333,9 +419,9 @@ rapidjson::Value Account::to_rapidjson(rapidjson::Document::AllocatorType& alloc
   if (include_channels) {
     // channels (only UID)
     rapidjson::Value channelsArray(rapidjson::kArrayType);
-    for (auto it = channels.begin(); it != channels.end(); ++it) {
-      if (it.value()) {
-        channelsArray.PushBack(rapidjson::Value(it.value()->uid_str.constData(), allocator), allocator);
+    for (const auto& channel_handle: channels) {
+      if (const Channel *channel = g::channelSlab.get(channel_handle)) {
+        channelsArray.PushBack(rapidjson::Value(channel->uid_str.constData(), allocator), allocator);
       }
     }
     obj.AddMember("channels", channelsArray, allocator);
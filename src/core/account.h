@@ -11,6 +11,9 @@
 #include <QHash>
 #include <QUuid>
 
+#include <atomic>
+#include <functional>
+
 #include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
@@ -18,11 +21,13 @@
 #include "lib/globals.h"
 #include "core/qtypes.h"
 #include "core/metadata.h"
+#include "core/handles.h"
+#include "core/backlog.h"
 #include "irc/client_connection.h"
 
 class Channel;
 
-class Account final : public QObject {
+class Account final : public QObject, public QEnableSharedFromThis<Account> {
 Q_OBJECT
 Q_PROPERTY(QByteArray name READ name WRITE setName NOTIFY nickChanged)
 Q_PROPERTY(QUuid uid READ uid WRITE setUID)
@@ -34,9 +39,14 @@ Q_PROPERTY(QDateTime creation_date MEMBER creation_date)
 public:
   explicit Account(const QByteArray& account_name = "", QObject* parent = nullptr);
   static QSharedPointer<Account> create_from_db(const QUuid &id, const QByteArray &username, const QByteArray &password, const QDateTime &creation);
+  // no cache lookup or insertion; for bulk loads that fill the caches in one go
+  static QSharedPointer<Account> from_db_row(const QUuid &id, const QByteArray &username, const QByteArray &password, const QDateTime &creation);
   static QSharedPointer<Account> create();
 
-  QSharedPointer<QEventAuthUser> verifyPassword(const QSharedPointer<QEventAuthUser> &auth) const;
+  // `done` gets the outcome, right away or from a PasswordVerifier thread.
+  // false when the verifier is overloaded; `done` is not called then
+  using VerifyDone = std::function<void(const QSharedPointer<QEventAuthUser> &auth)>;
+  bool verifyPassword(const QSharedPointer<QEventAuthUser> &auth, const VerifyDone &done) const;
 
   static QSharedPointer<Account> get_by_uid(const QUuid &uid);
   static QSharedPointer<Account> get_by_name(const QByteArray &name);
@@ -52,6 +62,7 @@ public:
   void setName(const QByteArray &name);
 
   QUuid uid() const;
+  [[nodiscard]] AccountHandle handle() const { return m_handle; }
   QByteArray uid_str() { return m_uid_str; }
   void setUID(const QUuid &uid);
 
@@ -88,6 +99,17 @@ public:
   }
   void setHost(const QByteArray &host);
 
+  [[nodiscard]] QByteArray away() const {
+    QReadLocker locker(&mtx_lock);
+    return m_away;
+  }
+  [[nodiscard]] bool isAway() const {
+    QReadLocker locker(&mtx_lock);
+    return !m_away.isEmpty();
+  }
+  // empty message clears the away status
+  void setAway(const QByteArray &message);
+
   [[nodiscard]] QByteArray prefix(const QByteArray &nick_override = "") const {
     QReadLocker locker(&mtx_lock);
     auto _nick = nick_override.isEmpty() ? m_nick : nick_override;
@@ -99,10 +121,28 @@ public:
 
   void broadcast_nick_changed(const QByteArray& msg) const;
 
-  void add_channel(const QByteArray &channel);
+  void add_channel(ChannelHandle channel);
+  void remove_channel(ChannelHandle channel);
+  [[nodiscard]] QSet<ChannelHandle> channel_handles() const {
+    QReadLocker locker(&mtx_lock);
+    return channels;
+  }
+
   void add_connection(irc::client_connection *ptr);
-  bool hasConnections() const {
-    return connections.size() > 0;
+  [[nodiscard]] bool hasConnections() const;
+
+  // visits live connections; handles of connections that went away are skipped.
+  // must not be called while holding `mtx_lock`
+  template <typename F>
+  void for_each_connection(F &&fn) const {
+    QReadLocker locker(&mtx_lock);
+    const auto handles = connections;
+    locker.unlock();
+
+    for (const auto &h : handles) {
+      if (irc::client_connection *conn = g::connectionSlab.get(h))
+        fn(conn);
+    }
   }
   void onConnectionDisconnected(irc::client_connection *conn, const QByteArray &nick_to_delete);
   void clearConnections();
@@ -110,11 +150,22 @@ public:
 
   QDateTime creation_date;
 
-  QList<irc::client_connection*> connections;
-  QHash<QByteArray, QSharedPointer<Channel>> channels;
+  QList<ConnectionHandle> connections;
+  QSet<ChannelHandle> channels;
 
   mutable QReadWriteLock mtx_lock;
 
+  // dedup stamp for irc::Fanout, only touched under its lock
+  quint64 fanout_epoch = 0;
+
+  // bouncer; private message tail and read cursors while offline
+  Backlog &backlog() { return m_backlog; }
+
+  // --lazy-load bookkeeping, see LazyLoader
+  std::atomic<bool> channels_loaded = false;
+  [[nodiscard]] qint64 last_active() const { return m_last_active; }
+  void touch() { m_last_active = QDateTime::currentSecsSinceEpoch(); }
+
   QSharedPointer<Metadata> metadata() {
     if (m_metadata.isNull())
       m_metadata = QSharedPointer<Metadata>::create(this);
@@ -125,12 +176,16 @@ public:
 signals:
   void nickChanged(const QByteArray& old_nick, const QByteArray& new_nick);
 private:
+  AccountHandle m_handle;
   QUuid m_uid;
   QByteArray m_uid_str;
   QByteArray m_name;
   QByteArray m_nick;
   QByteArray m_password;
   QByteArray m_host;
+  QByteArray m_away;
+  std::atomic<qint64> m_last_active = QDateTime::currentSecsSinceEpoch();
+  Backlog m_backlog;
 
   QSharedPointer<Metadata> m_metadata;
 
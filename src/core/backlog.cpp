@@ -0,0 +1,81 @@
+#include <QThreadPool>
+
+#include "core/backlog.h"
+#include "lib/sql.h"
+
+Backlog::Backlog(const int capacity) : m_capacity(std::max(1, capacity)) {}
+
+void Backlog::append(HistoryEntry entry) {
+  QWriteLocker locker(&mtx_lock);
+  if (!m_private)
+    m_private = std::make_unique<HistoryRing>(m_capacity);
+  locker.unlock();
+
+  m_private->append(std::move(entry));
+}
+
+QList<HistoryEntry> Backlog::range(const QUuid &account_id, const HistoryKey &lo, const HistoryKey &hi, const bool backward, const int limit,
+                                   const bool inclusive_lo, const QUuid &peer) const {
+  // the ring is never replaced once it exists, and locks itself
+  QReadLocker locker(&mtx_lock);
+  const HistoryRing *ring = m_private.get();
+  locker.unlock();
+
+  return history::range(ring, lo, hi, backward, limit, inclusive_lo,
+    [&account_id, &peer](const HistoryKey &db_lo, const HistoryKey &db_hi, const bool db_backward, const int db_limit, const bool db_inclusive_lo) {
+      return sql::private_history(account_id, db_lo, db_hi, db_backward, db_limit, db_inclusive_lo, peer);
+    }, peer);
+}
+
+QList<HistoryEntry> Backlog::conversations(const HistoryKey &lo, const HistoryKey &hi) const {
+  QReadLocker locker(&mtx_lock);
+  const HistoryRing *ring = m_private.get();
+  locker.unlock();
+
+  return ring != nullptr ? ring->newest_per_peer(lo, hi) : QList<HistoryEntry>();
+}
+
+// one thread, so a park's save and the next take's delete reach the
+// database in the order they were issued
+static QThreadPool *io() {
+  static auto *pool = [] {
+    auto *p = new QThreadPool;
+    p->setMaxThreadCount(1);
+    p->setExpiryTimeout(-1);
+    return p;
+  }();
+  return pool;
+}
+
+void Backlog::park(const QUuid &account_id, const Cursors &cursors) {
+  QWriteLocker locker(&mtx_lock);
+  m_cursors = cursors;
+  locker.unlock();
+
+  // survives restarts and --lazy-load evictions
+  io()->start([account_id, cursors] { sql::backlog_cursors_save(account_id, cursors); });
+}
+
+void Backlog::take(const QUuid &account_id, QObject *context, std::function<void(Cursors)> done) {
+  QWriteLocker locker(&mtx_lock);
+  Cursors cursors = std::move(m_cursors);
+  m_cursors.clear();
+  locker.unlock();
+
+  // parked by this process; the database holds the same, drop it there
+  if (!cursors.isEmpty()) {
+    io()->start([account_id] { sql::backlog_cursors_take(account_id); });
+    done(std::move(cursors));
+    return;
+  }
+
+  // parked before a restart or an eviction
+  io()->start([account_id, context, done = std::move(done)] {
+    auto stored = sql::backlog_cursors_take(account_id);
+    if (stored.isEmpty())
+      return;
+    QMetaObject::invokeMethod(context, [done, stored = std::move(stored)] {
+      done(stored);
+    }, Qt::QueuedConnection);
+  });
+}
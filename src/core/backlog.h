@@ -0,0 +1,50 @@
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QList>
+#include <QReadWriteLock>
+#include <QUuid>
+
+#include <functional>
+#include <memory>
+
+#include "core/history.h"
+
+// bouncer state of one account: the tail of its private conversations and,
+// while no connection is attached, a read cursor per target (#channel, or
+// "*" for private messages) marking where the last connection left off.
+// Whatever lies past the cursors is replayed on reconnect.
+class Backlog {
+public:
+  static constexpr auto PRIVATE = "*";
+
+  explicit Backlog(int capacity);
+
+  // private messages to and from the account
+  void append(HistoryEntry entry);
+  // private messages in (lo, hi), see HistoryRing::range(); the database
+  // below the ring's floor. With `peer`, only those exchanged with it
+  QList<HistoryEntry> range(const QUuid &account_id, const HistoryKey &lo, const HistoryKey &hi, bool backward, int limit,
+                            bool inclusive_lo = false, const QUuid &peer = QUuid()) const;
+  // the newest message of every conversation still in the ring, for
+  // CHATHISTORY TARGETS
+  QList<HistoryEntry> conversations(const HistoryKey &lo, const HistoryKey &hi) const;
+
+  using Cursors = QHash<QByteArray, HistoryKey>;
+
+  // last connection went away; cursors are kept in memory right away and
+  // written to the database in the background
+  void park(const QUuid &account_id, const Cursors &cursors);
+  // first connection is back; hands the parked cursors (and forgets them)
+  // to `done`, on the thread of `context`. Without cursors in memory they
+  // are looked up in the background, the caller does not wait on the DB
+  void take(const QUuid &account_id, QObject *context, std::function<void(Cursors)> done);
+
+private:
+  mutable QReadWriteLock mtx_lock;
+  int m_capacity;
+  // allocated on the first private message; most accounts never get one
+  std::unique_ptr<HistoryRing> m_private;
+  Cursors m_cursors;
+};
@@ -1,14 +1,43 @@
 #include "core/channel.h"
 
+#include <QThreadPool>
+
 #include "ctx.h"
 #include "lib/globals.h"
 #include "core/server.h"
 #include "core/qtypes.h"
+#include "irc/utils.h"
+#include "lib/uuidv7.h"
 
-Channel::Channel(const QByteArray &name, QObject *parent) : QObject(parent), m_name(name) {
+Channel::Channel(const QByteArray &name, QObject *parent) :
+    QObject(parent), m_name(name), m_history(g::historySize),
+    m_events(g::historySize) {
   channel_modes.set(
     irc::ChannelModes::NO_OUTSIDE_MSGS,
     irc::ChannelModes::TOPIC_PROTECTED);
+  m_handle = g::channelSlab.insert(this);
+}
+
+Channel::~Channel() {
+  g::channelSlab.release(m_handle);
+}
+
+QList<AccountHandle> Channel::member_handles() const {
+  QReadLocker locker(&mtx_lock);
+  return m_members;
+}
+
+QList<QSharedPointer<Account>> Channel::members() const {
+  const auto handles = member_handles();
+  QList<QSharedPointer<Account>> result;
+  result.reserve(handles.size());
+  for (const auto& member: handles) {
+    if (Account *acc = g::accountSlab.get(member)) {
+      if (auto ptr = acc->sharedFromThis(); !ptr.isNull())
+        result << ptr;
+    }
+  }
+  return result;
 }
 
 bool Channel::has(const QByteArray &username) const {
@@ -21,13 +50,32 @@ QSharedPointer<Channel> Channel::create_from_db(
   const QByteArray &topic,
   const QSharedPointer<Account> &owner,
   const QSharedPointer<Server> &server,
-  const QDateTime &creation
+  const QDateTime &creation,
+  const std::optional<quint64> event_head
 ) {
   auto const ctx = Ctx::instance();
-  const auto it = ctx->channels.find(name);
-  if (it != ctx->channels.end())
-    return it.value();
+  QReadLocker rlock(&ctx->mtx_cache);
+  if (const auto ptr = ctx->channels.value(name); !ptr.isNull())
+    return ptr;
+  rlock.unlock();
+
+  auto channel = from_db_row(id, name, topic, owner, server, creation,
+                             event_head ? *event_head : sql::channel_event_head(id));
+
+  QWriteLocker wlock(&ctx->mtx_cache);
+  ctx->channels[name] = channel;
+  return channel;
+}
 
+QSharedPointer<Channel> Channel::from_db_row(
+  const QUuid &id,
+  const QByteArray &name,
+  const QByteArray &topic,
+  const QSharedPointer<Account> &owner,
+  const QSharedPointer<Server> &server,
+  const QDateTime &creation,
+  const quint64 event_head
+) {
   auto channel = QSharedPointer<Channel>(new Channel(name));
   if (g::mainThread != QThread::currentThread())
     channel->moveToThread(g::mainThread);
@@ -40,8 +88,7 @@ QSharedPointer<Channel> Channel::create_from_db(
   channel->setServer(server);
   channel->setTopic(topic);
   channel->date_creation = creation;
-
-  ctx->channels[name] = channel;
+  channel->m_events.seed(event_head);
   return channel;
 }
 
@@ -66,38 +113,48 @@ bool Channel::part(const QSharedPointer<QEventChannelPart> &event) {
     }
   }
 
-  const auto chan_ptr = get(m_name);
+  const auto account_handle = event->account->handle();
 
   QReadLocker rlock(&mtx_lock);
-  if (!m_members.contains(event->account))
+  if (!m_members.contains(account_handle))
     return false;
+  const auto members = m_members;
   rlock.unlock();
 
+  // a JOIN still queued for the peers would arrive after this PART
+  g::ctx->join_pipeline->cancel(m_handle, account_handle);
+
   // broadcast
-  rlock.relock();
-  for (const auto& member: m_members) {
-    for (const auto& conn: member->connections) {
-      qDebug() << "emit part to" << member->name();
+  for (const auto& member: members) {
+    const Account *acc = g::accountSlab.get(member);
+    if (acc == nullptr)
+      continue;
 
+    acc->for_each_connection([&event](irc::client_connection *conn) {
       QMetaObject::invokeMethod(conn,
         [conn, event] {
           conn->channel_part(event);
         }, Qt::QueuedConnection);
-    }
+    });
   }
-  rlock.unlock();
 
   QWriteLocker wlock(&mtx_lock);
-  m_members.removeAll(event->account);
+  m_members.removeAll(account_handle);
   wlock.unlock();
+  invalidate_roster();
+
+  event->account->remove_channel(m_handle);
+
+  QByteArray line = ":" + event->account->prefix() + " PART #" + name();
+  if (!event->message.isEmpty())
+    line += " :" + event->message;
+  record(sql::EventType::ChannelLeave, event->account, line);
 
   return true;
 }
 
 // @TODO: check if user is allowed to join/create new channel
 void Channel::join(const QSharedPointer<QEventChannelJoin> &event) {
-  const auto chan_ptr = get(m_name);
-
   if (!event->from_system && g::ctx->snakepit->hasEventHandler(QEnums::QIRCEvent::CHANNEL_JOIN)) {
     const auto result = g::ctx->snakepit->event(QEnums::QIRCEvent::CHANNEL_JOIN, event);
 
@@ -108,30 +165,117 @@ void Channel::join(const QSharedPointer<QEventChannelJoin> &event) {
     }
   }
 
+  const auto account_handle = event->account->handle();
+
   QWriteLocker locker(&mtx_lock);
-  if (!m_members.contains(event->account)) {
-    m_members << event->account;
+  const bool joined = !m_members.contains(account_handle);
+  if (joined) {
+    m_members << account_handle;
     emit memberJoined(event->account);
-    event->account->channels[m_name] = chan_ptr;
+    event->account->add_channel(m_handle);
+  }
+  locker.unlock();
+
+  if (joined) {
+    invalidate_roster();
+    record(sql::EventType::ChannelJoin, event->account, ":" + event->account->prefix() + " JOIN #" + name());
   }
 
   // make sure the various connections are actually in this channel
-  for (const auto& conn: event->account->connections) {
-    if (!conn->channels.contains(m_name))
+  event->account->for_each_connection([this, &event](irc::client_connection *conn) {
+    if (!conn->channels.contains(m_handle))
       conn->channel_join(event);
+  });
+
+  // notify channel participants; coalesced per tick
+  g::ctx->join_pipeline->enqueue(m_handle, event);
+}
+
+QList<HistoryEntry> Channel::history(const HistoryKey &lo, const HistoryKey &hi, const bool backward, const int limit, const bool inclusive_lo) const {
+  return history::range(&m_history, lo, hi, backward, limit, inclusive_lo,
+    [this](const HistoryKey &db_lo, const HistoryKey &db_hi, const bool db_backward, const int db_limit, const bool db_inclusive_lo) {
+      return sql::message_history(uid, name(), db_lo, db_hi, db_backward, db_limit, db_inclusive_lo);
+    });
+}
+
+quint64 Channel::record(const sql::EventType type, const QSharedPointer<Account> &account, const QByteArray &line,
+                        const QUuid &id, qint64 time) {
+  if (time == 0)
+    time = QDateTime::currentMSecsSinceEpoch();
+  const QUuid event_id = id.isNull() ? uuidv7::create() : id;
+
+  ChannelEvent event;
+  event.type = static_cast<int>(type);
+  event.id = event_id.toByteArray(QUuid::WithoutBraces);
+  event.time = QDateTime::fromMSecsSinceEpoch(time).toUTC().toString(Qt::ISODateWithMs).toUtf8();
+  event.account = account.isNull() ? QByteArray() : account->name();
+  event.line = line;
+  const quint64 seq = m_events.append(event);
+
+  // the next block of numbers, persisted before this one runs out
+  if (const quint64 upto = m_events.reservation_due()) {
+    QThreadPool::globalInstance()->start([self = sharedFromThis(), upto] {
+      self->m_events.reserved(upto, sql::channel_seq_reserve(self->uid, upto));
+    });
   }
 
-  // notify channel participants
-  for (const auto& member: m_members) {
-    if (member->uid() == event->account->uid())
-      continue;
+  // the events table wants an actor and a persisted channel
+  if (!uid.isNull() && !account.isNull()) {
+    sql::EventRow row;
+    row.id = event_id;
+    row.account_id = account->uid();
+    row.channel_id = uid;
+    row.event_type = event.type;
+    row.seq = seq;
+    // a message row with the same id holds the text; the message log keeps
+    // messages out of the database, so then the event carries it
+    if (type != sql::EventType::Message || g::ctx->message_log != nullptr)
+      row.data = line;
+    if (type == sql::EventType::Topic)
+      row.topic = topic();
+    row.creation_date = QDateTime::fromMSecsSinceEpoch(time);
+    g::ctx->queueEventForInsert(std::move(row));
+  }
 
-    for (const auto& conn: member->connections) {
-      if (!conn->channel_members[chan_ptr].contains(event->account)) {
-        conn->channel_join(event);
-      }
+  return seq;
+}
+
+QList<ChannelEvent> Channel::events_since(const quint64 since, const int limit) const {
+  const quint64 floor = m_events.floor();
+  if (since >= floor)
+    return m_events.since(since, limit);
+
+  auto events = sql::channel_events(uid, "#" + name(), since, floor, limit);
+  if (events.size() < limit)
+    events.append(m_events.since(floor, limit - static_cast<int>(events.size())));
+  return events;
+}
+
+QByteArrayList Channel::roster() const {
+  QMutexLocker locker(&mtx_roster);
+  if (!m_roster_dirty)
+    return m_roster;
+
+  QReadLocker rlock(&mtx_lock);
+  const auto members = m_members;
+  rlock.unlock();
+
+  m_roster.clear();
+  m_roster.reserve(members.size());
+  for (const auto& member: members) {
+    if (Account *acc = g::accountSlab.get(member)) {
+      auto nick_acc = acc->nick();
+      m_roster << (nick_acc.isEmpty() ? acc->name() : nick_acc);
     }
   }
+
+  m_roster_dirty = false;
+  return m_roster;
+}
+
+void Channel::invalidate_roster() {
+  QMutexLocker locker(&mtx_roster);
+  m_roster_dirty = true;
 }
 
 void Channel::setTopic(const QByteArray &t) {
@@ -156,13 +300,20 @@ void Channel::setKey(const QByteArray &k) {
 }
 
 QSharedPointer<Channel> Channel::get(const QByteArray &channel_name) {
-  return g::ctx->channels.value(channel_name);
+  QReadLocker locker(&g::ctx->mtx_cache);
+  auto ptr = g::ctx->channels.value(channel_name);
+  locker.unlock();
+
+  if (ptr.isNull() && g::lazyLoad)
+    ptr = g::ctx->lazy->channel_by_name(channel_name);
+  if (!ptr.isNull())
+    ptr->touch();
+  return ptr;
 }
 
 QSharedPointer<Channel> Channel::get_or_create(const QByteArray &channel_name) {
-  auto &channels = g::ctx->channels;
-  if (const auto it = channels.find(channel_name); it != channels.end())
-    return it.value();
+  if (auto ptr = get(channel_name); !ptr.isNull())
+    return ptr;
 
   // @TODO: check if we are allowed to do this according to permissions
   const auto channel = new Channel(channel_name);
@@ -171,8 +322,16 @@ QSharedPointer<Channel> Channel::get_or_create(const QByteArray &channel_name) {
     channel->moveToThread(g::mainThread);
 
   auto ptr = QSharedPointer<Channel>(channel);
+  ptr->members_loaded = true;
+
+  QWriteLocker locker(&g::ctx->mtx_cache);
+  if (const auto existing = g::ctx->channels.value(channel_name); !existing.isNull())
+    return existing;
+  g::ctx->channels.insert(channel_name, ptr);
+  locker.unlock();
 
-  channels.insert(channel_name, ptr);
+  if (g::lazyLoad)
+    g::ctx->lazy->forget_missing(channel_name);
   return ptr;
 }
 
@@ -189,9 +348,13 @@ void Channel::setAccountOwner(const QSharedPointer<Account> &owner) {
 void Channel::addMembers(QList<QSharedPointer<Account>> accounts) {
   QWriteLocker locker(&mtx_lock);
   for (const auto& acc: accounts) {
-    m_members.append(acc);
-    acc->channels[m_name] = g::ctx->channels[m_name];
+    if (m_members.contains(acc->handle()))
+      continue;
+    m_members.append(acc->handle());
+    acc->add_channel(m_handle);
   }
+  locker.unlock();
+  invalidate_roster();
 }
 
 void Channel::addBan(const QByteArray &mask) {
@@ -217,6 +380,8 @@ QList<QByteArray> Channel::banList() const {
 
 // @TODO: check if user is actually online, store stuff in db if not
 void Channel::message(QSharedPointer<QEventMessage> &message) {
+  message->stamp();
+
   auto ev_type = QEnums::QIRCEvent::CHANNEL_MSG;
   if (message->tag_msg)
     ev_type = QEnums::QIRCEvent::TAG_MSG;
@@ -233,13 +398,36 @@ void Channel::message(QSharedPointer<QEventMessage> &message) {
     }
   }
 
-  sql::insert_message(message);
+  // write-behind; members should not wait on the database
+  g::ctx->queueMessageForInsert(message);
+
+  if (!message->tag_msg) {
+    const QByteArray line = ":" + (message->account.isNull() ? message->nick : message->account->prefix()) +
+                            " PRIVMSG #" + name() + " :" + message->text;
+    message->seq = record(sql::EventType::Message, message->account, line, message->msgid, message->server_time);
+
+    HistoryEntry entry;
+    entry.key = {message->server_time, message->msgid.toRfc4122()};
+    entry.msgid = message->id;
+    entry.time = message->server_time_str;
+    entry.account = message->account.isNull() ? QByteArray() : message->account->name();
+    entry.tags = irc::encodeTags(message->tags);
+    entry.line = line;
+    m_history.append(std::move(entry));
+  }
 
   QReadLocker locker(&mtx_lock);
-  for (const auto&member: m_members) {
-    for (const auto& _conn: member->connections) {
-      _conn->message(message);
-    }
+  const auto members = m_members;
+  locker.unlock();
+
+  for (const auto& member: members) {
+    const Account *acc = g::accountSlab.get(member);
+    if (acc == nullptr)
+      continue;
+
+    acc->for_each_connection([&message](irc::client_connection *conn) {
+      conn->message(message);
+    });
   }
 }
 
@@ -270,14 +458,25 @@ bool Channel::rename(const QSharedPointer<QEventChannelRename> &event) {
 
   channel_from->setName(event->new_name);
 
+  if (!event->account.isNull()) {
+    QByteArray line = ":" + event->account->prefix() + " RENAME #" + event->old_name + " #" + event->new_name;
+    if (!event->message.isEmpty())
+      line += " :" + event->message;
+    channel_from->record(sql::EventType::Rename, event->account, line);
+  }
+
   // broadcast
-  for (const auto& acc: event->channel->members()) {
-    for (const auto&conn : acc->connections) {
+  for (const auto& member: event->channel->member_handles()) {
+    const Account *acc = g::accountSlab.get(member);
+    if (acc == nullptr)
+      continue;
+
+    acc->for_each_connection([&event](irc::client_connection *conn) {
       QMetaObject::invokeMethod(conn,
         [conn, event] {
           conn->channel_rename(event);
         }, Qt::QueuedConnection);
-    }
+    });
   }
 
   return true;
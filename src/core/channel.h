@@ -3,12 +3,18 @@
 #include <QSet>
 #include <QByteArray>
 #include <QPointer>
+#include <QMutex>
 #include <QJsonArray>
 #include <QJsonObject>
 
+#include <atomic>
+
 #include "utils.h"
 #include "core/account.h"
 #include "core/metadata.h"
+#include "core/handles.h"
+#include "core/history.h"
+#include "core/event_log.h"
 #include "irc/client_connection.h"
 #include "irc/modes.h"
 
@@ -18,8 +24,9 @@
 
 class Account;
 class Server;
+namespace sql { enum class EventType; }
 
-class Channel final : public QObject {
+class Channel final : public QObject, public QEnableSharedFromThis<Channel> {
 Q_OBJECT
 Q_PROPERTY(QByteArray name READ name WRITE setName NOTIFY topicChanged)
 Q_PROPERTY(QByteArray topic READ topic WRITE setTopic NOTIFY topicChanged)
@@ -31,13 +38,26 @@ Q_PROPERTY(QByteArray uid_str MEMBER uid_str)
 
 public:
   explicit Channel(const QByteArray &name, QObject *parent = nullptr);
+  ~Channel() override;
   static QSharedPointer<Channel> create_from_db(
     const QUuid &id,
     const QByteArray &name,
     const QByteArray &topic,
     const QSharedPointer<Account> &owner,
     const QSharedPointer<Server> &server,  // Server before creation
-    const QDateTime &creation
+    const QDateTime &creation,
+    // sql::channel_event_head(); looked up when not given
+    std::optional<quint64> event_head = std::nullopt
+  );
+  // no cache lookup or insertion; for bulk loads that fill the caches in one go
+  static QSharedPointer<Channel> from_db_row(
+    const QUuid &id,
+    const QByteArray &name,
+    const QByteArray &topic,
+    const QSharedPointer<Account> &owner,
+    const QSharedPointer<Server> &server,
+    const QDateTime &creation,
+    quint64 event_head
   );
 
   mutable QReadWriteLock mtx_lock;
@@ -59,7 +79,27 @@ public:
   static QSharedPointer<Channel> get(const QByteArray &channel_name);
   static QSharedPointer<Channel> get_or_create(const QByteArray &channel_name);
 
-  const QList<QSharedPointer<Account>> &members() const { return m_members; }
+  [[nodiscard]] ChannelHandle handle() const { return m_handle; }
+
+  // hot paths should prefer handles; members() resolves them to live accounts.
+  // a snapshot taken under the lock (implicitly shared, so no deep copy)
+  QList<AccountHandle> member_handles() const;
+  QList<QSharedPointer<Account>> members() const;
+
+  // CHATHISTORY; the ring when it covers the range, the database otherwise
+  QList<HistoryEntry> history(const HistoryKey &lo, const HistoryKey &hi, bool backward, int limit, bool inclusive_lo = false) const;
+  [[nodiscard]] std::optional<HistoryEntry> history_newest() const { return m_history.newest(); }
+
+  // delta sync; every state change takes the next per-channel sequence number
+  quint64 record(sql::EventType type, const QSharedPointer<Account> &account, const QByteArray &line,
+                 const QUuid &id = {}, qint64 time = 0);
+  // events with seq > since, ascending; the database below the ring's floor
+  QList<ChannelEvent> events_since(quint64 since, int limit) const;
+  [[nodiscard]] quint64 seq() const { return m_events.head(); }
+
+  // nicks for NAMES; cached until membership or a member's nick changes
+  QByteArrayList roster() const;
+  void invalidate_roster();
   void addMembers(QList<QSharedPointer<Account>> accounts);
 
   [[nodiscard]] QByteArray name() const { return m_name; }
@@ -85,6 +125,11 @@ public:
   QByteArray uid_str;
   QDateTime date_creation;
 
+  // --lazy-load bookkeeping, see LazyLoader
+  std::atomic<bool> members_loaded = false;
+  [[nodiscard]] qint64 last_active() const { return m_last_active; }
+  void touch() { m_last_active = QDateTime::currentSecsSinceEpoch(); }
+
   QSharedPointer<Metadata> metadata() {
     if (m_metadata.isNull())
       m_metadata = QSharedPointer<Metadata>::create(this);
@@ -105,7 +150,15 @@ private:
   QByteArray m_key;
   QSharedPointer<Server> m_server;
   QSharedPointer<Account> m_owner;
-  QList<QSharedPointer<Account>> m_members;
+  QList<AccountHandle> m_members;
+  ChannelHandle m_handle;
+  std::atomic<qint64> m_last_active = QDateTime::currentSecsSinceEpoch();
+  HistoryRing m_history;
+  EventLog m_events;
+
+  mutable QMutex mtx_roster;
+  mutable QByteArrayList m_roster;
+  mutable bool m_roster_dirty = true;
 
   // bans
   QSet<QByteArray> m_ban_masks;
@@ -129,8 +182,8 @@ public:
     // members: list of uid's
     QVariantList membersArray;
     for (const auto &member : m_members) {
-      if (member) {
-        membersArray.append(member->uid());
+      if (const Account *acc = g::accountSlab.get(member)) {
+        membersArray.append(acc->uid());
       }
     }
     obj["members"] = membersArray;
@@ -176,8 +229,8 @@ public:
     // members array
     rapidjson::Value membersArray(rapidjson::kArrayType);
     for (const auto &member : m_members) {
-      if (member) {
-        membersArray.PushBack(rapidjson::Value(member->uid_str().constData(), allocator), allocator);
+      if (Account *acc = g::accountSlab.get(member)) {
+        membersArray.PushBack(rapidjson::Value(acc->uid_str().constData(), allocator), allocator);
       }
     }
     obj.AddMember("members", membersArray, allocator);
@@ -0,0 +1,70 @@
+#include <QDebug>
+
+#include <algorithm>
+
+#include "core/event_log.h"
+
+EventLog::EventLog(const int capacity) :
+    m_capacity(std::max(1, capacity)) {}
+
+void EventLog::seed(const quint64 head) {
+  QMutexLocker locker(&mtx_lock);
+  m_head = std::max(m_head, head);
+  m_reserved = std::max(m_reserved, m_head);
+}
+
+quint64 EventLog::append(ChannelEvent &event) {
+  QMutexLocker locker(&mtx_lock);
+  event.seq = ++m_head;
+  m_events.append(event);
+  if (m_events.size() > m_capacity)
+    m_events.removeFirst();
+  return event.seq;
+}
+
+quint64 EventLog::reservation_due() {
+  QMutexLocker locker(&mtx_lock);
+  if (m_reserving || m_reserved > m_head + RESERVE_AHEAD)
+    return 0;
+  m_reserving = true;
+  return std::max(m_reserved, m_head) + RESERVE_BLOCK;
+}
+
+void EventLog::reserved(const quint64 upto, const bool ok) {
+  if (!ok)
+    qWarning() << "event log: could not reserve sequence numbers up to" << upto;
+
+  QMutexLocker locker(&mtx_lock);
+  if (ok)
+    m_reserved = std::max(m_reserved, upto);
+  m_reserving = false;
+}
+
+QList<ChannelEvent> EventLog::since(const quint64 since, const int limit) const {
+  QList<ChannelEvent> result;
+  if (limit <= 0)
+    return result;
+
+  QMutexLocker locker(&mtx_lock);
+  if (m_events.isEmpty() || since >= m_head)
+    return result;
+
+  // dense sequence numbers; the position follows from the first one
+  const quint64 first = m_events.first().seq;
+  const qsizetype from = since < first ? 0 : static_cast<qsizetype>(since - first + 1);
+  const qsizetype to = std::min<qsizetype>(m_events.size(), from + limit);
+  result.reserve(to - from);
+  for (qsizetype i = from; i < to; ++i)
+    result << m_events.at(i);
+  return result;
+}
+
+quint64 EventLog::head() const {
+  QMutexLocker locker(&mtx_lock);
+  return m_head;
+}
+
+quint64 EventLog::floor() const {
+  QMutexLocker locker(&mtx_lock);
+  return m_head - static_cast<quint64>(m_events.size());
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+
+// a state change of a channel as it is replayed by SYNC; pre-encoded like
+// HistoryEntry
+struct ChannelEvent {
+  quint64 seq = 0;
+  int type = 0;        // sql::EventType
+  QByteArray id;       // msgid for messages
+  QByteArray time;     // ISO 8601, for the time tag
+  QByteArray account;  // actor account name, for account-tag
+  QByteArray line;     // ":nick!user@host JOIN #chan"
+};
+
+// per-channel sequence counter plus the tail of its events. Within a run
+// sequence numbers are dense: the ring holds (floor(), head()], everything
+// at or below floor() lives in the database.
+//
+// events reach the database write-behind, so their MAX(seq) can lag what
+// was handed out. Numbers are therefore taken from blocks that are
+// persisted ahead of use; after a crash the counter resumes from the seed,
+// which covers the last reserved block, and skips whatever of it was
+// unused. The owner seeds the log when the channel is loaded and persists
+// the blocks off the event loop: reservation_due() names the next one once
+// fewer than RESERVE_AHEAD numbers are left, reserved() reports it back.
+// The first block of a run is requested by its first event. Numbers past
+// the reserved block are handed out anyway, as the database is not waited
+// for; a crash before their events are written may then reuse them.
+class EventLog {
+public:
+  explicit EventLog(int capacity);
+
+  // the persisted head, see sql::channel_event_head()
+  void seed(quint64 head);
+
+  // assigns the next sequence number to `event` and keeps it
+  quint64 append(ChannelEvent &event);
+
+  // the block end to persist next; 0 while none is due or one is in flight
+  [[nodiscard]] quint64 reservation_due();
+  void reserved(quint64 upto, bool ok);
+
+  // events with seq > since, ascending, at most `limit`; ring only
+  QList<ChannelEvent> since(quint64 since, int limit) const;
+
+  [[nodiscard]] quint64 head() const;
+  [[nodiscard]] quint64 floor() const;
+
+  static constexpr quint64 RESERVE_BLOCK = 1024;
+  static constexpr quint64 RESERVE_AHEAD = RESERVE_BLOCK / 2;
+
+private:
+  mutable QMutex mtx_lock;
+  int m_capacity;
+  quint64 m_head = 0;
+  quint64 m_reserved = 0;
+  bool m_reserving = false;
+  QList<ChannelEvent> m_events;
+};
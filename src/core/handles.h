@@ -0,0 +1,19 @@
+#pragma once
+#include "lib/slab.h"
+
+class Account;
+class Channel;
+namespace irc {
+  class client_connection;
+}
+
+using AccountHandle = Handle<Account>;
+using ChannelHandle = Handle<Channel>;
+using ConnectionHandle = Handle<irc::client_connection>;
+
+namespace g {
+  // objects register themselves on construction and release on destruction
+  extern Slab<Account> accountSlab;
+  extern Slab<Channel> channelSlab;
+  extern Slab<irc::client_connection> connectionSlab;
+}
@@ -0,0 +1,146 @@
+#include <QDateTime>
+#include <QSet>
+
+#include <algorithm>
+
+#include "core/history.h"
+#include "lib/uuidv7.h"
+
+namespace history {
+  HistoryKey key_min(const qint64 ms) {
+    return {ms, QByteArray()};
+  }
+
+  HistoryKey key_max(const qint64 ms) {
+    return {ms, QByteArray(17, '\xff')};
+  }
+
+  std::optional<HistoryKey> key_from_msgid(const QByteArray &msgid) {
+    const QUuid id = QUuid::fromString(QLatin1String(msgid));
+    if (id.isNull() || (id.data3 >> 12) != 7)
+      return std::nullopt;
+    return HistoryKey{uuidv7::timestamp(id), id.toRfc4122()};
+  }
+}
+
+HistoryRing::HistoryRing(const int capacity) :
+    m_capacity(std::max(1, capacity)),
+    m_floor(history::key_min(QDateTime::currentMSecsSinceEpoch())) {
+  // no reserve(); most channels never fill the ring, so it grows on append
+}
+
+void HistoryRing::append(HistoryEntry entry) {
+  QWriteLocker locker(&mtx_lock);
+
+  // concurrent senders may append slightly out of order
+  auto pos = m_entries.end();
+  while (pos != m_entries.begin() && entry.key < (pos - 1)->key)
+    --pos;
+  m_entries.insert(pos, std::move(entry));
+
+  if (m_entries.size() > m_capacity) {
+    m_entries.removeFirst();
+    m_floor = m_entries.first().key;
+  }
+}
+
+QList<HistoryEntry> HistoryRing::range(const HistoryKey &lo, const HistoryKey &hi, const bool backward, const int limit, const bool inclusive_lo, const QUuid &peer) const {
+  QList<HistoryEntry> result;
+  if (limit <= 0)
+    return result;
+
+  QReadLocker locker(&mtx_lock);
+  const auto cmp = [](const HistoryEntry &e, const HistoryKey &k) { return e.key < k; };
+
+  auto first = std::lower_bound(m_entries.cbegin(), m_entries.cend(), lo, cmp);
+  if (!inclusive_lo && first != m_entries.cend() && first->key == lo)
+    ++first;
+  auto last = std::lower_bound(first, m_entries.cend(), hi, cmp);
+
+  // one conversation; the ring is small, walk it from the end we keep
+  if (!peer.isNull()) {
+    if (backward) {
+      for (auto it = last; it != first && result.size() < limit;) {
+        if ((--it)->peer == peer)
+          result << *it;
+      }
+      std::reverse(result.begin(), result.end());
+    } else {
+      for (auto it = first; it != last && result.size() < limit; ++it) {
+        if (it->peer == peer)
+          result << *it;
+      }
+    }
+    return result;
+  }
+
+  if (last - first > limit) {
+    if (backward)
+      first = last - limit;
+    else
+      last = first + limit;
+  }
+
+  result.reserve(static_cast<int>(last - first));
+  for (auto it = first; it != last; ++it)
+    result << *it;
+  return result;
+}
+
+QList<HistoryEntry> HistoryRing::newest_per_peer(const HistoryKey &lo, const HistoryKey &hi) const {
+  QList<HistoryEntry> result;
+  QSet<QUuid> seen;
+
+  QReadLocker locker(&mtx_lock);
+  for (auto it = m_entries.crbegin(); it != m_entries.crend(); ++it) {
+    if (!(it->key < hi))
+      continue;
+    if (!(lo < it->key))
+      break;
+    if (it->peer.isNull() || seen.contains(it->peer))
+      continue;
+    seen.insert(it->peer);
+    result << *it;
+  }
+  return result;
+}
+
+HistoryKey HistoryRing::floor() const {
+  QReadLocker locker(&mtx_lock);
+  return m_floor;
+}
+
+std::optional<HistoryEntry> HistoryRing::newest() const {
+  QReadLocker locker(&mtx_lock);
+  if (m_entries.isEmpty())
+    return std::nullopt;
+  return m_entries.last();
+}
+
+namespace history {
+  QList<HistoryEntry> range(const HistoryRing *ring, const HistoryKey &lo, const HistoryKey &hi, const bool backward, const int limit, const bool inclusive_lo, const Fetch &older, const QUuid &peer) {
+    if (ring == nullptr)
+      return older(lo, hi, backward, limit, inclusive_lo);
+
+    const HistoryKey floor = ring->floor();
+    if (!(lo < floor))
+      return ring->range(lo, hi, backward, limit, inclusive_lo, peer);
+
+    // the part below the ring's floor comes from the database
+    const HistoryKey db_hi = std::min(hi, floor);
+    if (backward) {
+      auto entries = ring->range(lo, hi, true, limit, inclusive_lo, peer);
+      if (entries.size() >= limit)
+        return entries;
+
+      auto rest = older(lo, db_hi, true, limit - static_cast<int>(entries.size()), inclusive_lo);
+      rest.append(entries);
+      return rest;
+    }
+
+    auto entries = older(lo, db_hi, false, limit, inclusive_lo);
+    if (entries.size() < limit && floor < hi)
+      entries.append(ring->range(floor, hi, false, limit - static_cast<int>(entries.size()), true, peer));
+    return entries;
+  }
+}
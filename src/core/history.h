@@ -0,0 +1,68 @@
+#pragma once
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QReadWriteLock>
+#include <QUuid>
+
+#include <functional>
+#include <optional>
+
+// orders history: (unix ms, msgid as RFC 4122 bytes). An empty id sorts
+// before every message in that millisecond, see history::key_min/key_max.
+using HistoryKey = QPair<qint64, QByteArray>;
+
+// a message as it is replayed; everything pre-encoded so that serving
+// CHATHISTORY is mostly concatenation
+struct HistoryEntry {
+  HistoryKey key;
+  QByteArray msgid;    // for the msgid tag
+  QByteArray time;     // ISO 8601, for the time tag
+  QByteArray account;  // sender account name, for account-tag
+  QByteArray tags;     // client tags, escaped, without '@'
+  QByteArray line;     // ":nick!user@host PRIVMSG #chan :text"
+  QUuid peer;          // private messages: the other side of the conversation
+};
+
+namespace history {
+  static constexpr qint64 TIME_MAX = 253402300799999;  // 9999-12-31
+
+  HistoryKey key_min(qint64 ms);
+  HistoryKey key_max(qint64 ms);
+  // only for time-ordered (v7) ids; nullopt otherwise
+  std::optional<HistoryKey> key_from_msgid(const QByteArray &msgid);
+}
+
+// fixed-size tail of a channel's messages, oldest first. The ring is
+// complete for every key >= floor(); older messages live in the database.
+class HistoryRing {
+public:
+  explicit HistoryRing(int capacity);
+
+  void append(HistoryEntry entry);
+
+  // entries in (lo, hi), ascending. With `backward` the `limit` entries
+  // closest to `hi` are taken, otherwise those closest to `lo`. A non-null
+  // `peer` keeps only that conversation of a private backlog.
+  QList<HistoryEntry> range(const HistoryKey &lo, const HistoryKey &hi, bool backward, int limit, bool inclusive_lo = false, const QUuid &peer = QUuid()) const;
+  // the newest entry of every conversation in (lo, hi); private backlogs
+  QList<HistoryEntry> newest_per_peer(const HistoryKey &lo, const HistoryKey &hi) const;
+
+  [[nodiscard]] HistoryKey floor() const;
+  [[nodiscard]] std::optional<HistoryEntry> newest() const;
+
+private:
+  mutable QReadWriteLock mtx_lock;
+  int m_capacity;
+  QList<HistoryEntry> m_entries;
+  HistoryKey m_floor;
+};
+
+namespace history {
+  // fetches from the database, same semantics as HistoryRing::range()
+  using Fetch = std::function<QList<HistoryEntry>(const HistoryKey &lo, const HistoryKey &hi, bool backward, int limit, bool inclusive_lo)>;
+
+  // a range across a ring and the database behind it; without a ring
+  // everything comes from the database. `older` filters by `peer` itself
+  QList<HistoryEntry> range(const HistoryRing *ring, const HistoryKey &lo, const HistoryKey &hi, bool backward, int limit, bool inclusive_lo, const Fetch &older, const QUuid &peer = QUuid());
+}
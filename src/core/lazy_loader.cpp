@@ -0,0 +1,230 @@
+#include <QDateTime>
+
+#include "core/lazy_loader.h"
+#include "core/account.h"
+#include "core/channel.h"
+#include "core/server.h"
+#include "irc/threaded_server.h"
+#include "lib/sql.h"
+#include "ctx.h"
+
+LazyLoader::LazyLoader(const int ttl_secs, QObject *parent) : QObject(parent), m_ttl(ttl_secs) {
+  m_evict_timer = new QTimer(this);
+  m_evict_timer->setInterval(EVICT_INTERVAL_MS);
+  connect(m_evict_timer, &QTimer::timeout, this, &LazyLoader::evict);
+  m_evict_timer->start();
+}
+
+bool LazyLoader::is_missing(const QHash<QByteArray, qint64> &cache, const QByteArray &key) const {
+  QMutexLocker locker(&mtx_missing);
+  const auto it = cache.constFind(key);
+  return it != cache.constEnd() && it.value() > QDateTime::currentSecsSinceEpoch();
+}
+
+void LazyLoader::forget_missing(const QByteArray &name) {
+  QMutexLocker locker(&mtx_missing);
+  m_missing_accounts.remove(name);
+  m_missing_channels.remove(name);
+}
+
+QSharedPointer<Account> LazyLoader::account_by_name(const QByteArray &name) {
+  if (name.isEmpty() || is_missing(m_missing_accounts, name))
+    return {};
+
+  QMutexLocker locker(&mtx_load);
+  {
+    // somebody else may have faulted it in while we waited
+    QReadLocker rlock(&g::ctx->mtx_cache);
+    if (auto ptr = g::ctx->accounts_lookup_name.value(name); !ptr.isNull())
+      return ptr;
+  }
+
+  auto account = sql::account_get_by_name(name);
+  if (account.isNull()) {
+    QMutexLocker mlock(&mtx_missing);
+    m_missing_accounts[name] = QDateTime::currentSecsSinceEpoch() + NEGATIVE_TTL_SECS;
+    return {};
+  }
+
+  // shallow; channel memberships load on login (ensure_channels)
+  return account;
+}
+
+QSharedPointer<Account> LazyLoader::account_by_uid(const QUuid &uid) {
+  const QByteArray key = uid.toRfc4122();
+  if (uid.isNull() || is_missing(m_missing_account_uids, key))
+    return {};
+
+  QMutexLocker locker(&mtx_load);
+  {
+    QReadLocker rlock(&g::ctx->mtx_cache);
+    if (auto ptr = g::ctx->accounts_lookup_uuid.value(uid); !ptr.isNull())
+      return ptr;
+  }
+
+  auto account = sql::account_get_by_uid(uid);
+  if (account.isNull()) {
+    QMutexLocker mlock(&mtx_missing);
+    m_missing_account_uids[key] = QDateTime::currentSecsSinceEpoch() + NEGATIVE_TTL_SECS;
+    return {};
+  }
+
+  return account;
+}
+
+QSharedPointer<Channel> LazyLoader::channel_by_name(const QByteArray &name) {
+  if (name.isEmpty() || is_missing(m_missing_channels, name))
+    return {};
+
+  QMutexLocker locker(&mtx_load);
+  {
+    QReadLocker rlock(&g::ctx->mtx_cache);
+    if (auto ptr = g::ctx->channels.value(name); !ptr.isNull())
+      return ptr;
+  }
+
+  auto channel = sql::channel_get_by_name(name);
+  if (channel.isNull()) {
+    QMutexLocker mlock(&mtx_missing);
+    m_missing_channels[name] = QDateTime::currentSecsSinceEpoch() + NEGATIVE_TTL_SECS;
+    return {};
+  }
+
+  ensure_members(channel);
+  return channel;
+}
+
+void LazyLoader::ensure_channels(const QSharedPointer<Account> &account) {
+  if (account.isNull() || account->channels_loaded)
+    return;
+
+  QMutexLocker locker(&mtx_load);
+  if (account->channels_loaded)
+    return;
+
+  for (const auto& channel: sql::account_get_channels(account->uid())) {
+    channel->addMembers({account});
+    ensure_members(channel);
+  }
+  account->channels_loaded = true;
+}
+
+void LazyLoader::ensure_members(const QSharedPointer<Channel> &channel) {
+  if (channel.isNull() || channel->members_loaded)
+    return;
+
+  QMutexLocker locker(&mtx_load);
+  if (channel->members_loaded)
+    return;
+
+  // members come in shallow; their own channel lists load when they log in
+  channel->addMembers(sql::channel_get_members(channel->uid));
+  channel->members_loaded = true;
+}
+
+void LazyLoader::evict() {
+  // batches retired on an earlier tick whose workers all came back are
+  // unreferenced by now, so this is where they actually get freed
+  for (auto it = m_retired.begin(); it != m_retired.end();) {
+    if (it->pending->loadAcquire() <= 0)
+      it = m_retired.erase(it);
+    else
+      ++it;
+  }
+
+  const qint64 cutoff = QDateTime::currentSecsSinceEpoch() - m_ttl;
+
+  // channels first: idle, and nobody in it is connected
+  QList<QSharedPointer<Channel>> channels;
+  QReadLocker rlock(&g::ctx->mtx_cache);
+  for (const auto& channel: g::ctx->channels) {
+    if (channel->last_active() > cutoff)
+      continue;
+
+    const auto members = channel->member_handles();
+
+    bool online = false;
+    for (const auto& member: members) {
+      const Account *acc = g::accountSlab.get(member);
+      if (acc != nullptr && acc->hasConnections()) {
+        online = true;
+        break;
+      }
+    }
+
+    if (!online)
+      channels << channel;
+  }
+  rlock.unlock();
+
+  for (const auto& channel: channels)
+    evict_channel(channel);
+
+  // then accounts that are idle, offline and no longer in a resident channel
+  QList<QSharedPointer<Account>> accounts;
+  rlock.relock();
+  for (const auto& account: g::ctx->accounts) {
+    if (account->last_active() > cutoff || account->hasConnections())
+      continue;
+    if (!account->channel_handles().isEmpty())
+      continue;
+    accounts << account;
+  }
+  rlock.unlock();
+
+  for (const auto& account: accounts)
+    evict_account(account);
+
+  if (!channels.isEmpty() || !accounts.isEmpty()) {
+    retire(channels, accounts);
+    qDebug() << "lazy: evicted" << channels.size() << "channels and" << accounts.size() << "accounts";
+  }
+}
+
+void LazyLoader::retire(const QList<QSharedPointer<Channel>> &channels, const QList<QSharedPointer<Account>> &accounts) {
+  QList<QObject*> workers;
+  if (g::ctx->irc_server != nullptr)
+    workers = g::ctx->irc_server->workers();
+
+  Retired batch{channels, accounts, QSharedPointer<QAtomicInt>::create(workers.size())};
+
+  // a no-op queued behind whatever each worker is doing right now; once it
+  // ran, no handler on that worker can still hold a pointer it got earlier
+  for (QObject *worker: workers) {
+    QMetaObject::invokeMethod(worker, [pending = batch.pending] {
+      pending->deref();
+    }, Qt::QueuedConnection);
+  }
+
+  m_retired << batch;
+}
+
+void LazyLoader::evict_channel(const QSharedPointer<Channel> &channel) {
+  QMutexLocker locker(&mtx_load);
+
+  QWriteLocker wlock(&g::ctx->mtx_cache);
+  g::ctx->channels.remove(channel->name());
+  wlock.unlock();
+
+  if (const auto server = channel->server(); !server.isNull())
+    server->remove_channel(channel);
+
+  const auto members = channel->member_handles();
+
+  // resident members lose this channel, so their lists are partial now
+  for (const auto& member: members) {
+    if (Account *acc = g::accountSlab.get(member)) {
+      acc->remove_channel(channel->handle());
+      acc->channels_loaded = false;
+    }
+  }
+}
+
+void LazyLoader::evict_account(const QSharedPointer<Account> &account) {
+  QMutexLocker locker(&mtx_load);
+
+  const auto nick = account->nick();
+  g::ctx->irc_nicks_remove_cache(nick);
+  g::ctx->irc_nicks_remove_cache(nick.toLower());
+  g::ctx->account_remove_cache(account);
+}
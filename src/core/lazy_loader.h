@@ -0,0 +1,68 @@
+#pragma once
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QRecursiveMutex>
+#include <QTimer>
+#include <QUuid>
+#include <QSharedPointer>
+#include <QAtomicInt>
+
+class Account;
+class Channel;
+
+// on-demand residency for accounts and channels (--lazy-load). Objects are
+// faulted in from the database on first reference and evicted once idle
+// for longer than the TTL. Misses are remembered for a short while so
+// lookups of unknown names do not hit the database every time.
+class LazyLoader final : public QObject {
+  Q_OBJECT
+
+public:
+  explicit LazyLoader(int ttl_secs, QObject *parent = nullptr);
+
+  QSharedPointer<Account> account_by_name(const QByteArray &name);
+  QSharedPointer<Account> account_by_uid(const QUuid &uid);
+  QSharedPointer<Channel> channel_by_name(const QByteArray &name);
+
+  // makes sure every channel the account is a member of is resident
+  void ensure_channels(const QSharedPointer<Account> &account);
+  // makes sure every member of the channel is resident
+  void ensure_members(const QSharedPointer<Channel> &channel);
+
+  // called when something with this name gets created
+  void forget_missing(const QByteArray &name);
+
+private:
+  void evict();
+  void evict_channel(const QSharedPointer<Channel> &channel);
+  void evict_account(const QSharedPointer<Account> &account);
+  void retire(const QList<QSharedPointer<Channel>> &channels, const QList<QSharedPointer<Account>> &accounts);
+
+  bool is_missing(const QHash<QByteArray, qint64> &cache, const QByteArray &key) const;
+
+  static constexpr int EVICT_INTERVAL_MS = 60 * 1000;
+  static constexpr qint64 NEGATIVE_TTL_SECS = 30;
+
+  int m_ttl;
+
+  // serializes faulting so an object is never created twice
+  QRecursiveMutex mtx_load;
+
+  mutable QMutex mtx_missing;
+  QHash<QByteArray, qint64> m_missing_accounts;
+  QHash<QByteArray, qint64> m_missing_account_uids;
+  QHash<QByteArray, qint64> m_missing_channels;
+
+  // evicted objects stay alive until every IRC worker has drained its
+  // event queue once (handlers there hold raw slab pointers) and at least
+  // one more evict interval has passed for everybody else. Main thread only.
+  struct Retired {
+    QList<QSharedPointer<Channel>> channels;
+    QList<QSharedPointer<Account>> accounts;
+    QSharedPointer<QAtomicInt> pending;
+  };
+  QList<Retired> m_retired;
+
+  QTimer *m_evict_timer = nullptr;
+};
@@ -3,18 +3,19 @@
 #include "core/account.h"
 #include "core/channel.h"
 #include "lib/sql.h"
+#include "ctx.h"
 #include <QDebug>
 
 Metadata::Metadata(Account *account, QObject *parent) :
     m_account(account), QObject(parent) {
-  auto [keyValues, subs] = sql::metadata_get(account->uid());
+  auto [keyValues, subs] = g::ctx->metadata_cache->take(account->uid());
   kv = keyValues;
   subscribers = subs;
 }
 
 Metadata::Metadata(Channel *channel, QObject *parent) :
     m_channel(channel), QObject(parent) {
-  auto [keyValues, subs] = sql::metadata_get(channel->uid);
+  auto [keyValues, subs] = g::ctx->metadata_cache->take(channel->uid);
   kv = keyValues;
   subscribers = subs;
 }
@@ -28,14 +29,8 @@ bool Metadata::remove(const QByteArray &key) {
   QWriteLocker rlock(&mtx_lock);
   kv.remove(key);
 
-  QUuid ref_id;
-  if (!m_account.isNull()) {
-    ref_id = m_account->uid();
-  } else {
-    ref_id = m_channel->uid;
-  }
-
-  sql::metadata_remove(key, ref_id);
+  g::ctx->metadata_cache->remove(ref_id(), m_account != nullptr ? sql::RefType::Account : sql::RefType::Channel, key);
+  g::ctx->metadata_notifier->enqueue(target(), key, QVariant(), subscribers.value(key));
 
   emit changed(key, QVariant());
   return true;
@@ -46,21 +41,8 @@ void Metadata::set(const QByteArray &key, const QByteArray &value) {
   kv[key] = value;
   emit changed(key, value);
 
-  QUuid ref_id;
-  sql::RefType ref_type;
-  if (!m_account.isNull()) {
-    ref_id = m_account->uid();
-    ref_type = sql::RefType::Account;
-  } else {
-    ref_id = m_channel->uid;
-    ref_type = sql::RefType::Channel;
-  }
-
-  metadata_upsert(key, value, ref_id, ref_type);
-
-  if (subscribers.contains(key)) {
-    // TODO: later: notify subscribers
-  }
+  g::ctx->metadata_cache->set(ref_id(), m_account != nullptr ? sql::RefType::Account : sql::RefType::Channel, key, value);
+  g::ctx->metadata_notifier->enqueue(target(), key, value, subscribers.value(key));
 }
 
 void Metadata::handle(const QSharedPointer<QEventMetadata> &event) {
@@ -72,7 +54,7 @@ void Metadata::handle(const QSharedPointer<QEventMetadata> &event) {
     auto &key = args[0];
     auto &value = args[1];
 
-    if (!m_account.isNull() && !event->account.isNull() && event->account != m_account) {
+    if (m_account != nullptr && !event->account.isNull() && event->account.data() != m_account) {
       event->error_code = "KEY_NO_PERMISSION";
       event->error_target = m_account->nick();
       event->error_key = key;
@@ -91,7 +73,7 @@ void Metadata::handle(const QSharedPointer<QEventMetadata> &event) {
     if (args.isEmpty()) return;
     auto &key = args[0];
 
-    if (!m_account.isNull() && !event->account.isNull() && event->account != m_account) {
+    if (m_account != nullptr && !event->account.isNull() && event->account.data() != m_account) {
       event->error_code = "KEY_NO_PERMISSION";
       event->error_target = m_account->nick();
       event->error_key = key;
@@ -148,7 +130,7 @@ void Metadata::handle(const QSharedPointer<QEventMetadata> &event) {
 
   if (cmd == "SUBS") {
     for (auto it = subscribers.constBegin(); it != subscribers.constEnd(); ++it) {
-      if (it.value().contains(event->account)) {
+      if (it.value().contains(event->account->handle())) {
         event->subscriptions[it.key()].insert(event->account);
       }
     }
@@ -165,48 +147,40 @@ void Metadata::sub(const QSharedPointer<Account> &actor, const QList<QByteArray>
   QWriteLocker rlock(&mtx_lock);
 
   for (const auto &k: keys)
-    subscribers[k].insert(actor);
+    subscribers[k].insert(actor->handle());
 
-  QUuid ref_id;
-  if (!m_account.isNull()) {
-    ref_id = m_account->uid();
-  } else {
-    ref_id = m_channel->uid;
-  }
-
-  sql::metadata_subscribe_bulk(ref_id, keys, actor->uid());
+  g::ctx->metadata_cache->subscribe(ref_id(), keys, actor->uid(), true);
 }
 
 void Metadata::unsub(const QSharedPointer<Account> &actor, const QList<QByteArray> &keys) {
   QWriteLocker rlock(&mtx_lock);
 
-  QUuid ref_id;
-  if (!m_account.isNull()) {
-    ref_id = m_account->uid();
-  } else {
-    ref_id = m_channel->uid;
-  }
-
   for (const auto &k: keys) {
     if (subscribers.contains(k))
-      subscribers[k].remove(actor);
+      subscribers[k].remove(actor->handle());
   }
 
-  sql::metadata_unsubscribe_bulk(ref_id, keys, actor->uid());
+  g::ctx->metadata_cache->subscribe(ref_id(), keys, actor->uid(), false);
 }
 
 QSet<QString> Metadata::subs(const QSharedPointer<Account> &actor) const {
   // ??
   QSet<QString> result;
   for (auto it = subscribers.constBegin(); it != subscribers.constEnd(); ++it) {
-    if (it.value().contains(actor))
+    if (it.value().contains(actor->handle()))
       result.insert(it.key());
   }
   return result;
 }
 
+QByteArray Metadata::target() const {
+  if (m_account != nullptr)
+    return m_account->nick();
+  return "#" + m_channel->name();
+}
+
 QUuid Metadata::ref_id() const {
-  if (!m_account.isNull())
+  if (m_account != nullptr)
     return m_account->uid();
   return m_channel->uid;
 }
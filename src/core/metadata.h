@@ -7,6 +7,7 @@
 #include <QVariant>
 
 #include "core/qtypes.h"
+#include "core/handles.h"
 
 class Account;
 class Channel;
@@ -20,7 +21,7 @@ public:
   QMap<QString, QVariant> kv;
 
   // @TODO: needs testing
-  QMap<QString, QSet<QSharedPointer<Account>>> subscribers;
+  QMap<QString, QSet<AccountHandle>> subscribers;
 
   // core
   void set(const QByteArray &key, const QByteArray &value);
@@ -40,7 +41,10 @@ public:
 
   private:
     mutable QReadWriteLock mtx_lock;
-    QSharedPointer<Account> m_account;
-    QSharedPointer<Channel> m_channel;
+    // owners; raw since the owner holds us, not the other way around
+    Account *m_account = nullptr;
+    Channel *m_channel = nullptr;
     QUuid ref_id() const;
+    // as METADATA names it
+    QByteArray target() const;
 };
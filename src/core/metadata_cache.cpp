@@ -0,0 +1,101 @@
+#include <QElapsedTimer>
+#include <QDebug>
+
+#include "core/metadata_cache.h"
+
+void MetadataCache::preload() {
+  QElapsedTimer timer;
+  timer.start();
+
+  auto all = sql::metadata_all();
+
+  QMutexLocker locker(&mtx_lock);
+  m_preloaded = std::move(all);
+  m_complete = true;
+  qInfo() << "metadata: preloaded" << m_preloaded.size() << "objects in" << timer.elapsed() << "ms";
+}
+
+sql::MetadataResult MetadataCache::take(const QUuid &ref_id) {
+  {
+    QMutexLocker locker(&mtx_lock);
+    if (m_complete)
+      return m_preloaded.take(ref_id);
+  }
+
+  // faulted in (--lazy-load); whatever it wrote before it was evicted
+  // has to reach the table before it is read back
+  QMutexLocker flushing(&mtx_flush);
+  bool dirty = false;
+  {
+    QMutexLocker locker(&mtx_lock);
+    for (auto it = m_writes.constBegin(); it != m_writes.constEnd() && !dirty; ++it)
+      dirty = it.key().first == ref_id;
+    for (auto it = m_subs.constBegin(); it != m_subs.constEnd() && !dirty; ++it)
+      dirty = it.key().first.first == ref_id;
+  }
+  if (dirty)
+    write();
+
+  return sql::metadata_get(ref_id);
+}
+
+void MetadataCache::set(const QUuid &ref_id, const sql::RefType ref_type, const QByteArray &key, const QByteArray &value) {
+  QMutexLocker locker(&mtx_lock);
+  m_writes.insert({ref_id, key}, {ref_id, ref_type, key, value, false});
+}
+
+void MetadataCache::remove(const QUuid &ref_id, const sql::RefType ref_type, const QByteArray &key) {
+  QMutexLocker locker(&mtx_lock);
+  m_writes.insert({ref_id, key}, {ref_id, ref_type, key, {}, true});
+}
+
+void MetadataCache::subscribe(const QUuid &ref_id, const QList<QByteArray> &keys, const QUuid &account_id, const bool subscribe) {
+  QMutexLocker locker(&mtx_lock);
+  for (const auto &key: keys)
+    m_subs.insert({{ref_id, key}, account_id}, {ref_id, key, account_id, subscribe});
+}
+
+bool MetadataCache::pending() const {
+  QMutexLocker locker(&mtx_lock);
+  return !m_writes.isEmpty() || !m_subs.isEmpty();
+}
+
+bool MetadataCache::flush(const bool wait) {
+  if (wait) {
+    mtx_flush.lock();
+  } else if (!mtx_flush.tryLock()) {
+    return false;
+  }
+
+  const bool written = write();
+  mtx_flush.unlock();
+  return written;
+}
+
+bool MetadataCache::write() {
+  QHash<Key, sql::MetadataWrite> writes;
+  QHash<SubKey, sql::MetadataSubWrite> subs;
+  {
+    QMutexLocker locker(&mtx_lock);
+    writes.swap(m_writes);
+    subs.swap(m_subs);
+  }
+  if (writes.isEmpty() && subs.isEmpty())
+    return false;
+
+  if (sql::metadata_write(writes.values(), subs.values()))
+    return true;
+
+  // retried with the next flush, unless overwritten since
+  qWarning() << "metadata: flush of" << writes.size() + subs.size() << "changes failed, retrying";
+  QMutexLocker locker(&mtx_lock);
+  for (auto it = writes.constBegin(); it != writes.constEnd(); ++it) {
+    if (!m_writes.contains(it.key()))
+      m_writes.insert(it.key(), it.value());
+  }
+  for (auto it = subs.constBegin(); it != subs.constEnd(); ++it) {
+    if (!m_subs.contains(it.key()))
+      m_subs.insert(it.key(), it.value());
+  }
+  return false;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QUuid>
+
+#include "lib/sql.h"
+
+// write-behind layer under Metadata. Without --lazy-load, preload() reads
+// the whole metadata table in one query at startup and Metadata objects
+// take their share from memory instead of querying on first touch.
+//
+// Metadata applies changes to its own maps and records them here. They are
+// coalesced per key (and per subscriber), so within a flush window only the
+// last write of each survives, and flush() writes them in one transaction.
+// A failed flush puts back whatever was not overwritten in the meantime.
+class MetadataCache {
+public:
+  void preload();
+
+  // the ref's metadata at the time its Metadata object is built
+  sql::MetadataResult take(const QUuid &ref_id);
+
+  // thread-safe
+  void set(const QUuid &ref_id, sql::RefType ref_type, const QByteArray &key, const QByteArray &value);
+  void remove(const QUuid &ref_id, sql::RefType ref_type, const QByteArray &key);
+  void subscribe(const QUuid &ref_id, const QList<QByteArray> &keys, const QUuid &account_id, bool subscribe);
+
+  // false when nothing was written; without `wait`, also when another
+  // flush is already running
+  bool flush(bool wait = false);
+  [[nodiscard]] bool pending() const;
+
+  static constexpr int FLUSH_MS = 500;
+
+private:
+  using Key = QPair<QUuid, QByteArray>;
+  using SubKey = QPair<Key, QUuid>;
+
+  // mtx_flush held
+  bool write();
+
+  mutable QMutex mtx_lock;  // everything below
+  QMutex mtx_flush;
+
+  QHash<Key, sql::MetadataWrite> m_writes;
+  QHash<SubKey, sql::MetadataSubWrite> m_subs;
+
+  // preload(); taken out as Metadata objects are built
+  QHash<QUuid, sql::MetadataResult> m_preloaded;
+  bool m_complete = false;
+};
@@ -7,6 +7,7 @@
 #include "core/upload.h"
 
 #include "ctx.h"
+#include "lib/uuidv7.h"
 
 // QEventChannelJoin
 QSharedPointer<QObject> QEventChannelJoin::getChannel() const {
@@ -43,6 +44,16 @@ void QEventChannelPart::setAccount(const QSharedPointer<QObject>& a) {
 }
 
 // QEventMessage
+void QEventMessage::stamp() {
+  if (!msgid.isNull())
+    return;
+
+  msgid = uuidv7::create();
+  id = msgid.toByteArray(QUuid::WithoutBraces);
+  server_time = uuidv7::timestamp(msgid);
+  server_time_str = QDateTime::fromMSecsSinceEpoch(server_time).toUTC().toString(Qt::ISODateWithMs).toUtf8();
+}
+
 QSharedPointer<QObject> QEventMessage::getChannel() const {
   return qSharedPointerCast<QObject>(channel);
 }
@@ -6,6 +6,7 @@
 #include <QSharedPointer>
 #include <QMap>
 #include <QStringList>
+#include <QUuid>
 
 class Channel;
 class Account;
@@ -181,6 +182,12 @@ public:
 
   QByteArray raw;
 
+  // time-ordered id and receive time (unix ms), see stamp()
+  QUuid msgid;
+  qint64 server_time = 0;
+  QByteArray server_time_str;  // ISO 8601, for the `time` tag
+  quint64 seq = 0;             // per-channel sequence number, see Channel::record()
+
   // t:Account d:None
   QSharedPointer<Account> account;
   // t:Account d:None
@@ -195,6 +202,9 @@ public:
 
   QEventMessage() = default;
 
+  // assigns msgid/id and server time once, before handlers and fan-out
+  void stamp();
+
   QSharedPointer<QObject> getChannel() const;
   void setChannel(const QSharedPointer<QObject>& c);
 
@@ -0,0 +1,368 @@
+#include <QElapsedTimer>
+#include <QSaveFile>
+#include <QFile>
+#include <QSet>
+#include <QDebug>
+
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "core/snapshot.h"
+#include "lib/sql.h"
+
+std::atomic<bool> Snapshot::m_writing = false;
+
+static qint64 to_ms(const QDateTime &dt) {
+  return dt.isValid() ? dt.toMSecsSinceEpoch() : 0;
+}
+
+static QDateTime from_ms(const qint64 ms) {
+  return ms != 0 ? QDateTime::fromMSecsSinceEpoch(ms) : QDateTime();
+}
+
+quint64 Snapshot::checksum(const uchar *data, const quint64 size) {
+  quint64 hash = 0xcbf29ce484222325ULL;
+  for (quint64 i = 0; i < size; ++i) {
+    hash ^= data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+bool Snapshot::write(const QString &path) {
+  if (m_writing.exchange(true))
+    return false;
+  struct Done { ~Done() { m_writing = false; } } done;
+
+  static_assert(std::is_trivially_copyable_v<Header> && sizeof(Header) % 8 == 0);
+  static_assert(std::is_trivially_copyable_v<AccountRec> && sizeof(AccountRec) % 8 == 0);
+  static_assert(std::is_trivially_copyable_v<ServerRec> && sizeof(ServerRec) % 8 == 0);
+  static_assert(std::is_trivially_copyable_v<ChannelRec> && sizeof(ChannelRec) % 8 == 0);
+
+  QElapsedTimer timer;
+  timer.start();
+
+  // watermark first; whatever changes during the fetch is replayed on load
+  qint64 log_id = 0;
+  QDateTime db_time;
+  qint64 n_accounts = 0, n_servers = 0, n_channels = 0;
+  if (!sql::snapshot_watermark(log_id, db_time) || !sql::snapshot_counts(n_accounts, n_servers, n_channels))
+    return false;
+
+  const auto rows = WarmStart::fetch();
+
+  // these tables only grow; a short result means a page failed
+  if (rows.accounts.size() < n_accounts || rows.servers.size() < n_servers || rows.channels.size() < n_channels) {
+    qWarning() << "snapshot: incomplete read of the database, not written";
+    return false;
+  }
+
+  QByteArray strings;
+  const auto str = [&strings](const QByteArray &value) {
+    const Str s{static_cast<quint32>(strings.size()), static_cast<quint32>(value.size())};
+    strings.append(value);
+    return s;
+  };
+
+  QHash<QUuid, quint32> account_index;
+  account_index.reserve(rows.accounts.size());
+  QList<AccountRec> accounts;
+  accounts.reserve(rows.accounts.size());
+  for (const auto &row: rows.accounts) {
+    AccountRec rec{};
+    std::memcpy(rec.id, row.id.toRfc4122().constData(), sizeof(rec.id));
+    rec.username = str(row.username);
+    rec.password = str(row.password);
+    rec.created = to_ms(row.creation_date);
+    account_index.insert(row.id, accounts.size());
+    accounts << rec;
+  }
+
+  QHash<QUuid, quint32> server_index;
+  QList<ServerRec> servers;
+  servers.reserve(rows.servers.size());
+  for (const auto &row: rows.servers) {
+    ServerRec rec{};
+    std::memcpy(rec.id, row.id.toRfc4122().constData(), sizeof(rec.id));
+    rec.name = str(row.name);
+    rec.owner = account_index.value(row.owner_id, NONE);
+    rec.created = to_ms(row.creation_date);
+    server_index.insert(row.id, servers.size());
+    servers << rec;
+  }
+
+  // memberships of rows created after the table reads are dropped here, the
+  // membership_log brings them back
+  QHash<QUuid, QList<quint32>> members_by_channel;
+  for (const auto &[account_id, channel_id]: rows.memberships) {
+    if (const auto it = account_index.constFind(account_id); it != account_index.constEnd())
+      members_by_channel[channel_id].append(it.value());
+  }
+
+  QList<ChannelRec> channels;
+  channels.reserve(rows.channels.size());
+  QList<quint32> members;
+  members.reserve(rows.memberships.size());
+  for (const auto &row: rows.channels) {
+    ChannelRec rec{};
+    std::memcpy(rec.id, row.id.toRfc4122().constData(), sizeof(rec.id));
+    rec.name = str(row.name);
+    rec.topic = str(row.topic);
+    rec.owner = account_index.value(row.owner_id, NONE);
+    rec.server = server_index.value(row.server_id, NONE);
+    rec.created = to_ms(row.creation_date);
+
+    const auto channel_members = members_by_channel.value(row.id);
+    rec.members_begin = members.size();
+    rec.members_count = channel_members.size();
+    members.append(channel_members);
+    channels << rec;
+  }
+
+  if (static_cast<quint64>(strings.size()) > std::numeric_limits<quint32>::max()) {
+    qWarning() << "snapshot: string table too large, not written";
+    return false;
+  }
+
+  Header header{};
+  std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+  header.version = VERSION;
+  header.header_size = sizeof(Header);
+  header.db_time = to_ms(db_time);
+  header.log_id = log_id;
+  header.accounts = accounts.size();
+  header.servers = servers.size();
+  header.channels = channels.size();
+  header.members = members.size();
+  header.strings_size = strings.size();
+
+  QByteArray out;
+  out.reserve(sizeof(Header) +
+    accounts.size() * sizeof(AccountRec) +
+    servers.size() * sizeof(ServerRec) +
+    channels.size() * sizeof(ChannelRec) +
+    members.size() * sizeof(quint32) +
+    strings.size());
+  out.append(reinterpret_cast<const char*>(&header), sizeof(Header));
+  out.append(reinterpret_cast<const char*>(accounts.constData()), accounts.size() * sizeof(AccountRec));
+  out.append(reinterpret_cast<const char*>(servers.constData()), servers.size() * sizeof(ServerRec));
+  out.append(reinterpret_cast<const char*>(channels.constData()), channels.size() * sizeof(ChannelRec));
+  out.append(reinterpret_cast<const char*>(members.constData()), members.size() * sizeof(quint32));
+  out.append(strings);
+
+  header.file_size = out.size();
+  header.checksum = checksum(reinterpret_cast<const uchar*>(out.constData()) + sizeof(Header), out.size() - sizeof(Header));
+  std::memcpy(out.data(), &header, sizeof(Header));
+
+  // written next to the old one and renamed over it
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly) || file.write(out) != out.size() || !file.commit()) {
+    qWarning() << "snapshot: could not write" << path << file.errorString();
+    return false;
+  }
+
+  // the log before the watermark is covered by the file now
+  sql::membership_log_prune(log_id);
+
+  qInfo() << "snapshot: wrote" << accounts.size() << "accounts," << channels.size() << "channels,"
+          << members.size() << "memberships," << out.size() << "bytes in" << timer.elapsed() << "ms";
+  return true;
+}
+
+const char *Snapshot::decode(const uchar *data, const quint64 size, WarmStart::Rows &rows, qint64 &log_id, QDateTime &db_time) {
+  if (size < sizeof(Header))
+    return "truncated header";
+
+  Header header;
+  std::memcpy(&header, data, sizeof(Header));
+  if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0)
+    return "bad magic";
+  if (header.version != VERSION)
+    return "unsupported version";
+  if (header.header_size != sizeof(Header) || header.file_size != size)
+    return "size mismatch";
+
+  // counts are 32 bit, none of this can overflow
+  const quint64 off_servers = sizeof(Header) + static_cast<quint64>(header.accounts) * sizeof(AccountRec);
+  const quint64 off_channels = off_servers + static_cast<quint64>(header.servers) * sizeof(ServerRec);
+  const quint64 off_members = off_channels + static_cast<quint64>(header.channels) * sizeof(ChannelRec);
+  const quint64 off_strings = off_members + static_cast<quint64>(header.members) * sizeof(quint32);
+  if (header.strings_size > size || off_strings != size - header.strings_size)
+    return "size mismatch";
+
+  if (checksum(data + sizeof(Header), size - sizeof(Header)) != header.checksum)
+    return "checksum mismatch";
+
+  // sections are 8-byte aligned within a page-aligned mapping
+  const auto *accounts = reinterpret_cast<const AccountRec*>(data + sizeof(Header));
+  const auto *servers = reinterpret_cast<const ServerRec*>(data + off_servers);
+  const auto *channels = reinterpret_cast<const ChannelRec*>(data + off_channels);
+  const auto *members = reinterpret_cast<const quint32*>(data + off_members);
+  const auto *strings = reinterpret_cast<const char*>(data + off_strings);
+
+  bool bad_string = false;
+  const auto str = [&](const Str &s) {
+    if (static_cast<quint64>(s.offset) + s.size > header.strings_size) {
+      bad_string = true;
+      return QByteArray();
+    }
+    return QByteArray(strings + s.offset, s.size);
+  };
+  const auto uuid = [](const quint8 (&id)[16]) {
+    return QUuid::fromRfc4122(QByteArrayView(reinterpret_cast<const char*>(id), sizeof(id)));
+  };
+
+  rows.accounts.reserve(header.accounts);
+  for (quint32 i = 0; i < header.accounts; ++i) {
+    const auto &rec = accounts[i];
+    rows.accounts.append({uuid(rec.id), str(rec.username), str(rec.password), from_ms(rec.created)});
+  }
+
+  const auto account_id = [&](const quint32 index, bool &bad) {
+    if (index == NONE)
+      return QUuid();
+    if (index >= header.accounts) {
+      bad = true;
+      return QUuid();
+    }
+    return rows.accounts.at(index).id;
+  };
+
+  bool bad_index = false;
+  rows.servers.reserve(header.servers);
+  for (quint32 i = 0; i < header.servers; ++i) {
+    const auto &rec = servers[i];
+    rows.servers.append({uuid(rec.id), str(rec.name), account_id(rec.owner, bad_index), from_ms(rec.created)});
+  }
+
+  rows.channels.reserve(header.channels);
+  rows.memberships.reserve(header.members);
+  for (quint32 i = 0; i < header.channels; ++i) {
+    const auto &rec = channels[i];
+    QUuid server_id;
+    if (rec.server != NONE) {
+      if (rec.server >= header.servers)
+        return "server index out of range";
+      server_id = rows.servers.at(rec.server).id;
+    }
+
+    const QUuid channel_id = uuid(rec.id);
+    rows.channels.append({channel_id, str(rec.name), str(rec.topic), account_id(rec.owner, bad_index), server_id, from_ms(rec.created)});
+
+    if (static_cast<quint64>(rec.members_begin) + rec.members_count > header.members)
+      return "member range out of bounds";
+    for (quint32 m = rec.members_begin; m < rec.members_begin + rec.members_count; ++m)
+      rows.memberships.append({account_id(members[m], bad_index), channel_id});
+  }
+
+  if (bad_string)
+    return "string out of bounds";
+  if (bad_index)
+    return "account index out of range";
+
+  log_id = header.log_id;
+  db_time = from_ms(header.db_time);
+  return nullptr;
+}
+
+bool Snapshot::load(const QString &path) {
+  QFile file(path);
+  if (!file.exists())
+    return false;
+
+  QElapsedTimer total;
+  total.start();
+  QElapsedTimer timer;
+  timer.start();
+
+  if (!file.open(QIODevice::ReadOnly)) {
+    qWarning() << "snapshot: cannot open" << path << file.errorString();
+    return false;
+  }
+
+  const qint64 size = file.size();
+  const uchar *data = size > 0 ? file.map(0, size) : nullptr;
+  if (data == nullptr) {
+    qWarning() << "snapshot: cannot map" << path << file.errorString();
+    return false;
+  }
+
+  WarmStart::Rows rows;
+  qint64 log_id = 0;
+  QDateTime db_time;
+  const char *error = decode(data, size, rows, log_id, db_time);
+  file.unmap(const_cast<uchar*>(data));
+  file.close();
+
+  if (error != nullptr) {
+    qWarning() << "snapshot:" << path << "rejected:" << error;
+    return false;
+  }
+
+  const auto decoded = timer.restart();
+
+  // a restored or different database
+  qint64 head_id = 0;
+  QDateTime head_time;
+  if (!sql::snapshot_watermark(head_id, head_time) || head_id < log_id || !db_time.isValid()) {
+    qWarning() << "snapshot:" << path << "rejected: does not match the database";
+    return false;
+  }
+
+  QList<sql::MembershipChange> changes;
+  if (!sql::membership_log_since(log_id, changes))
+    return false;
+
+  // rows created after the watermark; the slack overlaps with the snapshot
+  const auto delta = WarmStart::fetch(db_time.addMSecs(-CLOCK_SLACK_MS));
+  qsizetype added = 0;
+
+  QSet<QUuid> seen;
+  seen.reserve(rows.accounts.size() + rows.servers.size() + rows.channels.size());
+  for (const auto &row: rows.accounts)
+    seen.insert(row.id);
+  for (const auto &row: rows.servers)
+    seen.insert(row.id);
+  for (const auto &row: rows.channels)
+    seen.insert(row.id);
+
+  for (const auto &row: delta.accounts) {
+    if (!seen.contains(row.id)) {
+      rows.accounts << row;
+      ++added;
+    }
+  }
+  for (const auto &row: delta.servers) {
+    if (!seen.contains(row.id)) {
+      rows.servers << row;
+      ++added;
+    }
+  }
+  for (const auto &row: delta.channels) {
+    if (!seen.contains(row.id)) {
+      rows.channels << row;
+      ++added;
+    }
+  }
+
+  // joins and parts, in commit order
+  if (!changes.isEmpty()) {
+    QSet<sql::MembershipRow> memberships(rows.memberships.constBegin(), rows.memberships.constEnd());
+    for (const auto &change: changes) {
+      const sql::MembershipRow row{change.account_id, change.channel_id};
+      if (change.joined)
+        memberships.insert(row);
+      else
+        memberships.remove(row);
+    }
+    rows.memberships = memberships.values();
+  }
+
+  qInfo() << "snapshot: decoded in" << decoded << "ms, delta of" << added << "rows and"
+          << changes.size() << "membership changes in" << timer.restart() << "ms";
+
+  WarmStart::apply(rows);
+  qInfo() << "snapshot: loaded" << path << "in" << total.elapsed() << "ms";
+  return true;
+}
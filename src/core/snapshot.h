@@ -0,0 +1,89 @@
+#pragma once
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+#include <atomic>
+
+#include "core/warm_start.h"
+
+// binary image of accounts, servers, channels and memberships for fast
+// restarts. The file is mapped and checked (magic, version, size, checksum,
+// bounds) before anything is trusted; a bad or missing snapshot falls back to
+// WarmStart. On top of a good one, only what the database gained after the
+// snapshot's watermark is fetched: rows created since then, and the joins
+// and parts in membership_log.
+//
+// layout, native byte order:
+//   Header | AccountRec[] | ServerRec[] | ChannelRec[] | quint32 members[] | strings
+// records are fixed size and refer to strings by (offset, size) and to each
+// other by index; a channel's members are a range of account indices in the
+// flat members array.
+class Snapshot {
+public:
+  // true when the caches were filled from `path`
+  static bool load(const QString &path);
+  // reads the database and atomically replaces `path`; false when another
+  // write is still running or something failed
+  static bool write(const QString &path);
+
+private:
+  static constexpr char MAGIC[8] = {'C', 'R', 'S', 'N', 'A', 'P', '\0', '\0'};
+  static constexpr quint32 VERSION = 1;
+  static constexpr quint32 NONE = 0xffffffff;
+  // rows committed this long after the watermark's clock reading may carry an
+  // earlier creation_date (transaction start); the overlap is deduplicated
+  static constexpr qint64 CLOCK_SLACK_MS = 60 * 1000;
+
+  struct Str {
+    quint32 offset;
+    quint32 size;
+  };
+
+  struct Header {
+    char magic[8];
+    quint32 version;
+    quint32 header_size;
+    quint64 file_size;
+    quint64 checksum;  // FNV-1a over everything after the header
+    qint64 db_time;    // watermark: database clock, ms since epoch
+    qint64 log_id;     // watermark: last membership_log id
+    quint32 accounts;
+    quint32 servers;
+    quint32 channels;
+    quint32 members;
+    quint64 strings_size;
+  };
+
+  struct AccountRec {
+    quint8 id[16];
+    Str username;
+    Str password;
+    qint64 created;
+  };
+
+  struct ServerRec {
+    quint8 id[16];
+    Str name;
+    quint32 owner;  // AccountRec index or NONE
+    quint32 reserved;
+    qint64 created;
+  };
+
+  struct ChannelRec {
+    quint8 id[16];
+    Str name;
+    Str topic;
+    quint32 owner;   // AccountRec index or NONE
+    quint32 server;  // ServerRec index or NONE
+    quint32 members_begin;
+    quint32 members_count;
+    qint64 created;
+  };
+
+  static std::atomic<bool> m_writing;
+
+  static quint64 checksum(const uchar *data, quint64 size);
+  // nullptr when the mapped file is sound, otherwise why it is not
+  static const char *decode(const uchar *data, quint64 size, WarmStart::Rows &rows, qint64 &log_id, QDateTime &db_time);
+};
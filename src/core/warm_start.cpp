@@ -0,0 +1,154 @@
+#include <QtConcurrent>
+#include <QDebug>
+
+#include "core/warm_start.h"
+#include "core/account.h"
+#include "core/channel.h"
+#include "core/server.h"
+#include "lib/sql.h"
+#include "ctx.h"
+
+// pages until one comes back short; `key_of` gives the keyset cursor of a row
+template <typename Row, typename Key, typename Page, typename KeyOf>
+static QList<Row> stream(Page page, KeyOf key_of, const int page_size) {
+  QList<Row> rows;
+  Key after{};
+  while (true) {
+    auto chunk = page(after, page_size);
+    const bool done = chunk.size() < page_size;
+    if (!chunk.isEmpty())
+      after = key_of(chunk.last());
+    rows.append(std::move(chunk));
+    if (done)
+      return rows;
+  }
+}
+
+void WarmStart::log_phase(const char *phase, const qsizetype rows, QElapsedTimer &timer) {
+  qInfo() << "warm start:" << phase << rows << "rows in" << timer.restart() << "ms";
+}
+
+void WarmStart::run() {
+  QElapsedTimer total;
+  total.start();
+  apply(fetch());
+  qInfo() << "warm start: done in" << total.elapsed() << "ms";
+}
+
+WarmStart::Rows WarmStart::fetch(const QDateTime &since) {
+  QElapsedTimer timer;
+  timer.start();
+
+  // the tables do not depend on each other
+  auto f_accounts = QtConcurrent::run([since] {
+    return stream<sql::AccountRow, QUuid>(
+      [&since](const QUuid &after, const int limit) { return sql::account_rows(after, limit, since); },
+      [](const sql::AccountRow &r) { return r.id; }, PAGE_SIZE);
+  });
+  auto f_servers = QtConcurrent::run([since] {
+    return stream<sql::ServerRow, QUuid>(
+      [&since](const QUuid &after, const int limit) { return sql::server_rows(after, limit, since); },
+      [](const sql::ServerRow &r) { return r.id; }, PAGE_SIZE);
+  });
+  auto f_channels = QtConcurrent::run([since] {
+    return stream<sql::ChannelRow, QUuid>(
+      [&since](const QUuid &after, const int limit) { return sql::channel_rows(after, limit, since); },
+      [](const sql::ChannelRow &r) { return r.id; }, PAGE_SIZE);
+  });
+
+  Rows rows;
+  if (!since.isValid())
+    rows.memberships = stream<sql::MembershipRow, sql::MembershipRow>(&sql::membership_rows, [](const sql::MembershipRow &r) { return r; }, PAGE_SIZE);
+  rows.accounts = f_accounts.result();
+  rows.servers = f_servers.result();
+  rows.channels = f_channels.result();
+  log_phase("fetch", rows.accounts.size() + rows.servers.size() + rows.channels.size() + rows.memberships.size(), timer);
+  return rows;
+}
+
+void WarmStart::apply(const Rows &rows) {
+  QElapsedTimer timer;
+  timer.start();
+
+  // accounts; preload_from_file() may have cached a few already
+  QHash<QUuid, QSharedPointer<Account>> accounts_by_id;
+  QHash<QByteArray, QSharedPointer<Channel>> cached_channels;
+  {
+    QReadLocker locker(&g::ctx->mtx_cache);
+    accounts_by_id = g::ctx->accounts_lookup_uuid;
+    cached_channels = g::ctx->channels;
+  }
+
+  QList<sql::AccountRow> new_accounts;
+  new_accounts.reserve(rows.accounts.size());
+  for (const auto& row: rows.accounts) {
+    if (!accounts_by_id.contains(row.id))
+      new_accounts << row;
+  }
+
+  const auto accounts = QtConcurrent::blockingMapped<QList<QSharedPointer<Account>>>(new_accounts, [](const sql::AccountRow &row) {
+    auto account = Account::from_db_row(row.id, row.username, row.password, row.creation_date);
+    account->channels_loaded = true;
+    return account;
+  });
+  g::ctx->accounts_insert_cache(accounts);
+
+  accounts_by_id.reserve(accounts_by_id.size() + accounts.size());
+  for (const auto& account: accounts)
+    accounts_by_id.insert(account->uid(), account);
+  log_phase("accounts", accounts.size(), timer);
+
+  // servers; few of them
+  QHash<QUuid, QSharedPointer<Server>> servers_by_id;
+  for (const auto& row: rows.servers)
+    servers_by_id.insert(row.id, Server::create_from_db(row.id, row.name, accounts_by_id.value(row.owner_id), row.creation_date));
+  log_phase("servers", servers_by_id.size(), timer);
+
+  // channels
+  QList<sql::ChannelRow> new_channels;
+  new_channels.reserve(rows.channels.size());
+  for (const auto& row: rows.channels) {
+    if (!cached_channels.contains(row.name))
+      new_channels << row;
+  }
+
+  // sequence heads from the database even when the rows came from a
+  // snapshot; events written since would otherwise be numbered again
+  QHash<QUuid, quint64> heads;
+  if (!new_channels.isEmpty())
+    heads = sql::channel_event_heads();
+
+  auto channels = QtConcurrent::blockingMapped<QList<QSharedPointer<Channel>>>(new_channels, [&accounts_by_id, &servers_by_id, &heads](const sql::ChannelRow &row) {
+    auto channel = Channel::from_db_row(
+      row.id, row.name, row.topic,
+      accounts_by_id.value(row.owner_id),
+      servers_by_id.value(row.server_id),
+      row.creation_date,
+      heads.value(row.id));
+    return channel;
+  });
+
+  {
+    QWriteLocker locker(&g::ctx->mtx_cache);
+    g::ctx->channels.reserve(g::ctx->channels.size() + channels.size());
+    for (const auto& channel: channels)
+      g::ctx->channels.insert(channel->name(), channel);
+  }
+  log_phase("channels", channels.size(), timer);
+
+  // memberships, grouped per channel so every channel is filled once
+  QHash<QUuid, QList<QSharedPointer<Account>>> members_by_channel;
+  members_by_channel.reserve(channels.size());
+  for (const auto& [account_id, channel_id]: rows.memberships) {
+    if (const auto account = accounts_by_id.value(account_id); !account.isNull())
+      members_by_channel[channel_id].append(account);
+  }
+
+  channels.append(cached_channels.values());
+  QtConcurrent::blockingMap(channels, [&members_by_channel](const QSharedPointer<Channel> &channel) {
+    if (const auto it = members_by_channel.constFind(channel->uid); it != members_by_channel.constEnd())
+      channel->addMembers(it.value());
+    channel->members_loaded = true;
+  });
+  log_phase("memberships", rows.memberships.size(), timer);
+}
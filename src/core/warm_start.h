@@ -0,0 +1,34 @@
+#pragma once
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QDateTime>
+#include <QList>
+
+#include "lib/sql.h"
+
+// startup load of everything into memory (without --lazy-load). Tables are
+// streamed with keyset pagination, each on its own thread and database
+// connection; all memberships come in one pass. Accounts and channels are
+// then built across cores and handed to the caches in bulk. Every phase is
+// timed and logged.
+class WarmStart {
+public:
+  struct Rows {
+    QList<sql::AccountRow> accounts;
+    QList<sql::ServerRow> servers;
+    QList<sql::ChannelRow> channels;
+    QList<sql::MembershipRow> memberships;
+  };
+
+  static void run();
+  // with `since`, only accounts/servers/channels created from then on and
+  // no memberships (see Snapshot)
+  static Rows fetch(const QDateTime &since = {});
+  // builds and caches whatever is not cached yet
+  static void apply(const Rows &rows);
+
+private:
+  static constexpr int PAGE_SIZE = 5000;
+
+  static void log_phase(const char *phase, qsizetype rows, QElapsedTimer &timer);
+};
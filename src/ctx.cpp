@@ -1,8 +1,10 @@
 #include <filesystem>
+#include <limits>
 
 #include <QObject>
 #include <QDir>
 #include <QStandardPaths>
+#include <QThreadPool>
 
 #include "ctx.h"
 #include "lib/logger_std/logger_std.h"
@@ -28,23 +30,119 @@ Ctx::Ctx() {
   g::defaultHost = "kroket.io";
   g::mainThread = QCoreApplication::instance()->thread();
 
+  if (g::lazyLoad)
+    lazy = new LazyLoader(g::lazyTTL, this);
+  metadata_cache = new MetadataCache();
+  password_verifier = new PasswordVerifier(g::authThreads, g::authQueue);
+  session_tokens = new SessionTokens(g::pathSessionKey.filePath());
+  irc_limits = new IrcRateLimits();
+
   // database
   const bool preload = true;
   sql::create_schema();
+  session_tokens->load();
+
+  // logouts made on other nodes sharing the database
+  m_session_timer = new QTimer(this);
+  m_session_timer->setInterval(SessionTokens::REFRESH_SECS * 1000);
+  connect(m_session_timer, &QTimer::timeout, this, [this] {
+    QThreadPool::globalInstance()->start([this] { session_tokens->load(); });
+  });
+  m_session_timer->start();
   if (preload)
     sql::preload_from_file(g::pathDatabasePreload.filePath());
 
+  // only snapshots read the membership_log; an old snapshot would not
+  // see the changes dropped here
+  if (g::lazyLoad || g::snapshotInterval == 0) {
+    sql::membership_log_prune(std::numeric_limits<qint64>::max());
+    QFile::remove(g::pathSnapshot.filePath());
+  }
+
   // initial loading into memory: accounts & channels
-  CLOCK_MEASURE_START(start_init_db_preload);
-  auto _channels = sql::channel_get_all();
-  for (auto const& channel : _channels) {
-    channels[channel->name()] = channel;
-    const auto accounts_channels = sql::channel_get_members(channel->uid);
-    channel->addMembers(accounts_channels);
+  // (with --lazy-load they are faulted in on first reference instead)
+  if (!g::lazyLoad) {
+    const bool snapshot = g::snapshotInterval > 0;
+    if (!snapshot || !Snapshot::load(g::pathSnapshot.filePath()))
+      WarmStart::run();
+
+    // refreshed in the background; the next start only fetches what is newer
+    if (snapshot) {
+      const auto write_snapshot = [] {
+        QThreadPool::globalInstance()->start([] { Snapshot::write(g::pathSnapshot.filePath()); });
+      };
+      m_snapshot_timer = new QTimer(this);
+      m_snapshot_timer->setInterval(g::snapshotInterval * 1000);
+      connect(m_snapshot_timer, &QTimer::timeout, this, write_snapshot);
+      m_snapshot_timer->start();
+      write_snapshot();
+    }
+
+    // every resident account and channel; Metadata no longer queries on first touch
+    metadata_cache->preload();
   }
 
-  sql::account_get_all();  // trigger cache insertion
-  CLOCK_MEASURE_END(start_init_db_preload, "initial db load");
+  // metadata changes, written behind in coalesced batches
+  m_metadata_timer = new QTimer(this);
+  m_metadata_timer->setInterval(MetadataCache::FLUSH_MS);
+  connect(m_metadata_timer, &QTimer::timeout, this, [this] {
+    if (metadata_cache->pending())
+      QThreadPool::globalInstance()->start([this] { metadata_cache->flush(); });
+  });
+  m_metadata_timer->start();
+
+  join_pipeline = new irc::JoinPipeline(this);
+  metadata_notifier = new irc::MetadataNotifier(this);
+
+  // messages on local disk instead of the messages table; like the db
+  // pool it is never torn down, history reads may still be running
+  if (g::messageStore == "log")
+    message_log = new MessageLog(g::messagesDirectory, g::messageRetentionDays);
+  else if (g::messageStore != "sql")
+    qFatal("unknown message store '%s'", qPrintable(g::messageStore));
+
+  // message insertions
+  m_writer_thread = new QThread();
+  m_writer_thread->setObjectName(QString("msgwriter"));
+  message_writer = new MessageWriter(
+    g::msgQueueSize,
+    g::msgBatchSize,
+    g::msgFlushInterval,
+    g::msgDropWhenFull ? MessageWriter::Overflow::Drop : MessageWriter::Overflow::Block,
+    g::msgAtLeastOnce);
+  message_writer->moveToThread(m_writer_thread);
+  connect(m_writer_thread, &QThread::started, message_writer, &MessageWriter::start);
+
+  connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, [this] {
+    // drain what is still queued before the thread goes away
+    QMetaObject::invokeMethod(message_writer, &MessageWriter::stop, Qt::BlockingQueuedConnection);
+    m_writer_thread->quit();
+    m_writer_thread->wait();
+    message_writer->deleteLater();
+    m_writer_thread->deleteLater();
+    metadata_cache->flush(true);
+    log_stats();
+  });
+
+  m_writer_thread->start();
+
+  // on the writer thread, between batches
+  if (message_log != nullptr) {
+    m_message_log_timer = new QTimer(this);
+    m_message_log_timer->setInterval(MessageLog::MAINTAIN_INTERVAL_MS);
+    connect(m_message_log_timer, &QTimer::timeout, message_writer, [this] { message_log->maintain(); });
+    m_message_log_timer->start();
+  } else {
+    // upcoming partitions and retention, in the background
+    const auto maintain_messages = [] {
+      QThreadPool::globalInstance()->start([] { sql::messages_maintain(g::messageRetentionDays, g::messageArchive); });
+    };
+    m_messages_timer = new QTimer(this);
+    m_messages_timer->setInterval(MESSAGES_MAINTAIN_MS);
+    connect(m_messages_timer, &QTimer::timeout, this, maintain_messages);
+    m_messages_timer->start();
+    maintain_messages();
+  }
 
   // irc/ws server - threadpool 4, max 5 connections per IP
   irc_server = new irc::ThreadedServer(4, 10, this);
@@ -95,25 +193,19 @@ Ctx::Ctx() {
     qInfo("WS server listening on port %hu", g::wsServerListeningPort);
   }
 
-  // message insertions
-  m_insertTimer = new QTimer(this);
-  m_insertTimer->setInterval(1000);
-  // @TODO: not used atm., but can be used for events that do not require an immediate return (not QEventMessage)
-  // connect(m_insertTimer, &QTimer::timeout, this, [this] {
-  //   QSet<QSharedPointer<QEventMessage>> msgs;
-  //   QReadLocker rlock(&mtx_messageInsertion);
-  //   if (m_messageInsertionQueue.isEmpty())
-  //     return;
-  //
-  //   for (const auto& msg : m_messageInsertionQueue)
-  //     msgs << msg;
-  //
-  //   m_messageInsertionQueue.clear();
-  //   rlock.unlock();
-  //
-  //   SQL::insert_messages(msgs);
-  // });
-  // m_insertTimer->start();
+  if (g::statsInterval > 0) {
+    m_stats_timer = new QTimer(this);
+    m_stats_timer->setInterval(g::statsInterval * 1000);
+    connect(m_stats_timer, &QTimer::timeout, this, &Ctx::log_stats);
+    m_stats_timer->start();
+  }
+}
+
+void Ctx::log_stats() const {
+  sql::log_pool_stats();
+  password_verifier->log_stats();
+  if (web_server != nullptr)
+    web_server->executor()->log_stats();
 }
 
 bool Ctx::account_username_exists(const QByteArray &username) const {
@@ -126,7 +218,7 @@ void Ctx::account_remove_cache(const QSharedPointer<Account>& ptr) {
     return;
 
   QWriteLocker locker(&mtx_cache);
-  accounts.remove(ptr);
+  accounts.remove(ptr->handle());
   accounts_lookup_uuid.remove(ptr->uid());
 
   const auto name = ptr->name();
@@ -153,12 +245,32 @@ QSharedPointer<Account> Ctx::irc_nick_get(const QByteArray &nick) const {
 
 void Ctx::account_insert_cache(const QSharedPointer<Account>& ptr) {
   QWriteLocker locker(&mtx_cache);
-  accounts << ptr;
+  accounts[ptr->handle()] = ptr;
   accounts_lookup_uuid[ptr->uid()] = ptr;
 
   const auto name = ptr->name();
   if (!name.isEmpty())
     accounts_lookup_name[ptr->name()] = ptr;
+  locker.unlock();
+
+  if (lazy != nullptr && !name.isEmpty())
+    lazy->forget_missing(name);
+}
+
+void Ctx::accounts_insert_cache(const QList<QSharedPointer<Account>>& list) {
+  QWriteLocker locker(&mtx_cache);
+  accounts.reserve(accounts.size() + list.size());
+  accounts_lookup_uuid.reserve(accounts_lookup_uuid.size() + list.size());
+  accounts_lookup_name.reserve(accounts_lookup_name.size() + list.size());
+  irc_nicks.reserve(irc_nicks.size() + list.size());
+
+  for (const auto& ptr: list) {
+    accounts[ptr->handle()] = ptr;
+    accounts_lookup_uuid[ptr->uid()] = ptr;
+    if (const auto name = ptr->name(); !name.isEmpty())
+      accounts_lookup_name[name] = ptr;
+    irc_nicks[ptr->nick()] = ptr;
+  }
 }
 
 QList<QVariantMap> Ctx::getAccountsByUUIDs(const QList<QUuid> &uuids) const {
@@ -259,12 +371,16 @@ void Ctx::createConfigDirectory(const QStringList &lst) {
 
 void Ctx::onApplicationLog(const QString &msg) {}
 
+// with --lazy-load, only what is resident
 QList<QSharedPointer<Channel>> Ctx::get_channels_ordered() const {
   QList<QSharedPointer<Channel>> values;
   QList<QPair<uint, QSharedPointer<Channel>>> hashedList;
 
+  QReadLocker locker(&mtx_cache);
+
   for (auto it = channels.cbegin(); it != channels.cend(); ++it)
     hashedList.append(qMakePair(qHash(it.key()), it.value()));
+  locker.unlock();
 
   std::sort(hashedList.begin(), hashedList.end(), [](const auto &a, const auto &b) {
     return a.first < b.first;
@@ -357,9 +473,12 @@ void onChannelMemberJoinedFailed(const QSharedPointer<Account> &account) {
 
 }
 
-void Ctx::queueMessageForInsert(const QSharedPointer<QEventMessage>& msg) {
-  QWriteLocker wlock(&mtx_messageInsertion);
-  m_messageInsertionQueue.insert(msg);
+void Ctx::queueMessageForInsert(const QSharedPointer<QEventMessage>& msg) const {
+  message_writer->enqueue(msg);
+}
+
+void Ctx::queueEventForInsert(sql::EventRow row) const {
+  message_writer->enqueue(std::move(row));
 }
 
 Ctx::~Ctx() = default;
\ No newline at end of file
@@ -15,6 +15,11 @@
 
 #include "lib/globals.h"
 #include "lib/sql.h"
+#include "lib/message_writer.h"
+#include "lib/message_log.h"
+#include "lib/password_verifier.h"
+#include "lib/session_tokens.h"
+#include "lib/rate_limiter.h"
 
 #include "web/webserver.h"
 
@@ -24,9 +29,15 @@
 #include "core/upload.h"
 #include "core/server.h"
 #include "core/permission.h"
+#include "core/lazy_loader.h"
+#include "core/warm_start.h"
+#include "core/snapshot.h"
+#include "core/metadata_cache.h"
 
 #include "irc/client_connection.h"
 #include "irc/threaded_server.h"
+#include "irc/join_pipeline.h"
+#include "irc/metadata_notifier.h"
 #include "python/manager.h"
 
 #include <QPair>
@@ -43,15 +54,26 @@ public:
 
   irc::ThreadedServer* irc_server = nullptr;
   irc::ThreadedServer* irc_ws = nullptr;
+  irc::JoinPipeline* join_pipeline = nullptr;
+  irc::MetadataNotifier* metadata_notifier = nullptr;
+  LazyLoader* lazy = nullptr;  // only with --lazy-load
+  MessageWriter* message_writer = nullptr;
+  MessageLog* message_log = nullptr;  // only with --message-store log
+  MetadataCache* metadata_cache = nullptr;
+  PasswordVerifier* password_verifier = nullptr;
+  SessionTokens* session_tokens = nullptr;
+  IrcRateLimits* irc_limits = nullptr;
   WebServer *web_server = nullptr;
   SnakePit* snakepit = nullptr;
 
   mutable QReadWriteLock mtx_cache;
 
-  QSet<QSharedPointer<Account>> accounts;
+  QHash<AccountHandle, QSharedPointer<Account>> accounts;
   QHash<QByteArray, QSharedPointer<Account>> accounts_lookup_name;
   QHash<QUuid, QSharedPointer<Account>> accounts_lookup_uuid;
   void account_insert_cache(const QSharedPointer<Account>& ptr);
+  // one lock for the lot, see WarmStart
+  void accounts_insert_cache(const QList<QSharedPointer<Account>>& list);
   void account_remove_cache(const QSharedPointer<Account>& ptr);
   bool account_username_exists(const QByteArray& username) const;
   void irc_nicks_remove_cache(const QByteArray& nick) const;
@@ -84,8 +106,9 @@ public:
   void permission_insert_cache(const QSharedPointer<Permission>& ptr);
   void permission_remove_cache(const QSharedPointer<Permission>& ptr);
 
-  // messages
-  void queueMessageForInsert(const QSharedPointer<QEventMessage>& msg);
+  // messages and channel events; persisted asynchronously by `message_writer`
+  void queueMessageForInsert(const QSharedPointer<QEventMessage>& msg) const;
+  void queueEventForInsert(sql::EventRow row) const;
 
   // need to keep track of nicks too, as on IRC they are unique
   // they need to be lowercase
@@ -113,9 +136,17 @@ private:
   QThread* m_web_thread = nullptr;
   QFileInfo m_path_db;
 
-  QReadWriteLock mtx_messageInsertion;
-  QSet<QSharedPointer<QEventMessage>> m_messageInsertionQueue;
-  QTimer* m_insertTimer;
+  QThread* m_writer_thread = nullptr;
+  QTimer* m_snapshot_timer = nullptr;
+  QTimer* m_message_log_timer = nullptr;
+  QTimer* m_messages_timer = nullptr;
+  QTimer* m_metadata_timer = nullptr;
+  QTimer* m_stats_timer = nullptr;
+  QTimer* m_session_timer = nullptr;
+  static constexpr int MESSAGES_MAINTAIN_MS = 60 * 60 * 1000;
+
+  // database pool, password checks and REST lanes; periodically and on shutdown
+  void log_stats() const;
 
   static void createConfigDirectory(const QStringList &lst);
   static void createDefaultFiles();
@@ -0,0 +1,120 @@
+#include <algorithm>
+
+#include "irc/admission.h"
+#include "irc/client_connection.h"
+#include "lib/globals.h"
+
+namespace irc {
+  AdmissionController::AdmissionController(const QList<QObject*> &workers, QObject *parent) :
+      QObject(parent), m_workers(workers) {
+    for (int i = 0; i < m_workers.size(); ++i) {
+      m_probe_sent << -1;
+      m_worker_lag << 0;
+    }
+
+    m_clock.start();
+
+    m_timer = new QTimer(this);
+    m_timer->setInterval(TICK_MS);
+    connect(m_timer, &QTimer::timeout, this, &AdmissionController::tick);
+    m_timer->start();
+  }
+
+  int AdmissionController::admit(client_connection *conn) {
+    QMutexLocker locker(&mtx_admission);
+
+    // fast path; nobody waiting and budget left
+    if (m_queue.isEmpty() && m_tokens >= 1.0) {
+      m_tokens -= 1.0;
+      return 0;
+    }
+
+    QObject *worker = conn->parent() != nullptr ? conn->parent() : conn;
+    m_queue.enqueue(qMakePair(conn->handle(), worker));
+    return static_cast<int>(m_queue.size());
+  }
+
+  void AdmissionController::withdraw(client_connection *conn) {
+    const ConnectionHandle handle = conn->handle();
+
+    QMutexLocker locker(&mtx_admission);
+    for (auto it = m_queue.begin(); it != m_queue.end(); ++it) {
+      if (it->first == handle) {
+        m_queue.erase(it);
+        return;
+      }
+    }
+    m_tokens = std::min(m_tokens + 1.0, std::max(1.0, m_rate * PROBE_MS / 1000.0));
+  }
+
+  void AdmissionController::tick() {
+    const qint64 now = m_clock.elapsed();
+    if (now - m_last_probe >= PROBE_MS) {
+      m_last_probe = now;
+      probe();
+    }
+
+    QList<QPair<ConnectionHandle, QObject*>> release;
+
+    QMutexLocker locker(&mtx_admission);
+    m_tokens = std::min(m_tokens + m_rate * TICK_MS / 1000.0, std::max(1.0, m_rate * PROBE_MS / 1000.0));
+    while (!m_queue.isEmpty() && m_tokens >= 1.0) {
+      release << m_queue.dequeue();
+      m_tokens -= 1.0;
+    }
+    locker.unlock();
+
+    for (const auto& [handle, worker]: release) {
+      QMetaObject::invokeMethod(worker, [handle] {
+        if (client_connection *conn = g::connectionSlab.get(handle))
+          conn->admitted();
+      }, Qt::QueuedConnection);
+    }
+  }
+
+  void AdmissionController::probe() {
+    const qint64 now = m_clock.elapsed();
+
+    qint64 lag = 0;
+    for (int i = 0; i < m_workers.size(); ++i) {
+      // a probe that has not come back yet counts as lag, too
+      if (m_probe_sent[i] >= 0) {
+        lag = std::max(lag, now - m_probe_sent[i]);
+        continue;
+      }
+
+      lag = std::max(lag, m_worker_lag[i]);
+      m_probe_sent[i] = now;
+
+      QMetaObject::invokeMethod(m_workers[i], [this, i, sent = now] {
+        const qint64 lag_worker = m_clock.elapsed() - sent;
+        QMetaObject::invokeMethod(this, [this, i, lag_worker] {
+          m_worker_lag[i] = lag_worker;
+          m_probe_sent[i] = -1;
+        }, Qt::QueuedConnection);
+      }, Qt::QueuedConnection);
+    }
+
+    QMutexLocker locker(&mtx_admission);
+    m_lag = lag;
+    if (lag > TARGET_LAG_MS)
+      m_rate = std::max(MIN_RATE, m_rate / 2.0);
+    else
+      m_rate = std::min(MAX_RATE, m_rate + RATE_STEP);
+  }
+
+  double AdmissionController::rate() const {
+    QMutexLocker locker(&mtx_admission);
+    return m_rate;
+  }
+
+  qint64 AdmissionController::lag() const {
+    QMutexLocker locker(&mtx_admission);
+    return m_lag;
+  }
+
+  int AdmissionController::queued() const {
+    QMutexLocker locker(&mtx_admission);
+    return static_cast<int>(m_queue.size());
+  }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <QObject>
+#include <QList>
+#include <QQueue>
+#include <QPair>
+#include <QMutex>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "core/handles.h"
+
+namespace irc {
+  class client_connection;
+
+  // throttles registrations after a restart, when every client reconnects
+  // at once. Registrations are admitted through a token bucket whose rate
+  // follows the measured worker lag (AIMD): it grows while the workers keep
+  // up and halves when queued calls start waiting. Connections that do not
+  // get a token wait in a FIFO and are released from the main thread.
+  class AdmissionController final : public QObject {
+    Q_OBJECT
+
+  public:
+    explicit AdmissionController(const QList<QObject*> &workers, QObject *parent = nullptr);
+
+    // thread-safe. 0 when admitted right away, otherwise the queue
+    // position; `conn->admitted()` is invoked on its worker once released.
+    int admit(client_connection *conn);
+    // a queued connection went away; it leaves the queue, or, when it was
+    // already released and the admission is still on its way, its token
+    // goes back into the bucket
+    void withdraw(client_connection *conn);
+
+    [[nodiscard]] double rate() const;
+    [[nodiscard]] qint64 lag() const;
+    [[nodiscard]] int queued() const;
+
+  private:
+    void tick();
+    void probe();
+
+    static constexpr int TICK_MS = 100;
+    static constexpr int PROBE_MS = 250;
+    static constexpr qint64 TARGET_LAG_MS = 50;
+    static constexpr double MIN_RATE = 5.0;     // registrations per second
+    static constexpr double MAX_RATE = 500.0;
+    static constexpr double RATE_STEP = 10.0;
+
+    QList<QObject*> m_workers;
+    QList<qint64> m_probe_sent;  // -1 when no probe is outstanding
+    QList<qint64> m_worker_lag;
+
+    mutable QMutex mtx_admission;
+    QQueue<QPair<ConnectionHandle, QObject*>> m_queue;
+    double m_rate = 50.0;
+    double m_tokens = 50.0;
+    qint64 m_lag = 0;
+
+    QElapsedTimer m_clock;
+    qint64 m_last_probe = 0;
+    QTimer *m_timer = nullptr;
+  };
+}
@@ -14,6 +14,11 @@ namespace irc {
     CHANNEL_RENAME    = 1 << 9,  // https://ircv3.net/specs/extensions/channel-rename
     METADATA          = 1 << 10,
     FILEHOST          = 1 << 11,
-    EXTENDED_ISUPPORT = 1 << 12
+    EXTENDED_ISUPPORT = 1 << 12,
+    AWAY_NOTIFY       = 1 << 13,  // https://ircv3.net/specs/extensions/away-notify
+    NO_IMPLICIT_NAMES = 1 << 14,  // https://ircv3.net/specs/extensions/no-implicit-names
+    SERVER_TIME       = 1 << 15,  // https://ircv3.net/specs/extensions/server-time
+    BATCH             = 1 << 16,  // https://ircv3.net/specs/extensions/batch
+    CHATHISTORY       = 1 << 17   // https://ircv3.net/specs/extensions/chathistory
   };
 }
@@ -1,6 +1,10 @@
 #include <QHostAddress>
 #include <QDateTime>
 #include <QMutexLocker>
+#include <QSet>
+
+#include <algorithm>
+#include <optional>
 
 #include "caps.h"
 #include "irc/threaded_server.h"
@@ -11,6 +15,7 @@
 #include "core/account.h"
 #include "lib/globals.h"
 #include "irc/utils.h"
+#include "irc/fanout.h"
 
 namespace irc {
   constexpr static qint64 CHUNK_SIZE = 1024;
@@ -19,6 +24,7 @@ namespace irc {
   void client_connection::init() {
     const QUuid uuid = QUuid::createUuid();
     m_uid = uuid.toRfc4122();
+    m_handle = g::connectionSlab.insert(this);
 
     setup_tasks.set(
         ConnectionSetupTasks::CAP_EXCHANGE,
@@ -59,11 +65,16 @@ namespace irc {
     m_remote = QHostAddress(peer_ip);
     connect(m_socket, &QTcpSocket::readyRead, this, &client_connection::onReadyRead);
     connect(m_socket, &QTcpSocket::disconnected, this, &client_connection::onSocketDisconnected);
+    connect(m_socket, &QTcpSocket::bytesWritten, this, &client_connection::pump_replay);
   }
 
   void client_connection::handleWSConnection(const uint32_t peer_ip) {
     m_remote = QHostAddress(peer_ip);
     connect(m_websocket, &QWebSocket::disconnected, this, &client_connection::onSocketDisconnected);
+    connect(m_websocket, &QWebSocket::bytesWritten, this, [this](const qint64 bytes) {
+      m_ws_replay_queued = std::max<qint64>(0, m_ws_replay_queued - bytes);
+      pump_replay();
+    });
   }
 
   void client_connection::handleCAP(const QList<QByteArray> &args) {
@@ -142,18 +153,30 @@ namespace irc {
             capabilities.set(PROTOCOL_CAPABILITY::EXTENDED_JOIN);
           } else if (cap == "chghost") {
             capabilities.set(PROTOCOL_CAPABILITY::CHGHOST);
+          } else if (cap == "account-notify") {
+            capabilities.set(PROTOCOL_CAPABILITY::ACCOUNT_NOTIFY);
+          } else if (cap == "away-notify") {
+            capabilities.set(PROTOCOL_CAPABILITY::AWAY_NOTIFY);
           } else if (cap == "echo-message") {
             capabilities.set(PROTOCOL_CAPABILITY::ECHO_MESSAGE);
           } else if (cap == "znc.in/self-message") {
             capabilities.set(PROTOCOL_CAPABILITY::ZNC_SELF_MESSAGE);
           } else if (cap == "message-tags") {
             capabilities.set(PROTOCOL_CAPABILITY::MESSAGE_TAGS);
+          } else if (cap == "server-time") {
+            capabilities.set(PROTOCOL_CAPABILITY::SERVER_TIME);
+          } else if (cap == "batch") {
+            capabilities.set(PROTOCOL_CAPABILITY::BATCH);
+          } else if (cap == "draft/chathistory") {
+            capabilities.set(PROTOCOL_CAPABILITY::CHATHISTORY);
           } else if (cap == "draft/metadata" || cap == "draft/metadata-2") {
             capabilities.set(PROTOCOL_CAPABILITY::METADATA);
           } else if (cap == "soju.im/FILEHOST") {
             capabilities.set(PROTOCOL_CAPABILITY::FILEHOST);
           } else if (cap == "extended-isupport") {
             capabilities.set(PROTOCOL_CAPABILITY::EXTENDED_ISUPPORT);
+          } else if (cap == "draft/no-implicit-names") {
+            capabilities.set(PROTOCOL_CAPABILITY::NO_IMPLICIT_NAMES);
           }
         }
       } else {
@@ -213,6 +236,15 @@ namespace irc {
       }
       event->setChannel(chan.staticCast<QObject>());
       chan->metadata()->handle(event);
+
+      // SET and CLEAR change channel state
+      const QByteArray cmd = subcmd.toUpper();
+      if (event->error_code.isEmpty() && !sub_args.isEmpty() && (cmd == "SET" || cmd == "CLEAR")) {
+        QByteArray line = ":" + m_account->prefix() + " METADATA " + target + " " + sub_args.at(0) + " *";
+        if (cmd == "SET" && sub_args.size() > 1)
+          line += " :" + sub_args.at(1);
+        chan->record(sql::EventType::Metadata, m_account, line);
+      }
     } else if (target == "*" || target == m_account->nick()) {
       event->setDest(m_account.staticCast<QObject>());
       m_account->metadata()->handle(event);
@@ -392,6 +424,8 @@ namespace irc {
       if (!result.isEmpty()) {
         const QByteArray modePrefix = adding ? "+" : "-";
         send_raw("MODE " + target + " :" + modePrefix + result.toUtf8());
+        channel->record(sql::EventType::Mode, m_account,
+                        ":" + m_account->prefix() + " MODE " + target + " " + modePrefix + result.toUtf8());
       }
       return;
     }
@@ -686,7 +720,6 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
   void client_connection::channel_join(const QSharedPointer<QEventChannelJoin> &event) {
     if (event.isNull()) return;
 
-    const auto &account = event->account;
     const auto &channel = event->channel;
 
     if (channel.isNull()) {
@@ -694,66 +727,77 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
       return;
     }
 
-    const auto channel_name = channel->name();
-
-    // notification of a participant joining
-    if (event->account != m_account) {
-      const auto acc_prefix = account->prefix();
-
-      const QByteArray msg = ":" + acc_prefix + " JOIN :#" + channel->name() + "\r\n";
-      emit sendData(msg);
-
-      QWriteLocker locker(&mtx_lock);
-      if (!channel_members.contains(channel))
-        channel_members[channel] = {};
-      channel_members[channel] << account;
-      locker.unlock();
-
+    // other participants are notified through irc::JoinPipeline
+    if (event->account != m_account)
       return;
-    }
+
+    const auto channel_name = channel->name();
 
     // we are joining
     auto account_nick = nick();
 
     // this connection is already in the channel
     // @TODO: move `channels` mutations to setters/getters+lock
+    const auto channel_handle = channel->handle();
     QWriteLocker locker(&mtx_lock);
-    if (channels.contains(channel_name))
+    if (channels.contains(channel_handle))
       return;
-    if (!channel_members.contains(channel))
-      channel_members[channel] = {};
-    for (const auto& member : channel->members()) {
-      channel_members[channel] << member;
-    }
+    auto &members = channel_members[channel_handle];
+    for (const auto& member : channel->member_handles())
+      members << member;
 
-    channels[channel_name] = channel;
+    channels << channel_handle;
     locker.unlock();
 
-    reply_self("JOIN", ":#" + channel_name);
+    // JOIN, topic and names go out as a single write
+    const QByteArray server_prefix = ":" + ThreadedServer::serverName() + " ";
+    QByteArray out = ":" + prefix() + " JOIN :#" + channel_name + "\r\n";
 
     // topic
-    if (channel->topic().isEmpty()) {
-      reply_num(331, "#" + channel_name + " :No topic is set");
+    const auto topic = channel->topic();
+    if (topic.isEmpty()) {
+      out += server_prefix + "331 " + account_nick + " #" + channel_name + " :No topic is set\r\n";
     } else {
       // :irc.local 333 bla #test bbb!dsc@127.0.0.1 :1758051783.
       // @TODO: implement RPL_TOPICWHOTIME^
-      send_raw("332 " + account_nick + " #" + channel_name + " :" + channel->topic());
+      out += server_prefix + "332 " + account_nick + " #" + channel_name + " :" + topic + "\r\n";
     }
 
-    // names
-    // @TODO: use channel_members
-    QByteArrayList names;
-    for (auto &acc: channel->members()) {
-      auto nick_acc = acc->nick();
-      if (nick_acc.isEmpty())
-        names << acc->name();
-      else
-        names << acc->nick();
+    // names, unless the client opted out via draft/no-implicit-names
+    if (!capabilities.has(PROTOCOL_CAPABILITY::NO_IMPLICIT_NAMES))
+      out += render_names(channel, server_prefix);
+
+    emit sendData(out);
+  }
+
+  void client_connection::members_joined(const ChannelHandle channel, const JoinBatch &joins) {
+    const auto self = m_account.isNull() ? AccountHandle() : m_account->handle();
+
+    QByteArray out;
+    QWriteLocker locker(&mtx_lock);
+    if (!channels.contains(channel))
+      return;
+
+    auto &members = channel_members[channel];
+    for (const auto& [account, line]: joins) {
+      if (account == self || members.contains(account))
+        continue;
+      members << account;
+      out += line;
     }
+    locker.unlock();
+
+    if (!out.isEmpty())
+      emit sendData(out);
+  }
 
-    const QByteArray namesPrefix = "353 " + account_nick + " = " + "#" + channel->name() + " :";
-    send_raw(namesPrefix + names.join(" "));
-    send_raw("366 " + account_nick + " " + "#" + channel->name() + " :End of NAMES list");
+  void client_connection::metadata_changed(const MetadataBatch &batch) {
+    if (m_account.isNull() || !capabilities.has(PROTOCOL_CAPABILITY::METADATA))
+      return;
+
+    const QByteArray out = batch.value(m_account->handle());
+    if (!out.isEmpty())
+      emit sendData(out);
   }
 
   void client_connection::channel_part(const QSharedPointer<QEventChannelPart> &event) {
@@ -762,17 +806,18 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
     if (event->account->uid() == m_account->uid()) {
       // PART self
       QWriteLocker locker(&mtx_lock);
-      channel_members.remove(event->channel);
-      channels.remove(channel_name);
+      channel_members.remove(event->channel->handle());
+      channels.remove(event->channel->handle());
       locker.unlock();
       reply_self("PART", ":#" + channel_name);
     } else {
       // notify channel participants
-      QReadLocker rlock(&mtx_lock);
-      if (!channel_members.contains(event->channel))
-        return;
+      const auto channel_handle = event->channel->handle();
+      const auto account_handle = event->account->handle();
 
-      if (!channel_members[event->channel].contains(event->account))
+      QReadLocker rlock(&mtx_lock);
+      const auto it = channel_members.constFind(channel_handle);
+      if (it == channel_members.constEnd() || !it->contains(account_handle))
         return;
       rlock.unlock();
 
@@ -782,8 +827,8 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
       emit sendData(msg);
 
       QWriteLocker locker(&mtx_lock);
-      if (channel_members.contains(event->channel))
-        channel_members.remove(event->channel);
+      if (const auto it = channel_members.find(channel_handle); it != channel_members.end())
+        it->remove(account_handle);
     }
   }
 
@@ -797,6 +842,10 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
     for (auto& name : chans) {
       const auto channel_name = name.mid(1);
       if (!channel_name.isEmpty()) {
+        if (!g::ctx->irc_limits->join.allow(m_remote)) {
+          send_raw("263 " + nick() + " JOIN :Server load is temporarily too heavy. Please wait a while and try again.");
+          return;
+        }
 
         const auto event = QSharedPointer<QEventChannelJoin>(new QEventChannelJoin);
         event->from_system = false;
@@ -858,6 +907,11 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
     }
 
     const auto _nick = nick();
+    if (!g::ctx->irc_limits->privmsg.allow(m_remote)) {
+      send_raw("263 " + _nick + " PRIVMSG :Server load is temporarily too heavy. Please wait a while and try again.");
+      return;
+    }
+
     const QByteArray target = args[0];
     const QByteArray text = args[1];
 
@@ -936,23 +990,21 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
 
   void client_connection::handleQUIT(const QList<QByteArray> &args) {
     const QByteArray reason = args.isEmpty() ? QByteArray("Client Quit") : args[0];
-    // QByteArray line = ":" + prefix() + " QUIT :" + reason + "\r\n";
-
-    // // broadcast quits
-    // for (Channel *ch: std::as_const(channels)) {
-    //   for (auto const &acc: ch->members()) {
-    //     for (const auto &c: acc->connections()) {
-    //       if (c != this) {
-    //         c->write(line);
-    //       }
-    //     }
-    //   }
-    //   ch->remove(m_account);
-    //   m_server->removeChannelIfEmpty(ch);
-    // }
+    // broadcast happens in onSocketDisconnected, once the last connection is gone
+    m_quit_reason = reason;
     return forceDisconnect();
   }
 
+  void client_connection::handleAWAY(const QList<QByteArray> &args) {
+    const QByteArray message = args.isEmpty() ? QByteArray() : args[0].left(390);
+    m_account->setAway(message);
+
+    if (message.isEmpty())
+      reply_num(305, "You are no longer marked as being away");
+    else
+      reply_num(306, "You have been marked as being away");
+  }
+
   void client_connection::handleRENAME(const QList<QByteArray> &args) {
     if (args.isEmpty() || args.size() <= 1)
       return;
@@ -1006,106 +1058,473 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
     Channel::rename(rename);
   }
 
-  // @TODO: error replies
+  // msgid=<id> or timestamp=<ISO 8601>; a timestamp becomes the lowest or
+  // highest key of its millisecond so that both ends stay exclusive
+  static std::optional<HistoryKey> parseMsgRef(const QByteArray &ref, const bool lower) {
+    if (ref.startsWith("msgid="))
+      return history::key_from_msgid(ref.mid(6));
+
+    if (ref.startsWith("timestamp=")) {
+      const auto ts = QDateTime::fromString(QString::fromUtf8(ref.mid(10)), Qt::ISODateWithMs);
+      if (!ts.isValid())
+        return std::nullopt;
+      const qint64 ms = ts.toMSecsSinceEpoch();
+      return lower ? history::key_max(ms) : history::key_min(ms);
+    }
+
+    return std::nullopt;
+  }
+
+  // https://ircv3.net/specs/extensions/chathistory
   void client_connection::handleCHATHISTORY(const QList<QByteArray> &args) {
-    if (args.isEmpty() || args.size() <= 3)
+    const QByteArray subcmd = args.isEmpty() ? QByteArray("*") : args.at(0).toUpper();
+    const auto fail = [this, &subcmd](const QByteArray &code, const QByteArray &context, const QByteArray &text) {
+      send_raw("FAIL CHATHISTORY " + code + " " + subcmd + (context.isEmpty() ? "" : " " + context) + " :" + text);
+    };
+
+    const int required = subcmd == "BETWEEN" ? 5 : 4;
+    if (args.size() < (subcmd == "TARGETS" ? 4 : required))
+      return fail("NEED_MORE_PARAMS", {}, "Not enough parameters");
+
+    bool ok = false;
+    int limit = args.last().toInt(&ok);
+    if (!ok || limit <= 0)
+      return fail("INVALID_PARAMS", args.last(), "Invalid limit");
+    limit = std::min(limit, ThreadedServer::CHATHISTORY_MAX);
+
+    const auto key_lo = history::key_min(0);
+    const auto key_hi = history::key_max(history::TIME_MAX);
+
+    // history may come from the database; it is read and rendered on the
+    // global pool, and only the bytes come back to this worker
+    QObject *worker = parent() != nullptr ? parent() : this;
+    const auto deliver = [worker, handle = handle()](const QByteArray &out) {
+      QMetaObject::invokeMethod(worker, [handle, out] {
+        if (client_connection *conn = g::connectionSlab.get(handle))
+          emit conn->sendData(out);
+      }, Qt::QueuedConnection);
+    };
+
+    if (subcmd == "TARGETS") {
+      const auto from = parseMsgRef(args.at(1), true);
+      const auto to = parseMsgRef(args.at(2), true);
+      if (!from || !to || !args.at(1).startsWith("timestamp=") || !args.at(2).startsWith("timestamp="))
+        return fail("INVALID_PARAMS", args.at(1), "Invalid timestamp");
+
+      QList<QSharedPointer<Channel>> channels;
+      for (const auto& channel_handle: m_account->channel_handles()) {
+        if (Channel *channel = g::channelSlab.get(channel_handle))
+          channels << channel->sharedFromThis();
+      }
+
+      QThreadPool::globalInstance()->start([deliver, account = m_account, caps = capabilities, channels, limit,
+                                            lo = std::min(*from, *to), hi = std::max(*from, *to)] {
+        // latest activity per channel and per correspondent, as far as the
+        // rings know
+        QList<QPair<HistoryKey, QByteArray>> targets;
+        for (const auto& channel: channels) {
+          const auto newest = channel->history_newest();
+          if (newest && lo < newest->key && newest->key < hi)
+            targets << qMakePair(newest->key, "#" + channel->name() + " timestamp=" + newest->time);
+        }
+        for (const auto& newest: account->backlog().conversations(lo, hi)) {
+          if (const auto peer = Account::get_by_uid(newest.peer); !peer.isNull())
+            targets << qMakePair(newest.key, peer->nick() + " timestamp=" + newest.time);
+        }
+
+        std::sort(targets.begin(), targets.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        if (targets.size() > limit)
+          targets = targets.mid(targets.size() - limit);
+
+        const QByteArray server_prefix = ":" + ThreadedServer::serverName() + " ";
+        const bool cap_batch = caps.has(PROTOCOL_CAPABILITY::BATCH);
+        const QByteArray ref = generateBatchRef();
+
+        QByteArray out;
+        if (cap_batch)
+          out += server_prefix + "BATCH +" + ref + " draft/chathistory-targets\r\n";
+        for (const auto& [_, target]: targets)
+          out += (cap_batch ? "@batch=" + ref + " " : QByteArray()) + server_prefix + "CHATHISTORY TARGETS " + target + "\r\n";
+        if (cap_batch)
+          out += server_prefix + "BATCH -" + ref + "\r\n";
+
+        deliver(out);
+      });
       return;
+    }
 
-    auto channel_name = args.at(1).mid(1);
+    static const QSet<QByteArray> subcmds = {"LATEST", "BEFORE", "AFTER", "AROUND", "BETWEEN"};
+    if (!subcmds.contains(subcmd))
+      return fail("INVALID_PARAMS", {}, "Unknown subcommand");
 
-    auto chan_ptr = Channel::get(channel_name);
-    if (chan_ptr.isNull())
+    const QByteArray &target = args.at(1);
+
+    // a channel we are in, or the conversation with a nick or account
+    history::Fetch fetch;
+    if (target.startsWith('#')) {
+      const auto channel = Channel::get(target.mid(1));
+      if (channel.isNull() || !m_account->channel_handles().contains(channel->handle()))
+        return fail("INVALID_TARGET", target, "Messages could not be retrieved");
+
+      fetch = [channel](const HistoryKey &lo, const HistoryKey &hi, const bool backward, const int n, const bool inclusive_lo) {
+        return channel->history(lo, hi, backward, n, inclusive_lo);
+      };
+    } else {
+      auto peer = g::ctx->irc_nick_get(target);
+      if (peer.isNull())
+        peer = Account::get_by_name(target);
+      if (peer.isNull())
+        return fail("INVALID_TARGET", target, "Messages could not be retrieved");
+
+      fetch = [account = m_account, peer_id = peer->uid()](const HistoryKey &lo, const HistoryKey &hi, const bool backward, const int n, const bool inclusive_lo) {
+        return account->backlog().range(account->uid(), lo, hi, backward, n, inclusive_lo, peer_id);
+      };
+    }
+
+    // (lo, hi) and the end the limit counts from; AROUND splits it at `hi`
+    std::optional<HistoryKey> lo = key_lo;
+    std::optional<HistoryKey> hi = key_hi;
+    bool backward = true;
+    const bool around = subcmd == "AROUND";
+    if (subcmd == "LATEST") {
+      if (args.at(2) != "*")
+        lo = parseMsgRef(args.at(2), true);
+    } else if (subcmd == "BEFORE" || around) {
+      hi = parseMsgRef(args.at(2), false);
+    } else if (subcmd == "AFTER") {
+      lo = parseMsgRef(args.at(2), true);
+      backward = false;
+    } else {
+      // BETWEEN; the first reference decides the direction
+      const auto first = parseMsgRef(args.at(2), false);
+      const auto second = parseMsgRef(args.at(3), false);
+      if (!first || !second)
+        return fail("INVALID_PARAMS", args.at(2), "Invalid message reference");
+
+      const bool forward = *first < *second;
+      lo = parseMsgRef(forward ? args.at(2) : args.at(3), true);
+      hi = parseMsgRef(forward ? args.at(3) : args.at(2), false);
+      backward = !forward;
+    }
+    if (!lo || !hi)
+      return fail("INVALID_PARAMS", args.at(2), "Invalid message reference");
+
+    QThreadPool::globalInstance()->start([deliver, fetch, caps = capabilities, target, limit, around, backward,
+                                          lo = *lo, hi = *hi, key_hi] {
+      QList<HistoryEntry> entries;
+      if (around) {
+        entries = fetch(lo, hi, true, limit / 2, false);
+        entries.append(fetch(hi, key_hi, false, limit - static_cast<int>(entries.size()), true));
+      } else {
+        entries = fetch(lo, hi, backward, limit, false);
+      }
+
+      if (const QByteArray out = render_history(caps, target, entries); !out.isEmpty())
+        deliver(out);
+    });
+  }
+
+  QByteArray client_connection::render_history(const Flags<PROTOCOL_CAPABILITY> caps, const QByteArray &target, const QList<HistoryEntry> &entries) {
+    const QByteArray server_prefix = ":" + ThreadedServer::serverName() + " ";
+    const bool cap_batch = caps.has(PROTOCOL_CAPABILITY::BATCH);
+    const bool cap_tags = caps.has(PROTOCOL_CAPABILITY::MESSAGE_TAGS);
+    const bool cap_time = caps.has(PROTOCOL_CAPABILITY::SERVER_TIME);
+    const bool cap_account = cap_tags && caps.has(PROTOCOL_CAPABILITY::ACCOUNT_TAG);
+    const QByteArray ref = generateBatchRef();
+
+    QByteArray out;
+    if (cap_batch)
+      out += server_prefix + "BATCH +" + ref + " chathistory " + target + "\r\n";
+
+    for (const auto& entry: entries) {
+      QByteArrayList tags;
+      if (cap_batch)
+        tags << "batch=" + ref;
+      if (cap_time)
+        tags << "time=" + entry.time;
+      if (cap_tags)
+        tags << "msgid=" + entry.msgid;
+      if (cap_account && !entry.account.isEmpty())
+        tags << "account=" + entry.account;
+      if (cap_tags && !entry.tags.isEmpty())
+        tags << entry.tags;
+
+      if (!tags.isEmpty())
+        out += "@" + tags.join(";") + " ";
+      out += entry.line + "\r\n";
+    }
+
+    if (cap_batch)
+      out += server_prefix + "BATCH -" + ref + "\r\n";
+    return out;
+  }
+
+  void client_connection::replay_backlog() {
+    if (g::backlogReplay <= 0 || !logged_in)
       return;
 
-    send_raw("BATCH +123 chathistory #" + chan_ptr->name());
-    send_raw("BATCH -123");
+    // cursors from the database come back later, on our worker; the
+    // connection may be gone by then
+    QObject *worker = parent() != nullptr ? parent() : this;
+    m_account->backlog().take(m_account->uid(), worker, [handle = handle()](const Backlog::Cursors &cursors) {
+      if (client_connection *conn = g::connectionSlab.get(handle))
+        conn->replay_backlog(cursors);
+    });
+  }
+
+  void client_connection::replay_backlog(const Backlog::Cursors &cursors) {
+    if (cursors.isEmpty() || !logged_in)
+      return;
+
+    // newer messages reach us live
+    const auto key_hi = history::key_min(QDateTime::currentMSecsSinceEpoch());
+
+    struct From {
+      QSharedPointer<Channel> channel;
+      QByteArray target;
+      HistoryKey lo;
+    };
+    QList<From> channels;
+    for (const auto& channel_handle: m_account->channel_handles()) {
+      Channel *channel = g::channelSlab.get(channel_handle);
+      if (channel == nullptr)
+        continue;
+      const QByteArray target = "#" + channel->name();
+      if (const auto it = cursors.find(target); it != cursors.end())
+        channels << From{channel->sharedFromThis(), target, it.value()};
+    }
+
+    std::optional<HistoryKey> private_lo;
+    if (const auto it = cursors.find(Backlog::PRIVATE); it != cursors.end())
+      private_lo = it.value();
+
+    // an old cursor lies below the rings and means a database read; that
+    // happens on the pool, and only the rendered lines come back to us
+    QObject *worker = parent() != nullptr ? parent() : this;
+    QThreadPool::globalInstance()->start([worker, handle = handle(), account = m_account, caps = capabilities,
+                                          nick = nick(), channels, private_lo, key_hi] {
+      QByteArray out;
+      for (const auto& from: channels) {
+        if (const auto entries = from.channel->history(from.lo, key_hi, true, g::backlogReplay); !entries.isEmpty())
+          out += render_history(caps, from.target, entries);
+      }
+
+      if (private_lo) {
+        const auto entries = account->backlog().range(account->uid(), *private_lo, key_hi, true, g::backlogReplay);
+        if (!entries.isEmpty())
+          out += render_history(caps, nick, entries);
+      }
+
+      if (out.isEmpty())
+        return;
+      QMetaObject::invokeMethod(worker, [handle, out] {
+        if (client_connection *conn = g::connectionSlab.get(handle)) {
+          conn->m_replay += out;
+          conn->pump_replay();
+        }
+      }, Qt::QueuedConnection);
+    });
+  }
+
+  void client_connection::pump_replay() {
+    if (m_replay.isEmpty())
+      return;
+
+    // a websocket has no SendQ to ask; count what we handed it ourselves
+    qint64 queued = 0;
+    if (m_websocket) {
+      if (!m_websocket->isValid()) {
+        m_replay.clear();
+        return;
+      }
+      queued = m_ws_replay_queued;
+    } else {
+      if (!m_socket || !m_socket->isOpen()) {
+        m_replay.clear();
+        return;
+      }
+      queued = m_socket->bytesToWrite();
+    }
+
+    // under a line ending's worth, lastIndexOf() would get a negative
+    // `from` and search from the end
+    const qint64 room = REPLAY_SENDQ - queued;
+    if (room < 2)
+      return;
+
+    // cut after the last line that fits; bytesWritten brings us back
+    qsizetype cut = m_replay.size();
+    if (cut > room) {
+      cut = m_replay.lastIndexOf("\r\n", room - 2);
+      if (cut < 0)
+        cut = m_replay.indexOf("\r\n");
+      cut = cut < 0 ? m_replay.size() : cut + 2;
+    }
+
+    if (m_websocket)
+      m_ws_replay_queued += cut;
+    emit sendData(m_replay.left(cut));
+    m_replay.remove(0, cut);
+  }
+
+  // SYNC #chan <seq> [limit]: the channel's events after <seq> in one batch,
+  // followed by "SYNC #chan <last seq sent> <current seq>"
+  void client_connection::handleSYNC(const QList<QByteArray> &args) {
+    const auto fail = [this](const QByteArray &code, const QByteArray &context, const QByteArray &text) {
+      send_raw("FAIL SYNC " + code + " " + context + " :" + text);
+    };
+
+    if (args.size() < 2)
+      return fail("NEED_MORE_PARAMS", "*", "Not enough parameters");
+
+    const QByteArray &target = args.at(0);
+    const auto channel = target.startsWith('#') ? Channel::get(target.mid(1)) : QSharedPointer<Channel>();
+    if (channel.isNull() || !m_account->channel_handles().contains(channel->handle()))
+      return fail("INVALID_TARGET", target, "Events could not be retrieved");
+
+    bool ok = false;
+    const quint64 since = args.at(1).toULongLong(&ok);
+    if (!ok)
+      return fail("INVALID_PARAMS", args.at(1), "Invalid sequence number");
+
+    int limit = ThreadedServer::SYNC_MAX;
+    if (args.size() > 2) {
+      limit = args.at(2).toInt(&ok);
+      if (!ok || limit <= 0)
+        return fail("INVALID_PARAMS", args.at(2), "Invalid limit");
+      limit = std::min(limit, ThreadedServer::SYNC_MAX);
+    }
+
+    const auto events = channel->events_since(since, limit);
+    const quint64 head = channel->seq();
+
+    const QByteArray server_prefix = ":" + ThreadedServer::serverName() + " ";
+    const bool cap_batch = capabilities.has(PROTOCOL_CAPABILITY::BATCH);
+    const bool cap_tags = capabilities.has(PROTOCOL_CAPABILITY::MESSAGE_TAGS);
+    const bool cap_time = capabilities.has(PROTOCOL_CAPABILITY::SERVER_TIME);
+    const bool cap_account = cap_tags && capabilities.has(PROTOCOL_CAPABILITY::ACCOUNT_TAG);
+    const QByteArray ref = generateBatchRef();
+
+    QByteArray out;
+    if (cap_batch)
+      out += server_prefix + "BATCH +" + ref + " chatripper.io/sync " + target + "\r\n";
+
+    for (const auto& event: events) {
+      QByteArrayList tags;
+      if (cap_batch)
+        tags << "batch=" + ref;
+      if (cap_time)
+        tags << "time=" + event.time;
+      if (cap_tags) {
+        tags << "msgid=" + event.id;
+        tags << "chatripper.io/seq=" + QByteArray::number(event.seq);
+      }
+      if (cap_account && !event.account.isEmpty())
+        tags << "account=" + event.account;
+
+      if (!tags.isEmpty())
+        out += "@" + tags.join(";") + " ";
+      out += event.line + "\r\n";
+    }
+
+    if (cap_batch)
+      out += server_prefix + "BATCH -" + ref + "\r\n";
+
+    // gaps (events that never made it to the database) must not stall the client
+    const quint64 last = events.isEmpty() ? std::max(since, head) : events.last().seq;
+    out += server_prefix + "SYNC " + target + " " + QByteArray::number(last) + " " + QByteArray::number(head) + "\r\n";
+    emit sendData(out);
   }
 
   void client_connection::handleNAMES(const QList<QByteArray> &args) {
-    // if (args.isEmpty()) {
-    //   // list names for all joined channels
-    //   for (Channel *ch: std::as_const(channels)) {
-    //     QByteArray names;
-    //     for (auto const &acc: ch->members()) {
-    //       for (const auto &c: acc->connections()) {
-    //         if (!names.isEmpty()) {
-    //           names += " ";
-    //         }
-    //         names += c->nickname();
-    //       }
-    //     }
-    //
-    //     sendRaw("353 " + nick + " = " + ch->name() + " :" + names);
-    //     sendRaw("366 " + nick + " " + ch->name() + " :End of NAMES list");
-    //   }
-    // } else {
-    //   QList<QByteArray> chans = args[0].split(',');
-    //   for (auto &c: chans) {
-    //
-    //     const Channel *ch = nullptr;
-    //     for (const Channel *mine: std::as_const(channels)) {
-    //       if (ircLower(mine->name()) == ircLower(c)) {
-    //         ch = mine;
-    //         break;
-    //       }
-    //     }
-    //
-    //     if (!ch) {
-    //       sendRaw("403 " + nick + " " + c + " :No such channel");
-    //       continue;
-    //     }
-    //
-    //     QByteArray names;
-    //     for (auto const &acc: ch->members()) {
-    //       for (const auto &cc: acc->connections()) {
-    //         if (!names.isEmpty()) {
-    //           names += " ";
-    //         }
-    //         names += cc->nickname();
-    //       }
-    //     }
-    //
-    //     sendRaw("353 " + nick + " = " + ch->name() + " :" + names);
-    //     sendRaw("366 " + nick + " " + ch->name() + " :End of NAMES list");
-    //   }
-    // }
+    const auto account_nick = nick();
+    const QByteArray server_prefix = ":" + ThreadedServer::serverName() + " ";
+
+    QList<QByteArray> names;
+    if (args.isEmpty()) {
+      // list names for all joined channels
+      QReadLocker rlock(&mtx_lock);
+      for (const auto& channel_handle: channels) {
+        if (const Channel *channel = g::channelSlab.get(channel_handle))
+          names << channel->name();
+      }
+    } else {
+      for (const auto& name: args[0].split(','))
+        names << (name.startsWith('#') ? name.mid(1) : name);
+    }
+
+    QByteArray out;
+    for (const auto& channel_name: names) {
+      const auto channel = Channel::get(channel_name);
+      if (channel.isNull()) {
+        out += server_prefix + "403 " + account_nick + " #" + channel_name + " :No such channel\r\n";
+        continue;
+      }
+      out += render_names(channel, server_prefix);
+    }
+
+    if (!out.isEmpty())
+      emit sendData(out);
+  }
+
+  QByteArray client_connection::render_names(const QSharedPointer<Channel> &channel, const QByteArray &server_prefix) {
+    const auto account_nick = nick();
+    const auto channel_name = channel->name();
+
+    QByteArray out;
+    const QByteArray namesPrefix = server_prefix + "353 " + account_nick + " = #" + channel_name + " :";
+    for (const auto& line: chunkItems(namesPrefix, channel->roster(), IRC_MAX_LEN))
+      out += namesPrefix + line + "\r\n";
+    out += server_prefix + "366 " + account_nick + " #" + channel_name + " :End of NAMES list\r\n";
+    return out;
   }
 
   void client_connection::handleTOPIC(const QList<QByteArray> &args) {
-    // if (args.isEmpty()) {
-    //   replyNumeric(461, nick, "TOPIC :Not enough parameters");
-    //   return;
-    // }
-    //
-    // const QByteArray& chan = args[0];
-    // Channel *ch = nullptr;
-    // for (Channel *mine: std::as_const(channels)) {
-    //   if (ircLower(mine->name()) == ircLower(chan)) {
-    //     ch = mine;
-    //     break;
-    //   }
-    // }
-    //
-    // if (!ch) {
-    //   sendRaw("442 " + nick + " " + chan + " :You're not on that channel");
-    //   return;
-    // }
-    //
-    // if (args.size() == 1) {
-    //   if (ch->topic().isEmpty())
-    //     sendRaw("331 " + nick + " " + ch->name() + " :No topic is set");
-    //   else
-    //     sendRaw("332 " + nick + " " + ch->name() + " :" + ch->topic());
-    // } else {
-    //   ch->setTopic(args[1]);
-    //   const QByteArray line = ":" + prefix() + " TOPIC " + ch->name() + " :" + ch->topic() + "\r\n";
-    //
-    //   for (auto const &acc: ch->members()) {
-    //     for (const auto &c: acc->connections()) {
-    //       c->write(line);
-    //     }
-    //   }
-    // }
+    if (args.isEmpty()) {
+      send_raw("461 " + nick() + " TOPIC :Not enough parameters");
+      return;
+    }
+
+    const QByteArray &target = args.at(0);
+    QSharedPointer<Channel> channel;
+    if (target.startsWith('#'))
+      channel = Channel::get(target.mid(1));
+    if (channel.isNull()) {
+      send_raw("403 " + nick() + " " + target + " :No such channel");
+      return;
+    }
+
+    if (!m_account->channel_handles().contains(channel->handle())) {
+      send_raw("442 " + nick() + " " + target + " :You're not on that channel");
+      return;
+    }
+
+    if (args.size() == 1) {
+      if (const auto topic = channel->topic(); topic.isEmpty())
+        send_raw("331 " + nick() + " " + target + " :No topic is set");
+      else
+        send_raw("332 " + nick() + " " + target + " :" + topic);
+      return;
+    }
+
+    // +t: only the owner or an operator sets the topic (operator as WHO
+    // reports it, until there are real permissions)
+    const auto owner = channel->accountOwner();
+    const bool is_op = (!owner.isNull() && owner->handle() == m_account->handle()) || m_account->name() == "admin";
+    if (channel->channel_modes.has(ChannelModes::TOPIC_PROTECTED) && !is_op) {
+      send_raw("482 " + nick() + " " + target + " :You're not channel operator");
+      return;
+    }
+
+    const QByteArray &topic = args.at(1);
+    channel->setTopic(topic);
+
+    const QByteArray line = ":" + m_account->prefix() + " TOPIC " + target + " :" + topic;
+    channel->record(sql::EventType::Topic, m_account, line);
+
+    Fanout::members(channel.data(), [data = QByteArray(line + "\r\n")](client_connection *conn) {
+      emit conn->sendData(data);
+    });
   }
 
   void client_connection::handleLUSERS(const QList<QByteArray> &args) {
@@ -1134,14 +1553,22 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
     send_raw(msg_252.join(" "));
   }
 
-  void client_connection::change_host(const QByteArray &new_host) {
-    if (!setup_tasks.empty())
+  void client_connection::send_if_capable(const PROTOCOL_CAPABILITY cap, const QByteArray &line) {
+    if (!setup_tasks.empty() || !capabilities.has(cap))
       return;
+    emit sendData(line);
+  }
 
-    // @TODO: needs a broadcast to all users in a channel that this m_nick is in
-    // https://ircv3.net/specs/extensions/chghost
-    // write(":" + prefix() + " CHGHOST " + m_nick + " " + new_host + "\r\n");
-    // m_nick = new_host;
+  void client_connection::account_quit(const AccountHandle account, const QByteArray &line) {
+    // only clients that know the account from a shared channel get the QUIT
+    bool shared = false;
+    QWriteLocker locker(&mtx_lock);
+    for (auto it = channel_members.begin(); it != channel_members.end(); ++it)
+      shared |= it->remove(account);
+    locker.unlock();
+
+    if (shared)
+      emit sendData(line);
   }
 
   bool client_connection::channel_rename(const QSharedPointer<QEventChannelRename> &event) {
@@ -1199,10 +1626,6 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
     emit sendData(out);
   }
 
-  void client_connection::change_host(const QSharedPointer<Account> &acc, const QByteArray &new_host) {
-
-  }
-
   void client_connection::reply_num(const int code, const QByteArray &text) {
     auto const _nick = nick();
     const QByteArray target = _nick.isEmpty() ? "*" : _nick;
@@ -1259,14 +1682,78 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
   }
 
   void client_connection::onSocketDisconnected() {
+    // queued for admission, or released and not yet told; either way the
+    // slot is not going to be used
+    if (m_admission_pending) {
+      m_admission_pending = false;
+      m_server->admission->withdraw(this);
+    }
+
     auto const _nick = nick();
-    if (!m_account.isNull())
+    if (!m_account.isNull()) {
+      const QByteArray quit_line = ":" + m_account->prefix() + " QUIT :" +
+        (m_quit_reason.isEmpty() ? QByteArray("Connection closed") : m_quit_reason) + "\r\n";
+
       m_account->onConnectionDisconnected(this, _nick);
+
+      if (is_ready && !m_account->hasConnections()) {
+        const auto account_handle = m_account->handle();
+        Fanout::neighbours(m_account.data(), [account_handle, quit_line](client_connection *conn) {
+          conn->account_quit(account_handle, quit_line);
+        }, false);
+      }
+    }
     emit disconnected(_nick);
   }
 
+  bool client_connection::request_admission() {
+    if (m_admitted)
+      return true;
+    if (m_admission_pending)
+      return false;
+
+    const int position = m_server->admission->admit(this);
+    if (position == 0) {
+      m_admitted = true;
+      return true;
+    }
+
+    m_admission_pending = true;
+    const QByteArray msg = ":" + ThreadedServer::serverName() + " NOTICE * :*** Server is busy, your connection is queued (position " +
+      QByteArray::number(position) + "), please wait\r\n";
+    emit sendData(msg);
+    return false;
+  }
+
+  void client_connection::admitted() {
+    // withdrawn on disconnect; the token went back already
+    if (!m_admission_pending)
+      return;
+
+    m_admitted = true;
+    m_admission_pending = false;
+
+    if (!m_deferred_auth.isEmpty()) {
+      const auto args = m_deferred_auth;
+      m_deferred_auth.clear();
+      handleAUTHENTICATE(args);
+    }
+
+    try_finalize_setup();
+  }
+
   void client_connection::try_finalize_setup() {
-    if (is_ready || !setup_tasks.empty())
+    if (is_ready || !setup_tasks.empty() || m_sasl_pending)
+      return;
+
+    // charged once, before the admission queue
+    if (!m_admitted && !m_admission_pending && !g::ctx->irc_limits->registration.allow(m_remote)) {
+      send_raw("ERROR :Too many registrations from your address, try again later");
+      return forceDisconnect();
+    }
+
+    // reconnect storms; welcome burst and auto-join wait for our turn
+    if (!request_admission())
       return;
 
     const auto server_password = m_server->password();
@@ -1352,14 +1839,23 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
     if (logged_in)
       handleMODE({_nick, "+r"});
 
-    for (const auto& channel : m_account->channels) {
+    if (g::lazyLoad && logged_in)
+      g::ctx->lazy->ensure_channels(m_account);
+
+    for (const auto& channel_handle : m_account->channel_handles()) {
+      Channel *channel = g::channelSlab.get(channel_handle);
+      if (channel == nullptr)
+        continue;
+
       auto event = QSharedPointer<QEventChannelJoin>(new QEventChannelJoin);
       event->from_system = true;
-      event->channel = channel;
+      event->channel = channel->sharedFromThis();
       event->account = m_account;
       channel->join(event);
     }
 
+    replay_backlog();
+
     is_ready = true;
   }
 
@@ -1369,12 +1865,45 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
       return forceDisconnect();
     }
 
+    // one check at a time; later lines are handled once it is done
+    if (m_sasl_pending) {
+      if (m_sasl_queue.size() >= MAX_SASL_QUEUE) {
+        reply_num(904, "SASL authentication failed: too many messages");
+        return;
+      }
+      m_sasl_queue << args;
+      return;
+    }
+
     const auto& arg = args.at(0);
-    if (arg == "PLAIN") {
+    if (arg == "PLAIN" || arg == "TOKEN") {
+      m_sasl_mechanism = arg;
       send_raw("AUTHENTICATE +");
       return;
     }
 
+    // password verification is expensive; hold it until admitted
+    if (!request_admission()) {
+      m_deferred_auth = args;
+      return;
+    }
+
+    // a token from an earlier login; an HMAC check instead of bcrypt
+    if (m_sasl_mechanism == "TOKEN") {
+      const auto claims = g::ctx->session_tokens->verify(QByteArray::fromBase64(arg));
+      const auto account = claims ? Account::get_by_uid(claims->account) : QSharedPointer<Account>();
+      if (account.isNull()) {
+        reply_num(900, "SASL authentication failed: invalid token");
+        return forceDisconnect();
+      }
+
+      const auto auth = QSharedPointer<QEventAuthUser>(new QEventAuthUser);
+      auth->username = account->name();
+      auth->ip = get_ip();
+      m_sasl_device = claims->device;
+      return sasl_verified(account, auth);
+    }
+
     const QByteArray plain = QByteArray::fromBase64(arg);
     const auto plain_spl = plain.split('\0');
 
@@ -1387,26 +1916,40 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
     const QByteArray& password = plain_spl.at(2);
 
     const auto account = Account::get_by_name(username);
-    if (!account.isNull()) {
-      auto auth = QSharedPointer<QEventAuthUser>(new QEventAuthUser);
-      auth->username = username;
-      auth->password = password;
-      auth->ip = get_ip();
+    if (account.isNull()) {
+      reply_num(900, "SASL authentication failed");
+      return forceDisconnect();
+    }
 
-      auth = account->verifyPassword(auth);
-      if (!auth->cancelled()) {
-        if (!m_account.isNull())
-          account->merge(m_account);  // @TODO: fix this when we support SASL login *after* connection bootstrap
-        else {
-          m_account = account;
-        }
+    auto auth = QSharedPointer<QEventAuthUser>(new QEventAuthUser);
+    auth->username = username;
+    auth->password = password;
+    auth->ip = get_ip();
+
+    // the outcome comes back through our worker's event loop; we may be gone by then
+    QObject *worker = parent() != nullptr ? parent() : this;
+    const ConnectionHandle handle = m_handle;
+    m_sasl_pending = true;
+    const bool accepted = account->verifyPassword(auth, [worker, handle, account](const QSharedPointer<QEventAuthUser> &result) {
+      QMetaObject::invokeMethod(worker, [handle, account, result] {
+        if (client_connection *conn = g::connectionSlab.get(handle))
+          conn->sasl_verified(account, result);
+      }, Qt::QueuedConnection);
+    });
+
+    if (!accepted) {
+      m_sasl_pending = false;
+      reply_num(900, "SASL authentication failed: server busy, try again later");
+      return forceDisconnect();
+    }
+  }
 
-        reply_num(900, "You are now logged in as " + username);
-        reply_num(903, "SASL authentication successful");
-        logged_in = true;
-        return;
-      }
+  void client_connection::sasl_verified(const QSharedPointer<Account> &account, const QSharedPointer<QEventAuthUser> &auth) {
+    m_sasl_pending = false;
+    const QByteArray &username = auth->username;
 
+    if (auth->cancelled()) {
+      m_sasl_queue.clear();
       QByteArray reply = "SASL authentication failed";
       if (!auth->reason.isEmpty())
         reply += ": " + auth->reason;
@@ -1415,8 +1958,35 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
       return forceDisconnect();
     }
 
-    reply_num(900, "SASL authentication failed");
-    return forceDisconnect();
+    // already registered; let people sharing a channel with us know
+    if (is_ready && !m_account.isNull()) {
+      const QByteArray line = ":" + m_account->prefix() + " ACCOUNT " + username + "\r\n";
+      Fanout::neighbours(m_account.data(), [line](client_connection *conn) {
+        conn->send_if_capable(PROTOCOL_CAPABILITY::ACCOUNT_NOTIFY, line);
+      }, false);
+    }
+
+    if (!m_account.isNull())
+      account->merge(m_account);  // @TODO: fix this when we support SASL login *after* connection bootstrap
+    else {
+      m_account = account;
+    }
+
+    reply_num(900, "You are now logged in as " + username);
+    reply_num(903, "SASL authentication successful");
+    logged_in = true;
+
+    // reconnects can use SASL TOKEN with this instead of the password
+    if (m_sasl_device.isEmpty())
+      m_sasl_device = SessionTokens::new_device();
+    const QByteArray token = g::ctx->session_tokens->issue(account->uid(), m_sasl_device, SessionTokens::IRC_TTL_SECS);
+    send_raw("NOTE AUTHENTICATE SESSION_TOKEN " + m_sasl_device + " :" + token.toBase64());
+
+    // what arrived during the check, in order; a line may start another one
+    while (!m_sasl_queue.isEmpty() && !m_sasl_pending)
+      handleAUTHENTICATE(m_sasl_queue.takeFirst());
+
+    try_finalize_setup();
   }
 
   void client_connection::forceDisconnect() const {
@@ -1484,7 +2054,7 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
       QByteArray ident = "~u";
 
       // status: H (online), G (offline)
-      QByteArray status = acc->hasConnections() ? "H" : "G";
+      QByteArray status = acc->hasConnections() && !acc->isAway() ? "H" : "G";
       // operator or not
       // @TODO: replace with actual permissions
       if (acc->name() == "admin")
@@ -1676,10 +2246,14 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
       handleTAGMSG(tags, parts);
     else if (cmd == "QUIT")
       handleQUIT(parts);
+    else if (cmd == "AWAY" && is_ready)
+      handleAWAY(parts);
     else if (cmd == "NAMES" && is_ready)
       handleNAMES(parts);
     else if (cmd == "CHATHISTORY" && is_ready)
       handleCHATHISTORY(parts);
+    else if (cmd == "SYNC" && is_ready)
+      handleSYNC(parts);
     else if (cmd == "RENAME" && is_ready)
       handleRENAME(parts);
     else if (cmd == "METADATA" && is_ready)
@@ -1719,6 +2293,8 @@ void client_connection::metadata(const QSharedPointer<QEventMetadata> &event) {
   }
 
   client_connection::~client_connection() {
+    g::connectionSlab.release(m_handle);
+
     if (m_websocket != nullptr)
       m_websocket->close();
     else
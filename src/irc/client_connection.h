@@ -16,6 +16,11 @@
 #include "irc/caps.h"
 #include "irc/modes.h"
 #include "core/qtypes.h"
+#include "core/handles.h"
+#include "core/history.h"
+#include "core/backlog.h"
+#include "irc/join_pipeline.h"
+#include "irc/metadata_notifier.h"
 
 class Channel;
 class Account;
@@ -86,10 +91,14 @@ namespace irc {
       return true;
     }
 
-    QMap<QByteArray, QSharedPointer<Channel>> channels;
-    QMap<QSharedPointer<Channel>, QSet<QSharedPointer<Account>>> channel_members;
+    [[nodiscard]] ConnectionHandle handle() const { return m_handle; }
+
+    QSet<ChannelHandle> channels;
+    QHash<ChannelHandle, QSet<AccountHandle>> channel_members;
 
     void channel_join(const QSharedPointer<QEventChannelJoin> &event);
+    void members_joined(ChannelHandle channel, const JoinBatch &joins);
+    void metadata_changed(const MetadataBatch &batch);
     void channel_send_topic(const QByteArray &channel_name, const QByteArray &topic);
 
     // QByteArray nickname() const { return nick; }
@@ -107,11 +116,15 @@ namespace irc {
     void message(const QSharedPointer<QEventMessage> &message);
     void metadata(const QSharedPointer<QEventMetadata> &event);
 
-    void change_host(const QSharedPointer<Account> &acc, const QByteArray &new_host);
-    void change_host(const QByteArray &new_host);
+    // fan-out deliveries (see irc::Fanout)
+    void send_if_capable(PROTOCOL_CAPABILITY cap, const QByteArray &line);
+    void account_quit(AccountHandle account, const QByteArray &line);
 
     void applyUserMode(UserModes mode, bool adding);
 
+    // released by the admission controller
+    void admitted();
+
     static QByteArray irc_lower(const QByteArray &s);
     static QList<QByteArray> split_irc(const QByteArray &line);
 
@@ -144,10 +157,12 @@ namespace irc {
     void handlePART(const QList<QByteArray> &args);
     void handleRENAME(const QList<QByteArray> &args);
     void handleCHATHISTORY(const QList<QByteArray> &args);
+    void handleSYNC(const QList<QByteArray> &args);
     void handlePRIVMSG(QMap<QString, QVariant>& tags, const QList<QByteArray> &args);
     void handleTAGMSG(QMap<QString, QVariant>& tags, const QList<QByteArray> &args);
     void handleMETADATA(QMap<QString, QVariant>& tags, const QList<QByteArray> &args);
     void handleQUIT(const QList<QByteArray> &args);
+    void handleAWAY(const QList<QByteArray> &args);
     void handleNAMES(const QList<QByteArray> &args);
     void handleTOPIC(const QList<QByteArray> &args);
     void handleLUSERS(const QList<QByteArray> &args);
@@ -155,9 +170,25 @@ namespace irc {
     void handleCAP(const QList<QByteArray> &args);
     void handleMOTD(const QList<QByteArray> &args);
     void handleAUTHENTICATE(const QList<QByteArray> &args);
+    void sasl_verified(const QSharedPointer<Account> &account, const QSharedPointer<QEventAuthUser> &auth);
     void handleWHOIS(const QList<QByteArray> &args);
     void handleWHO(const QList<QByteArray> &args);
     void try_finalize_setup();
+    bool request_admission();
+    QByteArray render_names(const QSharedPointer<Channel> &channel, const QByteArray &server_prefix);
+    // static so it can run off the worker, on a copy of the capabilities
+    static QByteArray render_history(Flags<PROTOCOL_CAPABILITY> caps, const QByteArray &target, const QList<HistoryEntry> &entries);
+
+    // bouncer; what the account missed while it had no connection, read and
+    // rendered on the global pool, then written in slices that keep the
+    // socket's SendQ under REPLAY_SENDQ
+    void replay_backlog();
+    void replay_backlog(const Backlog::Cursors &cursors);
+    void pump_replay();
+    QByteArray m_replay;
+    // websocket only; replay bytes handed to the socket and not written yet
+    qint64 m_ws_replay_queued = 0;
+    static constexpr qint64 REPLAY_SENDQ = 64 * 1024;
 
     ThreadedServer *m_server;
     QSharedPointer<Account> m_account;
@@ -166,14 +197,28 @@ namespace irc {
 
     bool is_ready = false;
 
+    // admission control; SASL and registration wait until we are admitted
+    bool m_admitted = false;
+    bool m_admission_pending = false;
+    QList<QByteArray> m_deferred_auth;
+    QByteArray m_sasl_mechanism;
+    QByteArray m_sasl_device;  // the token's, so a token login renews it
+    // password check in flight; registration and further AUTHENTICATE
+    // lines wait for it
+    bool m_sasl_pending = false;
+    QList<QList<QByteArray>> m_sasl_queue;
+    static constexpr int MAX_SASL_QUEUE = 4;
+
     // only used during connection setup
     bool user_already_exists = false;
 
     QByteArray m_nick;
     QByteArray m_buffer;
     QByteArray m_passGiven;
+    QByteArray m_quit_reason;
     QByteArray m_host;
     QByteArray m_uid;
+    ConnectionHandle m_handle;
 
     time_t m_last_activity = 0;
     time_t m_time_connection_established = 0;
@@ -0,0 +1,87 @@
+#include "irc/fanout.h"
+
+#include "core/account.h"
+#include "core/channel.h"
+#include "irc/client_connection.h"
+#include "lib/globals.h"
+
+namespace irc {
+  QMutex Fanout::mtx_plan;
+  quint64 Fanout::epoch = 0;
+
+  void Fanout::neighbours(Account *account, const Deliver &deliver, const bool include_self) {
+    if (account == nullptr)
+      return;
+
+    // connections grouped by the worker they live on
+    QHash<QObject*, QList<ConnectionHandle>> batches;
+
+    QMutexLocker locker(&mtx_plan);
+    const quint64 stamp = ++epoch;
+
+    account->fanout_epoch = stamp;
+    if (include_self)
+      collect(batches, account);
+
+    for (const auto& channel_handle: account->channel_handles()) {
+      const Channel *channel = g::channelSlab.get(channel_handle);
+      if (channel == nullptr)
+        continue;
+
+      for (const auto& member: channel->member_handles()) {
+        Account *acc = g::accountSlab.get(member);
+        if (acc == nullptr || acc->fanout_epoch == stamp)
+          continue;
+
+        acc->fanout_epoch = stamp;
+        collect(batches, acc);
+      }
+    }
+    locker.unlock();
+
+    dispatch(batches, deliver);
+  }
+
+  void Fanout::members(const Channel *channel, const Deliver &deliver) {
+    if (channel == nullptr)
+      return;
+
+    QHash<QObject*, QList<ConnectionHandle>> batches;
+    for (const auto& member: channel->member_handles()) {
+      if (const Account *acc = g::accountSlab.get(member))
+        collect(batches, acc);
+    }
+
+    dispatch(batches, deliver);
+  }
+
+  void Fanout::accounts(const QList<AccountHandle> &accounts, const Deliver &deliver) {
+    QHash<QObject*, QList<ConnectionHandle>> batches;
+    for (const auto& handle: accounts) {
+      if (const Account *acc = g::accountSlab.get(handle))
+        collect(batches, acc);
+    }
+
+    dispatch(batches, deliver);
+  }
+
+  void Fanout::collect(QHash<QObject*, QList<ConnectionHandle>> &batches, const Account *account) {
+    account->for_each_connection([&batches](client_connection *conn) {
+      QObject *worker = conn->parent() != nullptr ? conn->parent() : conn;
+      batches[worker] << conn->handle();
+    });
+  }
+
+  void Fanout::dispatch(const QHash<QObject*, QList<ConnectionHandle>> &batches, const Deliver &deliver) {
+    for (auto it = batches.constBegin(); it != batches.constEnd(); ++it) {
+      // resolved again on the worker; connections may be gone by then
+      QMetaObject::invokeMethod(it.key(),
+        [targets = it.value(), deliver] {
+          for (const auto& h: targets) {
+            if (client_connection *conn = g::connectionSlab.get(h))
+              deliver(conn);
+          }
+        }, Qt::QueuedConnection);
+    }
+  }
+}
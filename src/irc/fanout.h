@@ -0,0 +1,36 @@
+#pragma once
+#include <functional>
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+
+#include "core/handles.h"
+
+class Account;
+class Channel;
+
+namespace irc {
+  class client_connection;
+
+  // "notify everyone who shares a channel with X" - used for NICK, QUIT,
+  // CHGHOST, AWAY and ACCOUNT. Neighbours are deduplicated by stamping each
+  // visited account with a per-event epoch (no temporary hash sets), and
+  // delivery is grouped into a single queued call per worker thread rather
+  // than one per connection.
+  class Fanout {
+  public:
+    using Deliver = std::function<void(client_connection *conn)>;
+
+    static void neighbours(Account *account, const Deliver &deliver, bool include_self = true);
+    static void members(const Channel *channel, const Deliver &deliver);
+    static void accounts(const QList<AccountHandle> &accounts, const Deliver &deliver);
+
+  private:
+    static void collect(QHash<QObject*, QList<ConnectionHandle>> &batches, const Account *account);
+    static void dispatch(const QHash<QObject*, QList<ConnectionHandle>> &batches, const Deliver &deliver);
+
+    static QMutex mtx_plan;
+    static quint64 epoch;
+  };
+}
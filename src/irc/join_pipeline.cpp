@@ -0,0 +1,81 @@
+#include "irc/join_pipeline.h"
+
+#include "core/account.h"
+#include "core/channel.h"
+#include "irc/client_connection.h"
+#include "irc/fanout.h"
+#include "lib/globals.h"
+
+namespace irc {
+  JoinPipeline::JoinPipeline(QObject *parent) : QObject(parent) {
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    m_timer->setInterval(TICK_MS);
+    connect(m_timer, &QTimer::timeout, this, &JoinPipeline::flush);
+  }
+
+  void JoinPipeline::enqueue(const ChannelHandle channel, const QSharedPointer<QEventChannelJoin> &event) {
+    QMutexLocker locker(&mtx_pending);
+    auto &joiners = m_pending[channel];
+    const auto account_handle = event->account->handle();
+    if (!joiners.contains(account_handle))
+      joiners << account_handle;
+
+    if (m_scheduled)
+      return;
+    m_scheduled = true;
+    locker.unlock();
+
+    // the timer lives on our thread
+    QMetaObject::invokeMethod(this, [this] {
+      m_timer->start();
+    }, Qt::QueuedConnection);
+  }
+
+  void JoinPipeline::cancel(const ChannelHandle channel, const AccountHandle account) {
+    QMutexLocker flushing(&mtx_flush);
+    QMutexLocker locker(&mtx_pending);
+    const auto it = m_pending.find(channel);
+    if (it == m_pending.end())
+      return;
+
+    it->removeAll(account);
+    if (it->isEmpty())
+      m_pending.erase(it);
+  }
+
+  void JoinPipeline::flush() {
+    QMutexLocker flushing(&mtx_flush);
+    QMutexLocker locker(&mtx_pending);
+    const auto pending = std::move(m_pending);
+    m_pending.clear();
+    m_scheduled = false;
+    locker.unlock();
+
+    for (auto it = pending.constBegin(); it != pending.constEnd(); ++it) {
+      const Channel *channel = g::channelSlab.get(it.key());
+      if (channel == nullptr)
+        continue;
+
+      const QByteArray suffix = " JOIN :#" + channel->name() + "\r\n";
+      const auto members = channel->member_handles();
+
+      JoinBatch joins;
+      joins.reserve(it.value().size());
+      for (const auto& joiner: it.value()) {
+        // joined and left again within the tick
+        if (!members.contains(joiner))
+          continue;
+        if (const Account *acc = g::accountSlab.get(joiner))
+          joins << qMakePair(joiner, ":" + acc->prefix() + suffix);
+      }
+
+      if (joins.isEmpty())
+        continue;
+
+      Fanout::members(channel, [channel_handle = it.key(), joins](client_connection *conn) {
+        conn->members_joined(channel_handle, joins);
+      });
+    }
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QMutex>
+#include <QTimer>
+
+#include "core/handles.h"
+#include "core/qtypes.h"
+
+namespace irc {
+  // (joiner, pre-rendered JOIN line)
+  using JoinBatch = QList<QPair<AccountHandle, QByteArray>>;
+
+  // coalesces JOIN notifications to existing channel members. Joins are
+  // queued per channel and flushed once per tick, so a member receives all
+  // JOINs for a channel in a single write, and each worker gets one queued
+  // call per channel instead of one per joiner per connection.
+  class JoinPipeline final : public QObject {
+    Q_OBJECT
+
+  public:
+    explicit JoinPipeline(QObject *parent = nullptr);
+
+    // thread-safe
+    void enqueue(ChannelHandle channel, const QSharedPointer<QEventChannelJoin> &event);
+    // drops a queued JOIN, and waits out a flush that may be sending it;
+    // a PART broadcast after this is ordered after any JOIN of `account`
+    void cancel(ChannelHandle channel, AccountHandle account);
+
+  private:
+    void flush();
+
+    static constexpr int TICK_MS = 25;
+
+    QMutex mtx_flush;  // held for a whole flush, see cancel()
+    QMutex mtx_pending;
+    QHash<ChannelHandle, QList<AccountHandle>> m_pending;
+    bool m_scheduled = false;
+    QTimer *m_timer = nullptr;
+  };
+}
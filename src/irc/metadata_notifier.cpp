@@ -0,0 +1,61 @@
+#include "irc/metadata_notifier.h"
+
+#include "irc/client_connection.h"
+#include "irc/fanout.h"
+#include "irc/threaded_server.h"
+
+namespace irc {
+  MetadataNotifier::MetadataNotifier(QObject *parent) : QObject(parent) {
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    m_timer->setInterval(TICK_MS);
+    connect(m_timer, &QTimer::timeout, this, &MetadataNotifier::flush);
+  }
+
+  void MetadataNotifier::enqueue(const QByteArray &target, const QByteArray &key, const QVariant &value, const QSet<AccountHandle> &subscribers) {
+    if (subscribers.isEmpty())
+      return;
+
+    QMutexLocker locker(&mtx_pending);
+    m_pending.insert({target, key}, {value, subscribers});
+
+    if (m_scheduled)
+      return;
+    m_scheduled = true;
+    locker.unlock();
+
+    // the timer lives on our thread
+    QMetaObject::invokeMethod(this, [this] {
+      m_timer->start();
+    }, Qt::QueuedConnection);
+  }
+
+  void MetadataNotifier::flush() {
+    QMutexLocker locker(&mtx_pending);
+    const auto pending = std::move(m_pending);
+    m_pending.clear();
+    m_scheduled = false;
+    locker.unlock();
+
+    const QByteArray prefix = ":" + ThreadedServer::serverName() + " METADATA ";
+
+    MetadataBatch batch;
+    for (auto it = pending.constBegin(); it != pending.constEnd(); ++it) {
+      const auto &[target, key] = it.key();
+      QByteArray line = prefix + target + " " + key + " *";
+      if (!it.value().value.isNull())
+        line += " :" + it.value().value.toByteArray();
+      line += "\r\n";
+
+      for (const auto &subscriber: it.value().subscribers)
+        batch[subscriber] += line;
+    }
+
+    if (batch.isEmpty())
+      return;
+
+    Fanout::accounts(batch.keys(), [batch](client_connection *conn) {
+      conn->metadata_changed(batch);
+    });
+  }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <QObject>
+#include <QHash>
+#include <QPair>
+#include <QSet>
+#include <QMutex>
+#include <QTimer>
+#include <QVariant>
+
+#include "core/handles.h"
+
+namespace irc {
+  // subscriber -> its pre-rendered METADATA lines
+  using MetadataBatch = QHash<AccountHandle, QByteArray>;
+
+  // delivers draft/metadata-2 subscriptions. Metadata keeps, per target, the
+  // accounts subscribed to each key; changes are queued here under (target,
+  // key) and flushed once per tick, so a key that changes again before then
+  // is sent once, with its latest value. A subscriber gets all its lines in
+  // a single write, and each worker one queued call per tick.
+  class MetadataNotifier final : public QObject {
+    Q_OBJECT
+
+  public:
+    explicit MetadataNotifier(QObject *parent = nullptr);
+
+    // thread-safe; a null value is a cleared key
+    void enqueue(const QByteArray &target, const QByteArray &key, const QVariant &value, const QSet<AccountHandle> &subscribers);
+
+  private:
+    void flush();
+
+    static constexpr int TICK_MS = 250;
+
+    struct Change {
+      QVariant value;
+      QSet<AccountHandle> subscribers;
+    };
+
+    QMutex mtx_pending;
+    QHash<QPair<QByteArray, QByteArray>, Change> m_pending;
+    bool m_scheduled = false;
+    QTimer *m_timer = nullptr;
+  };
+}
@@ -35,17 +35,22 @@ namespace irc {
     capabilities << "draft/metadata";
     capabilities << "draft/metadata-2";
     capabilities << "message-tags";
+    capabilities << "server-time";
+    capabilities << "batch";
+    capabilities << "draft/chathistory";
     capabilities << "multi-prefix";
     capabilities << "extended-join";
     capabilities << "chghost";
     capabilities << "account-tag";
     capabilities << "account-notify";
+    capabilities << "away-notify";
     capabilities << "echo-message";
     capabilities << "znc.in/self-message";
     // capabilities << "fish";
-    capabilities << "sasl";
+    capabilities << "sasl=PLAIN,TOKEN";
     capabilities << "draft/channel-rename";
     capabilities << "extended-isupport";
+    capabilities << "draft/no-implicit-names";
 
     // @TODO: replace with actual values
     isupport.insert("AWAYLEN", "390");
@@ -55,8 +60,8 @@ namespace irc {
     isupport.insert("CHANMODES", "Ibe,k,fl,CEMRUimnstu");
     isupport.insert("CHANNELLEN", "64");
     isupport.insert("CHANTYPES", "#");
-//    isupport.insert("CHATHISTORY", "1000");
-//    isupport.insert("draft/CHATHISTORY", "1000");
+    isupport.insert("CHATHISTORY", QByteArray::number(CHATHISTORY_MAX));
+    isupport.insert("draft/CHATHISTORY", QByteArray::number(CHATHISTORY_MAX));
     isupport.insert("ELIST", "U");
     isupport.insert("EXCEPTS", QByteArray());
     isupport.insert("EXTBAN", ",m");
@@ -87,6 +92,14 @@ namespace irc {
     isupport.insert("WHOX", QByteArray());
 
     setup_pool(thread_count);
+    admission = new AdmissionController(workers(), this);
+  }
+
+  QList<QObject*> ThreadedServer::workers() const {
+    QList<QObject*> rtn;
+    for (const auto& worker: m_workers)
+      rtn << worker;
+    return rtn;
   }
 
   void ThreadedServer::setup_pool(const int thread_count) {
@@ -133,6 +146,15 @@ namespace irc {
       remote_ip = QHostAddress(ntohl(addr.sin_addr.s_addr));
     }
 #endif
+    // reconnect loops and scans, before anything is set up for them
+    if (remote_ip != 0 && !g::ctx->irc_limits->connect.allow(QHostAddress(remote_ip))) {
+      ::close(static_cast<int>(socketDescriptor));
+#ifndef QT_NO_DEBUG_OUTPUT
+      qDebug() << "rejected connection (rate limit) from" << remote_ip;
+#endif
+      return;
+    }
+
     if (remote_ip != 0) {
       QMutexLocker locker(&activeConnectionsMutex);
 
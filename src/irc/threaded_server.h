@@ -11,6 +11,7 @@
 
 #include "lib/globals.h"
 #include "worker.h"
+#include "admission.h"
 
 namespace irc {
   class ThreadedServer final : public QTcpServer {
@@ -31,7 +32,15 @@ namespace irc {
 
     QByteArray network_name = "chatripper";
 
+    // max. messages per CHATHISTORY request
+    static constexpr int CHATHISTORY_MAX = 1000;
+    // max. channel events per SYNC request
+    static constexpr int SYNC_MAX = 1000;
+
     unsigned int concurrent_peers();
+    QList<QObject*> workers() const;
+
+    AdmissionController *admission = nullptr;
 
     QHash<uint32_t,int> activeConnections;
     QMutex activeConnectionsMutex;
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <atomic>
+
 #include "utils.h"
 
 namespace irc {
@@ -38,11 +41,27 @@ namespace irc {
   QByteArray buildMessageTags(const QSharedPointer<QEventMessage> &message,
                               const QSharedPointer<Account> &src,
                               const Flags<PROTOCOL_CAPABILITY> &capabilities) {
-    if (!capabilities.has(PROTOCOL_CAPABILITY::MESSAGE_TAGS))
+    const bool cap_tags = capabilities.has(PROTOCOL_CAPABILITY::MESSAGE_TAGS);
+    const bool cap_time = capabilities.has(PROTOCOL_CAPABILITY::SERVER_TIME);
+    if (!cap_tags && !cap_time)
       return {};
 
     QList<QByteArray> tags;
 
+    // server-time stands on its own, no message-tags needed
+    if (cap_time && !message->server_time_str.isEmpty())
+      tags.append("time=" + message->server_time_str);
+
+    if (!cap_tags)
+      return tags.isEmpty() ? QByteArray() : "@" + tags.first() + " ";
+
+    if (!message->id.isEmpty())
+      tags.append("msgid=" + message->id);
+
+    // lets clients resume with SYNC
+    if (message->seq > 0)
+      tags.append("chatripper.io/seq=" + QByteArray::number(message->seq));
+
     // add account-tag if applicable
     if (capabilities.has(PROTOCOL_CAPABILITY::ACCOUNT_TAG) && !src.isNull()) {
       if (const QByteArray username = src->name(); !username.isEmpty())
@@ -50,14 +69,8 @@ namespace irc {
     }
 
     // add message-level tags
-    for (auto it = message->tags.begin(); it != message->tags.end(); ++it) {
-      const QByteArray key = it.key().toUtf8();
-      const QByteArray value = it.value().toByteArray();
-      if (value.isEmpty())
-        tags.append(key);
-      else
-        tags.append(key + "=" + escapeTagValue(value));
-    }
+    if (const QByteArray encoded = encodeTags(message->tags); !encoded.isEmpty())
+      tags.append(encoded);
 
     if (tags.isEmpty())
       return {};
@@ -72,6 +85,23 @@ namespace irc {
     return tag_prefix;
   }
 
+  QByteArray encodeTags(const QMap<QString, QVariant> &tags) {
+    QByteArrayList encoded;
+    for (auto it = tags.begin(); it != tags.end(); ++it) {
+      // server-owned; clients do not get to spoof these
+      if (it.key() == "msgid" || it.key() == "time")
+        continue;
+
+      const QByteArray key = it.key().toUtf8();
+      const QByteArray value = it.value().toByteArray();
+      if (value.isEmpty())
+        encoded.append(key);
+      else
+        encoded.append(key + "=" + escapeTagValue(value));
+    }
+    return encoded.join(";");
+  }
+
   QMap<QString, QVariant> parseMessageTags(const QByteArray &line, int &tagsEndPos) {
     QMap<QString, QVariant> tags;
     tagsEndPos = -1; // default: no tags found
@@ -148,7 +178,31 @@ namespace irc {
   }
 
   QByteArray generateBatchRef() {
-    return QUuid::createUuid().toByteArray(QUuid::Id128);
+    // only has to be unique per connection; a counter will do
+    static std::atomic<quint64> counter{0};
+    return QByteArray::number(++counter, 36);
+  }
+
+  QByteArrayList chunkItems(const QByteArray &prefix, const QByteArrayList &items, const int max_len) {
+    QByteArrayList lines;
+    const int budget = std::max(1, max_len - static_cast<int>(prefix.size()));
+
+    QByteArray current;
+    current.reserve(budget);
+    for (const auto& item: items) {
+      if (!current.isEmpty() && current.size() + 1 + item.size() > budget) {
+        lines << current;
+        current.clear();
+      }
+
+      if (!current.isEmpty())
+        current += ' ';
+      current += item;
+    }
+
+    if (!current.isEmpty())
+      lines << current;
+    return lines;
   }
 
 }
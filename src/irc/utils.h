@@ -49,11 +49,13 @@ namespace irc {
    *
    * This function generates the '@tag1=value1;tag2=value2 ... ' prefix for a message.
    * It includes:
+   *   - The 'time' tag if the SERVER_TIME capability is enabled.
+   *   - The 'msgid' tag if the MESSAGE_TAGS capability is enabled.
    *   - The 'account' tag if the sender is logged in and ACCOUNT_TAG capability is enabled.
    *   - Any additional tags present in QEventMessage::tags.
    *
-   * The resulting string is empty if the MESSAGE_TAGS capability is not negotiated
-   * or if no tags are present.
+   * The resulting string is empty if neither MESSAGE_TAGS nor SERVER_TIME is
+   * negotiated, or if no tags are present.
    *
    * @param message Pointer to the QEventMessage containing user-defined tags.
    * @param src Pointer to the sender Account object (used for account-tag).
@@ -67,6 +69,29 @@ namespace irc {
       const Flags<PROTOCOL_CAPABILITY> &capabilities
       );
 
+  /**
+   * @brief Encodes client-supplied tags as 'key=value;key2', values escaped.
+   *
+   * Server-owned tags (msgid, time) are left out.
+   *
+   * @param tags The tags as parsed by parseMessageTags().
+   * @return QByteArray The encoded tags without leading '@', possibly empty.
+   */
+  QByteArray encodeTags(const QMap<QString, QVariant> &tags);
+
   QMap<QString, QVariant> parseMessageTags(const QByteArray &line, int &tagsEndPos);
   QByteArray generateBatchRef();
+
+  /**
+   * @brief Packs space-separated items into as few lines as possible.
+   *
+   * Every returned line, once appended to @p prefix, stays within @p max_len bytes.
+   * Used for numerics with long lists such as RPL_NAMREPLY (353).
+   *
+   * @param prefix The numeric/target part each line will be sent with.
+   * @param items The items to pack (e.g. nicks).
+   * @param max_len Maximum length of prefix + line.
+   * @return QByteArrayList The packed lines, without the prefix.
+   */
+  QByteArrayList chunkItems(const QByteArray &prefix, const QByteArrayList &items, int max_len);
 }
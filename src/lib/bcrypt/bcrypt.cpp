@@ -37,7 +37,11 @@
 #include <sys/types.h>
 #include <string.h>
 
+#include <algorithm>
+#include <map>
+
 #include "node_blf.h"
+#include "eksblowfish.h"
 
 #include "bcrypt.h"
 #include "openbsd.h"
@@ -149,130 +153,126 @@ bcrypt_gensalt(char minor, u_int8_t log_rounds, u_int8_t *seed, char *gsalt)
 /* We handle $Vers$log2(NumRounds)$salt+passwd$
    i.e. $2$04$iwouldntknowwhattosayetKdJ6iFtacBqJdKe6aW7ou */
 
-void
-node_bcrypt(const char *key, size_t key_len, const char *salt, char *encrypted)
-{
-	blf_ctx state;
-	u_int32_t rounds, i, k;
-	u_int16_t j;
-	u_int8_t salt_len, logr, minor;
-	u_int8_t ciphertext[4 * BCRYPT_BLOCKS+1] = "OrpheanBeholderScryDoubt";
+struct bcrypt_setting {
+	u_int8_t minor;
+	u_int8_t logr;
 	u_int8_t csalt[BCRYPT_MAXSALT];
-	u_int32_t cdata[BCRYPT_BLOCKS];
+};
+
+static int
+parse_setting(const char *salt, struct bcrypt_setting *setting)
+{
 	int n;
 
 	/* Discard "$" identifier */
 	salt++;
 
-	if (*salt > BCRYPT_VERSION) {
-		/* How do I handle errors ? Return ':' */
-		strcpy(encrypted, error);
-		return;
-	}
+	if (*salt > BCRYPT_VERSION)
+		return 0;
 
 	/* Check for minor versions */
 	if (salt[1] != '$') {
 		 switch (salt[1]) {
 		 case 'a': /* 'ab' should not yield the same as 'abab' */
 		 case 'b': /* cap input length at 72 bytes */
-			 minor = salt[1];
+			 setting->minor = salt[1];
 			 salt++;
 			 break;
 		 default:
-			 strcpy(encrypted, error);
-			 return;
+			 return 0;
 		 }
 	} else
-		 minor = 0;
+		 setting->minor = 0;
 
 	/* Discard version + "$" identifier */
 	salt += 2;
 
-	if (salt[2] != '$') {
+	if (salt[2] != '$')
 		/* Out of sync with passwd entry */
-		strcpy(encrypted, error);
-		return;
-	}
+		return 0;
 
 	/* Computer power doesn't increase linear, 2^x should be fine */
 	n = atoi(salt);
-	if (n > 31 || n < 0) {
-		strcpy(encrypted, error);
-		return;
-	}
-	logr = (u_int8_t)n;
-	if ((rounds = (u_int32_t) 1 << logr) < BCRYPT_MINROUNDS) {
-		strcpy(encrypted, error);
-		return;
-	}
+	if (n > 31 || n < 0)
+		return 0;
+	setting->logr = (u_int8_t)n;
+	if (((u_int32_t) 1 << setting->logr) < BCRYPT_MINROUNDS)
+		return 0;
 
 	/* Discard num rounds + "$" identifier */
 	salt += 3;
 
-	if (strlen(salt) * 3 / 4 < BCRYPT_MAXSALT) {
-		strcpy(encrypted, error);
-		return;
-	}
+	if (strlen(salt) * 3 / 4 < BCRYPT_MAXSALT)
+		return 0;
 
 	/* We dont want the base64 salt but the raw data */
-	decode_base64(csalt, BCRYPT_MAXSALT, (u_int8_t *) salt);
-	salt_len = BCRYPT_MAXSALT;
-	if (minor <= 'a')
-		key_len = (u_int8_t)(key_len + (minor >= 'a' ? 1 : 0));
-	else
-	{
-		/* cap key_len at the actual maximum supported
-		* length here to avoid integer wraparound */
-		if (key_len > 72)
-			key_len = 72;
-		key_len++; /* include the NUL */
-	}
-
+	decode_base64(setting->csalt, BCRYPT_MAXSALT, (u_int8_t *) salt);
+	return 1;
+}
 
-	/* Setting up S-Boxes and Subkeys */
-	Blowfish_initstate(&state);
-	Blowfish_expandstate(&state, csalt, salt_len,
-		(u_int8_t *) key, key_len);
-	for (k = 0; k < rounds; k++) {
-		Blowfish_expand0state(&state, (u_int8_t *) key, key_len);
-		Blowfish_expand0state(&state, csalt, salt_len);
-	}
+static size_t
+effective_key_len(size_t key_len, u_int8_t minor)
+{
+	if (minor <= 'a')
+		return (u_int8_t)(key_len + (minor >= 'a' ? 1 : 0));
 
- 	/* This can be precomputed later */
-	j = 0;
-	for (i = 0; i < BCRYPT_BLOCKS; i++)
-		cdata[i] = Blowfish_stream2word(ciphertext, 4 * BCRYPT_BLOCKS, &j);
+	/* cap key_len at the actual maximum supported
+	* length here to avoid integer wraparound */
+	if (key_len > 72)
+		key_len = 72;
+	return key_len + 1; /* include the NUL */
+}
 
-	/* Now do the encryption */
-	for (k = 0; k < 64; k++)
-		blf_enc(&state, cdata, BCRYPT_BLOCKS / 2);
+static void
+format_hash(const struct bcrypt_setting *setting, u_int32_t *cdata, char *encrypted)
+{
+	u_int8_t ciphertext[4 * BCRYPT_BLOCKS];
+	u_int32_t i;
 
 	for (i = 0; i < BCRYPT_BLOCKS; i++) {
 		ciphertext[4 * i + 3] = cdata[i] & 0xff;
-		cdata[i] = cdata[i] >> 8;
-		ciphertext[4 * i + 2] = cdata[i] & 0xff;
-		cdata[i] = cdata[i] >> 8;
-		ciphertext[4 * i + 1] = cdata[i] & 0xff;
-		cdata[i] = cdata[i] >> 8;
-		ciphertext[4 * i + 0] = cdata[i] & 0xff;
+		ciphertext[4 * i + 2] = (cdata[i] >> 8) & 0xff;
+		ciphertext[4 * i + 1] = (cdata[i] >> 16) & 0xff;
+		ciphertext[4 * i + 0] = (cdata[i] >> 24) & 0xff;
 	}
 
 	i = 0;
 	encrypted[i++] = '$';
 	encrypted[i++] = BCRYPT_VERSION;
-	if (minor)
-		encrypted[i++] = minor;
+	if (setting->minor)
+		encrypted[i++] = setting->minor;
 	encrypted[i++] = '$';
 
-	snprintf(encrypted + i, 4, "%2.2u$", logr & 0x001F);
+	snprintf(encrypted + i, 4, "%2.2u$", setting->logr & 0x001F);
 
-	encode_base64((u_int8_t *) encrypted + i + 3, csalt, BCRYPT_MAXSALT);
+	encode_base64((u_int8_t *) encrypted + i + 3, (u_int8_t *) setting->csalt, BCRYPT_MAXSALT);
 	encode_base64((u_int8_t *) encrypted + strlen(encrypted), ciphertext,
 		4 * BCRYPT_BLOCKS - 1);
-	memset(&state, 0, sizeof(state));
 	memset(ciphertext, 0, sizeof(ciphertext));
-	memset(csalt, 0, sizeof(csalt));
-	memset(cdata, 0, sizeof(cdata));
+}
+
+/* The key schedule and the 64 encryptions run in bcrypt::eks, which
+ * produces the same words as Blowfish_expandstate/expand0state/blf_enc */
+void
+node_bcrypt(const char *key, size_t key_len, const char *salt, char *encrypted)
+{
+	struct bcrypt_setting setting;
+	bcrypt::eks::Job job;
+
+	if (!parse_setting(salt, &setting)) {
+		/* How do I handle errors ? Return ':' */
+		strcpy(encrypted, error);
+		return;
+	}
+
+	job.key = (const u_int8_t *) key;
+	job.key_len = effective_key_len(key_len, setting.minor);
+	job.salt = setting.csalt;
+	bcrypt::eks::run(&job, 1, setting.logr);
+
+	format_hash(&setting, job.cdata, encrypted);
+	memset(&setting, 0, sizeof(setting));
+	memset(job.cdata, 0, sizeof(job.cdata));
 }
 
 u_int32_t bcrypt_get_rounds(const char * hash)
@@ -334,9 +334,61 @@ std::string bcrypt::generateHash(const std::string &password, unsigned int round
     return hash;
 }
 
+// compared in full, so the time taken says nothing about where they differ
+static bool
+hash_equals(const std::string &a, const char *b)
+{
+	if (a.size() != strlen(b))
+		return false;
+
+	unsigned char diff = 0;
+	for (size_t i = 0; i < a.size(); i++)
+		diff |= (unsigned char) a[i] ^ (unsigned char) b[i];
+	return diff == 0;
+}
+
 bool bcrypt::validatePassword(const std::string &password, const std::string &hash) {
-    std::string got(61, '\0');
-    node_bcrypt(password.c_str(), password.size(), hash.c_str(), &got[0]);
-    got.resize(60);
-    return hash == got;
+    char got[61]{};
+    node_bcrypt(password.c_str(), password.size(), hash.c_str(), got);
+    const bool ok = hash_equals(hash, got);
+    memset(got, 0, sizeof(got));
+    return ok;
+}
+
+std::vector<bool> bcrypt::validatePasswords(const std::vector<std::pair<std::string, std::string>> &checks) {
+    std::vector<bool> results(checks.size(), false);
+    std::vector<bcrypt_setting> settings(checks.size());
+
+    // lanes have to run the same number of rounds, so group by cost
+    std::map<u_int8_t, std::vector<size_t>> by_cost;
+    for (size_t i = 0; i < checks.size(); i++) {
+        if (parse_setting(checks[i].second.c_str(), &settings[i]))
+            by_cost[settings[i].logr].push_back(i);
+    }
+
+    for (const auto &[cost, indexes]: by_cost) {
+        for (size_t first = 0; first < indexes.size(); first += eks::LANES) {
+            const int count = (int) std::min<size_t>(eks::LANES, indexes.size() - first);
+            eks::Job jobs[eks::LANES];
+            for (int lane = 0; lane < count; lane++) {
+                const size_t i = indexes[first + lane];
+                jobs[lane].key = (const u_int8_t *) checks[i].first.c_str();
+                jobs[lane].key_len = effective_key_len(checks[i].first.size(), settings[i].minor);
+                jobs[lane].salt = settings[i].csalt;
+            }
+            eks::run(jobs, count, cost);
+
+            for (int lane = 0; lane < count; lane++) {
+                const size_t i = indexes[first + lane];
+                char got[61]{};
+                format_hash(&settings[i], jobs[lane].cdata, got);
+                results[i] = hash_equals(checks[i].second, got);
+                memset(got, 0, sizeof(got));
+                memset(jobs[lane].cdata, 0, sizeof(jobs[lane].cdata));
+            }
+        }
+    }
+
+    memset(settings.data(), 0, settings.size() * sizeof(bcrypt_setting));
+    return results;
 }
@@ -2,6 +2,8 @@
 #define BCRYPT_H
 
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace bcrypt {
 
@@ -9,6 +11,10 @@ namespace bcrypt {
 
     bool validatePassword(const std::string & password, const std::string & hash);
 
+    // (password, hash) pairs; hashes of the same cost are computed
+    // together, several per core, see eksblowfish.h
+    std::vector<bool> validatePasswords(const std::vector<std::pair<std::string, std::string>> & checks);
+
 }
 
 #endif // BCRYPT_H
@@ -0,0 +1,177 @@
+#include <cstring>
+
+#include "eksblowfish.h"
+#include "node_blf.h"
+
+namespace bcrypt::eks {
+  namespace {
+    struct alignas(64) State {
+      blf_ctx ctx;
+    };
+
+    // bytes cycled into big-endian words, as Blowfish_stream2word reads them
+    template <int WORDS>
+    void stream_words(const uint8_t *data, const size_t len, uint32_t (&out)[WORDS]) {
+      size_t j = 0;
+      for (int i = 0; i < WORDS; ++i) {
+        uint32_t word = 0;
+        for (int b = 0; b < 4; ++b) {
+          word = (word << 8) | data[j];
+          if (++j >= len)
+            j = 0;
+        }
+        out[i] = word;
+      }
+    }
+
+    #define EKS_F(s, x) ((((s)[(x) >> 24] \
+                         + (s)[0x100 + (((x) >> 16) & 0xff)]) \
+                         ^ (s)[0x200 + (((x) >> 8) & 0xff)]) \
+                         + (s)[0x300 + ((x) & 0xff)])
+
+    #define EKS_ROUND(a, b, n) \
+      for (int i = 0; i < N; ++i) \
+        a[i] ^= EKS_F(s[i], b[i]) ^ p[i][n];
+
+    // one block per lane; the lanes do not depend on each other, so their
+    // loads overlap instead of waiting one round at a time
+    template <int N>
+    inline void encipher(State *const *st, uint32_t *l, uint32_t *r) {
+      const uint32_t *s[N];
+      const uint32_t *p[N];
+      for (int i = 0; i < N; ++i) {
+        s[i] = st[i]->ctx.S[0];
+        p[i] = st[i]->ctx.P;
+        l[i] ^= p[i][0];
+      }
+
+      EKS_ROUND(r, l, 1)  EKS_ROUND(l, r, 2)
+      EKS_ROUND(r, l, 3)  EKS_ROUND(l, r, 4)
+      EKS_ROUND(r, l, 5)  EKS_ROUND(l, r, 6)
+      EKS_ROUND(r, l, 7)  EKS_ROUND(l, r, 8)
+      EKS_ROUND(r, l, 9)  EKS_ROUND(l, r, 10)
+      EKS_ROUND(r, l, 11) EKS_ROUND(l, r, 12)
+      EKS_ROUND(r, l, 13) EKS_ROUND(l, r, 14)
+      EKS_ROUND(r, l, 15) EKS_ROUND(l, r, 16)
+
+      for (int i = 0; i < N; ++i) {
+        const uint32_t t = l[i];
+        l[i] = r[i] ^ p[i][17];
+        r[i] = t;
+      }
+    }
+
+    #undef EKS_ROUND
+    #undef EKS_F
+
+    // P ^= words, then P and S are rewritten by the running cipher. SALTED
+    // is Blowfish_expandstate: the salt is mixed into every block first
+    template <int N, bool SALTED>
+    void expand(State *const *st, const uint32_t (*words)[18], const uint32_t (*salt)[4]) {
+      for (int i = 0; i < N; ++i) {
+        for (int k = 0; k < BLF_N + 2; ++k)
+          st[i]->ctx.P[k] ^= words[i][k];
+      }
+
+      uint32_t l[N] = {};
+      uint32_t r[N] = {};
+      int m = 0;
+      const auto block = [&](const int box, const int k) {
+        if constexpr (SALTED) {
+          for (int i = 0; i < N; ++i) {
+            l[i] ^= salt[i][m];
+            r[i] ^= salt[i][m + 1];
+          }
+          m ^= 2;
+        }
+        encipher<N>(st, l, r);
+        for (int i = 0; i < N; ++i) {
+          uint32_t *dst = box < 0 ? st[i]->ctx.P : st[i]->ctx.S[box];
+          dst[k] = l[i];
+          dst[k + 1] = r[i];
+        }
+      };
+
+      for (int k = 0; k < BLF_N + 2; k += 2)
+        block(-1, k);
+      for (int box = 0; box < 4; ++box) {
+        for (int k = 0; k < 256; k += 2)
+          block(box, k);
+      }
+    }
+
+    const blf_ctx &initial_state() {
+      static const blf_ctx state = [] {
+        blf_ctx c;
+        Blowfish_initstate(&c);
+        return c;
+      }();
+      return state;
+    }
+
+    template <int N>
+    void run_lanes(Job *jobs, const uint8_t cost) {
+      State states[N];
+      State *st[N];
+      uint32_t key[N][18];
+      uint32_t salt[N][18];
+      uint32_t salt4[N][4];
+
+      for (int i = 0; i < N; ++i) {
+        st[i] = &states[i];
+        std::memcpy(&states[i].ctx, &initial_state(), sizeof(blf_ctx));
+        stream_words(jobs[i].key, jobs[i].key_len, key[i]);
+        stream_words(jobs[i].salt, BCRYPT_MAXSALT, salt[i]);
+        std::memcpy(salt4[i], salt[i], sizeof(salt4[i]));
+      }
+
+      expand<N, true>(st, key, salt4);
+      const uint64_t rounds = uint64_t(1) << cost;
+      for (uint64_t k = 0; k < rounds; ++k) {
+        expand<N, false>(st, key, nullptr);
+        expand<N, false>(st, salt, nullptr);
+      }
+
+      // the three blocks of every lane are independent as well
+      static constexpr uint8_t magic[] = "OrpheanBeholderScryDoubt";
+      uint32_t words[BCRYPT_BLOCKS];
+      stream_words(magic, 4 * BCRYPT_BLOCKS, words);
+
+      constexpr int B = BCRYPT_BLOCKS / 2;
+      State *st3[N * B];
+      uint32_t l[N * B];
+      uint32_t r[N * B];
+      for (int i = 0; i < N; ++i) {
+        for (int b = 0; b < B; ++b) {
+          st3[i * B + b] = st[i];
+          l[i * B + b] = words[2 * b];
+          r[i * B + b] = words[2 * b + 1];
+        }
+      }
+      for (int k = 0; k < 64; ++k)
+        encipher<N * B>(st3, l, r);
+
+      for (int i = 0; i < N; ++i) {
+        for (int b = 0; b < B; ++b) {
+          jobs[i].cdata[2 * b] = l[i * B + b];
+          jobs[i].cdata[2 * b + 1] = r[i * B + b];
+        }
+      }
+
+      std::memset(states, 0, sizeof(states));
+      std::memset(key, 0, sizeof(key));
+    }
+  }
+
+  void run(Job *jobs, const int count, const uint8_t cost) {
+    switch (count) {
+      case 1: return run_lanes<1>(jobs, cost);
+      case 2: return run_lanes<2>(jobs, cost);
+      case 3: return run_lanes<3>(jobs, cost);
+      case 4: return run_lanes<4>(jobs, cost);
+      default: break;
+    }
+  }
+
+  static_assert(LANES == 4, "run() dispatches up to four lanes");
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// the expensive part of bcrypt - EksBlowfishSetup and the 64 encryptions of
+// "OrpheanBeholderScryDoubt" - written for throughput:
+//
+// - key and salt are expanded into words once, not re-read byte by byte
+//   for every one of the 2^cost rounds
+// - the 16 Feistel rounds are unrolled, with the four S-boxes and P-array
+//   of a hash kept in one 64-byte aligned block (4 KiB, resident in L1)
+// - up to LANES independent hashes advance in lockstep. A Blowfish round
+//   depends on the previous one, so a single hash leaves the core waiting
+//   on S-box loads; interleaving hashes fills those stalls.
+//
+// output matches Blowfish_expandstate/expand0state/blf_enc bit for bit.
+namespace bcrypt::eks {
+  constexpr int LANES = 4;
+
+  struct Job {
+    const uint8_t *key = nullptr;
+    size_t key_len = 0;            // as bcrypt feeds it: NUL included, capped at 72
+    const uint8_t *salt = nullptr; // 16 bytes
+    uint32_t cdata[6] = {};        // result
+  };
+
+  // `count` <= LANES jobs with the same cost (log2 of the rounds)
+  void run(Job *jobs, int count, uint8_t cost);
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+// bounded multi-producer/multi-consumer ring (Vyukov). Every cell carries
+// a sequence number that tells producers and consumers whose turn it is,
+// so neither side takes a lock. The capacity is rounded up to a power of
+// two.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity)
+      size <<= 1;
+
+    m_mask = size - 1;
+    m_cells = std::make_unique<Cell[]>(size);
+    for (size_t i = 0; i < size; ++i)
+      m_cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  // false when full
+  bool try_push(T &&value) {
+    size_t pos = m_enqueue.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = m_cells[pos & m_mask];
+      const size_t seq = cell.seq.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+
+      if (diff == 0) {
+        if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.data = std::move(value);
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_enqueue.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // false when empty
+  bool try_pop(T &out) {
+    size_t pos = m_dequeue.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = m_cells[pos & m_mask];
+      const size_t seq = cell.seq.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+
+      if (diff == 0) {
+        if (m_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          out = std::move(cell.data);
+          cell.data = T();
+          cell.seq.store(pos + m_mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_dequeue.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // racy by nature; good enough for flush heuristics and metrics
+  [[nodiscard]] size_t size_approx() const {
+    const size_t enq = m_enqueue.load(std::memory_order_relaxed);
+    const size_t deq = m_dequeue.load(std::memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+  }
+
+  [[nodiscard]] size_t capacity() const { return m_mask + 1; }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq{0};
+    T data{};
+  };
+
+  std::unique_ptr<Cell[]> m_cells;
+  size_t m_mask = 0;
+
+  alignas(64) std::atomic<size_t> m_enqueue{0};
+  alignas(64) std::atomic<size_t> m_dequeue{0};
+};
@@ -0,0 +1,68 @@
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QRegularExpression>
+#include <QDebug>
+
+#include "lib/db_backend.h"
+#include "lib/globals.h"
+
+std::unique_ptr<DbBackend> DbBackend::create(const QString &name) {
+  if (name == "sqlite")
+    return std::make_unique<SqliteBackend>();
+  if (name == "postgres" || name == "postgresql" || name == "pg")
+    return std::make_unique<PostgresBackend>();
+
+  qFatal("unknown database backend '%s'", qPrintable(name));
+}
+
+QSqlDatabase PostgresBackend::add(const QString &name) const {
+  auto db = QSqlDatabase::addDatabase("QPSQL", name);
+  db.setConnectOptions(QString("application_name=%1").arg(name));
+  db.setHostName(g::pgHost);
+  db.setPort(g::pgPort);
+  db.setDatabaseName(g::pgDatabase);
+  db.setUserName(g::pgUsername);
+  if (!g::pgPassword.isEmpty())
+    db.setPassword(g::pgPassword);
+  return db;
+}
+
+QSqlDatabase SqliteBackend::add(const QString &name) const {
+  auto db = QSqlDatabase::addDatabase("QSQLITE", name);
+  db.setConnectOptions(QString("QSQLITE_BUSY_TIMEOUT=%1").arg(BUSY_TIMEOUT_MS));
+  db.setDatabaseName(g::sqlitePath.isEmpty() ? g::configDirectory + "chatripper.sqlite3" : g::sqlitePath);
+  return db;
+}
+
+bool SqliteBackend::setup(QSqlDatabase &db) const {
+  QSqlQuery q(db);
+  for (const auto *pragma: {
+      "PRAGMA journal_mode = WAL",
+      "PRAGMA synchronous = NORMAL",
+      "PRAGMA foreign_keys = ON",
+      "PRAGMA temp_store = MEMORY"}) {
+    if (!q.exec(pragma)) {
+      qCritical() << "sqlite:" << pragma << "failed:" << q.lastError().text();
+      return false;
+    }
+  }
+  return true;
+}
+
+QString SqliteBackend::dialect(const QString &sql) const {
+  // ISO 8601 with milliseconds, like the QDateTime values Qt binds, so
+  // stored and bound timestamps compare as text
+  static const QString now = "strftime('%Y-%m-%dT%H:%M:%f', 'now', 'localtime')";
+  static const QRegularExpression uuid("\\bUUID\\b");
+
+  QString out = sql;
+  out.replace("BIGSERIAL PRIMARY KEY", "INTEGER PRIMARY KEY AUTOINCREMENT");
+  out.replace("BYTEA", "BLOB");
+  out.replace("ref_type_enum", "TEXT");
+  out.replace("ADD COLUMN IF NOT EXISTS", "ADD COLUMN");
+  out.replace("DEFAULT CURRENT_TIMESTAMP", "DEFAULT (" + now + ")");
+  out.replace("CURRENT_TIMESTAMP", now);
+  out.replace("LOCALTIMESTAMP", now);
+  out.replace(uuid, "TEXT");
+  return out;
+}
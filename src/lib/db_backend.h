@@ -0,0 +1,50 @@
+#pragma once
+#include <QSqlDatabase>
+#include <QString>
+
+#include <memory>
+
+// what differs between the storage engines. Queries are written for
+// Postgres; dialect() rewrites the few constructs another engine spells
+// differently, and create_schema() branches on kind() for the rest
+// (enum types, trigger functions).
+class DbBackend {
+public:
+  enum class Kind { Postgres, Sqlite };
+
+  virtual ~DbBackend() = default;
+
+  // "postgres" or "sqlite"
+  static std::unique_ptr<DbBackend> create(const QString &name);
+
+  [[nodiscard]] virtual Kind kind() const = 0;
+  // registers (but does not open) a connection called `name`
+  [[nodiscard]] virtual QSqlDatabase add(const QString &name) const = 0;
+  // per-connection settings, right after it opened
+  virtual bool setup(QSqlDatabase &db) const { return true; }
+  // connections reserved for writes; 0 when any connection may write
+  [[nodiscard]] virtual int writers() const { return 0; }
+  [[nodiscard]] virtual QString dialect(const QString &sql) const { return sql; }
+};
+
+// a separate server over the network; any connection reads and writes
+class PostgresBackend final : public DbBackend {
+public:
+  [[nodiscard]] Kind kind() const override { return Kind::Postgres; }
+  [[nodiscard]] QSqlDatabase add(const QString &name) const override;
+};
+
+// embedded, for single-node installs. WAL lets readers run next to the
+// writer; all writes go through one connection so they never contend for
+// the database lock, and synchronous=NORMAL only syncs at checkpoints.
+class SqliteBackend final : public DbBackend {
+public:
+  [[nodiscard]] Kind kind() const override { return Kind::Sqlite; }
+  [[nodiscard]] QSqlDatabase add(const QString &name) const override;
+  bool setup(QSqlDatabase &db) const override;
+  [[nodiscard]] int writers() const override { return 1; }
+  [[nodiscard]] QString dialect(const QString &sql) const override;
+
+private:
+  static constexpr int BUSY_TIMEOUT_MS = 5000;
+};
@@ -0,0 +1,232 @@
+#include <QSqlError>
+#include <QDeadlineTimer>
+#include <QDateTime>
+#include <QDebug>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "lib/db_pool.h"
+
+thread_local QWeakPointer<DbPool::Lease::Hold> DbPool::t_lease;
+thread_local QWeakPointer<DbPool::Lease::Hold> DbPool::t_write_lease;
+
+DbPool::DbPool(const DbBackend *backend, const int size, const int timeout_ms) :
+    m_backend(backend),
+    m_timeout_ms(timeout_ms),
+    m_split(backend->writers() > 0) {
+  m_connections.prefix = m_split ? "cr_read_" : "cr_pool_";
+  m_connections.size = std::max(1, size);
+  m_connections.connections.reserve(m_connections.size);
+  m_writers.prefix = "cr_write_";
+  m_writers.size = backend->writers();
+}
+
+DbPool::Lease DbPool::acquire(const Access access) {
+  // a writer serves reads too; a transaction sees its own writes
+  if (auto hold = t_write_lease.toStrongRef(); !hold.isNull())
+    return Lease(hold);
+
+  const bool write = m_split && access == Access::Write;
+  if (!write) {
+    if (auto hold = t_lease.toStrongRef(); !hold.isNull())
+      return Lease(hold);
+  }
+
+  auto hold = QSharedPointer<Lease::Hold>(new Lease::Hold{this, checkout(write ? m_writers : m_connections)});
+  (write ? t_write_lease : t_lease) = hold;
+  return Lease(hold);
+}
+
+DbPool::Connection *DbPool::checkout(Set &set) {
+  QMutexLocker locker(&mtx_pool);
+  ++m_checkouts;
+
+  Connection *conn = nullptr;
+  if (set.idle.isEmpty() && static_cast<int>(set.connections.size()) < set.size) {
+    // grow; opened outside the lock
+    set.connections.push_back(std::make_unique<Connection>());
+    conn = set.connections.back().get();
+    conn->set = &set;
+    conn->name = set.prefix + QString::number(set.connections.size());
+    conn->broken = true;
+  } else {
+    if (set.idle.isEmpty()) {
+      ++m_waits;
+      QElapsedTimer waited;
+      waited.start();
+      const QDeadlineTimer deadline(m_timeout_ms);
+      while (set.idle.isEmpty()) {
+        if (!set.returned.wait(&mtx_pool, deadline) && set.idle.isEmpty()) {
+          ++m_timeouts;
+          qCritical() << "db pool: no connection became available within" << m_timeout_ms << "ms";
+          throw std::runtime_error("database pool exhausted");
+        }
+      }
+
+      const quint64 us = waited.nsecsElapsed() / 1000;
+      m_wait_us += us;
+      quint64 max = m_wait_max_us;
+      while (us > max && !m_wait_max_us.compare_exchange_weak(max, us)) {}
+
+      const qint64 now = QDateTime::currentMSecsSinceEpoch();
+      if (us / 1000 >= SLOW_WAIT_MS && now - m_last_slow_log.exchange(now) >= 1000)
+        qWarning() << "db pool: waited" << us / 1000 << "ms for a connection, all" << set.size << "in use";
+    }
+
+    // most recently returned first; the rest may go idle long enough to be probed
+    conn = set.idle.takeLast();
+  }
+  locker.unlock();
+
+  try {
+    ensure_healthy(conn);
+  } catch (...) {
+    release(conn);
+    throw;
+  }
+  return conn;
+}
+
+void DbPool::release(Connection *conn) {
+  conn->idle.restart();
+
+  QMutexLocker locker(&mtx_pool);
+  conn->set->idle.append(conn);
+  conn->set->returned.wakeOne();
+}
+
+bool DbPool::open(Connection *conn) {
+  if (!conn->db.isValid())
+    conn->db = m_backend->add(conn->name);
+
+  if (!conn->db.open()) {
+    qCritical() << "db pool: could not open" << conn->name << conn->db.lastError().text();
+    return false;
+  }
+
+  if (!m_backend->setup(conn->db)) {
+    conn->db.close();
+    return false;
+  }
+
+  qDebug() << "db pool: opened connection" << conn->name;
+  return true;
+}
+
+void DbPool::ensure_healthy(Connection *conn) {
+  if (!conn->broken && conn->db.isOpen()) {
+    if (!conn->idle.isValid() || conn->idle.elapsed() < HEALTH_IDLE_MS)
+      return;
+
+    QSqlQuery probe(conn->db);
+    if (probe.exec("SELECT 1"))
+      return;
+    qWarning() << "db pool:" << conn->name << "failed its health check:" << probe.lastError().text();
+  }
+
+  // statements belong to the old session
+  conn->statements.clear();
+  if (conn->db.isOpen()) {
+    conn->db.close();
+    ++m_reconnects;
+  }
+
+  if (!open(conn))
+    throw std::runtime_error("failed to open database");
+  conn->broken = false;
+}
+
+void DbPool::mark(Connection *conn, const QSqlQuery *q) {
+  if (q->lastError().type() == QSqlError::ConnectionError)
+    conn->broken = true;
+}
+
+void DbPool::evict(Connection *conn) {
+  auto victim = conn->statements.end();
+  for (auto it = conn->statements.begin(); it != conn->statements.end(); ++it) {
+    if (it.value()->in_use)
+      continue;
+    if (victim == conn->statements.end() || it.value()->last_used < victim.value()->last_used)
+      victim = it;
+  }
+
+  if (victim != conn->statements.end())
+    conn->statements.erase(victim);
+}
+
+DbPool::Stats DbPool::stats() const {
+  Stats s;
+  {
+    QMutexLocker locker(&mtx_pool);
+    s.open = static_cast<int>(m_connections.connections.size() + m_writers.connections.size());
+    s.in_use = s.open - static_cast<int>(m_connections.idle.size() + m_writers.idle.size());
+  }
+  s.checkouts = m_checkouts;
+  s.waits = m_waits;
+  s.timeouts = m_timeouts;
+  s.wait_us = m_wait_us;
+  s.wait_max_us = m_wait_max_us;
+  s.reconnects = m_reconnects;
+  s.statement_hits = m_statement_hits;
+  s.statement_misses = m_statement_misses;
+  return s;
+}
+
+void DbPool::log_stats() const {
+  const auto s = stats();
+  qInfo() << "db pool:" << s.open << "connections," << s.checkouts << "checkouts," << s.waits << "waited"
+          << "(total" << s.wait_us / 1000 << "ms, max" << s.wait_max_us / 1000 << "ms)," << s.timeouts << "timeouts,"
+          << s.reconnects << "reconnects; statements" << s.statement_hits << "hits," << s.statement_misses << "misses";
+}
+
+QSqlDatabase &DbPool::Lease::db() const {
+  return m_hold->conn->db;
+}
+
+QSharedPointer<QSqlQuery> DbPool::Lease::query() const {
+  const auto hold = m_hold;
+  return QSharedPointer<QSqlQuery>(new QSqlQuery(hold->conn->db), [hold](QSqlQuery *q) {
+    mark(hold->conn, q);
+    delete q;
+  });
+}
+
+QSharedPointer<QSqlQuery> DbPool::Lease::prepare(const QString &sql) const {
+  const auto hold = m_hold;
+  Connection *conn = hold->conn;
+  DbPool *pool = hold->pool;
+
+  auto stmt = conn->statements.value(sql);
+  if (!stmt.isNull() && stmt->in_use) {
+    auto q = query();
+    q->prepare(pool->m_backend->dialect(sql));
+    return q;
+  }
+
+  if (stmt.isNull()) {
+    ++pool->m_statement_misses;
+    stmt = QSharedPointer<Statement>::create(conn->db);
+    const QString text = pool->m_backend->dialect(sql);
+    if (!stmt->query.prepare(text)) {
+      // not cached; the caller gets the error from exec()
+      auto q = query();
+      q->prepare(text);
+      return q;
+    }
+
+    if (conn->statements.size() >= MAX_STATEMENTS)
+      evict(conn);
+    conn->statements.insert(sql, stmt);
+  } else {
+    ++pool->m_statement_hits;
+  }
+
+  stmt->in_use = true;
+  stmt->last_used = ++conn->tick;
+  return QSharedPointer<QSqlQuery>(&stmt->query, [hold, stmt](QSqlQuery *q) {
+    mark(hold->conn, q);
+    q->finish();
+    stmt->in_use = false;
+  });
+}
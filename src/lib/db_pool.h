@@ -0,0 +1,146 @@
+#pragma once
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSharedPointer>
+#include <QElapsedTimer>
+#include <QWaitCondition>
+#include <QMutex>
+#include <QHash>
+#include <QList>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "lib/db_backend.h"
+
+// bounded set of database connections shared by all threads. A thread checks
+// a connection out for as long as it holds a Lease (or a query made from
+// one) and hands it back when the last of those goes away; nested leases on
+// the same thread share the connection, so transactions span helpers. When
+// every connection is out, callers wait up to `timeout_ms` and then throw.
+//
+// each connection keeps its prepared statements keyed by SQL text, so hot
+// queries are parsed and planned once per connection instead of per call.
+// Connections idle for HEALTH_IDLE_MS are probed before they are handed out;
+// one whose query failed with a connection error is reopened.
+//
+// backends that want a dedicated writer (see DbBackend::writers()) get a
+// second, smaller set for Access::Write; a thread holding a writer uses it
+// for its reads as well. Otherwise the access mode is ignored.
+//
+// neither QPSQL nor QSQLITE connections have thread affinity besides
+// notifications, which are not used; a connection is only ever used by one
+// thread at a time.
+class DbPool {
+public:
+  enum class Access { Read, Write };
+
+  struct Stats {
+    int open = 0;
+    int in_use = 0;
+    quint64 checkouts = 0;
+    quint64 waits = 0;        // checkouts that found no idle connection
+    quint64 timeouts = 0;
+    quint64 wait_us = 0;      // total time spent waiting
+    quint64 wait_max_us = 0;
+    quint64 reconnects = 0;
+    quint64 statement_hits = 0;
+    quint64 statement_misses = 0;
+  };
+
+private:
+  struct Statement {
+    explicit Statement(const QSqlDatabase &db) : query(db) {}
+    QSqlQuery query;
+    bool in_use = false;
+    quint64 last_used = 0;
+  };
+
+  struct Set;
+
+  struct Connection {
+    Set *set = nullptr;
+    QString name;
+    QSqlDatabase db;
+    QHash<QString, QSharedPointer<Statement>> statements;
+    quint64 tick = 0;
+    QElapsedTimer idle;
+    bool broken = false;
+  };
+
+  struct Set {
+    QString prefix;
+    int size = 0;
+    std::vector<std::unique_ptr<Connection>> connections;
+    QList<Connection*> idle;
+    QWaitCondition returned;
+  };
+
+public:
+  class Lease {
+  public:
+    Lease() = default;
+
+    [[nodiscard]] bool isValid() const { return !m_hold.isNull(); }
+    // for transactions; keep the lease alive until commit/rollback
+    [[nodiscard]] QSqlDatabase &db() const;
+    [[nodiscard]] QSharedPointer<QSqlQuery> query() const;
+    // cached per connection; falls back to a one-off query while the same
+    // statement is still in use further up the stack
+    [[nodiscard]] QSharedPointer<QSqlQuery> prepare(const QString &sql) const;
+
+  private:
+    friend class DbPool;
+    struct Hold {
+      DbPool *pool;
+      Connection *conn;
+      ~Hold() { pool->release(conn); }
+    };
+
+    explicit Lease(QSharedPointer<Hold> hold) : m_hold(std::move(hold)) {}
+    QSharedPointer<Hold> m_hold;
+  };
+
+  DbPool(const DbBackend *backend, int size, int timeout_ms);
+
+  // the calling thread's connection, checked out on first use
+  Lease acquire(Access access = Access::Write);
+
+  [[nodiscard]] Stats stats() const;
+  void log_stats() const;
+
+private:
+  static constexpr int MAX_STATEMENTS = 256;
+  static constexpr qint64 HEALTH_IDLE_MS = 30 * 1000;
+  static constexpr qint64 SLOW_WAIT_MS = 100;
+
+  Connection *checkout(Set &set);
+  void release(Connection *conn);
+  bool open(Connection *conn);
+  void ensure_healthy(Connection *conn);
+  static void mark(Connection *conn, const QSqlQuery *q);
+  static void evict(Connection *conn);
+
+  // the leases the current thread holds, if any
+  static thread_local QWeakPointer<Lease::Hold> t_lease;
+  static thread_local QWeakPointer<Lease::Hold> t_write_lease;
+
+  const DbBackend *m_backend;
+  const int m_timeout_ms;
+  const bool m_split;
+
+  mutable QMutex mtx_pool;
+  Set m_connections;  // all of them, unless m_split
+  Set m_writers;
+
+  std::atomic<quint64> m_checkouts = 0;
+  std::atomic<quint64> m_waits = 0;
+  std::atomic<quint64> m_timeouts = 0;
+  std::atomic<quint64> m_wait_us = 0;
+  std::atomic<quint64> m_wait_max_us = 0;
+  std::atomic<quint64> m_reconnects = 0;
+  std::atomic<quint64> m_statement_hits = 0;
+  std::atomic<quint64> m_statement_misses = 0;
+  std::atomic<qint64> m_last_slow_log = 0;
+};
@@ -1,5 +1,6 @@
 #include "lib/globals.h"
 #include "ctx.h"
+#include "core/handles.h"
 
 namespace g {
   QString configRoot;
@@ -11,6 +12,9 @@ namespace g {
   QString staticDirectory;
   QByteArray defaultHost;
   QFileInfo pathDatabasePreload;
+  QFileInfo pathSnapshot;
+  QFileInfo pathSessionKey;
+  QString messagesDirectory;
   QByteArray irc_motd;
   unsigned int irc_motd_size;
   QFileInfo irc_motd_path;
@@ -22,6 +26,13 @@ namespace g {
   WebSessionStore* webSessions = nullptr;
   QThread* mainThread = nullptr;
   Ctx* ctx = nullptr;
+  Slab<Account> accountSlab;
+  Slab<Channel> channelSlab;
+  Slab<irc::client_connection> connectionSlab;
+  // storage
+  QString dbBackend = "postgres";
+  int dbPoolSize = 16;
+  QString sqlitePath;
   // pg
   QString pgHost;
   quint16 pgPort;
@@ -33,4 +44,21 @@ namespace g {
   QString msHost;
   quint16 msPort;
   QString msApiKey;
+  bool lazyLoad = false;
+  int lazyTTL = 900;
+  int msgQueueSize = 65536;
+  int msgBatchSize = 500;
+  int msgFlushInterval = 50;
+  bool msgDropWhenFull = false;
+  bool msgAtLeastOnce = true;
+  QString messageStore = "sql";
+  int messageRetentionDays = 0;
+  bool messageArchive = false;
+  int historySize = 1000;
+  int backlogSize = 500;
+  int backlogReplay = 200;
+  int snapshotInterval = 300;
+  int authThreads = 2;
+  int authQueue = 256;
+  int statsInterval = 300;
 }
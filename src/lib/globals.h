@@ -12,6 +12,9 @@ namespace g {
   extern QString homeDir;
   extern QString configDirectory;
   extern QFileInfo pathDatabasePreload;
+  extern QFileInfo pathSnapshot;
+  extern QFileInfo pathSessionKey;
+  extern QString messagesDirectory;
   extern QString pythonModulesDirectory;
   extern QString uploadsDirectory;
   extern QString cacheDirectory;
@@ -28,6 +31,10 @@ namespace g {
   extern WebSessionStore* webSessions;
   extern QThread* mainThread;
   extern Ctx* ctx;
+  // storage
+  extern QString dbBackend;
+  extern int dbPoolSize;
+  extern QString sqlitePath;
   // pg
   extern QString pgHost;
   extern quint16 pgPort;
@@ -39,4 +46,30 @@ namespace g {
   extern QString msHost;
   extern quint16 msPort;
   extern QString msApiKey;
+  // on-demand loading of accounts/channels
+  extern bool lazyLoad;
+  extern int lazyTTL;
+  // message persistence
+  extern int msgQueueSize;
+  extern int msgBatchSize;
+  extern int msgFlushInterval;
+  extern bool msgDropWhenFull;
+  extern bool msgAtLeastOnce;
+  // 'sql' or 'log', see MessageLog; retention in days (0 keeps everything),
+  // per server with servers.message_retention_days
+  extern QString messageStore;
+  extern int messageRetentionDays;
+  extern bool messageArchive;
+  // per-channel CHATHISTORY ring
+  extern int historySize;
+  // bouncer
+  extern int backlogSize;
+  extern int backlogReplay;
+  // state snapshot, seconds between writes (0 disables)
+  extern int snapshotInterval;
+  // bcrypt threads and how many checks may wait for them
+  extern int authThreads;
+  extern int authQueue;
+  // seconds between pool/queue statistics in the log (0: only on shutdown)
+  extern int statsInterval;
 }
@@ -0,0 +1,128 @@
+#include "lib/message_codec.h"
+
+namespace message_codec {
+  static constexpr quint8 FLAG_COMPRESSED = 0x1;
+  static constexpr quint8 FLAG_RAW = 0x2;
+
+  static void put_varint(QByteArray &out, quint32 value) {
+    while (value >= 0x80) {
+      out.append(static_cast<char>(value | 0x80));
+      value >>= 7;
+    }
+    out.append(static_cast<char>(value));
+  }
+
+  static void put_bytes(QByteArray &out, const QByteArray &value) {
+    put_varint(out, value.size());
+    out.append(value);
+  }
+
+  // bounds-checked; `ok` drops to false on a truncated or garbled input
+  struct Reader {
+    const char *p;
+    const char *end;
+    bool ok = true;
+
+    quint32 varint() {
+      quint32 value = 0;
+      for (int shift = 0; shift < 35; shift += 7) {
+        if (p == end) {
+          ok = false;
+          return 0;
+        }
+        const auto byte = static_cast<quint8>(*p++);
+        value |= static_cast<quint32>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+          return value;
+      }
+      ok = false;
+      return 0;
+    }
+
+    QByteArray bytes() {
+      const quint32 size = varint();
+      if (!ok || end - p < static_cast<qsizetype>(size)) {
+        ok = false;
+        return {};
+      }
+      QByteArray value(p, size);
+      p += size;
+      return value;
+    }
+  };
+
+  QByteArray encode_tags(const QMap<QString, QVariant> &tags) {
+    QByteArray out;
+    if (tags.isEmpty())
+      return out;
+
+    put_varint(out, tags.size());
+    for (auto it = tags.constBegin(); it != tags.constEnd(); ++it) {
+      put_bytes(out, it.key().toUtf8());
+      put_bytes(out, it.value().toByteArray());
+    }
+    return out;
+  }
+
+  QMap<QString, QVariant> decode_tags(const QByteArray &data) {
+    QMap<QString, QVariant> tags;
+    if (data.isEmpty())
+      return tags;
+
+    Reader r{data.constData(), data.constData() + data.size()};
+    const quint32 count = r.varint();
+    for (quint32 i = 0; i < count && r.ok; ++i) {
+      const QByteArray key = r.bytes();
+      const QByteArray value = r.bytes();
+      if (r.ok)
+        tags.insert(QString::fromUtf8(key), value.isEmpty() ? QVariant() : QVariant(value));
+    }
+    return tags;
+  }
+
+  QByteArray derive_raw(const QByteArray &target, const QByteArray &text, const bool tag_msg) {
+    return tag_msg ? target : target + " " + text;
+  }
+
+  QByteArray encode_body(const Body &body) {
+    QByteArray inner;
+    inner.reserve(body.text.size() + body.tags.size() + body.raw.size() + 8);
+    put_bytes(inner, body.text);
+    put_bytes(inner, body.tags);
+    if (!body.raw.isEmpty())
+      put_bytes(inner, body.raw);
+
+    quint8 flags = body.raw.isEmpty() ? 0 : FLAG_RAW;
+    if (inner.size() >= COMPRESS_MIN) {
+      if (QByteArray packed = qCompress(inner); packed.size() < inner.size()) {
+        inner = std::move(packed);
+        flags |= FLAG_COMPRESSED;
+      }
+    }
+
+    QByteArray out;
+    out.reserve(inner.size() + 1);
+    out.append(static_cast<char>(flags));
+    out.append(inner);
+    return out;
+  }
+
+  bool decode_body(const QByteArray &data, Body &body) {
+    if (data.isEmpty())
+      return false;
+
+    const auto flags = static_cast<quint8>(data[0]);
+    QByteArray inner = data.mid(1);
+    if (flags & FLAG_COMPRESSED) {
+      inner = qUncompress(inner);
+      if (inner.isEmpty())
+        return false;
+    }
+
+    Reader r{inner.constData(), inner.constData() + inner.size()};
+    body.text = r.bytes();
+    body.tags = r.bytes();
+    body.raw = flags & FLAG_RAW ? r.bytes() : QByteArray();
+    return r.ok;
+  }
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+#include <QVariant>
+
+// compact storage encoding for message content. Tags are length-prefixed
+// key/value pairs instead of JSON, the raw line is only kept when it cannot
+// be rebuilt from target and text, and bodies past COMPRESS_MIN bytes are
+// deflated when that makes them smaller.
+namespace message_codec {
+  // IRC tag values are strings; an empty one is a tag without value
+  QByteArray encode_tags(const QMap<QString, QVariant> &tags);
+  QMap<QString, QVariant> decode_tags(const QByteArray &data);
+
+  // what PRIVMSG/TAGMSG store as raw: their arguments, space-joined
+  QByteArray derive_raw(const QByteArray &target, const QByteArray &text, bool tag_msg);
+
+  struct Body {
+    QByteArray text;
+    QByteArray tags;  // encode_tags()
+    QByteArray raw;   // empty when derive_raw() gives it back
+  };
+
+  QByteArray encode_body(const Body &body);
+  bool decode_body(const QByteArray &data, Body &body);
+
+  constexpr int COMPRESS_MIN = 512;
+}
@@ -0,0 +1,896 @@
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QSet>
+#include <QtEndian>
+#include <QDebug>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <unistd.h>
+
+#include "lib/message_log.h"
+#include "lib/message_codec.h"
+#include "irc/utils.h"
+
+static constexpr qint64 MS_PER_DAY = 24 * 60 * 60 * 1000;
+// u32 payload size, u32 checksum
+static constexpr qsizetype RECORD_HEADER = 8;
+// ms, id, flags, sender, channel, recipient, 8 length-prefixed fields
+static constexpr qsizetype PAYLOAD_MIN = 8 + 16 + 1 + 3 * 16 + 8 * 4;
+static constexpr quint32 PAYLOAD_MAX = 16 * 1024 * 1024;
+static constexpr quint8 FLAG_TAG_MSG = 0x1;
+static constexpr quint8 FLAG_FROM_SYSTEM = 0x2;
+// tags in message_codec's encoding; JSON without it
+static constexpr quint8 FLAG_BINARY_TAGS = 0x4;
+
+static quint32 checksum(const char *data, const qsizetype size) {
+  quint32 hash = 0x811c9dc5;
+  for (qsizetype i = 0; i < size; ++i) {
+    hash ^= static_cast<uchar>(data[i]);
+    hash *= 0x01000193;
+  }
+  return hash;
+}
+
+template <typename T>
+static void put(QByteArray &out, const T value) {
+  const T le = qToLittleEndian(value);
+  out.append(reinterpret_cast<const char*>(&le), sizeof(le));
+}
+
+static void put_bytes(QByteArray &out, const QByteArray &value) {
+  put<quint32>(out, value.size());
+  out.append(value);
+}
+
+template <typename T>
+static T get(const char *data) {
+  return qFromLittleEndian<T>(data);
+}
+
+// bounds-checked reads from a payload; `ok` drops to false on overrun
+struct Cursor {
+  const char *p;
+  const char *end;
+  bool ok = true;
+
+  template <typename T> T take() {
+    if (end - p < static_cast<qsizetype>(sizeof(T))) {
+      ok = false;
+      return {};
+    }
+    const T value = get<T>(p);
+    p += sizeof(T);
+    return value;
+  }
+
+  QByteArray raw(const qsizetype size) {
+    if (end - p < size) {
+      ok = false;
+      return {};
+    }
+    QByteArray value(p, size);
+    p += size;
+    return value;
+  }
+
+  QByteArray bytes() { return raw(take<quint32>()); }
+};
+
+// every record in [data, data + size), until one is cut off or fails its
+// checksum; returns how many bytes were valid
+template <typename Fn>
+static qsizetype walk(const char *data, const qsizetype size, Fn &&fn) {
+  qsizetype pos = 0;
+  while (size - pos >= RECORD_HEADER) {
+    const auto length = get<quint32>(data + pos);
+    const auto sum = get<quint32>(data + pos + 4);
+    if (length < PAYLOAD_MIN || length > PAYLOAD_MAX || size - pos - RECORD_HEADER < length)
+      break;
+
+    const char *payload = data + pos + RECORD_HEADER;
+    if (checksum(payload, length) != sum)
+      break;
+
+    fn(pos, payload, length);
+    pos += RECORD_HEADER + length;
+  }
+  return pos;
+}
+
+static QString segment_name(const QString &dir, const qint64 ms, int generation) {
+  QString path;
+  do {
+    path = dir + QString("%1_%2").arg(ms, 16, 10, QChar('0')).arg(generation++, 4, 10, QChar('0'));
+  } while (QFile::exists(path + ".log"));
+  return path;
+}
+
+static qint64 segment_base(const QString &path) {
+  return QFileInfo(path).fileName().section('_', 0, 0).toLongLong();
+}
+
+static int segment_generation(const QString &path) {
+  return QFileInfo(path).fileName().section('_', 1, 1).toInt();
+}
+
+static QByteArray channel_stream(const QUuid &channel_id) {
+  return "c-" + channel_id.toByteArray(QUuid::WithoutBraces);
+}
+
+static QByteArray account_stream(const QUuid &account_id) {
+  return "a-" + account_id.toByteArray(QUuid::WithoutBraces);
+}
+
+MessageLog::Segment::~Segment() {
+  if (mapped != nullptr)
+    idx.unmap(reinterpret_cast<uchar*>(const_cast<Block*>(mapped)));
+  if (doomed) {
+    QFile::remove(path + ".log");
+    QFile::remove(path + ".idx");
+  }
+}
+
+MessageLog::MessageLog(const QString &directory, const int retention_days) :
+    m_directory(directory),
+    m_retention_days(retention_days) {
+  QDir().mkpath(m_directory);
+  qInfo() << "message log: storing messages in" << m_directory;
+}
+
+MessageLog::~MessageLog() {
+  for (const auto &s: m_streams)
+    close_log(s.data());
+}
+
+QByteArray MessageLog::encode(const sql::MessageRow &row) {
+  QByteArray out;
+  out.reserve(PAYLOAD_MIN + row.account.size() + row.nick.size() + row.user.size() + row.host.size() +
+              row.targets.size() + row.text.size() + row.tags.size() + row.raw.size());
+
+  put<qint64>(out, row.creation_date.toMSecsSinceEpoch());
+  out.append(row.id.toRfc4122());
+  put<quint8>(out, (row.tag_msg ? FLAG_TAG_MSG : 0) | (row.from_system ? FLAG_FROM_SYSTEM : 0) | FLAG_BINARY_TAGS);
+  out.append(row.sender_id.toRfc4122());
+  out.append(row.channel_id.toRfc4122());
+  out.append(row.recipient_id.toRfc4122());
+  put_bytes(out, row.account);
+  put_bytes(out, row.nick);
+  put_bytes(out, row.user);
+  put_bytes(out, row.host);
+  put_bytes(out, row.targets.toUtf8());
+  put_bytes(out, row.text);
+  put_bytes(out, row.tags);
+  put_bytes(out, row.raw);
+  return out;
+}
+
+bool MessageLog::decode(const char *payload, const quint32 size, HistoryEntry &entry, const QByteArray &target, const QByteArray &peer) {
+  Cursor c{payload, payload + size};
+  const auto ms = c.take<qint64>();
+  const QByteArray id = c.raw(16);
+  const auto flags = c.take<quint8>();
+  if (flags & FLAG_TAG_MSG)
+    return false;
+
+  const QByteArray sender = c.raw(16);
+  c.raw(16);
+  const QByteArray recipient = c.raw(16);
+  if (!peer.isEmpty() && sender != peer && recipient != peer)
+    return false;
+  const QByteArray account = c.bytes();
+  const QByteArray nick = c.bytes();
+  const QByteArray user = c.bytes();
+  const QByteArray host = c.bytes();
+  const QByteArray targets = c.bytes();
+  const QByteArray text = c.bytes();
+  const QByteArray tags = c.bytes();
+  if (!c.ok)
+    return false;
+
+  entry.key = {ms, id};
+  entry.msgid = QUuid::fromRfc4122(id).toByteArray(QUuid::WithoutBraces);
+  entry.time = QDateTime::fromMSecsSinceEpoch(ms).toUTC().toString(Qt::ISODateWithMs).toUtf8();
+  entry.account = account;
+  entry.tags = irc::encodeTags(flags & FLAG_BINARY_TAGS
+    ? message_codec::decode_tags(tags)
+    : QJsonDocument::fromJson(tags).toVariant().toMap());
+  entry.line = ":" + nick + "!" + user + "@" + host + " PRIVMSG " + (target.isEmpty() ? targets : target) + " :" + text;
+  return true;
+}
+
+QSharedPointer<MessageLog::Stream> MessageLog::stream(const QByteArray &name) {
+  QMutexLocker locker(&mtx_streams);
+  if (auto s = m_streams.value(name); !s.isNull())
+    return s;
+
+  auto s = QSharedPointer<Stream>::create();
+  s->dir = m_directory + QString::fromUtf8(name) + "/";
+  load(s.data());
+  m_streams.insert(name, s);
+  return s;
+}
+
+void MessageLog::load(Stream *s) {
+  const QStringList files = QDir(s->dir).entryList({"*.log"}, QDir::Files, QDir::Name);
+  for (int i = 0; i < files.size(); ++i) {
+    const QString path = s->dir + files[i].chopped(4);
+    const bool active = i == files.size() - 1;
+
+    qsizetype indexed = 0;
+    const auto seg = load_segment(path, active, indexed);
+    if (seg.isNull())
+      continue;
+    if (seg->size == 0) {
+      seg->doomed = true;
+      continue;
+    }
+
+    s->segments << seg;
+    if (active) {
+      s->active = seg;
+      s->blocks = seg->blocks;
+      s->size = seg->size;
+      s->indexed = indexed;
+    }
+  }
+}
+
+QSharedPointer<MessageLog::Segment> MessageLog::load_segment(const QString &path, const bool active, qsizetype &indexed) {
+  QFile log(path + ".log");
+  if (!log.open(QIODevice::ReadWrite)) {
+    qCritical() << "message log: could not open" << log.fileName() << log.errorString();
+    return {};
+  }
+  const qint64 file_size = log.size();
+
+  // the index is trusted as far as it is contiguous and inside the log; a
+  // block that kept growing after it was written shows up twice
+  QList<Block> blocks;
+  qsizetype raw_count = 0;
+  qint64 end = 0;
+  QFile idx(path + ".idx");
+  if (idx.open(QIODevice::ReadOnly)) {
+    const QByteArray data = idx.readAll();
+    raw_count = data.size() / static_cast<qsizetype>(sizeof(Block));
+    for (qsizetype i = 0; i < raw_count; ++i) {
+      Block b;
+      std::memcpy(&b, data.constData() + i * sizeof(Block), sizeof(Block));
+      if (b.count == 0 || static_cast<qint64>(b.offset + b.bytes) > file_size)
+        break;
+      if (!blocks.isEmpty() && b.offset == blocks.last().offset && b.bytes >= blocks.last().bytes)
+        blocks.last() = b;
+      else if (static_cast<qint64>(b.offset) == end)
+        blocks << b;
+      else
+        break;
+      end = static_cast<qint64>(blocks.last().offset + blocks.last().bytes);
+    }
+  }
+  indexed = blocks.size();
+
+  // whatever the index does not cover yet; a torn record ends the log
+  qint64 size = end;
+  if (file_size > end) {
+    const uchar *data = log.map(end, file_size - end);
+    if (data == nullptr) {
+      qCritical() << "message log: could not map" << log.fileName() << log.errorString();
+      return {};
+    }
+
+    const qsizetype valid = walk(reinterpret_cast<const char*>(data), file_size - end, [&](const qsizetype pos, const char *payload, const quint32 length) {
+      const qint64 offset = end + pos;
+      const auto ms = get<qint64>(payload);
+      const auto bytes = static_cast<quint32>(RECORD_HEADER + length);
+      if (blocks.isEmpty() || static_cast<qint64>(blocks.last().offset) < end || blocks.last().bytes >= BLOCK_BYTES) {
+        blocks << Block{static_cast<quint64>(offset), bytes, 1, ms, ms};
+        return;
+      }
+      auto &b = blocks.last();
+      b.bytes += bytes;
+      ++b.count;
+      b.min_ms = std::min(b.min_ms, ms);
+      b.max_ms = std::max(b.max_ms, ms);
+    });
+    log.unmap(const_cast<uchar*>(data));
+    size = end + valid;
+
+    if (size < file_size) {
+      qWarning() << "message log: cutting" << file_size - size << "bytes of torn records from" << log.fileName();
+      if (!log.resize(size))
+        qCritical() << "message log: could not truncate" << log.fileName() << log.errorString();
+    }
+  }
+  log.close();
+
+  auto seg = QSharedPointer<Segment>::create();
+  seg->path = path;
+  seg->base_ms = segment_base(path);
+  seg->size = size;
+  if (blocks.isEmpty())
+    return seg;
+
+  seg->min_ms = std::numeric_limits<qint64>::max();
+  seg->max_ms = std::numeric_limits<qint64>::min();
+  for (const auto &b: blocks) {
+    seg->min_ms = std::min(seg->min_ms, b.min_ms);
+    seg->max_ms = std::max(seg->max_ms, b.max_ms);
+  }
+
+  if (active) {
+    seg->blocks = blocks;
+    return seg;
+  }
+
+  if ((blocks.size() != raw_count || indexed != raw_count) && !write_index(path, blocks.constData(), blocks.size()))
+    return {};
+  if (!map_index(seg.data()))
+    return {};
+  return seg;
+}
+
+bool MessageLog::write_index(const QString &path, const Block *blocks, const qsizetype count) {
+  QSaveFile file(path + ".idx");
+  if (!file.open(QIODevice::WriteOnly)) {
+    qCritical() << "message log: could not write" << file.fileName() << file.errorString();
+    return false;
+  }
+  file.write(reinterpret_cast<const char*>(blocks), count * static_cast<qsizetype>(sizeof(Block)));
+  if (!file.commit()) {
+    qCritical() << "message log: could not write" << file.fileName() << file.errorString();
+    return false;
+  }
+  return true;
+}
+
+bool MessageLog::map_index(Segment *seg) {
+  seg->idx.setFileName(seg->path + ".idx");
+  if (!seg->idx.open(QIODevice::ReadOnly)) {
+    qCritical() << "message log: could not open" << seg->idx.fileName() << seg->idx.errorString();
+    return false;
+  }
+
+  const qsizetype count = seg->idx.size() / static_cast<qsizetype>(sizeof(Block));
+  const uchar *data = count > 0 ? seg->idx.map(0, count * static_cast<qsizetype>(sizeof(Block))) : nullptr;
+  // the mapping outlives the descriptor
+  seg->idx.close();
+  if (count > 0 && data == nullptr) {
+    qCritical() << "message log: could not map" << seg->idx.fileName();
+    return false;
+  }
+
+  seg->mapped = reinterpret_cast<const Block*>(data);
+  seg->mapped_count = count;
+  seg->blocks.clear();
+  return true;
+}
+
+bool MessageLog::read_block(const QString &path, const Block &block, QList<Record> &records) {
+  QFile file(path + ".log");
+  if (!file.open(QIODevice::ReadOnly) || !file.seek(static_cast<qint64>(block.offset))) {
+    qCritical() << "message log: could not read" << file.fileName() << file.errorString();
+    return false;
+  }
+
+  const QByteArray data = file.read(block.bytes);
+  const qsizetype valid = walk(data.constData(), data.size(), [&](qsizetype, const char *payload, const quint32 length) {
+    Record rec;
+    rec.ms = get<qint64>(payload);
+    rec.id = QByteArray(payload + 8, 16);
+    rec.payload = QByteArray(payload, length);
+    records << std::move(rec);
+  });
+
+  if (valid != block.bytes) {
+    qCritical() << "message log: corrupt block at" << block.offset << "in" << file.fileName();
+    return false;
+  }
+  return true;
+}
+
+bool MessageLog::append(const QList<sql::MessageRow> &rows) {
+  // encoded once, shared by every stream the row goes to
+  QHash<QByteArray, QList<Record>> batches;
+  for (const auto &row: rows) {
+    Record rec;
+    rec.ms = row.creation_date.toMSecsSinceEpoch();
+    rec.id = row.id.toRfc4122();
+    rec.payload = encode(row);
+
+    if (!row.channel_id.isNull()) {
+      batches[channel_stream(row.channel_id)] << rec;
+    } else if (!row.recipient_id.isNull()) {
+      batches[account_stream(row.recipient_id)] << rec;
+      if (!row.sender_id.isNull() && row.sender_id != row.recipient_id)
+        batches[account_stream(row.sender_id)] << rec;
+    } else {
+      batches["misc"] << rec;
+    }
+  }
+
+  bool ok = true;
+  QList<QSharedPointer<Stream>> touched;
+  for (auto it = batches.constBegin(); it != batches.constEnd(); ++it) {
+    const auto s = stream(it.key());
+    if (!write(s.data(), it.value())) {
+      rollback(s.data());
+      ok = false;
+      continue;
+    }
+    touched << s;
+  }
+
+  // group commit: one fsync per segment for the whole batch
+  for (const auto &s: touched) {
+    if (!commit(s.data())) {
+      rollback(s.data());
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool MessageLog::write(Stream *s, const QList<Record> &records) {
+  QByteArray out;
+  for (const auto &rec: records) {
+    const auto bytes = static_cast<quint32>(RECORD_HEADER + rec.payload.size());
+
+    // a new day starts a new segment, so retention drops whole files; a
+    // late record from the day before stays where it is
+    const bool full = s->size > 0 && s->size + bytes > SEGMENT_BYTES;
+    if (s->active.isNull() || full || rec.ms / MS_PER_DAY > s->active->base_ms / MS_PER_DAY) {
+      if (!out.isEmpty()) {
+        if (s->log->write(out) != out.size())
+          return false;
+        out.clear();
+      }
+      if (!roll(s, rec.ms))
+        return false;
+    }
+
+    if (!open_log(s))
+      return false;
+
+    if (s->blocks.isEmpty() || s->blocks.last().bytes >= BLOCK_BYTES) {
+      s->blocks << Block{static_cast<quint64>(s->size), bytes, 1, rec.ms, rec.ms};
+    } else {
+      auto &b = s->blocks.last();
+      b.bytes += bytes;
+      ++b.count;
+      b.min_ms = std::min(b.min_ms, rec.ms);
+      b.max_ms = std::max(b.max_ms, rec.ms);
+    }
+
+    put<quint32>(out, rec.payload.size());
+    put<quint32>(out, checksum(rec.payload.constData(), rec.payload.size()));
+    out.append(rec.payload);
+    s->size += bytes;
+    s->dirty = true;
+  }
+
+  if (!out.isEmpty() && s->log->write(out) != out.size())
+    return false;
+  s->last_write_ms = QDateTime::currentMSecsSinceEpoch();
+  return true;
+}
+
+bool MessageLog::commit(Stream *s) {
+  if (!s->dirty)
+    return true;
+
+  if (!s->log->flush() || ::fsync(s->log->handle()) != 0) {
+    qCritical() << "message log: could not sync" << s->log->fileName() << s->log->errorString();
+    return false;
+  }
+  s->dirty = false;
+
+  // closed blocks go to the index, unsynced; a lost entry is rebuilt from
+  // the log on the next start
+  if (s->blocks.size() - 1 > s->indexed) {
+    QFile idx(s->active->path + ".idx");
+    if (idx.open(QIODevice::WriteOnly | QIODevice::Append)) {
+      const qsizetype count = s->blocks.size() - 1 - s->indexed;
+      idx.write(reinterpret_cast<const char*>(s->blocks.constData() + s->indexed), count * static_cast<qsizetype>(sizeof(Block)));
+      s->indexed += count;
+    }
+  }
+
+  qint64 min_ms = std::numeric_limits<qint64>::max();
+  qint64 max_ms = std::numeric_limits<qint64>::min();
+  for (const auto &b: s->blocks) {
+    min_ms = std::min(min_ms, b.min_ms);
+    max_ms = std::max(max_ms, b.max_ms);
+  }
+
+  QMutexLocker locker(&s->mtx_lock);
+  s->active->blocks = s->blocks;
+  s->active->size = s->size;
+  s->active->min_ms = min_ms;
+  s->active->max_ms = max_ms;
+  return true;
+}
+
+void MessageLog::rollback(Stream *s) {
+  // back to what readers have seen; the batch is retried as a whole
+  close_log(s);
+  s->dirty = false;
+  if (s->active.isNull())
+    return;
+
+  {
+    QMutexLocker locker(&s->mtx_lock);
+    s->blocks = s->active->blocks;
+    s->size = s->active->size;
+  }
+  s->indexed = std::min(s->indexed, s->blocks.size());
+  if (!QFile::resize(s->active->path + ".log", s->size))
+    qCritical() << "message log: could not roll back" << s->active->path + ".log";
+}
+
+bool MessageLog::roll(Stream *s, const qint64 ms) {
+  if (!s->active.isNull() && !seal(s))
+    return false;
+
+  if (!QDir().mkpath(s->dir)) {
+    qCritical() << "message log: could not create" << s->dir;
+    return false;
+  }
+
+  auto seg = QSharedPointer<Segment>::create();
+  seg->path = segment_name(s->dir, ms, 0);
+  seg->base_ms = ms;
+  seg->min_ms = ms;
+  seg->max_ms = ms;
+
+  s->active = seg;
+  s->blocks.clear();
+  s->size = 0;
+  s->indexed = 0;
+  if (!open_log(s)) {
+    s->active.reset();
+    return false;
+  }
+
+  QMutexLocker locker(&s->mtx_lock);
+  s->segments << seg;
+  return true;
+}
+
+bool MessageLog::seal(Stream *s) {
+  if (!commit(s))
+    return false;
+  close_log(s);
+
+  const auto seg = s->active;
+  if (!write_index(seg->path, s->blocks.constData(), s->blocks.size()))
+    return false;
+
+  {
+    QMutexLocker locker(&s->mtx_lock);
+    if (!map_index(seg.data()))
+      return false;
+  }
+
+  s->active.reset();
+  s->blocks.clear();
+  s->size = 0;
+  s->indexed = 0;
+  return true;
+}
+
+bool MessageLog::open_log(Stream *s) {
+  if (s->log != nullptr)
+    return true;
+
+  // a descriptor per active channel adds up; the least recently written
+  // stream that has nothing uncommitted gives its up
+  if (m_open_files >= MAX_OPEN_FILES) {
+    QMutexLocker locker(&mtx_streams);
+    Stream *victim = nullptr;
+    for (const auto &other: m_streams) {
+      if (other->log == nullptr || other->dirty || other.data() == s)
+        continue;
+      if (victim == nullptr || other->last_write_ms < victim->last_write_ms)
+        victim = other.data();
+    }
+    if (victim != nullptr)
+      close_log(victim);
+  }
+
+  s->log = std::make_unique<QFile>(s->active->path + ".log");
+  if (!s->log->open(QIODevice::WriteOnly | QIODevice::Append)) {
+    qCritical() << "message log: could not open" << s->log->fileName() << s->log->errorString();
+    s->log.reset();
+    return false;
+  }
+  ++m_open_files;
+  return true;
+}
+
+void MessageLog::close_log(Stream *s) {
+  if (s->log == nullptr)
+    return;
+  s->log->close();
+  s->log.reset();
+  --m_open_files;
+}
+
+QList<HistoryEntry> MessageLog::channel_range(
+    const QUuid &channel_id,
+    const QByteArray &target,
+    const HistoryKey &lo,
+    const HistoryKey &hi,
+    const bool backward,
+    const int limit,
+    const bool inclusive_lo) {
+  return range(channel_stream(channel_id), target, lo, hi, backward, limit, inclusive_lo);
+}
+
+QList<HistoryEntry> MessageLog::private_range(
+    const QUuid &account_id,
+    const HistoryKey &lo,
+    const HistoryKey &hi,
+    const bool backward,
+    const int limit,
+    const bool inclusive_lo,
+    const QUuid &peer) {
+  return range(account_stream(account_id), {}, lo, hi, backward, limit, inclusive_lo,
+               peer.isNull() ? QByteArray() : peer.toRfc4122());
+}
+
+QList<HistoryEntry> MessageLog::range(
+    const QByteArray &name,
+    const QByteArray &target,
+    const HistoryKey &lo,
+    const HistoryKey &hi,
+    const bool backward,
+    const int limit,
+    const bool inclusive_lo,
+    const QByteArray &peer) {
+  QList<HistoryEntry> entries;
+  if (limit <= 0)
+    return entries;
+
+  const auto s = stream(name);
+  QList<View> views;
+  {
+    QMutexLocker locker(&s->mtx_lock);
+    views.reserve(s->segments.size());
+    for (const auto &seg: s->segments) {
+      auto &v = views.emplace_back();
+      v.segment = seg;
+      v.min_ms = seg->min_ms;
+      v.max_ms = seg->max_ms;
+      if (seg->mapped != nullptr) {
+        v.blocks = seg->mapped;
+        v.count = seg->mapped_count;
+      } else {
+        v.owned = seg->blocks;
+        v.blocks = v.owned.constData();
+        v.count = v.owned.size();
+      }
+    }
+  }
+
+  const auto by_key = [](const HistoryEntry &a, const HistoryEntry &b) { return a.key < b.key; };
+
+  // entries stays sorted and at most `limit` long, so once it is full a
+  // block can be skipped when none of its keys would make the cut
+  const auto skip = [&](const qint64 min_ms, const qint64 max_ms) {
+    if (max_ms < lo.first || min_ms > hi.first)
+      return true;
+    if (entries.size() < limit)
+      return false;
+    return backward ? max_ms < entries.first().key.first : min_ms > entries.last().key.first;
+  };
+
+  QSet<QByteArray> seen;
+  QList<Record> records;
+  for (qsizetype i = 0; i < views.size(); ++i) {
+    const auto &v = views.at(backward ? views.size() - 1 - i : i);
+    if (v.count == 0 || skip(v.min_ms, v.max_ms))
+      continue;
+
+    for (qsizetype j = 0; j < v.count; ++j) {
+      const Block &block = v.blocks[backward ? v.count - 1 - j : j];
+      if (skip(block.min_ms, block.max_ms))
+        continue;
+
+      records.clear();
+      if (!read_block(v.segment->path, block, records))
+        continue;
+
+      for (const auto &rec: records) {
+        const HistoryKey key{rec.ms, rec.id};
+        if ((inclusive_lo ? key < lo : key <= lo) || !(key < hi) || seen.contains(rec.id))
+          continue;
+
+        HistoryEntry entry;
+        if (!decode(rec.payload.constData(), rec.payload.size(), entry, target, peer))
+          continue;
+        seen.insert(rec.id);
+        entries << std::move(entry);
+      }
+
+      std::sort(entries.begin(), entries.end(), by_key);
+      if (entries.size() > limit) {
+        if (backward)
+          entries.remove(0, entries.size() - limit);
+        else
+          entries.resize(limit);
+      }
+    }
+  }
+
+  return entries;
+}
+
+void MessageLog::maintain() {
+  const qint64 cutoff = m_retention_days > 0 ?
+    QDateTime::currentMSecsSinceEpoch() - m_retention_days * MS_PER_DAY :
+    std::numeric_limits<qint64>::min();
+
+  // also the streams nobody touched since the start
+  const QStringList names = QDir(m_directory).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+  for (const auto &name: names) {
+    const auto s = stream(name.toUtf8());
+    retain(s.data(), cutoff);
+    compact(s.data());
+  }
+
+  close_idle(IDLE_CLOSE_MS);
+}
+
+void MessageLog::retain(Stream *s, const qint64 cutoff_ms) {
+  QList<QSharedPointer<Segment>> expired;
+  {
+    QMutexLocker locker(&s->mtx_lock);
+    for (auto it = s->segments.begin(); it != s->segments.end();) {
+      if ((*it)->max_ms < cutoff_ms) {
+        expired << *it;
+        it = s->segments.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  if (expired.isEmpty())
+    return;
+
+  for (const auto &seg: expired) {
+    if (seg == s->active) {
+      close_log(s);
+      s->active.reset();
+      s->blocks.clear();
+      s->size = 0;
+      s->indexed = 0;
+    }
+    // deleted once running reads are done with it
+    seg->doomed = true;
+  }
+  qInfo() << "message log: retention removed" << expired.size() << "segments from" << s->dir;
+}
+
+void MessageLog::compact(Stream *s) {
+  QList<QSharedPointer<Segment>> segments;
+  {
+    QMutexLocker locker(&s->mtx_lock);
+    segments = s->segments;
+  }
+  if (!s->active.isNull())
+    segments.removeAll(s->active);
+
+  // runs of small neighbours, not spanning so much time that retention
+  // would keep them around for long
+  qsizetype i = 0;
+  while (i < segments.size()) {
+    qsizetype j = i;
+    qint64 total = 0;
+    while (j < segments.size() &&
+           segments[j]->size < SEGMENT_BYTES / 4 &&
+           total + segments[j]->size <= SEGMENT_BYTES &&
+           segments[j]->max_ms - segments[i]->min_ms <= COMPACT_SPAN_MS) {
+      total += segments[j]->size;
+      ++j;
+    }
+
+    if (j - i >= 2)
+      merge(s, segments.mid(i, j - i));
+    i = std::max(j, i + 1);
+  }
+}
+
+bool MessageLog::merge(Stream *s, const QList<QSharedPointer<Segment>> &run) {
+  QList<Record> records;
+  QSet<QByteArray> seen;
+  qsizetype duplicates = 0;
+  for (const auto &seg: run) {
+    QList<Record> block_records;
+    for (qsizetype i = 0; i < seg->mapped_count; ++i) {
+      block_records.clear();
+      if (!read_block(seg->path, seg->mapped[i], block_records))
+        return false;
+      for (auto &rec: block_records) {
+        if (seen.contains(rec.id)) {
+          ++duplicates;
+          continue;
+        }
+        seen.insert(rec.id);
+        records << std::move(rec);
+      }
+    }
+  }
+
+  std::stable_sort(records.begin(), records.end(), [](const Record &a, const Record &b) {
+    return a.ms != b.ms ? a.ms < b.ms : a.id < b.id;
+  });
+
+  int generation = 0;
+  for (const auto &seg: run)
+    generation = std::max(generation, segment_generation(seg->path));
+
+  auto merged = QSharedPointer<Segment>::create();
+  merged->base_ms = run.first()->base_ms;
+  merged->path = segment_name(s->dir, merged->base_ms, generation + 1);
+
+  QList<Block> blocks;
+  QByteArray out;
+  for (const auto &rec: records) {
+    const auto bytes = static_cast<quint32>(RECORD_HEADER + rec.payload.size());
+    if (blocks.isEmpty() || blocks.last().bytes >= BLOCK_BYTES) {
+      blocks << Block{static_cast<quint64>(out.size()), bytes, 1, rec.ms, rec.ms};
+    } else {
+      auto &b = blocks.last();
+      b.bytes += bytes;
+      ++b.count;
+      b.max_ms = rec.ms;
+    }
+    put<quint32>(out, rec.payload.size());
+    put<quint32>(out, checksum(rec.payload.constData(), rec.payload.size()));
+    out.append(rec.payload);
+  }
+
+  QSaveFile log(merged->path + ".log");
+  if (!log.open(QIODevice::WriteOnly) || log.write(out) != out.size() || !log.commit()) {
+    qCritical() << "message log: could not write" << log.fileName() << log.errorString();
+    return false;
+  }
+  if (!write_index(merged->path, blocks.constData(), blocks.size()) || !map_index(merged.data())) {
+    QFile::remove(merged->path + ".log");
+    return false;
+  }
+
+  merged->size = out.size();
+  merged->min_ms = records.isEmpty() ? 0 : records.first().ms;
+  merged->max_ms = records.isEmpty() ? 0 : records.last().ms;
+
+  {
+    QMutexLocker locker(&s->mtx_lock);
+    const qsizetype at = s->segments.indexOf(run.first());
+    for (const auto &seg: run)
+      s->segments.removeAll(seg);
+    s->segments.insert(std::max<qsizetype>(at, 0), merged);
+  }
+
+  // a crash before these are gone leaves both copies; reads skip the
+  // repeated ids and the next compaction drops them
+  for (const auto &seg: run)
+    seg->doomed = true;
+
+  qInfo() << "message log: compacted" << run.size() << "segments in" << s->dir << "," << duplicates << "duplicates dropped";
+  return true;
+}
+
+void MessageLog::close_idle(const qint64 idle_ms) {
+  const qint64 now = QDateTime::currentMSecsSinceEpoch();
+  QMutexLocker locker(&mtx_streams);
+  for (const auto &s: m_streams) {
+    if (s->log != nullptr && !s->dirty && now - s->last_write_ms >= idle_ms)
+      close_log(s.data());
+  }
+}
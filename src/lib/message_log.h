@@ -0,0 +1,186 @@
+#pragma once
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QUuid>
+
+#include <atomic>
+#include <memory>
+
+#include "core/history.h"
+#include "lib/sql.h"
+
+// append-only message store on the local disk, used instead of the
+// messages table with --message-store log. Relational data stays in the
+// database; only the message stream lands here.
+//
+// every channel, and every account for its private messages, is a stream:
+// a directory of segment files named after the first message they hold.
+// Records go to the newest segment; it is sealed at SEGMENT_BYTES or when
+// the day changes, so retention can drop whole files.
+//
+// a segment is cut into blocks of ~BLOCK_BYTES. Its .idx file has one
+// entry per block (offset, size, oldest and newest timestamp) and is
+// mmapped once the segment is sealed, so a range query only reads the
+// blocks that can hold matching keys. Message ids are time-ordered, but
+// batches from several workers are not strictly so; blocks bound their
+// keys instead of assuming order, and results are sorted after reading.
+//
+// append() is the group commit: the whole batch is written, then every
+// touched segment is fsynced once. A torn tail from a crash fails its
+// checksum and is cut off when the stream is opened. Retried batches may
+// repeat records; reads skip duplicate ids and compaction drops them.
+//
+// maintain() deletes segments past the retention period and merges runs
+// of small sealed segments (quiet channels seal one a day) into one.
+//
+// append() and maintain() are called from the message writer thread
+// only; range() from any thread.
+class MessageLog {
+public:
+  explicit MessageLog(const QString &directory, int retention_days);
+  ~MessageLog();
+
+  // channel messages go to the channel, private messages to both sides
+  bool append(const QList<sql::MessageRow> &rows);
+
+  // same semantics as HistoryRing::range(); channel messages get `target`,
+  // private ones the target they were sent to, and only those exchanged
+  // with `peer` when it is set
+  QList<HistoryEntry> channel_range(
+    const QUuid &channel_id,
+    const QByteArray &target,
+    const HistoryKey &lo,
+    const HistoryKey &hi,
+    bool backward,
+    int limit,
+    bool inclusive_lo);
+  QList<HistoryEntry> private_range(
+    const QUuid &account_id,
+    const HistoryKey &lo,
+    const HistoryKey &hi,
+    bool backward,
+    int limit,
+    bool inclusive_lo,
+    const QUuid &peer = QUuid());
+
+  // retention, compaction of small sealed segments, closing idle files
+  void maintain();
+
+  static constexpr qint64 SEGMENT_BYTES = 64 * 1024 * 1024;
+  static constexpr qint64 BLOCK_BYTES = 16 * 1024;
+  static constexpr int MAX_OPEN_FILES = 256;
+  static constexpr int MAINTAIN_INTERVAL_MS = 10 * 60 * 1000;
+
+private:
+  #pragma pack(push, 1)
+  struct Block {
+    quint64 offset;
+    quint32 bytes;
+    quint32 count;
+    qint64 min_ms;
+    qint64 max_ms;
+  };
+  #pragma pack(pop)
+  static_assert(sizeof(Block) == 32);
+
+  struct Record {
+    qint64 ms = 0;
+    QByteArray id;  // rfc4122
+    QByteArray payload;
+  };
+
+  struct Segment {
+    ~Segment();
+
+    QString path;  // without extension
+    qint64 base_ms = 0;  // from the name, the first record written
+    qint64 size = 0;
+    qint64 min_ms = 0;
+    qint64 max_ms = 0;
+
+    // sealed: the mmapped .idx
+    QFile idx;
+    const Block *mapped = nullptr;
+    qsizetype mapped_count = 0;
+    // active: what readers may see of it, the last block still grows
+    QList<Block> blocks;
+
+    // removed from disk once the last reader lets go
+    std::atomic<bool> doomed = false;
+  };
+
+  struct Stream {
+    QString dir;
+    QMutex mtx_lock;  // segments, and the active segment's blocks and bounds
+    QList<QSharedPointer<Segment>> segments;
+
+    // writer thread only; ahead of the segment until commit()
+    QSharedPointer<Segment> active;
+    std::unique_ptr<QFile> log;
+    QList<Block> blocks;
+    qint64 size = 0;
+    qsizetype indexed = 0;  // blocks already in the .idx
+    bool dirty = false;
+    qint64 last_write_ms = 0;
+  };
+
+  // what a reader looked at, stable while the writer moves on
+  struct View {
+    QSharedPointer<Segment> segment;
+    qint64 min_ms = 0;
+    qint64 max_ms = 0;
+    QList<Block> owned;
+    const Block *blocks = nullptr;
+    qsizetype count = 0;
+  };
+
+  QSharedPointer<Stream> stream(const QByteArray &name);
+  QList<HistoryEntry> range(
+    const QByteArray &name,
+    const QByteArray &target,
+    const HistoryKey &lo,
+    const HistoryKey &hi,
+    bool backward,
+    int limit,
+    bool inclusive_lo,
+    const QByteArray &peer = {});
+
+  void load(Stream *s);
+  static QSharedPointer<Segment> load_segment(const QString &path, bool active, qsizetype &indexed);
+  static bool map_index(Segment *seg);
+  static bool write_index(const QString &path, const Block *blocks, qsizetype count);
+  static bool read_block(const QString &path, const Block &block, QList<Record> &records);
+
+  bool write(Stream *s, const QList<Record> &records);
+  bool commit(Stream *s);
+  void rollback(Stream *s);
+  bool roll(Stream *s, qint64 ms);
+  bool seal(Stream *s);
+  bool open_log(Stream *s);
+  void close_log(Stream *s);
+
+  void retain(Stream *s, qint64 cutoff_ms);
+  void compact(Stream *s);
+  bool merge(Stream *s, const QList<QSharedPointer<Segment>> &run);
+  void close_idle(qint64 idle_ms);
+
+  static QByteArray encode(const sql::MessageRow &row);
+  // false for TAGMSG, which has no place in history
+  // false for tag messages, and with `peer` (rfc4122) for messages neither
+  // from nor to it
+  static bool decode(const char *payload, quint32 size, HistoryEntry &entry, const QByteArray &target, const QByteArray &peer = {});
+
+  static constexpr qint64 IDLE_CLOSE_MS = 10 * 60 * 1000;
+  static constexpr qint64 COMPACT_SPAN_MS = 7LL * 24 * 60 * 60 * 1000;
+
+  QString m_directory;
+  int m_retention_days;
+
+  QMutex mtx_streams;
+  QHash<QByteArray, QSharedPointer<Stream>> m_streams;
+  int m_open_files = 0;  // writer thread only
+};
@@ -0,0 +1,163 @@
+#include <QThread>
+#include <QDebug>
+
+#include "lib/message_writer.h"
+#include "core/qtypes.h"
+
+MessageWriter::MessageWriter(
+    const int capacity,
+    const int batch_size,
+    const int flush_ms,
+    const Overflow overflow,
+    const bool at_least_once,
+    QObject *parent) :
+    QObject(parent),
+    m_messages(capacity, &sql::insert_messages),
+    m_events(capacity, &sql::insert_events),
+    m_batch_size(batch_size),
+    m_flush_ms(flush_ms),
+    m_overflow(overflow),
+    m_at_least_once(at_least_once) {}
+
+void MessageWriter::start() {
+  m_timer = new QTimer(this);
+  m_timer->setInterval(m_flush_ms);
+  connect(m_timer, &QTimer::timeout, this, &MessageWriter::flush);
+  m_timer->start();
+  m_messages.retry_clock.start();
+  m_events.retry_clock.start();
+}
+
+bool MessageWriter::enqueue(const QSharedPointer<QEventMessage> &msg) {
+  if (msg.isNull())
+    return false;
+  return push(m_messages, sql::message_row(msg));
+}
+
+bool MessageWriter::enqueue(sql::EventRow row) {
+  return push(m_events, std::move(row));
+}
+
+template <typename Row>
+bool MessageWriter::push(Lane<Row> &lane, Row &&row) {
+  if (!lane.queue.try_push(std::move(row))) {
+    if (m_overflow == Overflow::Drop) {
+      if (m_dropped++ % 1000 == 0)
+        qWarning() << "message writer: queue full, rows are not persisted";
+      return false;
+    }
+
+    // backpressure; the sender sleeps until the writer popped a batch.
+    // m_waiting goes up before the retry, so a pop in between still wakes us
+    QMutexLocker locker(&mtx_room);
+    ++m_waiting;
+    while (!lane.queue.try_push(std::move(row))) {
+      wake();
+      m_room.wait(&mtx_room, BLOCK_WAIT_MS);
+    }
+    --m_waiting;
+  }
+
+  if (lane.queue.size_approx() >= static_cast<size_t>(m_batch_size))
+    wake();
+  return true;
+}
+
+void MessageWriter::wake() {
+  if (!m_wake_pending.exchange(true))
+    QMetaObject::invokeMethod(this, &MessageWriter::flush, Qt::QueuedConnection);
+}
+
+void MessageWriter::flush() {
+  m_wake_pending = false;
+  flush_lane(m_messages);
+  flush_lane(m_events);
+}
+
+template <typename Row>
+void MessageWriter::flush_lane(Lane<Row> &lane) {
+  // a failed batch is retried at a slower pace, the database is probably down
+  if (!lane.retry.isEmpty() && lane.retry_clock.elapsed() < RETRY_MS)
+    return;
+
+  for (int i = 0; i < MAX_BATCHES_PER_FLUSH; ++i) {
+    if (!write_batch(lane, m_batch_size))
+      break;
+  }
+}
+
+template <typename Row>
+bool MessageWriter::write_batch(Lane<Row> &lane, const int max_rows) {
+  QList<Row> rows;
+  if (!lane.retry.isEmpty()) {
+    rows = std::move(lane.retry);
+    lane.retry.clear();
+  } else {
+    rows.reserve(max_rows);
+    Row row;
+    while (rows.size() < max_rows && lane.queue.try_pop(row))
+      rows << std::move(row);
+
+    // pairs with ++m_waiting; either the producer sees the free cell or we see it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!rows.isEmpty() && m_waiting.load() > 0) {
+      QMutexLocker locker(&mtx_room);
+      m_room.wakeAll();
+    }
+  }
+
+  if (rows.isEmpty())
+    return false;
+
+  bool ok = false;
+  try {
+    ok = lane.insert(rows);
+  } catch (const std::exception &ex) {
+    qCritical() << "message writer:" << ex.what();
+  }
+
+  if (!ok) {
+    if (m_at_least_once) {
+      lane.retry = std::move(rows);
+      lane.retry_size = lane.retry.size();
+      lane.retry_clock.restart();
+    } else {
+      m_dropped += rows.size();
+    }
+    return false;
+  }
+
+  lane.retry_size = 0;
+  m_written += rows.size();
+  return rows.size() >= max_rows;
+}
+
+template <typename Row>
+void MessageWriter::drain(Lane<Row> &lane, const char *what) {
+  int attempts = 0;
+  while (attempts < 3) {
+    if (write_batch(lane, m_batch_size))
+      continue;
+    if (lane.retry.isEmpty() && lane.queue.size_approx() == 0)
+      break;
+    if (!lane.retry.isEmpty()) {
+      ++attempts;
+      QThread::msleep(RETRY_MS / 4);
+    }
+  }
+
+  if (const size_t lost = lane.queue.size_approx() + lane.retry_size; lost > 0) {
+    m_dropped += lost;
+    qCritical() << "message writer: could not persist" << lost << what << "on shutdown";
+  }
+}
+
+void MessageWriter::stop() {
+  if (m_timer != nullptr)
+    m_timer->stop();
+
+  drain(m_messages, "messages");
+  drain(m_events, "events");
+
+  qInfo() << "message writer: stopped," << m_written.load() << "written," << m_dropped.load() << "dropped";
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QList>
+#include <QSharedPointer>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+
+#include "lib/bounded_queue.h"
+#include "lib/sql.h"
+
+class QEventMessage;
+
+// write-behind persistence for chat messages and channel events, each in
+// its own lane. Workers push flattened rows
+// into a bounded lock-free queue and move on with the fan-out; a writer
+// thread drains it in multi-row INSERTs, either once a full batch has
+// piled up or every `flush_ms`, whichever comes first.
+//
+// when the queue is full, producers either wait for the writer (block) or
+// the message is not persisted (drop). With at-least-once, a batch that
+// fails to insert is kept and retried; otherwise it is logged and lost.
+class MessageWriter final : public QObject {
+  Q_OBJECT
+
+public:
+  enum class Overflow { Block, Drop };
+
+  explicit MessageWriter(
+    int capacity,
+    int batch_size,
+    int flush_ms,
+    Overflow overflow,
+    bool at_least_once,
+    QObject *parent = nullptr);
+
+  // thread-safe. false when the row was dropped
+  bool enqueue(const QSharedPointer<QEventMessage> &msg);
+  bool enqueue(sql::EventRow row);
+
+  // writer thread
+  void start();
+  // writer thread; drains everything that is still queued
+  void stop();
+
+  [[nodiscard]] quint64 written() const { return m_written; }
+  [[nodiscard]] quint64 dropped() const { return m_dropped; }
+  [[nodiscard]] size_t pending() const {
+    return m_messages.queue.size_approx() + m_messages.retry_size +
+           m_events.queue.size_approx() + m_events.retry_size;
+  }
+
+private:
+  template <typename Row>
+  struct Lane {
+    using Insert = bool (*)(const QList<Row> &);
+    Lane(const int capacity, const Insert insert) : queue(capacity), insert(insert) {}
+
+    BoundedQueue<Row> queue;
+    Insert insert;
+
+    // rows of a failed batch, retried before anything new (writer thread only)
+    QList<Row> retry;
+    std::atomic<size_t> retry_size = 0;
+    QElapsedTimer retry_clock;
+  };
+
+  void wake();
+  void flush();
+  template <typename Row> bool push(Lane<Row> &lane, Row &&row);
+  template <typename Row> void flush_lane(Lane<Row> &lane);
+  template <typename Row> bool write_batch(Lane<Row> &lane, int max_rows);
+  template <typename Row> void drain(Lane<Row> &lane, const char *what);
+
+  static constexpr int MAX_BATCHES_PER_FLUSH = 16;
+  static constexpr qint64 RETRY_MS = 1000;
+  // upper bound per wait, in case the writer is stuck on the database
+  static constexpr unsigned long BLOCK_WAIT_MS = 100;
+
+  Lane<sql::MessageRow> m_messages;
+  Lane<sql::EventRow> m_events;
+  int m_batch_size;
+  int m_flush_ms;
+  Overflow m_overflow;
+  bool m_at_least_once;
+
+  std::atomic<bool> m_wake_pending = false;
+
+  // producers blocked on a full queue sleep here until a batch is popped
+  QMutex mtx_room;
+  QWaitCondition m_room;
+  std::atomic<int> m_waiting = 0;
+
+  std::atomic<quint64> m_written = 0;
+  std::atomic<quint64> m_dropped = 0;
+
+  QTimer *m_timer = nullptr;
+};
@@ -0,0 +1,112 @@
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QDebug>
+
+#include <algorithm>
+
+#include "lib/password_verifier.h"
+#include "lib/bcrypt/bcrypt.h"
+#include "lib/bcrypt/eksblowfish.h"
+
+PasswordVerifier::PasswordVerifier(const int threads, const int queue_limit) :
+    m_limit(std::max(1, threads) + std::max(0, queue_limit)) {
+  m_pool.setMaxThreadCount(std::max(1, threads));
+  m_pool.setObjectName("passwords");
+}
+
+PasswordVerifier::~PasswordVerifier() {
+  m_pool.waitForDone();
+}
+
+bool PasswordVerifier::submit(const QByteArray &candidate, const QByteArray &hash, Done done) {
+  // reserve a slot first; the check and the increment are one step
+  if (m_queued.fetch_add(1) >= m_limit) {
+    --m_queued;
+    ++m_rejected;
+    return false;
+  }
+  ++m_submitted;
+
+  QElapsedTimer queued;
+  queued.start();
+  {
+    QMutexLocker locker(&mtx_pending);
+    m_pending.append({candidate, hash, std::move(done), queued});
+  }
+  // one task per check; a task that finds the queue emptied by an
+  // earlier batch returns right away
+  m_pool.start([this] { drain(); });
+  return true;
+}
+
+void PasswordVerifier::drain() {
+  QList<Pending> batch;
+  {
+    QMutexLocker locker(&mtx_pending);
+    const int count = std::min<int>(bcrypt::eks::LANES, m_pending.size());
+    batch = m_pending.mid(0, count);
+    m_pending.remove(0, count);
+  }
+  if (batch.isEmpty())
+    return;
+
+  std::vector<std::pair<std::string, std::string>> checks;
+  checks.reserve(batch.size());
+  for (const auto &pending: batch) {
+    const quint64 wait = pending.queued.nsecsElapsed() / 1000;
+    m_wait_us += wait;
+    quint64 max = m_wait_max_us;
+    while (wait > max && !m_wait_max_us.compare_exchange_weak(max, wait)) {}
+    checks.emplace_back(pending.candidate.toStdString(), pending.hash.toStdString());
+  }
+  if (batch.size() > 1)
+    m_batched += batch.size();
+
+  QElapsedTimer timer;
+  timer.start();
+  const std::vector<bool> valid = bcrypt::validatePasswords(checks);
+  m_verify_us += timer.nsecsElapsed() / 1000 * batch.size();
+
+  for (int i = 0; i < batch.size(); ++i) {
+    if (!valid[i])
+      ++m_failed;
+    --m_queued;
+    batch[i].done(valid[i]);
+  }
+}
+
+PasswordVerifier::Result PasswordVerifier::verify(const QByteArray &candidate, const QByteArray &hash) {
+  QSemaphore finished;
+  bool result = false;
+  const bool accepted = submit(candidate, hash, [&finished, &result](const bool valid) {
+    result = valid;
+    finished.release();
+  });
+  if (!accepted)
+    return Result::Overloaded;
+
+  finished.acquire();
+  return result ? Result::Ok : Result::Bad;
+}
+
+PasswordVerifier::Stats PasswordVerifier::stats() const {
+  Stats s;
+  s.threads = m_pool.maxThreadCount();
+  s.queued = m_queued;
+  s.submitted = m_submitted;
+  s.rejected = m_rejected;
+  s.failed = m_failed;
+  s.wait_us = m_wait_us;
+  s.wait_max_us = m_wait_max_us;
+  s.verify_us = m_verify_us;
+  s.batched = m_batched;
+  return s;
+}
+
+void PasswordVerifier::log_stats() const {
+  const auto s = stats();
+  const quint64 done = std::max<quint64>(1, s.submitted);
+  qInfo() << "passwords:" << s.submitted << "checked," << s.failed << "bad," << s.rejected << "rejected as overloaded;"
+          << "avg wait" << s.wait_us / done / 1000 << "ms (max" << s.wait_max_us / 1000 << "ms), avg check"
+          << s.verify_us / done / 1000 << "ms (" << s.batched << "batched)," << s.threads << "threads";
+}
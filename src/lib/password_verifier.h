@@ -0,0 +1,75 @@
+#pragma once
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+
+#include <atomic>
+#include <functional>
+
+// bcrypt checks on threads of their own. A check costs tens of milliseconds;
+// run inline it stalls every other client of an IRC worker, and a reconnect
+// storm stalls all of them. Callers hand the check over and get the result
+// through `done` on a pool thread (IRC connections post it back to their
+// worker).
+//
+// at most `threads` checks run and `queue_limit` wait; past that submit()
+// refuses right away, so an overloaded server answers "try again" instead
+// of queueing logins that time out on the client anyway.
+//
+// checks waiting in the queue are taken up to bcrypt::eks::LANES at a time
+// and computed together, which roughly doubles throughput per thread once
+// there is a backlog. A lone check still runs by itself.
+class PasswordVerifier {
+public:
+  enum class Result { Ok, Bad, Overloaded };
+  using Done = std::function<void(bool valid)>;
+
+  PasswordVerifier(int threads, int queue_limit);
+  ~PasswordVerifier();
+
+  // thread-safe. false when overloaded; `done` is not called then
+  bool submit(const QByteArray &candidate, const QByteArray &hash, Done done);
+  // for threads that may block (web handlers run off the event loop)
+  Result verify(const QByteArray &candidate, const QByteArray &hash);
+
+  struct Stats {
+    int threads = 0;
+    int queued = 0;       // waiting or running
+    quint64 submitted = 0;
+    quint64 rejected = 0;
+    quint64 failed = 0;   // bad passwords
+    quint64 wait_us = 0;  // submit -> start, summed
+    quint64 wait_max_us = 0;
+    quint64 verify_us = 0;
+    quint64 batched = 0;  // checks that shared a thread with others
+  };
+  [[nodiscard]] Stats stats() const;
+  void log_stats() const;
+
+private:
+  struct Pending {
+    QByteArray candidate;
+    QByteArray hash;
+    Done done;
+    QElapsedTimer queued;
+  };
+
+  // pool task; takes whatever is waiting, up to a batch
+  void drain();
+
+  QThreadPool m_pool;
+  QMutex mtx_pending;
+  QList<Pending> m_pending;
+  int m_limit;
+
+  std::atomic<int> m_queued = 0;
+  std::atomic<quint64> m_submitted = 0;
+  std::atomic<quint64> m_rejected = 0;
+  std::atomic<quint64> m_failed = 0;
+  std::atomic<quint64> m_wait_us = 0;
+  std::atomic<quint64> m_wait_max_us = 0;
+  std::atomic<quint64> m_verify_us = 0;
+  std::atomic<quint64> m_batched = 0;
+};
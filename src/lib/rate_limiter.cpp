@@ -0,0 +1,108 @@
+#include <QtEndian>
+
+#include <algorithm>
+
+#include "lib/rate_limiter.h"
+
+RateLimiter::RateLimiter(const int burst, const int period_secs, const int prefix_factor) :
+    m_period_us(std::max(1, period_secs) * 1000000LL),
+    m_interval_us(std::max<qint64>(1, m_period_us / std::max(1, burst))),
+    m_burst(std::max(1, burst)),
+    m_prefix_factor(std::max(0, prefix_factor)) {
+  m_clock.start();
+}
+
+RateLimiter::Key RateLimiter::key_for(const QHostAddress &addr) {
+  // IPv4 comes back v4-mapped
+  const Q_IPV6ADDR bytes = addr.toIPv6Address();
+  Key key;
+  key.hi = qFromBigEndian<quint64>(bytes.c);
+  key.lo = qFromBigEndian<quint64>(bytes.c + 8);
+  return key;
+}
+
+RateLimiter::Key RateLimiter::prefix_of(const Key &key) {
+  Key prefix = key;
+  const bool v4 = key.hi == 0 && (key.lo >> 32) == 0xffff;
+  prefix.bits = v4 ? 120 : 64;
+  prefix.lo = v4 ? key.lo & ~quint64(0xff) : 0;
+  return prefix;
+}
+
+RateLimitResult RateLimiter::check(const QHostAddress &addr, const QString &msg) {
+  qint64 retry_ms = 0;
+  if (allow(addr, &retry_ms))
+    return {true, 0, {}};
+
+  const qint64 seconds = std::max<qint64>(1, (retry_ms + 999) / 1000);
+  return {false, seconds, msg.arg(QString::number(seconds))};
+}
+
+bool RateLimiter::allow(const QHostAddress &addr, qint64 *retry_ms) {
+  const qint64 now = m_clock.nsecsElapsed() / 1000;
+  const Key key = key_for(addr);
+
+  Bucket buckets[2];
+  buckets[0] = {key, m_interval_us, m_interval_us * m_burst};
+  int count = 1;
+  if (m_prefix_factor > 0) {
+    // same period, `prefix_factor` times the tokens
+    const qint64 interval = std::max<qint64>(1, m_interval_us / m_prefix_factor);
+    buckets[count++] = {prefix_of(key), interval, interval * m_burst * m_prefix_factor};
+  }
+
+  // both shards at once, in a fixed order; a refusal by one bucket must not
+  // spend the other's token
+  Shard *shards[2] = {&shard_for(buckets[0].key), count > 1 ? &shard_for(buckets[1].key) : nullptr};
+  Shard *first = shards[0];
+  Shard *second = shards[1] != nullptr && shards[1] != shards[0] ? shards[1] : nullptr;
+  if (second != nullptr && second < first)
+    std::swap(first, second);
+  QMutexLocker lock_first(&first->mtx);
+  QMutexLocker lock_second(second != nullptr ? &second->mtx : nullptr);
+
+  qint64 next[2] = {};
+  qint64 retry_us = 0;
+  for (int i = 0; i < count; ++i) {
+    next[i] = next_tat(*shards[i], buckets[i], now);
+    retry_us = std::max(retry_us, next[i] - now - buckets[i].limit);
+  }
+
+  if (retry_us > 0) {
+    if (retry_ms != nullptr)
+      *retry_ms = retry_us / 1000;
+    return false;
+  }
+
+  for (int i = 0; i < count; ++i)
+    store(*shards[i], buckets[i].key, next[i], now);
+  return true;
+}
+
+qint64 RateLimiter::next_tat(const Shard &shard, const Bucket &bucket, const qint64 now) {
+  const auto it = shard.index.constFind(bucket.key);
+  const qint64 tat = it == shard.index.constEnd() ? now : std::max(it.value()->tat, now);
+  return tat + bucket.interval;
+}
+
+void RateLimiter::store(Shard &shard, const Key &key, const qint64 tat, const qint64 now) {
+  if (const auto it = shard.index.find(key); it != shard.index.end()) {
+    it.value()->tat = tat;
+    shard.lru.splice(shard.lru.end(), shard.lru, it.value());
+    return;
+  }
+
+  // a refilled bucket needs no entry; the least recently used ones are the
+  // likeliest to be, so expired entries go from the front up to a live one
+  while (!shard.lru.empty() && shard.lru.front().tat <= now) {
+    shard.index.remove(shard.lru.front().key);
+    shard.lru.pop_front();
+  }
+  // still full of live buckets; the least recently used one starts over
+  if (shard.lru.size() >= MAX_SHARD_ENTRIES) {
+    shard.index.remove(shard.lru.front().key);
+    shard.lru.pop_front();
+  }
+
+  shard.index.insert(key, shard.lru.insert(shard.lru.end(), {key, tat}));
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QMutex>
+#include <QString>
+
+#include <array>
+#include <list>
+
+struct RateLimitResult {
+  bool allowed;
+  qint64 retryAfter;  // seconds, when not allowed
+  QString msg;
+};
+
+// GCRA (a token bucket that stores one timestamp per key): `burst`
+// requests at once, refilled at `burst` per `period_secs`. Keys are the
+// binary address (IPv4 as v4-mapped IPv6), on a monotonic clock.
+//
+// the table is split in SHARDS, each with its own mutex, so callers on
+// different threads rarely meet. An entry whose bucket has refilled is the
+// same as no entry. Each shard keeps its entries least recently used
+// first: refilled ones are dropped from that end as new keys come in, and
+// a shard that is still at MAX_SHARD_ENTRIES drops its least recently
+// used bucket. Both are amortized O(1), never a walk over the shard.
+//
+// with `prefix_factor`, the /24 (IPv4) or /64 (IPv6) around an address
+// shares a bucket `prefix_factor` times the size, so a scan from one
+// network runs dry even when every address is new. A request is charged
+// to both buckets only when both have a token.
+class RateLimiter {
+public:
+  RateLimiter(int burst = 5, int period_secs = 60, int prefix_factor = 8);
+
+  // thread-safe; takes one token when allowed. `msg` gets the seconds to
+  // wait as %1
+  RateLimitResult check(const QHostAddress &addr, const QString &msg);
+  bool allow(const QHostAddress &addr, qint64 *retry_ms = nullptr);
+
+  static constexpr int SHARDS = 16;
+  static constexpr int MAX_SHARD_ENTRIES = 4096;
+
+private:
+  struct Key {
+    quint64 hi = 0;
+    quint64 lo = 0;
+    quint8 bits = 128;
+    bool operator==(const Key &other) const { return hi == other.hi && lo == other.lo && bits == other.bits; }
+  };
+  friend size_t qHash(const Key &key, size_t seed = 0) { return qHashMulti(seed, key.hi, key.lo, key.bits); }
+
+  struct Entry {
+    Key key;
+    qint64 tat;  // theoretical arrival time, us
+  };
+
+  struct alignas(64) Shard {
+    QMutex mtx;
+    std::list<Entry> lru;  // least recently used first
+    QHash<Key, std::list<Entry>::iterator> index;
+  };
+
+  struct Bucket {
+    Key key;
+    qint64 interval;  // one token, us
+    qint64 limit;     // burst, us
+  };
+
+  static Key key_for(const QHostAddress &addr);
+  static Key prefix_of(const Key &key);
+  Shard &shard_for(const Key &key) { return m_shards[qHash(key) % SHARDS]; }
+  // the bucket's TAT after one more token; shard locked
+  static qint64 next_tat(const Shard &shard, const Bucket &bucket, qint64 now);
+  // shard locked
+  static void store(Shard &shard, const Key &key, qint64 tat, qint64 now);
+
+  const qint64 m_period_us;
+  const qint64 m_interval_us;  // one token
+  const int m_burst;
+  const int m_prefix_factor;
+  QElapsedTimer m_clock;
+  std::array<Shard, SHARDS> m_shards;
+};
+
+// the IRC layer's budgets, per address
+struct IrcRateLimits {
+  RateLimiter connect{10, 60};
+  RateLimiter registration{5, 60};
+  RateLimiter join{20, 10};
+  RateLimiter privmsg{20, 10};
+};
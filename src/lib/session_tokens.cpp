@@ -0,0 +1,174 @@
+#include <QDateTime>
+#include <QFile>
+#include <QMessageAuthenticationCode>
+#include <QRandomGenerator>
+#include <QSaveFile>
+#include <QtEndian>
+#include <QDebug>
+
+#include "lib/session_tokens.h"
+#include "lib/sql.h"
+
+static QByteArray random_bytes(const int size) {
+  QByteArray out(size, Qt::Uninitialized);
+  QRandomGenerator::system()->fillRange(reinterpret_cast<quint32*>(out.data()), size / 4);
+  return out;
+}
+
+SessionTokens::SessionTokens(const QString &key_path) {
+  QFile file(key_path);
+  if (file.open(QIODevice::ReadOnly))
+    m_key = file.readAll();
+
+  if (m_key.size() == KEY_BYTES)
+    return;
+
+  // every token issued with the old key stops verifying
+  if (file.exists())
+    qWarning() << "session tokens:" << key_path << "is not a valid key, replacing it";
+
+  // owner-only before the rename, so the key is never readable by others
+  m_key = random_bytes(KEY_BYTES);
+  QSaveFile out(key_path);
+  if (!out.open(QIODevice::WriteOnly) ||
+      !out.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner) ||
+      out.write(m_key) != KEY_BYTES || !out.commit()) {
+    qWarning() << "session tokens: could not write" << key_path << "- tokens will not survive a restart";
+  }
+}
+
+void SessionTokens::load() {
+  const qint64 now = QDateTime::currentSecsSinceEpoch();
+  const auto loaded = sql::session_revocations(now, now - MAX_TTL_SECS);
+
+  // merged rather than replaced; a revocation made here while the query ran
+  // may not have been in its result
+  QWriteLocker locker(&mtx_revoked);
+  for (auto it = loaded.devices.constBegin(); it != loaded.devices.constEnd(); ++it)
+    m_revoked.insert(it.key(), std::max(it.value(), m_revoked.value(it.key(), 0)));
+  for (auto it = loaded.generations.constBegin(); it != loaded.generations.constEnd(); ++it)
+    m_generations.insert(it.key(), std::max(it.value(), m_generations.value(it.key(), 0)));
+  prune(now);
+}
+
+void SessionTokens::prune(const qint64 now) {
+  // whatever expired is rejected on its own
+  for (auto it = m_revoked.begin(); it != m_revoked.end();) {
+    if (it.value() <= now)
+      it = m_revoked.erase(it);
+    else
+      ++it;
+  }
+  for (auto it = m_generations.begin(); it != m_generations.end();) {
+    if (static_cast<qint64>(it.value()) + MAX_TTL_SECS <= now)
+      it = m_generations.erase(it);
+    else
+      ++it;
+  }
+  m_revocations = m_revoked.size() + m_generations.size();
+}
+
+QByteArray SessionTokens::new_device() {
+  return random_bytes(16).toHex();
+}
+
+QByteArray SessionTokens::sign(const QByteArray &payload) const {
+  return QMessageAuthenticationCode::hash(payload, m_key, QCryptographicHash::Sha256);
+}
+
+QByteArray SessionTokens::issue(const QUuid &account, const QByteArray &device, const qint64 ttl_secs) const {
+  const QByteArray dev = device.left(MAX_DEVICE);
+
+  quint32 generation = 0;
+  if (m_revocations.load(std::memory_order_acquire) > 0) {
+    QReadLocker locker(&mtx_revoked);
+    generation = m_generations.value(account, 0);
+  }
+
+  QByteArray payload;
+  payload.reserve(1 + 16 + 8 + 4 + dev.size());
+  payload.append(static_cast<char>(VERSION));
+  payload.append(account.toRfc4122());
+  const qint64 expires = qToBigEndian(QDateTime::currentSecsSinceEpoch() + ttl_secs);
+  payload.append(reinterpret_cast<const char*>(&expires), sizeof(expires));
+  const quint32 gen = qToBigEndian(generation);
+  payload.append(reinterpret_cast<const char*>(&gen), sizeof(gen));
+  payload.append(dev);
+
+  constexpr auto options = QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals;
+  return payload.toBase64(options) + "." + sign(payload).toBase64(options);
+}
+
+std::optional<SessionTokens::Claims> SessionTokens::verify(const QByteArray &token) const {
+  const qsizetype dot = token.indexOf('.');
+  if (dot <= 0)
+    return std::nullopt;
+
+  constexpr auto options = QByteArray::Base64UrlEncoding | QByteArray::AbortOnBase64DecodingErrors;
+  const auto payload = QByteArray::fromBase64Encoding(token.left(dot), options);
+  const auto mac = QByteArray::fromBase64Encoding(token.mid(dot + 1), options);
+  if (!payload || !mac)
+    return std::nullopt;
+
+  const QByteArray expected = sign(*payload);
+  if (mac->size() != expected.size())
+    return std::nullopt;
+
+  // constant time; a timing oracle on the MAC would let it be guessed bytewise
+  quint8 diff = 0;
+  for (qsizetype i = 0; i < expected.size(); ++i)
+    diff |= static_cast<quint8>((*mac)[i] ^ expected[i]);
+  if (diff != 0)
+    return std::nullopt;
+
+  const quint8 version = payload->isEmpty() ? 0 : static_cast<quint8>(payload->at(0));
+  const qsizetype header = version == 1 ? 1 + 16 + 8 : 1 + 16 + 8 + 4;
+  if (version < 1 || version > VERSION || payload->size() < header)
+    return std::nullopt;
+
+  Claims claims;
+  claims.account = QUuid::fromRfc4122(QByteArrayView(*payload).mid(1, 16));
+  claims.expires = qFromBigEndian<qint64>(payload->constData() + 17);
+  if (version >= 2)
+    claims.generation = qFromBigEndian<quint32>(payload->constData() + 25);
+  claims.device = payload->mid(header);
+  if (claims.expires <= QDateTime::currentSecsSinceEpoch())
+    return std::nullopt;
+
+  // the common case: nobody logged out, every request goes through here
+  if (m_revocations.load(std::memory_order_acquire) == 0)
+    return claims;
+
+  QReadLocker locker(&mtx_revoked);
+  if (m_revoked.contains({claims.account, claims.device}))
+    return std::nullopt;
+  if (claims.generation < m_generations.value(claims.account, 0))
+    return std::nullopt;
+  return claims;
+}
+
+void SessionTokens::revoke(const Claims &claims) {
+  const qint64 now = QDateTime::currentSecsSinceEpoch();
+
+  QWriteLocker locker(&mtx_revoked);
+  m_revoked.insert({claims.account, claims.device}, claims.expires);
+  prune(now);
+  locker.unlock();
+
+  sql::session_revoke_device(claims.account, claims.device, claims.expires);
+}
+
+void SessionTokens::revoke_all(const QUuid &account) {
+  const qint64 now = QDateTime::currentSecsSinceEpoch();
+
+  // a time rather than a counter: once the entry is pruned, new tokens go
+  // back to generation 0 and the next revoke_all() still lands above every
+  // generation that was handed out in between
+  QWriteLocker locker(&mtx_revoked);
+  const quint32 generation = std::max<quint32>(m_generations.value(account, 0) + 1, static_cast<quint32>(now));
+  m_generations.insert(account, generation);
+  prune(now);
+  locker.unlock();
+
+  sql::session_generation_set(account, generation);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <QByteArray>
+#include <QHash>
+#include <QPair>
+#include <QReadWriteLock>
+#include <QString>
+#include <QUuid>
+
+#include <algorithm>
+#include <atomic>
+#include <optional>
+
+// signed login tokens, shared by SASL TOKEN and web sessions. A token is
+//
+//   base64url(payload) "." base64url(HMAC-SHA256(key, payload))
+//   payload: version, account uid, expiry (unix seconds), generation, device id
+//
+// so checking one is an HMAC and a constant-time compare, where a password
+// is a bcrypt run, and nothing is stored per session. The key is generated
+// once and kept in `key_path`; nodes that share it (and the database)
+// accept each other's tokens.
+//
+// revocation is the exception list: a logout remembers its (account,
+// device) pair until the token would have expired anyway, and
+// revoke_all() raises the account's generation (the time of the call)
+// above the one every older token carries; once the longest TTL has passed
+// since, no older token is left and the entry is dropped. Both lists are
+// written to the database and load() merges them back in, at startup and
+// every REFRESH_SECS, so a logout on one node reaches the others within
+// that. While neither list has entries, verify() does not touch the lock.
+class SessionTokens {
+public:
+  struct Claims {
+    QUuid account;
+    QByteArray device;
+    qint64 expires = 0;
+    quint32 generation = 0;
+  };
+
+  explicit SessionTokens(const QString &key_path);
+  // revocations from the database, once the schema is in place and then
+  // periodically; blocking, keep it off the event loops
+  void load();
+
+  [[nodiscard]] QByteArray issue(const QUuid &account, const QByteArray &device, qint64 ttl_secs) const;
+  // signature, expiry and revocation
+  [[nodiscard]] std::optional<Claims> verify(const QByteArray &token) const;
+  void revoke(const Claims &claims);
+  // every token of the account issued so far
+  void revoke_all(const QUuid &account);
+
+  // random, for a login without one
+  static QByteArray new_device();
+
+  static constexpr qint64 IRC_TTL_SECS = 30LL * 24 * 60 * 60;
+  static constexpr qint64 WEB_TTL_SECS = 60 * 60;
+  static constexpr int MAX_DEVICE = 64;
+  static constexpr int REFRESH_SECS = 30;
+
+private:
+  [[nodiscard]] QByteArray sign(const QByteArray &payload) const;
+  // drops what no unexpired token can match any more; mtx_revoked held
+  void prune(qint64 now);
+
+  // version 1 tokens have no generation; they count as generation 0
+  static constexpr quint8 VERSION = 2;
+  static constexpr int KEY_BYTES = 32;
+  static constexpr qint64 MAX_TTL_SECS = std::max(IRC_TTL_SECS, WEB_TTL_SECS);
+
+  QByteArray m_key;
+
+  mutable QReadWriteLock mtx_revoked;  // the two below
+  QHash<QPair<QUuid, QByteArray>, qint64> m_revoked;  // -> expiry
+  QHash<QUuid, quint32> m_generations;
+  // entries in both; verify() skips the lock at 0
+  std::atomic<int> m_revocations = 0;
+};
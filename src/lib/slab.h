@@ -0,0 +1,160 @@
+#pragma once
+#include <atomic>
+#include <QMutex>
+#include <QQueue>
+#include <QVector>
+#include <QtGlobal>
+#include <QHashFunctions>
+
+// generational 64-bit handles backed by slab storage.
+//
+// A handle packs a 32-bit generation (high word) and a 24-bit slot index
+// (low bits of the low word, the top 8 bits unused), so a slab holds at most
+// 2^24 - 1 objects at a time; index 0 is reserved for the null handle.
+// Releasing a slot bumps its generation, so a handle that outlives its
+// object resolves to nullptr instead of a dangling pointer. Freed slots are
+// reused oldest first, so a stale handle would need 2^32 reuses of its own
+// slot to alias a new object; a slot whose generation would wrap is retired
+// instead. Slots live in fixed-size chunks that are never moved, which makes
+// `get()` lock-free; `insert()` and `release()` serialize on a mutex.
+
+template <typename T>
+struct Handle {
+  // bits of the low word used for the index
+  static constexpr quint32 INDEX_BITS = 24;
+  static constexpr quint32 INDEX_MASK = (1u << INDEX_BITS) - 1;
+
+  quint64 raw = 0;
+
+  constexpr Handle() = default;
+  constexpr explicit Handle(const quint64 r) : raw(r) {}
+  constexpr Handle(const quint32 index, const quint32 generation) :
+      raw((static_cast<quint64>(generation) << 32) | index) {}
+
+  [[nodiscard]] constexpr quint32 index() const { return static_cast<quint32>(raw) & INDEX_MASK; }
+  [[nodiscard]] constexpr quint32 generation() const { return static_cast<quint32>(raw >> 32); }
+  [[nodiscard]] constexpr bool isNull() const { return raw == 0; }
+
+  constexpr bool operator==(const Handle &other) const { return raw == other.raw; }
+  constexpr bool operator!=(const Handle &other) const { return raw != other.raw; }
+  constexpr bool operator<(const Handle &other) const { return raw < other.raw; }
+};
+
+template <typename T>
+inline size_t qHash(const Handle<T> &handle, const size_t seed = 0) noexcept {
+  return qHash(handle.raw, seed);
+}
+
+template <typename T>
+class Slab {
+public:
+  static constexpr quint32 CHUNK_BITS = 12;
+  static constexpr quint32 CHUNK_SIZE = 1u << CHUNK_BITS;
+  static constexpr quint32 MAX_CHUNKS = 1u << (Handle<T>::INDEX_BITS - CHUNK_BITS);
+
+  Slab() {
+    for (auto &chunk : m_chunks)
+      chunk.store(nullptr, std::memory_order_relaxed);
+  }
+
+  ~Slab() {
+    for (auto &chunk : m_chunks)
+      delete[] chunk.load(std::memory_order_relaxed);
+  }
+
+  Q_DISABLE_COPY(Slab)
+
+  Handle<T> insert(T *ptr) {
+    QMutexLocker locker(&m_mutex);
+
+    quint32 index;
+    if (!m_free.isEmpty()) {
+      index = m_free.dequeue();
+    } else {
+      if (m_next > Handle<T>::INDEX_MASK)
+        qFatal("slab exhausted");
+      index = m_next++;
+
+      auto &chunk = m_chunks[index >> CHUNK_BITS];
+      if (chunk.load(std::memory_order_relaxed) == nullptr)
+        chunk.store(new Slot[CHUNK_SIZE], std::memory_order_release);
+    }
+
+    Slot &s = slot(index);
+    s.ptr.store(ptr, std::memory_order_release);
+    m_size.fetch_add(1, std::memory_order_relaxed);
+    return Handle<T>(index, s.generation.load(std::memory_order_relaxed));
+  }
+
+  // invalidates every outstanding copy of `handle`
+  void release(const Handle<T> handle) {
+    if (handle.isNull())
+      return;
+
+    QMutexLocker locker(&m_mutex);
+    Slot *s = find(handle);
+    if (s == nullptr)
+      return;
+
+    s->ptr.store(nullptr, std::memory_order_release);
+    const quint32 generation = s->generation.load(std::memory_order_relaxed) + 1;
+    s->generation.store(generation, std::memory_order_release);
+    // a wrapped generation would bring old handles back to life
+    if (generation != 0)
+      m_free.enqueue(handle.index());
+    m_size.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // nullptr when the handle is null or stale
+  [[nodiscard]] T *get(const Handle<T> handle) const {
+    const Slot *s = find(handle);
+    if (s == nullptr)
+      return nullptr;
+    T *ptr = s->ptr.load(std::memory_order_acquire);
+    // the slot may have been released and reused since find(); insert()
+    // stores the new pointer after release() bumped the generation, so
+    // having seen that pointer, this load sees the new generation too
+    if (s->generation.load(std::memory_order_acquire) != handle.generation())
+      return nullptr;
+    return ptr;
+  }
+
+  [[nodiscard]] bool alive(const Handle<T> handle) const {
+    return get(handle) != nullptr;
+  }
+
+  [[nodiscard]] quint32 size() const {
+    return m_size.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Slot {
+    std::atomic<T*> ptr{nullptr};
+    std::atomic<quint32> generation{0};
+  };
+
+  Slot &slot(const quint32 index) const {
+    return m_chunks[index >> CHUNK_BITS].load(std::memory_order_acquire)[index & (CHUNK_SIZE - 1)];
+  }
+
+  Slot *find(const Handle<T> handle) const {
+    if (handle.isNull())
+      return nullptr;
+
+    const quint32 index = handle.index();
+    Slot *chunk = m_chunks[index >> CHUNK_BITS].load(std::memory_order_acquire);
+    if (chunk == nullptr)
+      return nullptr;
+
+    Slot &s = chunk[index & (CHUNK_SIZE - 1)];
+    if (s.generation.load(std::memory_order_acquire) != handle.generation())
+      return nullptr;
+    return &s;
+  }
+
+  mutable std::atomic<Slot*> m_chunks[MAX_CHUNKS];
+  QMutex m_mutex;
+  QQueue<quint32> m_free;  // oldest release first
+  quint32 m_next = 1;  // index 0 is reserved so that raw == 0 means null
+  std::atomic<quint32> m_size{0};
+};
@@ -6,57 +6,63 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QRegularExpression>
+#include <QMutex>
+
+#include <algorithm>
+#include <atomic>
 
 #include "ctx.h"
 #include "lib/globals.h"
 #include "lib/sql.h"
 #include "bcrypt/bcrypt.h"
+#include "lib/uuidv7.h"
+#include "lib/message_codec.h"
+#include "irc/utils.h"
 
 namespace sql {
-  std::unordered_map<unsigned long, QSqlDatabase*> DB_INSTANCES = {};
+  static constexpr int POOL_TIMEOUT_MS = 10 * 1000;
 
-  // each thread has its own database connection
-  QSqlDatabase& ensureThreadDatabase() {
-    const unsigned long thread_id = reinterpret_cast<uintptr_t>(QThread::currentThreadId());
-    auto it = DB_INSTANCES.find(thread_id);
-    if (it != DB_INSTANCES.end()) {
-      return *(it->second);
-    }
+  const DbBackend &backend() {
+    static const auto instance = DbBackend::create(g::dbBackend);
+    return *instance;
+  }
 
-    const QString connection_name = "cr_" + QString::number(thread_id);
-    QSqlDatabase* db = new QSqlDatabase(QSqlDatabase::addDatabase("QPSQL", connection_name));
-    db->setConnectOptions(QString("application_name=%1").arg(connection_name));
-    db->setHostName(g::pgHost);
-    db->setPort(g::pgPort);
-    db->setDatabaseName(g::pgDatabase);
-    db->setUserName(g::pgUsername);
-    if (!g::pgPassword.isEmpty())
-      db->setPassword(g::pgPassword);
+  // shared by every thread, see DbPool; never torn down, like the
+  // connections it holds
+  static DbPool &pool() {
+    static auto *instance = new DbPool(&backend(), g::dbPoolSize, POOL_TIMEOUT_MS);
+    return *instance;
+  }
 
-    if (!db->open())
-      throw std::runtime_error("failed to open database");
+  DbPool::Lease connection(const DbPool::Access access) {
+    return pool().acquire(access);
+  }
 
-    qDebug() << "db: created connection" << connection_name;
+  QSharedPointer<QSqlQuery> getQuery(const DbPool::Access access = DbPool::Access::Write) {
+    return connection(access).query();
+  }
 
-    DB_INSTANCES[thread_id] = db;
-    return *db;
+  QSharedPointer<QSqlQuery> prepared(const QString &sql) {
+    const bool read = QStringView(sql).trimmed().startsWith(u"SELECT", Qt::CaseInsensitive);
+    return connection(read ? DbPool::Access::Read : DbPool::Access::Write).prepare(sql);
   }
 
-  QSharedPointer<QSqlQuery> getQuery() {
-    const QSqlDatabase& db = ensureThreadDatabase();
-    return QSharedPointer<QSqlQuery>(new QSqlQuery(db));
+  void log_pool_stats() {
+    pool().log_stats();
   }
 
-  QSqlDatabase& getDatabaseForThread() {
-    return ensureThreadDatabase();
+  // schema changes that were applied before
+  static bool benign(const QString &err) {
+    return err.contains("already exists") || err.contains("duplicate column");
   }
 
   QSharedPointer<QSqlQuery> exec(const QString &sql) {
     auto q = getQuery();
-    const auto res = q->exec(sql);
+    const auto res = q->exec(backend().dialect(sql));
     if (!res) {
       const auto err = q->lastError().text();
-      if (!err.contains("already exists"))
+      if (!benign(err))
         qCritical() << "SQL error: " << err;
     }
     return q;
@@ -64,12 +70,167 @@ namespace sql {
 
   QSharedPointer<QSqlQuery> exec(const QSharedPointer<QSqlQuery> &q) {
     if (const auto res = q->exec(); !res) {
-      if (const auto err = q->lastError().text(); !err.contains("already exists"))
+      if (const auto err = q->lastError().text(); !benign(err))
         qCritical() << "SQL error: " << err;
     }
     return q;
   }
 
+  // one month of messages per partition on Postgres, so retention drops
+  // whole tables instead of deleting rows, and vacuum and index upkeep stay
+  // per month. The primary key has to include the partition key.
+  static constexpr int PARTITION_MONTHS_AHEAD = 3;
+  static constexpr int RETENTION_DELETE_BATCH = 5000;
+
+  static const QString MESSAGES_COLUMNS = R"(
+      id UUID NOT NULL,
+      sender_id UUID NOT NULL,
+      channel_id UUID,
+      text TEXT,
+      raw BYTEA,
+      tags TEXT,
+      nick TEXT,
+      host TEXT,
+      username TEXT,
+      targets TEXT,
+      recipient_id UUID,
+      from_system INTEGER DEFAULT 0,
+      tag_msg INTEGER DEFAULT 0,
+      creation_date TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,
+      body BYTEA,
+      sender_ref BIGINT,
+      FOREIGN KEY(sender_id) REFERENCES accounts(id) ON DELETE CASCADE,
+      FOREIGN KEY(channel_id) REFERENCES channels(id) ON DELETE SET NULL)";
+
+  // messages.text of an old SQLite database is NOT NULL, see create_schema()
+  static bool legacy_text_required = false;
+
+  static bool partitioned() {
+    return backend().kind() == DbBackend::Kind::Postgres;
+  }
+
+  static QDate month_start(const QDate &date) {
+    return {date.year(), date.month(), 1};
+  }
+
+  // a plain messages table from before partitioning is kept as it is and
+  // becomes the partition for everything up to next month; it is dropped
+  // like the others once that is past retention
+  static bool messages_convert_legacy() {
+    qInfo() << "messages: converting to a partitioned table";
+    const QString upto = month_start(QDate::currentDate()).addMonths(1).toString(Qt::ISODate);
+
+    const auto lease = connection();
+    QSqlDatabase &db = lease.db();
+    db.transaction();
+
+    const auto q = lease.query();
+    for (const QString &stmt: {
+        QString("ALTER TABLE messages RENAME TO messages_legacy"),
+        QString("ALTER TABLE messages_legacy RENAME CONSTRAINT messages_pkey TO messages_legacy_pkey"),
+        QString("DROP INDEX IF EXISTS idx_messages_sender, idx_messages_channel, idx_messages_date, "
+                "idx_messages_channel_date, idx_messages_recipient_date, idx_messages_sender_date"),
+        QString("ALTER TABLE messages_legacy ADD COLUMN IF NOT EXISTS recipient_id UUID"),
+        QString("ALTER TABLE messages_legacy ADD COLUMN IF NOT EXISTS body BYTEA"),
+        QString("ALTER TABLE messages_legacy ADD COLUMN IF NOT EXISTS sender_ref BIGINT"),
+        QString("UPDATE messages_legacy SET creation_date = LOCALTIMESTAMP WHERE creation_date IS NULL"),
+        QString("ALTER TABLE messages_legacy ALTER COLUMN creation_date SET NOT NULL"),
+        QString("CREATE TABLE messages (%1, PRIMARY KEY (id, creation_date)) PARTITION BY RANGE (creation_date)").arg(MESSAGES_COLUMNS),
+        QString("ALTER TABLE messages ATTACH PARTITION messages_legacy FOR VALUES FROM (MINVALUE) TO ('%1')").arg(upto)}) {
+      if (!q->exec(stmt)) {
+        qCritical() << "messages_convert_legacy error:" << q->lastError().text();
+        db.rollback();
+        return false;
+      }
+    }
+    return db.commit();
+  }
+
+  struct MessagePartition {
+    QString name;
+    QDateTime from;  // invalid: MINVALUE
+    QDateTime to;    // invalid: MAXVALUE
+  };
+
+  // the monthly partitions and a converted legacy table; not the default one
+  static bool message_partitions(QList<MessagePartition> &partitions) {
+    const auto q = prepared(R"(
+      SELECT c.relname, pg_get_expr(c.relpartbound, c.oid)
+      FROM pg_inherits i
+      JOIN pg_class c ON c.oid = i.inhrelid
+      WHERE i.inhparent = 'messages'::regclass
+    )");
+
+    if (!q->exec()) {
+      qCritical() << "message_partitions query error:" << q->lastError().text();
+      return false;
+    }
+
+    // FOR VALUES FROM ('2026-10-01 00:00:00') TO ('2026-11-01 00:00:00')
+    static const QRegularExpression bound(R"(FROM \((?:'([^']*)'|MINVALUE)\) TO \((?:'([^']*)'|MAXVALUE)\))");
+    while (q->next()) {
+      const auto match = bound.match(q->value(1).toString());
+      if (!match.hasMatch())
+        continue;
+
+      MessagePartition partition;
+      partition.name = q->value(0).toString();
+      partition.from = QDateTime::fromString(match.captured(1), "yyyy-MM-dd HH:mm:ss");
+      partition.to = QDateTime::fromString(match.captured(2), "yyyy-MM-dd HH:mm:ss");
+      partitions << partition;
+    }
+    return true;
+  }
+
+  // this month and the next `months_ahead`, unless a partition already
+  // covers them
+  static void messages_partitions_create(const int months_ahead) {
+    QList<MessagePartition> existing;
+    if (!message_partitions(existing))
+      return;
+
+    const QDate first = month_start(QDate::currentDate());
+    for (int i = 0; i <= months_ahead; ++i) {
+      const QDate from = first.addMonths(i);
+      const QDate to = from.addMonths(1);
+
+      const bool covered = std::any_of(existing.begin(), existing.end(), [&](const MessagePartition &p) {
+        return (!p.from.isValid() || p.from.date() < to) && (!p.to.isValid() || p.to.date() > from);
+      });
+      if (covered)
+        continue;
+
+      const QString name = "messages_p" + from.toString("yyyy_MM");
+      const auto q = getQuery();
+      if (!q->exec(QString("CREATE TABLE IF NOT EXISTS %1 PARTITION OF messages FOR VALUES FROM ('%2') TO ('%3')")
+                     .arg(name, from.toString(Qt::ISODate), to.toString(Qt::ISODate)))) {
+        // most likely rows for that month ended up in messages_default
+        qCritical() << "messages: could not create partition" << name << q->lastError().text();
+        continue;
+      }
+      qInfo() << "messages: created partition" << name;
+    }
+  }
+
+  static void create_messages_table() {
+    if (!partitioned()) {
+      exec(QString("CREATE TABLE IF NOT EXISTS messages (%1, PRIMARY KEY (id))").arg(MESSAGES_COLUMNS));
+      return;
+    }
+
+    const auto q = exec("SELECT relkind FROM pg_class WHERE oid = to_regclass('messages')");
+    const QString relkind = q->next() ? q->value(0).toString() : QString();
+    if (relkind == "r")
+      messages_convert_legacy();
+    else if (relkind.isEmpty())
+      exec(QString("CREATE TABLE IF NOT EXISTS messages (%1, PRIMARY KEY (id, creation_date)) PARTITION BY RANGE (creation_date)").arg(MESSAGES_COLUMNS));
+
+    // catches rows no monthly partition covers (e.g. a clock far off);
+    // should stay empty, see messages_maintain()
+    exec("CREATE TABLE IF NOT EXISTS messages_default PARTITION OF messages DEFAULT");
+    messages_partitions_create(PARTITION_MONTHS_AHEAD);
+  }
+
   void create_schema() {
     exec(R"(
     CREATE TABLE IF NOT EXISTS accounts (
@@ -90,6 +251,10 @@ namespace sql {
     )
     )");
 
+    // days before a server's channel messages are deleted; NULL follows
+    // --message-retention-days, 0 keeps them
+    exec("ALTER TABLE servers ADD COLUMN IF NOT EXISTS message_retention_days INTEGER");
+
     exec(R"(
     CREATE TABLE IF NOT EXISTS server_members (
       account_id UUID NOT NULL,
@@ -188,6 +353,7 @@ namespace sql {
       channel_id UUID,
       recipient_id UUID,
       event_type INTEGER NOT NULL,
+      seq BIGINT,
       data TEXT NOT NULL,
       reply_to UUID,
       display_name TEXT,
@@ -199,36 +365,124 @@ namespace sql {
     )
     )");
 
+    // upper bound of the sequence numbers a channel may have handed out,
+    // persisted ahead of the write-behind events, see EventLog
     exec(R"(
-    CREATE TABLE IF NOT EXISTS messages (
-      id UUID PRIMARY KEY,
-      sender_id UUID NOT NULL,
-      channel_id UUID,
-      text TEXT NOT NULL,
-      raw BYTEA,
-      tags TEXT,
-      nick TEXT,
-      host TEXT,
-      username TEXT,
-      targets TEXT,
-      from_system INTEGER DEFAULT 0,
-      tag_msg INTEGER DEFAULT 0,
-      creation_date TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
-      FOREIGN KEY(sender_id) REFERENCES accounts(id) ON DELETE CASCADE,
-      FOREIGN KEY(channel_id) REFERENCES channels(id) ON DELETE SET NULL
+    CREATE TABLE IF NOT EXISTS channel_sequences (
+      channel_id UUID PRIMARY KEY,
+      reserved BIGINT NOT NULL,
+      FOREIGN KEY(channel_id) REFERENCES channels(id) ON DELETE CASCADE
+    )
+    )");
+
+    // joins and parts in id order, which is the order the ids were
+    // allocated in; concurrent transactions may commit out of it. A restart
+    // from a state snapshot replays what came after the snapshot's
+    // watermark, see Snapshot
+    exec(R"(
+    CREATE TABLE IF NOT EXISTS membership_log (
+      id BIGSERIAL PRIMARY KEY,
+      account_id UUID NOT NULL,
+      channel_id UUID NOT NULL,
+      joined BOOLEAN NOT NULL
+    )
+    )");
+
+    // only snapshots read the log, and each snapshot write prunes it; without
+    // them nothing would, so the triggers are not installed at all
+    const bool log_membership = !g::lazyLoad && g::snapshotInterval > 0;
+    if (backend().kind() == DbBackend::Kind::Postgres) {
+      exec("DROP TRIGGER IF EXISTS account_channels_log ON account_channels");
+      if (log_membership) {
+        exec(R"(
+        CREATE OR REPLACE FUNCTION membership_log_append() RETURNS trigger AS $$
+        BEGIN
+          IF TG_OP = 'INSERT' THEN
+            INSERT INTO membership_log (account_id, channel_id, joined) VALUES (NEW.account_id, NEW.channel_id, TRUE);
+          ELSE
+            INSERT INTO membership_log (account_id, channel_id, joined) VALUES (OLD.account_id, OLD.channel_id, FALSE);
+          END IF;
+          RETURN NULL;
+        END$$ LANGUAGE plpgsql;
+        )");
+        exec(R"(
+        CREATE TRIGGER account_channels_log
+          AFTER INSERT OR DELETE ON account_channels
+          FOR EACH ROW EXECUTE FUNCTION membership_log_append()
+        )");
+      }
+    } else if (log_membership) {
+      exec(R"(
+      CREATE TRIGGER IF NOT EXISTS account_channels_log_join AFTER INSERT ON account_channels
+      BEGIN
+        INSERT INTO membership_log (account_id, channel_id, joined) VALUES (NEW.account_id, NEW.channel_id, TRUE);
+      END
+      )");
+      exec(R"(
+      CREATE TRIGGER IF NOT EXISTS account_channels_log_part AFTER DELETE ON account_channels
+      BEGIN
+        INSERT INTO membership_log (account_id, channel_id, joined) VALUES (OLD.account_id, OLD.channel_id, FALSE);
+      END
+      )");
+    } else {
+      exec("DROP TRIGGER IF EXISTS account_channels_log_join");
+      exec("DROP TRIGGER IF EXISTS account_channels_log_part");
+    }
+
+    // bouncer read cursors of offline accounts, see Backlog
+    exec(R"(
+    CREATE TABLE IF NOT EXISTS backlog_cursors (
+      account_id UUID NOT NULL,
+      target TEXT NOT NULL,
+      ts BIGINT NOT NULL,
+      ref BYTEA NOT NULL,
+      PRIMARY KEY(account_id, target),
+      FOREIGN KEY(account_id) REFERENCES accounts(id) ON DELETE CASCADE
+    )
+    )");
+
+    // signed session tokens are checked without a lookup; these are the
+    // exceptions, see SessionTokens
+    exec(R"(
+    CREATE TABLE IF NOT EXISTS session_generations (
+      account_id UUID PRIMARY KEY,
+      generation BIGINT NOT NULL,
+      FOREIGN KEY(account_id) REFERENCES accounts(id) ON DELETE CASCADE
+    )
+    )");
+    exec(R"(
+    CREATE TABLE IF NOT EXISTS session_revocations (
+      account_id UUID NOT NULL,
+      device BYTEA NOT NULL,
+      expires BIGINT NOT NULL,
+      PRIMARY KEY(account_id, device)
     )
     )");
 
-    // enum: metadata:ref_type
     exec(R"(
-    DO $$
-    BEGIN
-      IF NOT EXISTS (SELECT 1 FROM pg_type WHERE typname = 'ref_type_enum') THEN
-        CREATE TYPE ref_type_enum AS ENUM ('channel', 'account');
-      END IF;
-    END$$;
+    CREATE TABLE IF NOT EXISTS message_senders (
+      id BIGSERIAL PRIMARY KEY,
+      nick TEXT NOT NULL,
+      username TEXT NOT NULL,
+      host TEXT NOT NULL,
+      UNIQUE(nick, username, host)
+    )
     )");
 
+    create_messages_table();
+
+    // enum: metadata:ref_type (plain text elsewhere)
+    if (backend().kind() == DbBackend::Kind::Postgres) {
+      exec(R"(
+      DO $$
+      BEGIN
+        IF NOT EXISTS (SELECT 1 FROM pg_type WHERE typname = 'ref_type_enum') THEN
+          CREATE TYPE ref_type_enum AS ENUM ('channel', 'account');
+        END IF;
+      END$$;
+      )");
+    }
+
     exec(R"(
     CREATE TABLE IF NOT EXISTS metadata (
       id UUID PRIMARY KEY,
@@ -262,11 +516,40 @@ namespace sql {
     exec("CREATE INDEX IF NOT EXISTS idx_metadata_subs_metadata ON metadata_subs(metadata_id)");
     exec("CREATE INDEX IF NOT EXISTS idx_metadata_subs_account ON metadata_subs(account_id)");
     exec("CREATE INDEX IF NOT EXISTS idx_metadata_subs_metadata_account ON metadata_subs(metadata_id, account_id)");
+    // the target of ON CONFLICT (metadata_id, account_id)
+    exec("CREATE UNIQUE INDEX IF NOT EXISTS idx_metadata_subs_unique ON metadata_subs(metadata_id, account_id)");
 
-    // Optional indexes for filtering and performance
+    // Optional indexes for filtering and performance; on Postgres indexes
+    // on messages are created on every partition
     exec("CREATE INDEX IF NOT EXISTS idx_messages_sender ON messages(sender_id)");
-    exec("CREATE INDEX IF NOT EXISTS idx_messages_channel ON messages(channel_id)");
-    exec("CREATE INDEX IF NOT EXISTS idx_messages_date ON messages(creation_date DESC)");
+    // CHATHISTORY fallback, newest first, with id as tie-breaker; covers
+    // lookups by channel alone too
+    exec("CREATE INDEX IF NOT EXISTS idx_messages_channel_recent ON messages(channel_id, creation_date DESC, id DESC)");
+    exec("DROP INDEX IF EXISTS idx_messages_channel");
+    exec("DROP INDEX IF EXISTS idx_messages_channel_date");
+    // retention deletes by date; partitions make it redundant on Postgres
+    if (partitioned())
+      exec("DROP INDEX IF EXISTS idx_messages_date");
+    else
+      exec("CREATE INDEX IF NOT EXISTS idx_messages_date ON messages(creation_date DESC)");
+
+    // bouncer backlog of private messages; databases from before it
+    exec("ALTER TABLE messages ADD COLUMN IF NOT EXISTS recipient_id UUID");
+
+    // compact encoding, see message_codec; the text/raw/tags and sender
+    // columns only hold rows from before it
+    exec("ALTER TABLE messages ADD COLUMN IF NOT EXISTS body BYTEA");
+    exec("ALTER TABLE messages ADD COLUMN IF NOT EXISTS sender_ref BIGINT");
+    // new rows leave text NULL. SQLite cannot drop the constraint of a table
+    // created before that; those get an empty string instead
+    if (partitioned()) {
+      exec("ALTER TABLE messages ALTER COLUMN text DROP NOT NULL");
+    } else {
+      const auto q = exec("SELECT \"notnull\" FROM pragma_table_info('messages') WHERE name = 'text'");
+      legacy_text_required = q->next() && q->value(0).toInt() != 0;
+    }
+    exec("CREATE INDEX IF NOT EXISTS idx_messages_recipient_date ON messages(recipient_id, creation_date, id)");
+    exec("CREATE INDEX IF NOT EXISTS idx_messages_sender_date ON messages(sender_id, creation_date, id)");
 
     // Index for event_type
     exec("CREATE INDEX IF NOT EXISTS idx_channels_account_owner ON channels(account_owner_id)");
@@ -298,6 +581,10 @@ namespace sql {
     // Index for reply_to
     exec("CREATE INDEX IF NOT EXISTS idx_events_reply ON events(reply_to)");
 
+    // delta sync; databases from before per-channel sequence numbers
+    exec("ALTER TABLE events ADD COLUMN IF NOT EXISTS seq BIGINT");
+    exec("CREATE INDEX IF NOT EXISTS idx_events_channel_seq ON events(channel_id, seq)");
+
     // Index for server membership lookups
     exec("CREATE INDEX IF NOT EXISTS idx_server_members_account ON server_members(account_id)");
     exec("CREATE INDEX IF NOT EXISTS idx_server_members_server ON server_members(server_id)");
@@ -320,9 +607,7 @@ namespace sql {
   }
 
   QUuid metadata_create(const QByteArray& key, const QByteArray& value, const QUuid ref_id, RefType ref_type) {
-    const auto q = getQuery();
-
-    q->prepare(R"(
+    const auto q = prepared(R"(
       INSERT INTO metadata (
         id, key, value, ref_id, ref_type
       ) VALUES (?, ?, ?, ?, ?)
@@ -353,9 +638,7 @@ namespace sql {
 
   MetadataResult metadata_get(const QUuid ref_id) {
     MetadataResult result;
-    const auto q = getQuery();
-
-    q->prepare(R"(
+    const auto q = prepared(R"(
       SELECT m.key, m.value, ms.account_id
       FROM metadata m
       LEFT JOIN metadata_subs ms ON ms.metadata_id = m.id
@@ -385,16 +668,14 @@ namespace sql {
       if (!account_ptr)
         continue;
 
-      result.subscribers[key].insert(account_ptr);
+      result.subscribers[key].insert(account_ptr->handle());
     }
 
     return result;
   }
 
   bool metadata_remove(const QByteArray& key, QUuid ref_id) {
-    const auto q = getQuery();
-
-    q->prepare(R"(
+    const auto q = prepared(R"(
       DELETE FROM metadata
       WHERE ref_id = ? AND key = ?
     )");
@@ -411,9 +692,7 @@ namespace sql {
   }
 
   bool metadata_modify(QUuid ref_id, const QByteArray& key, const QByteArray& new_value) {
-    const auto q = getQuery();
-
-    q->prepare(R"(
+    const auto q = prepared(R"(
     UPDATE metadata
     SET value = ?, modified_at = CURRENT_TIMESTAMP
     WHERE ref_id = ? AND key = ?
@@ -432,9 +711,7 @@ namespace sql {
   }
 
   bool metadata_upsert(const QByteArray& key, const QByteArray& value, QUuid ref_id, RefType ref_type) {
-    const auto q = getQuery();
-
-    q->prepare(R"(
+    const auto q = prepared(R"(
       INSERT INTO metadata (id, key, value, ref_id, ref_type)
       VALUES (?, ?, ?, ?, ?)
       ON CONFLICT (ref_id, key)
@@ -466,8 +743,7 @@ namespace sql {
   }
 
   bool metadata_subscribe(QUuid ref_id, const QByteArray& key, QUuid account_id) {
-    const auto q1 = getQuery();
-      q1->prepare(R"(
+    const auto q1 = prepared(R"(
       SELECT id FROM metadata
       WHERE ref_id = ? AND key = ?
     )");
@@ -481,8 +757,7 @@ namespace sql {
 
     const QUuid metadata_id = q1->value("id").toUuid();
 
-    const auto q2 = getQuery();
-    q2->prepare(R"(
+    const auto q2 = prepared(R"(
       INSERT INTO metadata_subs (id, metadata_id, account_id)
       VALUES (?, ?, ?)
       ON CONFLICT (metadata_id, account_id) DO NOTHING
@@ -506,7 +781,8 @@ namespace sql {
 
     constexpr int INSERT_BATCH_SIZE = 500;
 
-    QSqlDatabase& db = ensureThreadDatabase();
+    const auto lease = connection();
+    QSqlDatabase &db = lease.db();
     db.transaction();
 
     // resolve metadata IDs for all keys
@@ -525,9 +801,7 @@ namespace sql {
         WHERE ref_id = ? AND key IN (%1)
       )").arg(placeholders.join(", "));
 
-      auto q = getQuery();
-      q->prepare(queryStr);
-
+      const auto q = lease.prepare(queryStr);
       q->addBindValue(ref_id);
 
       for (const auto& key : keyStrings)
@@ -553,8 +827,7 @@ namespace sql {
     }
 
     // prepare bulk insert
-    const auto q = getQuery();
-    q->prepare(R"(
+    const auto q = prepared(R"(
       INSERT INTO metadata_subs (id, metadata_id, account_id)
       VALUES (?, ?, ?)
       ON CONFLICT (metadata_id, account_id) DO NOTHING
@@ -616,13 +889,13 @@ namespace sql {
     if (keys.isEmpty())
       return false;
 
-    QSqlDatabase db = ensureThreadDatabase();
+    const auto lease = connection();
+    QSqlDatabase &db = lease.db();
     db.transaction();
 
     // resolve metadata IDs for the given keys
     QMap<QByteArray, QUuid> keyToMetadataId;
     {
-      const auto q = getQuery();
       QStringList keyStrings;
       for (const auto& k : keys)
         keyStrings << QString::fromUtf8(k);
@@ -636,7 +909,7 @@ namespace sql {
         WHERE ref_id = ? AND key IN (%1)
       )").arg(placeholders.join(", "));
 
-      q->prepare(queryStr);
+      const auto q = lease.prepare(queryStr);
       q->addBindValue(ref_id);
 
       for (const auto& key : keyStrings)
@@ -662,7 +935,6 @@ namespace sql {
     }
 
     // delete subscriptions for the resolved metadata IDs
-    const auto q = getQuery();
     QList<QUuid> metadataIds = keyToMetadataId.values();
     QStringList placeholders;
     for (int i = 0; i < metadataIds.size(); ++i)
@@ -673,7 +945,7 @@ namespace sql {
       WHERE account_id = ? AND metadata_id IN (%1)
     )").arg(placeholders.join(", "));
 
-    q->prepare(queryStr);
+    const auto q = lease.prepare(queryStr);
     q->addBindValue(account_id);
 
     for (const auto& id : metadataIds)
@@ -689,9 +961,152 @@ namespace sql {
     return true;
   }
 
+  QHash<QUuid, MetadataResult> metadata_all() {
+    QHash<QUuid, MetadataResult> result;
+    const auto q = prepared(R"(
+      SELECT m.ref_id, m.key, m.value, ms.account_id
+      FROM metadata m
+      LEFT JOIN metadata_subs ms ON ms.metadata_id = m.id
+    )");
+
+    if (!q->exec()) {
+      qWarning() << "failed to fetch metadata:" << q->lastError().text();
+      return result;
+    }
+
+    QHash<QUuid, QSharedPointer<Account>> accounts;
+    {
+      QReadLocker locker(&g::ctx->mtx_cache);
+      accounts = g::ctx->accounts_lookup_uuid;
+    }
+
+    while (q->next()) {
+      auto &entry = result[q->value("ref_id").toUuid()];
+      const QString key = q->value("key").toString();
+      entry.keyValues.insert(key, q->value("value"));
+
+      const auto account_id = q->value("account_id").toUuid();
+      if (account_id.isNull())
+        continue;
+
+      if (const auto account = accounts.value(account_id); !account.isNull())
+        entry.subscribers[key].insert(account->handle());
+    }
+
+    return result;
+  }
+
+  bool metadata_write(const QList<MetadataWrite> &writes, const QList<MetadataSubWrite> &subs) {
+    if (writes.isEmpty() && subs.isEmpty())
+      return true;
+
+    constexpr int UPSERT_BATCH = 500;
+
+    QList<const MetadataWrite*> upserts;
+    QVariantList remove_refs, remove_keys;
+    for (const auto &w: writes) {
+      if (w.remove) {
+        remove_refs << w.ref_id;
+        remove_keys << QString::fromUtf8(w.key);
+      } else {
+        upserts << &w;
+      }
+    }
+
+    const auto lease = connection();
+    QSqlDatabase &db = lease.db();
+    db.transaction();
+
+    // multi-row upserts; a key appears once, as ON CONFLICT requires
+    for (qsizetype at = 0; at < upserts.size(); at += UPSERT_BATCH) {
+      const qsizetype n = std::min<qsizetype>(UPSERT_BATCH, upserts.size() - at);
+
+      QString stmt = "INSERT INTO metadata (id, key, value, ref_id, ref_type) VALUES ";
+      for (qsizetype i = 0; i < n; ++i)
+        stmt += i == 0 ? "(?, ?, ?, ?, ?)" : ", (?, ?, ?, ?, ?)";
+      stmt += " ON CONFLICT (ref_id, key) DO UPDATE SET value = EXCLUDED.value, modified_at = CURRENT_TIMESTAMP";
+
+      const auto q = lease.prepare(stmt);
+      for (qsizetype i = at; i < at + n; ++i) {
+        const auto &w = *upserts[i];
+        q->addBindValue(QUuid::createUuid());
+        q->addBindValue(QString::fromUtf8(w.key));
+        q->addBindValue(w.value);
+        q->addBindValue(w.ref_id);
+        q->addBindValue(w.ref_type == RefType::Channel ? "channel" : "account");
+      }
+
+      if (!q->exec()) {
+        qWarning() << "metadata_write upsert error:" << q->lastError().text();
+        db.rollback();
+        return false;
+      }
+    }
+
+    if (!remove_refs.isEmpty()) {
+      const auto q = prepared("DELETE FROM metadata WHERE ref_id = ? AND key = ?");
+      q->addBindValue(remove_refs);
+      q->addBindValue(remove_keys);
+      if (!q->execBatch()) {
+        qWarning() << "metadata_write remove error:" << q->lastError().text();
+        db.rollback();
+        return false;
+      }
+    }
+
+    QVariantList sub_ids, sub_accounts, sub_refs, sub_keys;
+    QVariantList unsub_accounts, unsub_refs, unsub_keys;
+    for (const auto &s: subs) {
+      if (s.subscribe) {
+        sub_ids << QUuid::createUuid();
+        sub_accounts << s.account_id;
+        sub_refs << s.ref_id;
+        sub_keys << QString::fromUtf8(s.key);
+      } else {
+        unsub_accounts << s.account_id;
+        unsub_refs << s.ref_id;
+        unsub_keys << QString::fromUtf8(s.key);
+      }
+    }
+
+    // keys without a value have nothing to subscribe to, as before
+    if (!sub_ids.isEmpty()) {
+      const auto q = prepared(R"(
+        INSERT INTO metadata_subs (id, metadata_id, account_id)
+        SELECT ?, id, ? FROM metadata WHERE ref_id = ? AND key = ?
+        ON CONFLICT (metadata_id, account_id) DO NOTHING
+      )");
+      q->addBindValue(sub_ids);
+      q->addBindValue(sub_accounts);
+      q->addBindValue(sub_refs);
+      q->addBindValue(sub_keys);
+      if (!q->execBatch()) {
+        qWarning() << "metadata_write subscribe error:" << q->lastError().text();
+        db.rollback();
+        return false;
+      }
+    }
+
+    if (!unsub_accounts.isEmpty()) {
+      const auto q = prepared(R"(
+        DELETE FROM metadata_subs
+        WHERE account_id = ? AND metadata_id IN (SELECT id FROM metadata WHERE ref_id = ? AND key = ?)
+      )");
+      q->addBindValue(unsub_accounts);
+      q->addBindValue(unsub_refs);
+      q->addBindValue(unsub_keys);
+      if (!q->execBatch()) {
+        qWarning() << "metadata_write unsubscribe error:" << q->lastError().text();
+        db.rollback();
+        return false;
+      }
+    }
+
+    return db.commit();
+  }
+
   bool metadata_unsubscribe(QUuid ref_id, const QByteArray& key, QUuid account_id) {
-    const auto q1 = getQuery();
-    q1->prepare(R"(
+    const auto q1 = prepared(R"(
       SELECT id FROM metadata
       WHERE ref_id = ? AND key = ?
     )");
@@ -705,8 +1120,7 @@ namespace sql {
 
     const QUuid metadata_id = q1->value("id").toUuid();
 
-    const auto q2 = getQuery();
-      q2->prepare(R"(
+    const auto q2 = prepared(R"(
       DELETE FROM metadata_subs
       WHERE metadata_id = ? AND account_id = ?
     )");
@@ -725,106 +1139,686 @@ namespace sql {
     if (!msg)
       return {};
 
-    const auto q = getQuery();
+    const auto row = message_row(msg);
+    return insert_messages({row}) ? row.id : QUuid();
+  }
+
+  MessageRow message_row(const QSharedPointer<QEventMessage> &msg) {
+    MessageRow row;
+    row.id = msg->msgid.isNull() ? uuidv7::create() : msg->msgid;
+    row.sender_id = msg->account ? msg->account->uid() : QUuid();
+    row.account = msg->account ? msg->account->name() : QByteArray();
+    row.channel_id = msg->channel ? msg->channel->uid : QUuid();
+    row.text = msg->text;
+    row.raw = msg->raw;
+    row.tags = message_codec::encode_tags(msg->tags);
+    row.nick = msg->nick;
+    row.host = msg->host;
+    row.user = msg->user;
+    row.targets = msg->targets.join(",");
+
+    // raw is PRIVMSG/TAGMSG's arguments; only kept when it says more than
+    // target and text. It also names the target when nothing else did
+    QByteArray target = row.targets.toUtf8();
+    if (target.isEmpty())
+      target = msg->tag_msg ? msg->raw : msg->raw.left(msg->raw.indexOf(' '));
+    if (!target.isEmpty() && message_codec::derive_raw(target, msg->text, msg->tag_msg) == msg->raw) {
+      row.raw.clear();
+      if (row.targets.isEmpty())
+        row.targets = QString::fromUtf8(target);
+    }
+    row.recipient_id = msg->dest ? msg->dest->uid() : QUuid();
+    row.from_system = msg->from_system;
+    row.tag_msg = msg->tag_msg;
+    row.creation_date = msg->server_time > 0 ?
+      QDateTime::fromMSecsSinceEpoch(msg->server_time) :
+      QDateTime::currentDateTime();
+    return row;
+  }
+
+  // nick, username and host repeat for every message of a session; they
+  // are stored once in message_senders and messages point at them
+  static constexpr int SENDER_CACHE_MAX = 65536;
+  static QMutex mtx_senders;
+  static QHash<QByteArray, qint64> senders;
+
+  static bool sender_refs(const QList<MessageRow> &rows, QList<qint64> &refs) {
+    refs.resize(rows.size());
+    QHash<QByteArray, QList<int>> missing;
+    {
+      QMutexLocker locker(&mtx_senders);
+      for (int i = 0; i < rows.size(); ++i) {
+        const QByteArray key = rows[i].nick + '\0' + rows[i].user + '\0' + rows[i].host;
+        if (const auto it = senders.constFind(key); it != senders.constEnd())
+          refs[i] = it.value();
+        else
+          missing[key] << i;
+      }
+    }
+
+    for (auto it = missing.constBegin(); it != missing.constEnd(); ++it) {
+      const auto &row = rows[it.value().first()];
+
+      const auto q_insert = prepared("INSERT INTO message_senders (nick, username, host) VALUES (?, ?, ?) ON CONFLICT (nick, username, host) DO NOTHING");
+      q_insert->addBindValue(QString::fromUtf8(row.nick));
+      q_insert->addBindValue(QString::fromUtf8(row.user));
+      q_insert->addBindValue(QString::fromUtf8(row.host));
+      if (!q_insert->exec()) {
+        qCritical() << "sender_refs insert error:" << q_insert->lastError().text();
+        return false;
+      }
+
+      const auto q = prepared("SELECT id FROM message_senders WHERE nick = ? AND username = ? AND host = ?");
+      q->addBindValue(QString::fromUtf8(row.nick));
+      q->addBindValue(QString::fromUtf8(row.user));
+      q->addBindValue(QString::fromUtf8(row.host));
+      if (!q->exec() || !q->next()) {
+        qCritical() << "sender_refs query error:" << q->lastError().text();
+        return false;
+      }
+
+      const qint64 id = q->value(0).toLongLong();
+      for (const int i: it.value())
+        refs[i] = id;
+
+      QMutexLocker locker(&mtx_senders);
+      if (senders.size() >= SENDER_CACHE_MAX)
+        senders.clear();
+      senders.insert(it.key(), id);
+    }
+    return true;
+  }
+
+  // "<head>(?, ..), (?, ..)<tail>" for a multi-row INSERT
+  static QString values_statement(const QString &head, const int columns, const qsizetype rows, const char *tail) {
+    QString tuple = "(";
+    for (int i = 0; i < columns; ++i)
+      tuple += i == 0 ? "?" : ", ?";
+    tuple += ")";
+
+    QString stmt = head;
+    stmt.reserve(head.size() + rows * (tuple.size() + 2) + 48);
+    for (qsizetype i = 0; i < rows; ++i) {
+      if (i > 0)
+        stmt += ", ";
+      stmt += tuple;
+    }
+    stmt += QLatin1String(tail);
+    return stmt;
+  }
+
+  // one multi-row INSERT per call, inside a transaction. Rows that already
+  // exist are skipped, so a batch can safely be retried.
+  bool insert_messages(const QList<MessageRow> &rows) {
+    if (rows.isEmpty())
+      return true;
+    if (g::ctx->message_log != nullptr)
+      return g::ctx->message_log->append(rows);
+
+    QList<qint64> refs;
+    if (!sender_refs(rows, refs))
+      return false;
+
+    // text, raw, tags and the sender live in body and sender_ref. One
+    // statement per batch size; the pool caches it per connection
+    const QString stmt = values_statement(R"(INSERT INTO messages (
+        id, sender_id, channel_id, text, body, sender_ref,
+        targets, recipient_id, from_system, tag_msg, creation_date
+      ) VALUES )", 11, rows.size(),
+      partitioned() ? " ON CONFLICT (id, creation_date) DO NOTHING" : " ON CONFLICT (id) DO NOTHING");
+
+    const auto lease = connection();
+    QSqlDatabase &db = lease.db();
+    db.transaction();
+
+    const auto q = lease.prepare(stmt);
+
+    for (int i = 0; i < rows.size(); ++i) {
+      const auto &row = rows[i];
+      q->addBindValue(row.id);
+      q->addBindValue(row.sender_id);
+      q->addBindValue(row.channel_id);
+      q->addBindValue(legacy_text_required ? QVariant(QString("")) : QVariant(QMetaType(QMetaType::QString)));
+      q->addBindValue(message_codec::encode_body({row.text, row.tags, row.raw}));
+      q->addBindValue(refs[i]);
+      q->addBindValue(row.targets);
+      q->addBindValue(row.recipient_id);
+      q->addBindValue(row.from_system ? 1 : 0);
+      q->addBindValue(row.tag_msg ? 1 : 0);
+      q->addBindValue(row.creation_date);
+    }
 
-    q->prepare(R"(
-      INSERT INTO messages (
-        id, sender_id, channel_id, text, raw, tags,
-        nick, host, username, targets, from_system, tag_msg
-      ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+    if (!q->exec()) {
+      qCritical() << "insert_messages error:" << q->lastError().text();
+      db.rollback();
+      return false;
+    }
+
+    return db.commit();
+  }
+
+  // keys map onto (creation_date, id); the sentinels onto the nil/max uuid
+  static QUuid history_bound(const HistoryKey &key) {
+    if (key.second.isEmpty())
+      return QUuid();
+    if (key.second.size() != 16)
+      return QUuid(QLatin1String("ffffffff-ffff-ffff-ffff-ffffffffffff"));
+    return QUuid::fromRfc4122(key.second);
+  }
+
+  static HistoryEntry history_entry(const QSharedPointer<QSqlQuery> &q, const QByteArray &target) {
+    const QUuid id = q->value("id").toUuid();
+    const QDateTime created = q->value("creation_date").toDateTime();
+
+    QByteArray text;
+    QMap<QString, QVariant> tags;
+    if (const QByteArray data = q->value("body").toByteArray(); !data.isEmpty()) {
+      message_codec::Body body;
+      if (!message_codec::decode_body(data, body))
+        qWarning() << "history: undecodable message body" << id;
+      text = body.text;
+      tags = message_codec::decode_tags(body.tags);
+    } else {
+      // rows from before the compact encoding
+      text = q->value("text").toByteArray();
+      tags = QJsonDocument::fromJson(q->value("tags").toByteArray()).toVariant().toMap();
+    }
+
+    HistoryEntry entry;
+    entry.key = {created.toMSecsSinceEpoch(), id.toRfc4122()};
+    entry.msgid = id.toByteArray(QUuid::WithoutBraces);
+    entry.time = created.toUTC().toString(Qt::ISODateWithMs).toUtf8();
+    entry.account = q->value("account").toByteArray();
+    entry.tags = irc::encodeTags(tags);
+    entry.line =
+      ":" + q->value("nick").toByteArray() +
+      "!" + q->value("username").toByteArray() +
+      "@" + q->value("host").toByteArray() +
+      " PRIVMSG " + target +
+      " :" + text;
+    return entry;
+  }
+
+  QList<HistoryEntry> message_history(
+      const QUuid &channel_id,
+      const QByteArray &channel_name,
+      const HistoryKey &lo,
+      const HistoryKey &hi,
+      const bool backward,
+      const int limit,
+      const bool inclusive_lo) {
+    QList<HistoryEntry> entries;
+    if (limit <= 0 || channel_id.isNull())
+      return entries;
+    if (g::ctx->message_log != nullptr)
+      return g::ctx->message_log->channel_range(channel_id, "#" + channel_name, lo, hi, backward, limit, inclusive_lo);
+
+    const auto q = prepared(QString(R"(
+      SELECT m.id, COALESCE(s.nick, m.nick) AS nick, COALESCE(s.username, m.username) AS username,
+             COALESCE(s.host, m.host) AS host, m.text, m.tags, m.body, m.creation_date, a.username AS account
+      FROM messages m
+      LEFT JOIN message_senders s ON s.id = m.sender_ref
+      LEFT JOIN accounts a ON a.id = m.sender_id
+      WHERE m.channel_id = ?
+        AND m.tag_msg = 0
+        AND m.creation_date BETWEEN ? AND ?
+        AND (m.creation_date, m.id) %1 (?, ?)
+        AND (m.creation_date, m.id) < (?, ?)
+      ORDER BY m.creation_date %2, m.id %2
+      LIMIT ?
+    )").arg(inclusive_lo ? ">=" : ">", backward ? "DESC" : "ASC"));
+    q->addBindValue(channel_id);
+    // plain bounds as well; partitions are pruned on these, not on the row
+    // comparisons
+    q->addBindValue(QDateTime::fromMSecsSinceEpoch(lo.first));
+    q->addBindValue(QDateTime::fromMSecsSinceEpoch(hi.first));
+    q->addBindValue(QDateTime::fromMSecsSinceEpoch(lo.first));
+    q->addBindValue(history_bound(lo));
+    q->addBindValue(QDateTime::fromMSecsSinceEpoch(hi.first));
+    q->addBindValue(history_bound(hi));
+    q->addBindValue(limit);
+
+    if (!q->exec()) {
+      qCritical() << "message_history query error:" << q->lastError().text();
+      return entries;
+    }
+
+    const QByteArray target = "#" + channel_name;
+    while (q->next())
+      entries << history_entry(q, target);
+
+    if (backward)
+      std::reverse(entries.begin(), entries.end());
+    return entries;
+  }
+
+  QList<HistoryEntry> private_history(
+      const QUuid &account_id,
+      const HistoryKey &lo,
+      const HistoryKey &hi,
+      const bool backward,
+      const int limit,
+      const bool inclusive_lo,
+      const QUuid &peer) {
+    QList<HistoryEntry> entries;
+    if (limit <= 0 || account_id.isNull())
+      return entries;
+    if (g::ctx->message_log != nullptr)
+      return g::ctx->message_log->private_range(account_id, lo, hi, backward, limit, inclusive_lo, peer);
+
+    const auto q = prepared(QString(R"(
+      SELECT m.id, COALESCE(s.nick, m.nick) AS nick, COALESCE(s.username, m.username) AS username,
+             COALESCE(s.host, m.host) AS host, m.text, m.tags, m.body, m.targets, m.creation_date, a.username AS account
+      FROM messages m
+      LEFT JOIN message_senders s ON s.id = m.sender_ref
+      LEFT JOIN accounts a ON a.id = m.sender_id
+      WHERE (m.recipient_id = ? OR (m.sender_id = ? AND m.recipient_id IS NOT NULL))
+        AND m.channel_id IS NULL
+        AND m.tag_msg = 0%3
+        AND m.creation_date BETWEEN ? AND ?
+        AND (m.creation_date, m.id) %1 (?, ?)
+        AND (m.creation_date, m.id) < (?, ?)
+      ORDER BY m.creation_date %2, m.id %2
+      LIMIT ?
+    )").arg(inclusive_lo ? ">=" : ">", backward ? "DESC" : "ASC",
+            peer.isNull() ? "" : "\n        AND (m.sender_id = ? OR m.recipient_id = ?)"));
+    q->addBindValue(account_id);
+    q->addBindValue(account_id);
+    if (!peer.isNull()) {
+      q->addBindValue(peer);
+      q->addBindValue(peer);
+    }
+    q->addBindValue(QDateTime::fromMSecsSinceEpoch(lo.first));
+    q->addBindValue(QDateTime::fromMSecsSinceEpoch(hi.first));
+    q->addBindValue(QDateTime::fromMSecsSinceEpoch(lo.first));
+    q->addBindValue(history_bound(lo));
+    q->addBindValue(QDateTime::fromMSecsSinceEpoch(hi.first));
+    q->addBindValue(history_bound(hi));
+    q->addBindValue(limit);
+
+    if (!q->exec()) {
+      qCritical() << "private_history query error:" << q->lastError().text();
+      return entries;
+    }
+
+    while (q->next())
+      entries << history_entry(q, q->value("targets").toByteArray());
+
+    if (backward)
+      std::reverse(entries.begin(), entries.end());
+    return entries;
+  }
+  // deletes `where` rows older than `cutoff` in bounded batches, so no
+  // single statement holds locks for long
+  static qint64 messages_delete_before(const QString &where, const QUuid &server_id, const QDateTime &cutoff) {
+    const QString sql = QString(R"(
+      DELETE FROM messages WHERE (id, creation_date) IN (
+        SELECT id, creation_date FROM messages
+        WHERE %1 AND creation_date < ?
+        LIMIT %2
+      )
+    )").arg(where).arg(RETENTION_DELETE_BATCH);
+
+    qint64 deleted = 0;
+    for (;;) {
+      const auto q = prepared(sql);
+      if (!server_id.isNull())
+        q->addBindValue(server_id);
+      q->addBindValue(cutoff);
+      if (!q->exec()) {
+        qCritical() << "messages_delete_before error:" << q->lastError().text();
+        break;
+      }
+      deleted += q->numRowsAffected();
+      if (q->numRowsAffected() < RETENTION_DELETE_BATCH)
+        break;
+    }
+    return deleted;
+  }
+
+  bool messages_maintain(const int default_days, const bool archive) {
+    static std::atomic<bool> running = false;
+    if (running.exchange(true))
+      return false;
+    struct Done { ~Done() { running = false; } } done;
+
+    if (partitioned())
+      messages_partitions_create(PARTITION_MONTHS_AHEAD);
+
+    // retention per server, channel messages only; private messages and
+    // those of deleted channels follow the default
+    QList<QPair<QUuid, int>> servers;
+    {
+      const auto q = prepared("SELECT id, message_retention_days FROM servers");
+      if (!q->exec()) {
+        qCritical() << "messages_maintain query error:" << q->lastError().text();
+        return false;
+      }
+      while (q->next())
+        servers << qMakePair(q->value(0).toUuid(), q->value(1).isNull() ? default_days : q->value(1).toInt());
+    }
+
+    // partitions go once every server is done with them; shorter
+    // retention than that is row deletes
+    bool forever = default_days == 0;
+    int horizon = default_days;
+    for (const auto &[id, days]: servers) {
+      forever |= days == 0;
+      horizon = std::max(horizon, days);
+    }
+    if (!partitioned() || forever)
+      horizon = 0;
+
+    const QDateTime now = QDateTime::currentDateTime();
+    if (horizon > 0) {
+      const QDateTime cutoff = now.addDays(-horizon);
+      QList<MessagePartition> partitions;
+      if (!message_partitions(partitions))
+        return false;
+
+      for (const auto &p: partitions) {
+        if (!p.to.isValid() || p.to > cutoff)
+          continue;
+
+        const auto q = getQuery();
+        const QString archived = "messages_archive_" + p.name.mid(QString("messages_").size());
+        const bool ok = archive ?
+          q->exec(QString("ALTER TABLE messages DETACH PARTITION %1").arg(p.name)) &&
+          q->exec(QString("ALTER TABLE %1 RENAME TO %2").arg(p.name, archived)) :
+          q->exec(QString("DROP TABLE %1").arg(p.name));
+        if (!ok) {
+          qCritical() << "messages: could not expire partition" << p.name << q->lastError().text();
+          continue;
+        }
+        qInfo() << "messages:" << (archive ? "archived partition" : "dropped partition") << p.name << (archive ? "as " + archived : QString());
+      }
+    }
+
+    const auto expires = [&](const int days) { return days > 0 && (horizon == 0 || days < horizon); };
+    for (const auto &[id, days]: servers) {
+      if (!expires(days))
+        continue;
+      const qint64 deleted = messages_delete_before("channel_id IN (SELECT id FROM channels WHERE server_id = ?)", id, now.addDays(-days));
+      if (deleted > 0)
+        qInfo() << "messages: retention deleted" << deleted << "messages of server" << id.toString(QUuid::WithoutBraces);
+    }
+
+    if (expires(default_days)) {
+      const qint64 deleted = messages_delete_before("channel_id IS NULL", {}, now.addDays(-default_days));
+      if (deleted > 0)
+        qInfo() << "messages: retention deleted" << deleted << "private messages";
+    }
+    return true;
+  }
+
+
+  bool backlog_cursors_save(const QUuid &account_id, const QHash<QByteArray, HistoryKey> &cursors) {
+    if (account_id.isNull() || cursors.isEmpty())
+      return true;
+
+    QString stmt = "INSERT INTO backlog_cursors (account_id, target, ts, ref) VALUES ";
+    for (int i = 0; i < cursors.size(); ++i)
+      stmt += i == 0 ? "(?, ?, ?, ?)" : ", (?, ?, ?, ?)";
+    stmt += " ON CONFLICT (account_id, target) DO UPDATE SET ts = EXCLUDED.ts, ref = EXCLUDED.ref";
+
+    const auto q = prepared(stmt);
+    for (auto it = cursors.constBegin(); it != cursors.constEnd(); ++it) {
+      q->addBindValue(account_id);
+      q->addBindValue(QString::fromUtf8(it.key()));
+      q->addBindValue(it.value().first);
+      q->addBindValue(it.value().second);
+    }
+
+    if (!q->exec()) {
+      qCritical() << "backlog_cursors_save error:" << q->lastError().text();
+      return false;
+    }
+    return true;
+  }
+
+  SessionRevocations session_revocations(const qint64 now, const qint64 stale) {
+    SessionRevocations result;
+
+    const auto stale_generations = prepared("DELETE FROM session_generations WHERE generation <= ?");
+    stale_generations->addBindValue(stale);
+    if (!stale_generations->exec())
+      qWarning() << "session_revocations prune error:" << stale_generations->lastError().text();
+
+    const auto generations = prepared("SELECT account_id, generation FROM session_generations");
+    if (!generations->exec()) {
+      qCritical() << "session_revocations error:" << generations->lastError().text();
+      return result;
+    }
+    while (generations->next())
+      result.generations.insert(generations->value("account_id").toUuid(), generations->value("generation").toUInt());
+
+    const auto pruned = prepared("DELETE FROM session_revocations WHERE expires <= ?");
+    pruned->addBindValue(now);
+    if (!pruned->exec())
+      qWarning() << "session_revocations prune error:" << pruned->lastError().text();
+
+    const auto devices = prepared("SELECT account_id, device, expires FROM session_revocations");
+    if (!devices->exec()) {
+      qCritical() << "session_revocations error:" << devices->lastError().text();
+      return result;
+    }
+    while (devices->next())
+      result.devices.insert({devices->value("account_id").toUuid(), devices->value("device").toByteArray()}, devices->value("expires").toLongLong());
+    return result;
+  }
+
+  bool session_revoke_device(const QUuid &account_id, const QByteArray &device, const qint64 expires) {
+    const auto q = prepared(R"(
+      INSERT INTO session_revocations (account_id, device, expires) VALUES (?, ?, ?)
+      ON CONFLICT (account_id, device) DO UPDATE SET expires = EXCLUDED.expires
     )");
+    q->addBindValue(account_id);
+    q->addBindValue(device);
+    q->addBindValue(expires);
 
-    const auto uuid = QUuid::createUuid();
+    if (!q->exec()) {
+      qCritical() << "session_revoke_device error:" << q->lastError().text();
+      return false;
+    }
+    return true;
+  }
 
-    q->addBindValue(uuid);                                             // id
-    q->addBindValue(msg->account ? msg->account->uid() : QUuid());     // sender_id
-    q->addBindValue(msg->channel ? msg->channel->uid : QUuid());       // channel_id
-    q->addBindValue(msg->text);                                        // text
-    q->addBindValue(msg->raw);                                         // raw
-    q->addBindValue(QJsonDocument::fromVariant(msg->tags).toJson(QJsonDocument::Compact)); // tags
-    q->addBindValue(msg->nick);                                        // nick
-    q->addBindValue(msg->host);                                        // host
-    q->addBindValue(msg->user);                                        // username
-    q->addBindValue(msg->targets.join(","));                           // targets
-    q->addBindValue(msg->from_system ? 1 : 0);                         // from_system
-    q->addBindValue(msg->tag_msg ? 1 : 0);                             // tag_msg
+  bool session_generation_set(const QUuid &account_id, const quint32 generation) {
+    const auto q = prepared(R"(
+      INSERT INTO session_generations (account_id, generation) VALUES (?, ?)
+      ON CONFLICT (account_id) DO UPDATE SET generation = EXCLUDED.generation
+    )");
+    q->addBindValue(account_id);
+    q->addBindValue(static_cast<qint64>(generation));
 
     if (!q->exec()) {
-      qWarning() << "Failed to insert message:" << q->lastError().text();
-      return {};
+      qCritical() << "session_generation_set error:" << q->lastError().text();
+      return false;
+    }
+    return true;
+  }
+
+  QHash<QByteArray, HistoryKey> backlog_cursors_take(const QUuid &account_id) {
+    QHash<QByteArray, HistoryKey> cursors;
+    if (account_id.isNull())
+      return cursors;
+
+    const auto q = prepared("DELETE FROM backlog_cursors WHERE account_id = ? RETURNING target, ts, ref");
+    q->addBindValue(account_id);
+
+    if (!q->exec()) {
+      qCritical() << "backlog_cursors_take error:" << q->lastError().text();
+      return cursors;
     }
 
-    return uuid;
+    while (q->next())
+      cursors.insert(q->value("target").toByteArray(), {q->value("ts").toLongLong(), q->value("ref").toByteArray()});
+    return cursors;
   }
 
-  void insert_messages(const QSet<QSharedPointer<QEventMessage>>& messages) {
-    if (messages.isEmpty())
-      return;
+  bool insert_events(const QList<EventRow> &rows) {
+    if (rows.isEmpty())
+      return true;
 
-    constexpr int INSERT_BATCH_SIZE = 1000;
+    const QString stmt = values_statement(
+      "INSERT INTO events (id, account_id, channel_id, event_type, seq, data, creation_date) VALUES ",
+      7, rows.size(), " ON CONFLICT (id) DO NOTHING");
 
-    QSqlDatabase db = QSqlDatabase::database();
+    const auto lease = connection();
+    QSqlDatabase &db = lease.db();
     db.transaction();
 
-    const auto q = getQuery();
-    q->prepare(R"(
-      INSERT INTO messages (
-        id, account_id, channel_id, text, raw, tags,
-        nick, host, username, targets, from_system, tag_msg
-      ) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+    const auto q = lease.prepare(stmt);
+
+    for (const auto& row: rows) {
+      q->addBindValue(row.id);
+      q->addBindValue(row.account_id);
+      q->addBindValue(row.channel_id);
+      q->addBindValue(row.event_type);
+      q->addBindValue(static_cast<qint64>(row.seq));
+      q->addBindValue(QString::fromUtf8(row.data));
+      q->addBindValue(row.creation_date);
+    }
+
+    if (!q->exec()) {
+      qCritical() << "insert_events error:" << q->lastError().text();
+      db.rollback();
+      return false;
+    }
+
+    // the latest topic per channel in this batch
+    QHash<QUuid, QByteArray> topics;
+    for (const auto& row: rows) {
+      if (row.event_type == static_cast<int>(EventType::Topic))
+        topics.insert(row.channel_id, row.topic);
+    }
+
+    if (!topics.isEmpty()) {
+      const auto q_topic = lease.prepare("UPDATE channels SET topic = ? WHERE id = ?");
+      for (auto it = topics.cbegin(); it != topics.cend(); ++it) {
+        q_topic->addBindValue(QString::fromUtf8(it.value()));
+        q_topic->addBindValue(it.key());
+        if (!q_topic->exec()) {
+          qCritical() << "insert_events topic error:" << q_topic->lastError().text();
+          db.rollback();
+          return false;
+        }
+      }
+    }
+
+    return db.commit();
+  }
+
+  quint64 channel_event_head(const QUuid &channel_id) {
+    if (channel_id.isNull())
+      return 0;
+
+    // the reservation covers every number that was handed out, the events
+    // only those that were written
+    const auto q = prepared(R"(
+      SELECT MAX(head) FROM (
+        SELECT COALESCE(MAX(seq), 0) AS head FROM events WHERE channel_id = ?
+        UNION ALL
+        SELECT reserved AS head FROM channel_sequences WHERE channel_id = ?
+      ) heads
     )");
+    q->addBindValue(channel_id);
+    q->addBindValue(channel_id);
 
-    QList<QVariant> ids, account_ids, channel_ids, texts, raws, tagss, nicks, hosts, users, targetss, from_systems, tag_msgs;
-    int count = 0;
+    if (!q->exec() || !q->next()) {
+      qCritical() << "channel_event_head query error:" << q->lastError().text();
+      return 0;
+    }
 
-    auto flush = [&] {
-      if (ids.isEmpty())
-        return;
+    return q->value(0).toULongLong();
+  }
 
-      q->addBindValue(ids);
-      q->addBindValue(account_ids);
-      q->addBindValue(channel_ids);
-      q->addBindValue(texts);
-      q->addBindValue(raws);
-      q->addBindValue(tagss);
-      q->addBindValue(nicks);
-      q->addBindValue(hosts);
-      q->addBindValue(users);
-      q->addBindValue(targetss);
-      q->addBindValue(from_systems);
-      q->addBindValue(tag_msgs);
-
-      q->execBatch();
-
-      ids.clear(); account_ids.clear(); channel_ids.clear();
-      texts.clear(); raws.clear(); tagss.clear();
-      nicks.clear(); hosts.clear(); users.clear();
-      targetss.clear(); from_systems.clear(); tag_msgs.clear();
-    };
+  QHash<QUuid, quint64> channel_event_heads() {
+    QHash<QUuid, quint64> heads;
+    const auto q = prepared(R"(
+      SELECT channel_id, MAX(head) AS head FROM (
+        SELECT channel_id, MAX(seq) AS head FROM events WHERE channel_id IS NOT NULL GROUP BY channel_id
+        UNION ALL
+        SELECT channel_id, reserved AS head FROM channel_sequences
+      ) heads
+      GROUP BY channel_id
+    )");
 
-    for (const auto& msg : messages) {
-      ids << QUuid::createUuid();
+    if (!q->exec()) {
+      qCritical() << "channel_event_heads query error:" << q->lastError().text();
+      return heads;
+    }
 
-      account_ids << (msg->account ? msg->account->uid() : QUuid());
-      channel_ids << (msg->channel ? msg->channel->uid : QUuid());
-      texts << msg->text;
-      raws << msg->raw;
-      tagss << QJsonDocument::fromVariant(msg->tags).toJson(QJsonDocument::Compact);
-      nicks << msg->nick;
-      hosts << msg->host;
-      users << msg->user;
-      targetss << msg->targets.join(",");
-      from_systems << (msg->from_system ? 1 : 0);
-      tag_msgs << (msg->tag_msg ? 1 : 0);
+    while (q->next())
+      heads.insert(q->value("channel_id").toUuid(), q->value("head").toULongLong());
+    return heads;
+  }
 
-      count++;
-      if (count % INSERT_BATCH_SIZE == 0) {
-        flush();
+  bool channel_seq_reserve(const QUuid &channel_id, const quint64 upto) {
+    if (channel_id.isNull())
+      return true;
+
+    const auto q = prepared(R"(
+      INSERT INTO channel_sequences (channel_id, reserved) VALUES (?, ?)
+      ON CONFLICT (channel_id) DO UPDATE SET reserved = EXCLUDED.reserved
+    )");
+    q->addBindValue(channel_id);
+    q->addBindValue(static_cast<qint64>(upto));
+
+    if (!q->exec()) {
+      qCritical() << "channel_seq_reserve error:" << q->lastError().text();
+      return false;
+    }
+    return true;
+  }
+
+  QList<ChannelEvent> channel_events(const QUuid &channel_id, const QByteArray &target, const quint64 after, const quint64 upto, const int limit) {
+    QList<ChannelEvent> events;
+    if (limit <= 0 || channel_id.isNull() || after >= upto)
+      return events;
+
+    // a message event without data refers to the message row of the same id
+    const auto q = prepared(R"(
+      SELECT e.id, e.seq, e.event_type, e.data, e.creation_date, a.username AS account,
+             m.id AS message_id, COALESCE(s.nick, m.nick) AS nick, COALESCE(s.username, m.username) AS username,
+             COALESCE(s.host, m.host) AS host, m.text, m.tags, m.body
+      FROM events e
+      LEFT JOIN accounts a ON a.id = e.account_id
+      LEFT JOIN messages m ON e.event_type = ? AND e.data = '' AND m.id = e.id AND m.creation_date = e.creation_date
+      LEFT JOIN message_senders s ON s.id = m.sender_ref
+      WHERE e.channel_id = ? AND e.seq > ? AND e.seq <= ?
+      ORDER BY e.seq ASC
+      LIMIT ?
+    )");
+    q->addBindValue(static_cast<int>(EventType::Message));
+    q->addBindValue(channel_id);
+    q->addBindValue(static_cast<qint64>(after));
+    q->addBindValue(static_cast<qint64>(upto));
+    q->addBindValue(limit);
+
+    if (!q->exec()) {
+      qCritical() << "channel_events query error:" << q->lastError().text();
+      return events;
+    }
+
+    while (q->next()) {
+      ChannelEvent event;
+      event.seq = q->value("seq").toULongLong();
+      event.type = q->value("event_type").toInt();
+      event.id = q->value("id").toUuid().toByteArray(QUuid::WithoutBraces);
+      event.time = q->value("creation_date").toDateTime().toUTC().toString(Qt::ISODateWithMs).toUtf8();
+      event.account = q->value("account").toByteArray();
+      event.line = q->value("data").toByteArray();
+      if (event.line.isEmpty()) {
+        // the message is gone (retention); nothing to replay
+        if (q->value("message_id").isNull())
+          continue;
+        event.line = history_entry(q, target).line;
       }
+      events << event;
     }
 
-    flush(); // insert remaining messages
-    db.commit();
+    return events;
   }
 
   QSharedPointer<Account> account_get_or_create(const QByteArray &username, const QByteArray &password) {
@@ -834,8 +1828,7 @@ namespace sql {
     }
 
     {
-      const auto q = getQuery();
-      q->prepare("SELECT id, username, password, creation_date FROM accounts WHERE username = ?");
+      const auto q = prepared("SELECT id, username, password, creation_date FROM accounts WHERE username = ?");
       q->addBindValue(QString::fromUtf8(username));
 
       if (!q->exec()) {
@@ -857,8 +1850,7 @@ namespace sql {
     const auto uuid = QUuid::createUuid();
     const QString hashedPassword = hashPasswordBcrypt(QString::fromUtf8(password));
 
-    const auto q_insert = getQuery();
-    q_insert->prepare("INSERT INTO accounts (id, username, password) VALUES (?, ?, ?)");
+    const auto q_insert = prepared("INSERT INTO accounts (id, username, password) VALUES (?, ?, ?)");
     q_insert->addBindValue(uuid.toString());
     q_insert->addBindValue(QString::fromUtf8(username));
     q_insert->addBindValue(hashedPassword);
@@ -877,9 +1869,7 @@ namespace sql {
       int type,
       int variant) {
 
-    const auto q = getQuery();
-    q->prepare(
-      "SELECT id, account_owner_id, path, type, variant, creation_date FROM uploads WHERE account_owner_id = ? AND path = ?");
+    const auto q = prepared("SELECT id, account_owner_id, path, type, variant, creation_date FROM uploads WHERE account_owner_id = ? AND path = ?");
     q->addBindValue(accountId);
     q->addBindValue(path);
 
@@ -900,8 +1890,7 @@ namespace sql {
     }
 
     const auto uuid = QUuid::createUuid();
-    const auto q_insert = getQuery();
-    q_insert->prepare("INSERT INTO uploads (id, account_owner_id, path, type, variant) VALUES (?, ?, ?, ?, ?)");
+    const auto q_insert = prepared("INSERT INTO uploads (id, account_owner_id, path, type, variant) VALUES (?, ?, ?, ?, ?)");
     q_insert->addBindValue(uuid);
     q_insert->addBindValue(accountId);
     q_insert->addBindValue(path);
@@ -917,8 +1906,7 @@ namespace sql {
   }
 
   QSharedPointer<Permission> permission_get_or_create(const QUuid &roleId, Permission::PermissionFlags flags) {
-    const auto q = getQuery();
-    q->prepare("SELECT id, role_id, permission_bits FROM permissions WHERE role_id = ?");
+    const auto q = prepared("SELECT id, role_id, permission_bits FROM permissions WHERE role_id = ?");
     q->addBindValue(roleId);
 
     if (!q->exec()) {
@@ -935,8 +1923,7 @@ namespace sql {
     }
 
     const auto uuid = QUuid::createUuid();
-    const auto insertQuery = getQuery();
-    insertQuery->prepare("INSERT INTO permissions (id, role_id, permission_bits) VALUES (?, ?, ?)");
+    const auto insertQuery = prepared("INSERT INTO permissions (id, role_id, permission_bits) VALUES (?, ?, ?)");
     insertQuery->addBindValue(uuid);
     insertQuery->addBindValue(roleId);
     insertQuery->addBindValue(flags.bits);
@@ -962,11 +1949,8 @@ namespace sql {
     // -------------------------
     // Check if role already exists
     // -------------------------
-    const auto q_select = getQuery();
-    q_select->prepare(
-      "SELECT id, server_id, name, icon, color, priority, creation_date "
-      "FROM roles WHERE server_id = ? AND name = ?"
-    );
+    const auto q_select = prepared("SELECT id, server_id, name, icon, color, priority, creation_date "
+      "FROM roles WHERE server_id = ? AND name = ?");
     q_select->addBindValue(server->uid());
     q_select->addBindValue(roleName);
 
@@ -996,10 +1980,7 @@ namespace sql {
     // create new role
     // -------------------------
     const auto role_uid = QUuid::createUuid();
-    const auto q_insert = getQuery();
-    q_insert->prepare(
-      "INSERT INTO roles (id, server_id, name, priority, icon) VALUES (?, ?, ?, ?, ?)"
-    );
+    const auto q_insert = prepared("INSERT INTO roles (id, server_id, name, priority, icon) VALUES (?, ?, ?, ?, ?)");
     q_insert->addBindValue(role_uid);        // UUID
     q_insert->addBindValue(server->uid());   // UUID
     q_insert->addBindValue(roleName);        // TEXT
@@ -1018,10 +1999,7 @@ namespace sql {
     // -------------------------
     // Fetch the newly created role to get creation_date
     // -------------------------
-    const auto q_fetch = getQuery();
-    q_fetch->prepare(
-      "SELECT id, server_id, name, icon, color, priority, creation_date FROM roles WHERE id = ?"
-    );
+    const auto q_fetch = prepared("SELECT id, server_id, name, icon, color, priority, creation_date FROM roles WHERE id = ?");
     q_fetch->addBindValue(role_uid);
 
     if (!q_fetch->exec() || !q_fetch->next()) {
@@ -1055,8 +2033,7 @@ namespace sql {
     // -------------------------
     if (assignToExistingMembers) {
       for (const auto &member : server->all_accounts()) {
-        const auto q_ar = getQuery();
-        q_ar->prepare("INSERT INTO account_roles (account_id, role_id) VALUES (?, ?) ON CONFLICT DO NOTHING");
+        const auto q_ar = prepared("INSERT INTO account_roles (account_id, role_id) VALUES (?, ?) ON CONFLICT DO NOTHING");
         q_ar->addBindValue(member->uid());
         q_ar->addBindValue(role_uid);
         if (!q_ar->exec()) {
@@ -1075,8 +2052,7 @@ namespace sql {
     if (!role || accountId.isNull())
       return false;
 
-    const auto q = getQuery();
-    q->prepare("INSERT INTO account_roles (account_id, role_id) VALUES (?, ?) ON CONFLICT DO NOTHING");
+    const auto q = prepared("INSERT INTO account_roles (account_id, role_id) VALUES (?, ?) ON CONFLICT DO NOTHING");
     q->addBindValue(accountId);
     q->addBindValue(role->uid());
 
@@ -1097,8 +2073,7 @@ namespace sql {
     }
 
     // prevent duplicate membership
-    const auto q_check = getQuery();
-    q_check->prepare("SELECT 1 FROM server_members WHERE account_id = ? AND server_id = ?");
+    const auto q_check = prepared("SELECT 1 FROM server_members WHERE account_id = ? AND server_id = ?");
     q_check->addBindValue(accountId);
     q_check->addBindValue(serverId);
     if (!q_check->exec()) {
@@ -1111,8 +2086,7 @@ namespace sql {
     }
 
     // insert into server_members table
-    const auto q = getQuery();
-    q->prepare("INSERT INTO server_members (account_id, server_id) VALUES (?, ?)");
+    const auto q = prepared("INSERT INTO server_members (account_id, server_id) VALUES (?, ?)");
     q->addBindValue(accountId);
     q->addBindValue(serverId);
     if (!q->exec()) {
@@ -1155,8 +2129,7 @@ namespace sql {
     QSharedPointer<Server> server;
 
     // --- Check DB ---
-    const auto q = getQuery();
-    q->prepare("SELECT id, name, account_owner_id, creation_date FROM servers WHERE name = ?");
+    const auto q = prepared("SELECT id, name, account_owner_id, creation_date FROM servers WHERE name = ?");
     q->addBindValue(name);
 
     if (!q->exec()) {
@@ -1178,8 +2151,7 @@ namespace sql {
     } else {
       // --- Create server in DB ---
       const auto uuid = QUuid::createUuid();
-      const auto q_insert = getQuery();
-      q_insert->prepare("INSERT INTO servers (id, name, account_owner_id) VALUES (?, ?, ?)");
+      const auto q_insert = prepared("INSERT INTO servers (id, name, account_owner_id) VALUES (?, ?, ?)");
       q_insert->addBindValue(uuid);
       q_insert->addBindValue(name);
       q_insert->addBindValue(owner->uid());
@@ -1203,8 +2175,7 @@ namespace sql {
     server->add_account(owner);
 
     // --- Load existing members from DB ---
-    const auto q_members = getQuery();
-    q_members->prepare("SELECT account_id FROM server_members WHERE server_id = ?");
+    const auto q_members = prepared("SELECT account_id FROM server_members WHERE server_id = ?");
     q_members->addBindValue(server->uid());
     if (q_members->exec()) {
       QReadLocker locker(&g::ctx->mtx_cache);
@@ -1222,8 +2193,7 @@ namespace sql {
     if (g::ctx->accounts_lookup_name.contains(username))
       return true;
 
-    const auto q = getQuery();
-    q->prepare("SELECT 1 FROM accounts WHERE username = ? LIMIT 1");
+    const auto q = prepared("SELECT 1 FROM accounts WHERE username = ? LIMIT 1");
     q->addBindValue(username);
 
     if (!q->exec()) {
@@ -1237,8 +2207,7 @@ namespace sql {
   QList<QSharedPointer<Channel>> account_get_channels(const QUuid &account_id) {
     QList<QSharedPointer<Channel>> channels;
 
-    const auto q = getQuery();
-    q->prepare(R"(
+    const auto q = prepared(R"(
       SELECT c.id, c.name, c.topic, c.account_owner_id, c.server_id, c.creation_date
       FROM channels c
       INNER JOIN account_channels ac ON c.id = ac.channel_id
@@ -1275,45 +2244,222 @@ namespace sql {
 
   QList<QSharedPointer<Account>> account_get_all() {
     QList<QSharedPointer<Account>> accounts;
-    const int batch_size = 100;
-    int offset = 0;
+    constexpr int limit = 1000;
 
+    QUuid after;
     while (true) {
-      const auto q = getQuery();
-      q->prepare("SELECT id, username, password, creation_date FROM accounts LIMIT ? OFFSET ?");
-      q->addBindValue(batch_size);
-      q->addBindValue(offset);
+      const auto rows = account_rows(after, limit);
+      for (const auto& row: rows)
+        accounts.append(Account::create_from_db(row.id, row.username, row.password, row.creation_date));
 
-      if (!q->exec()) {
-        qCritical() << "getAllAccounts query error:" << q->lastError().text();
+      if (rows.size() < limit)
         break;
-      }
+      after = rows.last().id;
+    }
 
-      int rowCount = 0;
-      while (q->next()) {
-        accounts.append(Account::create_from_db(
-          q->value("id").toUuid(),
-          q->value("username").toByteArray(),
-          q->value("password").toByteArray(),
-          q->value("creation_date").toDateTime()
-          ));
-        rowCount++;
-      }
+    return accounts;
+  }
 
-      if (rowCount < batch_size)
-        break;
-      offset += batch_size;
+  // keyset pagination; every page is an index range scan, unlike OFFSET
+  // which re-reads everything before the page
+  QList<AccountRow> account_rows(const QUuid &after, const int limit, const QDateTime &since) {
+    QList<AccountRow> rows;
+    const auto q = prepared("SELECT id, username, password, creation_date FROM accounts WHERE id > ? AND creation_date >= ? ORDER BY id LIMIT ?");
+    q->addBindValue(after);
+    q->addBindValue(since.isValid() ? since : QDateTime::fromMSecsSinceEpoch(0));
+    q->addBindValue(limit);
+
+    if (!q->exec()) {
+      qCritical() << "account_rows query error:" << q->lastError().text();
+      return rows;
     }
 
-    return accounts;
+    rows.reserve(limit);
+    while (q->next()) {
+      rows.append({
+        q->value(0).toUuid(),
+        q->value(1).toByteArray(),
+        q->value(2).toByteArray(),
+        q->value(3).toDateTime()
+      });
+    }
+    return rows;
+  }
+
+  QList<ServerRow> server_rows(const QUuid &after, const int limit, const QDateTime &since) {
+    QList<ServerRow> rows;
+    const auto q = prepared("SELECT id, name, account_owner_id, creation_date FROM servers WHERE id > ? AND creation_date >= ? ORDER BY id LIMIT ?");
+    q->addBindValue(after);
+    q->addBindValue(since.isValid() ? since : QDateTime::fromMSecsSinceEpoch(0));
+    q->addBindValue(limit);
+
+    if (!q->exec()) {
+      qCritical() << "server_rows query error:" << q->lastError().text();
+      return rows;
+    }
+
+    while (q->next()) {
+      rows.append({
+        q->value(0).toUuid(),
+        q->value(1).toByteArray(),
+        q->value(2).toUuid(),
+        q->value(3).toDateTime()
+      });
+    }
+    return rows;
+  }
+
+  QList<ChannelRow> channel_rows(const QUuid &after, const int limit, const QDateTime &since) {
+    QList<ChannelRow> rows;
+    const auto q = prepared(R"(
+      SELECT id, name, topic, account_owner_id, server_id, creation_date
+      FROM channels
+      WHERE id > ? AND creation_date >= ?
+      ORDER BY id
+      LIMIT ?
+    )");
+    q->addBindValue(after);
+    q->addBindValue(since.isValid() ? since : QDateTime::fromMSecsSinceEpoch(0));
+    q->addBindValue(limit);
+
+    if (!q->exec()) {
+      qCritical() << "channel_rows query error:" << q->lastError().text();
+      return rows;
+    }
+
+    rows.reserve(limit);
+    while (q->next()) {
+      rows.append({
+        q->value(0).toUuid(),
+        q->value(1).toByteArray(),
+        q->value(2).toByteArray(),
+        q->value(3).toUuid(),
+        q->value(4).toUuid(),
+        q->value(5).toDateTime()
+      });
+    }
+    return rows;
+  }
+
+  QList<MembershipRow> membership_rows(const MembershipRow &after, const int limit) {
+    QList<MembershipRow> rows;
+    const auto q = prepared(R"(
+      SELECT account_id, channel_id
+      FROM account_channels
+      WHERE (account_id, channel_id) > (?, ?)
+      ORDER BY account_id, channel_id
+      LIMIT ?
+    )");
+    q->addBindValue(after.first);
+    q->addBindValue(after.second);
+    q->addBindValue(limit);
+
+    if (!q->exec()) {
+      qCritical() << "membership_rows query error:" << q->lastError().text();
+      return rows;
+    }
+
+    rows.reserve(limit);
+    while (q->next())
+      rows.append({q->value(0).toUuid(), q->value(1).toUuid()});
+    return rows;
+  }
+
+  bool snapshot_watermark(qint64 &log_id, QDateTime &db_time) {
+    const auto q = prepared("SELECT COALESCE(MAX(id), 0), LOCALTIMESTAMP FROM membership_log");
+    if (!q->exec() || !q->next()) {
+      qCritical() << "snapshot_watermark query error:" << q->lastError().text();
+      return false;
+    }
+
+    log_id = q->value(0).toLongLong();
+    db_time = q->value(1).toDateTime();
+    return true;
+  }
+
+  bool snapshot_counts(qint64 &accounts, qint64 &servers, qint64 &channels) {
+    const auto q = prepared("SELECT (SELECT COUNT(*) FROM accounts), (SELECT COUNT(*) FROM servers), (SELECT COUNT(*) FROM channels)");
+    if (!q->exec() || !q->next()) {
+      qCritical() << "snapshot_counts query error:" << q->lastError().text();
+      return false;
+    }
+
+    accounts = q->value(0).toLongLong();
+    servers = q->value(1).toLongLong();
+    channels = q->value(2).toLongLong();
+    return true;
+  }
+
+  bool membership_log_since(const qint64 after, QList<MembershipChange> &changes) {
+    const auto q = prepared("SELECT account_id, channel_id, joined FROM membership_log WHERE id > ? ORDER BY id");
+    q->addBindValue(after);
+
+    if (!q->exec()) {
+      qCritical() << "membership_log_since query error:" << q->lastError().text();
+      return false;
+    }
+
+    while (q->next())
+      changes.append({q->value(0).toUuid(), q->value(1).toUuid(), q->value(2).toBool()});
+    return true;
+  }
+
+  bool membership_log_prune(const qint64 upto) {
+    const auto q = prepared("DELETE FROM membership_log WHERE id <= ?");
+    q->addBindValue(upto);
+
+    if (!q->exec()) {
+      qCritical() << "membership_log_prune error:" << q->lastError().text();
+      return false;
+    }
+    return true;
+  }
+
+  QSharedPointer<Account> account_get_by_name(const QByteArray &username) {
+    const auto q = prepared("SELECT id, username, password, creation_date FROM accounts WHERE username = ?");
+    q->addBindValue(QString::fromUtf8(username));
+
+    if (!q->exec()) {
+      qCritical() << "account_get_by_name query error:" << q->lastError().text();
+      return {};
+    }
+
+    if (!q->next())
+      return {};
+
+    return Account::create_from_db(
+      q->value("id").toUuid(),
+      q->value("username").toByteArray(),
+      q->value("password").toByteArray(),
+      q->value("creation_date").toDateTime()
+      );
+  }
+
+  QSharedPointer<Account> account_get_by_uid(const QUuid &account_id) {
+    const auto q = prepared("SELECT id, username, password, creation_date FROM accounts WHERE id = ?");
+    q->addBindValue(account_id);
+
+    if (!q->exec()) {
+      qCritical() << "account_get_by_uid query error:" << q->lastError().text();
+      return {};
+    }
+
+    if (!q->next())
+      return {};
+
+    return Account::create_from_db(
+      q->value("id").toUuid(),
+      q->value("username").toByteArray(),
+      q->value("password").toByteArray(),
+      q->value("creation_date").toDateTime()
+      );
   }
 
   bool channel_exists(const QByteArray &name) {
     if (g::ctx->channels.contains(name))
       return true;
 
-    const auto q = getQuery();
-    q->prepare("SELECT 1 FROM channels WHERE name = ? LIMIT 1");
+    const auto q = prepared("SELECT 1 FROM channels WHERE name = ? LIMIT 1");
     q->addBindValue(name);
 
     if (!q->exec()) {
@@ -1333,8 +2479,7 @@ namespace sql {
     if (const auto it = g::ctx->channels.find(name); it != g::ctx->channels.end() && !it.value().isNull())
       return it.value();
 
-    const auto q = getQuery();
-    q->prepare(R"(
+    const auto q = prepared(R"(
       SELECT id, name, topic, account_owner_id, server_id, creation_date
       FROM channels
       WHERE name = ?
@@ -1376,8 +2521,7 @@ namespace sql {
 
     const auto uuid = QUuid::createUuid();
 
-    const auto q_insert = getQuery();
-    q_insert->prepare(R"(
+    const auto q_insert = prepared(R"(
       INSERT INTO channels (id, name, topic, account_owner_id, server_id)
       VALUES (?, ?, ?, ?, ?)
     )");
@@ -1392,54 +2536,71 @@ namespace sql {
       return nullptr;
     }
 
-    return Channel::create_from_db(uuid, name, topic, owner, server, QDateTime::currentDateTime());
+    return Channel::create_from_db(uuid, name, topic, owner, server, QDateTime::currentDateTime(), 0);
   }
 
   QList<QSharedPointer<Channel>> channel_get_all() {
     QList<QSharedPointer<Channel>> channels;
-    constexpr int limit = 100;
-    int offset = 0;
+    constexpr int limit = 1000;
+    const auto heads = channel_event_heads();
 
+    QUuid after;
     while (true) {
-      const auto q = getQuery();
-      q->prepare("SELECT id, name, topic, account_owner_id, server_id, creation_date FROM channels LIMIT ? OFFSET ?");
-      q->addBindValue(limit);
-      q->addBindValue(offset);
-
-      if (!q->exec()) {
-        qCritical() << "channel_get_all query error:" << q->lastError().text();
-        break;
-      }
-
-      int rowCount = 0;
-      while (q->next()) {
+      const auto rows = channel_rows(after, limit);
+      for (const auto& row: rows) {
         QSharedPointer<Account> acc;
-        if (const auto acc_uid = q->value("account_owner_id").toUuid(); !acc_uid.isNull())
-          acc = Account::get_by_uid(acc_uid);
+        if (!row.owner_id.isNull())
+          acc = Account::get_by_uid(row.owner_id);
 
         QSharedPointer<Server> srv;
-        if (const auto srv_uid = q->value("server_id").toUuid(); !srv_uid.isNull())
-          srv = Server::get_by_uid(srv_uid);
+        if (!row.server_id.isNull())
+          srv = Server::get_by_uid(row.server_id);
 
-        channels.append(Channel::create_from_db(
-          q->value("id").toUuid(),
-          q->value("name").toByteArray(),
-          q->value("topic").toByteArray(),
-          acc,
-          srv,
-          q->value("creation_date").toDateTime()
-          ));
-        rowCount++;
+        channels.append(Channel::create_from_db(row.id, row.name, row.topic, acc, srv, row.creation_date, heads.value(row.id)));
       }
 
-      if (rowCount < limit)
+      if (rows.size() < limit)
         break;
-      offset += limit;
+      after = rows.last().id;
     }
 
     return channels;
   }
 
+  QSharedPointer<Channel> channel_get_by_name(const QByteArray &name) {
+    const auto q = prepared(R"(
+      SELECT id, name, topic, account_owner_id, server_id, creation_date
+      FROM channels
+      WHERE name = ?
+    )");
+    q->addBindValue(name);
+
+    if (!q->exec()) {
+      qCritical() << "channel_get_by_name query error:" << q->lastError().text();
+      return {};
+    }
+
+    if (!q->next())
+      return {};
+
+    QSharedPointer<Account> acc;
+    if (const auto acc_uid = q->value("account_owner_id").toUuid(); !acc_uid.isNull())
+      acc = Account::get_by_uid(acc_uid);
+
+    QSharedPointer<Server> srv;
+    if (const auto srv_uid = q->value("server_id").toUuid(); !srv_uid.isNull())
+      srv = Server::get_by_uid(srv_uid);
+
+    return Channel::create_from_db(
+      q->value("id").toUuid(),
+      q->value("name").toByteArray(),
+      q->value("topic").toByteArray(),
+      acc,
+      srv,
+      q->value("creation_date").toDateTime()
+      );
+  }
+
   QList<QSharedPointer<Account>> channel_get_members(const QUuid &channel_id) {
     QList<QSharedPointer<Account>> members;
 
@@ -1448,13 +2609,10 @@ namespace sql {
       return members;
     }
 
-    const auto q = getQuery();
-    q->prepare(
-      "SELECT a.id, a.username, a.password, a.creation_date "
+    const auto q = prepared("SELECT a.id, a.username, a.password, a.creation_date "
       "FROM accounts a "
       "INNER JOIN account_channels ac ON a.id = ac.account_id "
-      "WHERE ac.channel_id = ?"
-    );
+      "WHERE ac.channel_id = ?");
     q->addBindValue(channel_id); // single placeholder
 
     if (!q->exec()) {
@@ -1475,8 +2633,7 @@ namespace sql {
   }
 
   bool channel_add_member(const QUuid &account_id, const QUuid &channel_id) {
-    const auto q = getQuery();
-    q->prepare("INSERT INTO account_channels (account_id, channel_id) VALUES (?, ?) ON CONFLICT DO NOTHING");
+    const auto q = prepared("INSERT INTO account_channels (account_id, channel_id) VALUES (?, ?) ON CONFLICT DO NOTHING");
     q->addBindValue(account_id);
     q->addBindValue(channel_id);
 
@@ -1489,8 +2646,7 @@ namespace sql {
   }
 
   bool channel_remove_member(const QUuid &account_id, const QUuid &channel_id) {
-    const auto q = getQuery();
-    q->prepare("DELETE FROM account_channels WHERE account_id = ? AND channel_id = ?");
+    const auto q = prepared("DELETE FROM account_channels WHERE account_id = ? AND channel_id = ?");
     q->addBindValue(account_id);
     q->addBindValue(channel_id);
 
@@ -1503,8 +2659,7 @@ namespace sql {
   }
 
   bool insertChannel(const QString &name) {
-    const auto q = getQuery();
-    q->prepare("INSERT INTO channels (name) VALUES (?)");
+    const auto q = prepared("INSERT INTO channels (name) VALUES (?)");
     q->addBindValue(name);
     if (!q->exec()) {
       qCritical() << "insertChannel error:" << q->lastError().text();
@@ -1517,8 +2672,7 @@ namespace sql {
   LoginResult insertAccount(
       const QString &username, const QString &password, const QString &ip,
       QUuid &rtnAccountID) {
-    const auto q = getQuery();
-    q->prepare("SELECT id, password FROM accounts WHERE username = ?");
+    const auto q = prepared("SELECT id, password FROM accounts WHERE username = ?");
     q->addBindValue(username);
 
     if (!q->exec()) {
@@ -1535,8 +2689,7 @@ namespace sql {
     if (!validatePasswordBcrypt(password, storedHash))
       return LoginResult::InvalidPassword;
 
-    const auto q2 = getQuery();
-    q2->prepare("INSERT INTO logins (id, account_id, ip) VALUES (?, ?, ?)");
+    const auto q2 = prepared("INSERT INTO logins (id, account_id, ip) VALUES (?, ?, ?)");
     q2->addBindValue(QUuid::createUuid());
     q2->addBindValue(accountId);
     q2->addBindValue(ip);
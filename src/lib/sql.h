@@ -11,14 +11,87 @@
 #include "core/permission.h"
 #include "core/server.h"
 #include "core/upload.h"
+#include "core/history.h"
+#include "core/event_log.h"
 #include "lib/utils.h"
+#include "lib/db_pool.h"
 
 namespace sql {
-  extern std::unordered_map<unsigned long, QSqlDatabase*> DB_INSTANCES;
+  // selected with --db-backend
+  const DbBackend &backend();
+  // this thread's pooled connection; hold on to it across a transaction
+  DbPool::Lease connection(DbPool::Access access = DbPool::Access::Write);
+  void log_pool_stats();
 
   struct MetadataResult {
     QMap<QString, QVariant> keyValues;
-    QMap<QString, QSet<QSharedPointer<Account>>> subscribers;
+    QMap<QString, QSet<AccountHandle>> subscribers;
+  };
+
+  // a message flattened for persistence; built on the sending thread so the
+  // writer never touches live accounts or channels
+  struct MessageRow {
+    QUuid id;
+    QUuid sender_id;
+    QByteArray account;  // sender's account name; only the message log keeps it
+    QUuid channel_id;
+    QByteArray text;
+    QByteArray raw;
+    QByteArray tags;
+    QByteArray nick;
+    QByteArray host;
+    QByteArray user;
+    QString targets;
+    QUuid recipient_id;  // private messages
+    bool from_system = false;
+    bool tag_msg = false;
+    QDateTime creation_date;
+  };
+
+  // a channel event flattened for persistence, see MessageRow
+  struct EventRow {
+    QUuid id;
+    QUuid account_id;
+    QUuid channel_id;
+    int event_type = 0;
+    quint64 seq = 0;
+    QByteArray data;  // empty for messages stored as a message row with the same id
+    QByteArray topic;  // Topic events; channels.topic is set in the same transaction
+    QDateTime creation_date;
+  };
+
+  // raw rows for bulk loads, see WarmStart
+  struct AccountRow {
+    QUuid id;
+    QByteArray username;
+    QByteArray password;
+    QDateTime creation_date;
+  };
+
+  struct ServerRow {
+    QUuid id;
+    QByteArray name;
+    QUuid owner_id;
+    QDateTime creation_date;
+  };
+
+  struct ChannelRow {
+    QUuid id;
+    QByteArray name;
+    QByteArray topic;
+    QUuid owner_id;
+    QUuid server_id;
+    QDateTime creation_date;
+  };
+
+  // (account_id, channel_id)
+  using MembershipRow = QPair<QUuid, QUuid>;
+
+  // one row of membership_log, see Snapshot
+  struct MembershipChange {
+    QUuid account_id;
+    QUuid channel_id;
+    bool joined = false;
   };
 
   enum class RefType {
@@ -36,7 +109,11 @@ namespace sql {
   enum class EventType {
     Message = 0,
     ChannelJoin = 1,
-    ChannelLeave = 2
+    ChannelLeave = 2,
+    Topic = 3,
+    Mode = 4,
+    Rename = 5,
+    Metadata = 6
   };
 
   // static QSqlDatabase& getInstance();
@@ -49,6 +126,26 @@ namespace sql {
   // metadata
   // @TODO: deal with the removal of the resource backing ref_id
   MetadataResult metadata_get(QUuid ref_id);
+  // everything, by ref_id; subscribers are resolved against cached accounts
+  QHash<QUuid, MetadataResult> metadata_all();
+
+  // coalesced changes, see MetadataCache; at most one per (ref_id, key)
+  // and one per (ref_id, key, account_id)
+  struct MetadataWrite {
+    QUuid ref_id;
+    RefType ref_type = RefType::Account;
+    QByteArray key;
+    QByteArray value;
+    bool remove = false;
+  };
+  struct MetadataSubWrite {
+    QUuid ref_id;
+    QByteArray key;
+    QUuid account_id;
+    bool subscribe = true;
+  };
+  // one transaction; values first, so new keys can be subscribed to
+  bool metadata_write(const QList<MetadataWrite> &writes, const QList<MetadataSubWrite> &subs);
   bool metadata_modify(QUuid ref_id, const QByteArray& key, const QByteArray& new_value);
   bool metadata_remove(const QByteArray& key, QUuid ref_id);
   QUuid metadata_create(const QByteArray& key, const QByteArray& value, const QUuid ref_id, RefType ref_type);
@@ -65,12 +162,26 @@ namespace sql {
 
   bool account_exists(const QByteArray &username);
   QList<QSharedPointer<Account>> account_get_all();
+  // keyset pages ordered by primary key, rows after `after`; start with a null uuid.
+  // `since` limits the page to rows created from then on
+  QList<AccountRow> account_rows(const QUuid &after, int limit, const QDateTime &since = {});
+  QList<ServerRow> server_rows(const QUuid &after, int limit, const QDateTime &since = {});
+  QList<ChannelRow> channel_rows(const QUuid &after, int limit, const QDateTime &since = {});
+  QList<MembershipRow> membership_rows(const MembershipRow &after, int limit);
+  // state snapshot watermark: last membership_log id and the database clock
+  bool snapshot_watermark(qint64 &log_id, QDateTime &db_time);
+  bool snapshot_counts(qint64 &accounts, qint64 &servers, qint64 &channels);
+  bool membership_log_since(qint64 after, QList<MembershipChange> &changes);
+  bool membership_log_prune(qint64 upto);
+  QSharedPointer<Account> account_get_by_name(const QByteArray &username);
+  QSharedPointer<Account> account_get_by_uid(const QUuid &account_id);
   QList<QSharedPointer<Channel>> account_get_channels(const QUuid &account_id);
 
   // channel
   QSharedPointer<Channel> channel_get_or_create(const QByteArray &name, const QByteArray &topic, const QSharedPointer<Account> &owner, const QSharedPointer<Server> &server);
   bool channel_exists(const QByteArray &name);
   QList<QSharedPointer<Channel>> channel_get_all();
+  QSharedPointer<Channel> channel_get_by_name(const QByteArray &name);
   bool channel_add_member(const QUuid &account_id, const QUuid &channel_id);
   bool channel_remove_member(const QUuid &account_id, const QUuid &channel_id);
   QList<QSharedPointer<Account>> channel_get_members(const QUuid &channel_id);
@@ -88,8 +199,56 @@ namespace sql {
   bool assign_role_to_account(const QUuid &accountId, const QSharedPointer<Role> &role);
 
   // messages
-  void insert_messages(const QSet<QSharedPointer<QEventMessage>> &messages);
+  MessageRow message_row(const QSharedPointer<QEventMessage> &msg);
+  bool insert_messages(const QList<MessageRow> &rows);
   QUuid insert_message(const QSharedPointer<QEventMessage> &msg);
+  // CHATHISTORY beyond the in-memory ring; same semantics as HistoryRing::range()
+  QList<HistoryEntry> message_history(
+      const QUuid &channel_id,
+      const QByteArray &channel_name,
+      const HistoryKey &lo,
+      const HistoryKey &hi,
+      bool backward,
+      int limit,
+      bool inclusive_lo = false);
+
+  // private messages to and from an account, for the bouncer backlog; only
+  // those exchanged with `peer` when it is set (CHATHISTORY)
+  QList<HistoryEntry> private_history(
+      const QUuid &account_id,
+      const HistoryKey &lo,
+      const HistoryKey &hi,
+      bool backward,
+      int limit,
+      bool inclusive_lo = false,
+      const QUuid &peer = QUuid());
+  // creates upcoming monthly partitions (Postgres) and applies retention:
+  // `default_days`, or servers.message_retention_days where set. Expired
+  // partitions are dropped, or detached and renamed with `archive`
+  bool messages_maintain(int default_days, bool archive);
+  bool backlog_cursors_save(const QUuid &account_id, const QHash<QByteArray, HistoryKey> &cursors);
+  QHash<QByteArray, HistoryKey> backlog_cursors_take(const QUuid &account_id);
+
+  // session token revocations, see SessionTokens. Loading drops device
+  // revocations that expired by `now` and generations up to `stale`
+  struct SessionRevocations {
+    QHash<QUuid, quint32> generations;
+    QHash<QPair<QUuid, QByteArray>, qint64> devices;  // -> expiry
+  };
+  SessionRevocations session_revocations(qint64 now, qint64 stale);
+  bool session_revoke_device(const QUuid &account_id, const QByteArray &device, qint64 expires);
+  bool session_generation_set(const QUuid &account_id, quint32 generation);
+
+  // channel events, ordered by their per-channel sequence number
+  bool insert_events(const QList<EventRow> &rows);
+  quint64 channel_event_head(const QUuid &channel_id);
+  // the same for every channel, for bulk loads
+  QHash<QUuid, quint64> channel_event_heads();
+  // persists that sequence numbers up to `upto` may be in use
+  bool channel_seq_reserve(const QUuid &channel_id, quint64 upto);
+  // events with after < seq <= upto, ascending; message events are rebuilt
+  // from their message row, addressed to `target`
+  QList<ChannelEvent> channel_events(const QUuid &channel_id, const QByteArray &target, quint64 after, quint64 upto, int limit);
 
   bool insertChannel(const QString& name);
   LoginResult insertAccount(const QString& username, const QString& password, const QString& ip, QUuid &rtnAccountID);
@@ -14,10 +14,13 @@ void Utils::init() {
   g::configDirectory = g::configDirectory = QDir(QDir::currentPath()).filePath("data/");
   g::pythonModulesDirectory = g::configDirectory + "modules/";
   g::uploadsDirectory = g::configDirectory + "uploads/";
+  g::messagesDirectory = g::configDirectory + "messages/";
   g::staticDirectory = g::configDirectory + "static/";
   g::cacheDirectory = QString("%1/cache").arg(g::configDirectory);
   g::irc_motd_path = QFileInfo(g::configDirectory + "motd.txt");
   g::pathDatabasePreload = QFileInfo(g::configDirectory + "preload.json");
+  g::pathSnapshot = QFileInfo(g::configDirectory + "state.snapshot");
+  g::pathSessionKey = QFileInfo(g::configDirectory + "session.key");
 }
 
 bool Utils::readJsonFile(QIODevice &device, QSettings::SettingsMap &map) {
@@ -0,0 +1,63 @@
+#include <QRandomGenerator>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include "lib/uuidv7.h"
+
+namespace uuidv7 {
+  namespace {
+    constexpr int COUNTER_BITS = 22;  // 12 bits rand_a + top 10 bits of rand_b
+
+    // (unix_ms << COUNTER_BITS) | counter of the last issued id
+    std::atomic<quint64> last_state{0};
+
+    quint64 next_random() {
+      // splitmix64, seeded once per thread
+      thread_local quint64 state = QRandomGenerator::system()->generate64();
+      quint64 z = (state += 0x9E3779B97F4A7C15ULL);
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      return z ^ (z >> 31);
+    }
+  }
+
+  QUuid create() {
+    using namespace std::chrono;
+    const auto now_ms = static_cast<quint64>(
+      duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+
+    // monotonic even when the clock steps back or the counter overflows;
+    // in both cases we borrow from the next millisecond
+    quint64 prev = last_state.load(std::memory_order_relaxed);
+    quint64 next;
+    do {
+      next = std::max(now_ms << COUNTER_BITS, prev + 1);
+    } while (!last_state.compare_exchange_weak(prev, next, std::memory_order_relaxed));
+
+    const quint64 ms = next >> COUNTER_BITS;
+    const quint64 counter = next & ((1ULL << COUNTER_BITS) - 1);
+
+    const auto data1 = static_cast<uint>(ms >> 16);
+    const auto data2 = static_cast<ushort>(ms & 0xFFFF);
+    const auto data3 = static_cast<ushort>(0x7000 | (counter >> 10));
+
+    const quint64 tail =
+      (0b10ULL << 62) |
+      ((counter & 0x3FF) << 52) |
+      (next_random() & ((1ULL << 52) - 1));
+
+    return {
+      data1, data2, data3,
+      static_cast<uchar>(tail >> 56), static_cast<uchar>(tail >> 48),
+      static_cast<uchar>(tail >> 40), static_cast<uchar>(tail >> 32),
+      static_cast<uchar>(tail >> 24), static_cast<uchar>(tail >> 16),
+      static_cast<uchar>(tail >> 8), static_cast<uchar>(tail)
+    };
+  }
+
+  qint64 timestamp(const QUuid &id) {
+    return static_cast<qint64>((static_cast<quint64>(id.data1) << 16) | id.data2);
+  }
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <QUuid>
+#include <QtGlobal>
+
+// time-ordered UUIDs (RFC 9562, version 7), used as message ids. The
+// 48-bit millisecond timestamp is followed by a 22-bit counter shared by
+// all threads, so ids sort in creation order and consecutive inserts land
+// on the right edge of the primary key index. The remaining 52 bits come
+// from a per-thread PRNG; no syscall is made per id.
+namespace uuidv7 {
+  QUuid create();
+
+  // unix time in milliseconds embedded in `id`
+  qint64 timestamp(const QUuid &id);
+}
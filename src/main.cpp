@@ -45,6 +45,11 @@ int main(int argc, char *argv[]) {
   QCommandLineOption portOpt(QStringList() << "p" << "port", "Port (default 6667).", "port", "6667");
   QCommandLineOption passOpt(QStringList() << "P" << "password", "Server password (optional).", "password", "");
   QCommandLineOption webOpt(QStringList() << "w" << "web", "Enable the web-interface.", "port", "0");
+  // storage
+  QCommandLineOption dbBackendOpt("db-backend", "Storage backend: 'postgres' or 'sqlite' (default postgres).", "backend", "postgres");
+  // --pg-pool-size is the name it had before SQLite was supported
+  QCommandLineOption dbPoolOpt({"db-pool-size", "pg-pool-size"}, "Max. database connections shared by all threads (default 16).", "size", "16");
+  QCommandLineOption sqlitePathOpt("sqlite-path", "SQLite database file (default data/chatripper.sqlite3).", "path");
   // pg
   QCommandLineOption pgHostOpt("pg-host", "PostgreSQL host (default 127.0.0.1).", "host", "127.0.0.1");
   QCommandLineOption pgPortOpt("pg-port", "PostgreSQL port (default 5432).", "port", "5432");
@@ -57,9 +62,32 @@ int main(int argc, char *argv[]) {
   QCommandLineOption msPortOpt("ms-port", "MeiliSearch port (default 7700).", "port", "7700");
   QCommandLineOption msApiKeyOpt("ms-apikey", "MeiliSearch API key (optional).", "apikey", "");
 
+  QCommandLineOption lazyLoadOpt("lazy-load", "Load accounts and channels on demand instead of at startup.");
+  QCommandLineOption lazyTTLOpt("lazy-ttl", "Seconds before idle accounts/channels are evicted (default 900).", "seconds", "900");
+
+  QCommandLineOption msgQueueOpt("msg-queue", "Messages waiting to be persisted before backpressure (default 65536).", "size", "65536");
+  QCommandLineOption msgBatchOpt("msg-batch", "Messages per database insert (default 500).", "size", "500");
+  QCommandLineOption msgFlushOpt("msg-flush-ms", "Max. milliseconds before queued messages are persisted (default 50).", "ms", "50");
+  QCommandLineOption msgOverflowOpt("msg-overflow", "When the queue is full: 'block' the sender or 'drop' (default block).", "mode", "block");
+  QCommandLineOption msgAtMostOnceOpt("msg-at-most-once", "Do not retry failed message inserts.");
+  QCommandLineOption messageStoreOpt("message-store", "Where messages are kept: 'sql' (the database) or 'log' (segment files in data/messages) (default sql).", "store", "sql");
+  QCommandLineOption messageRetentionOpt("message-retention-days", "Days before messages are deleted, servers may override it; 0 keeps them (default 0).", "days", "0");
+  QCommandLineOption messageArchiveOpt("message-archive", "Keep expired monthly message partitions as messages_archive_* tables instead of dropping them.");
+  QCommandLineOption historySizeOpt("history-size", "Messages per channel kept in memory for CHATHISTORY (default 1000).", "size", "1000");
+  QCommandLineOption backlogSizeOpt("backlog-size", "Private messages per account kept in memory for the bouncer (default 500).", "size", "500");
+  QCommandLineOption backlogReplayOpt("backlog-replay", "Max. missed messages replayed per target on reconnect, 0 disables (default 200).", "count", "200");
+  QCommandLineOption snapshotIntervalOpt("snapshot-interval", "Seconds between state snapshots used for fast restarts, 0 disables (default 300).", "seconds", "300");
+  QCommandLineOption authThreadsOpt("auth-threads", "Threads verifying passwords, 0 for half the cores (default 0).", "count", "0");
+  QCommandLineOption authQueueOpt("auth-queue", "Password checks that may wait for a thread before logins are refused (default 256).", "count", "256");
+  QCommandLineOption statsIntervalOpt("stats-interval", "Seconds between pool and queue statistics in the log, 0 only logs them on shutdown (default 300).", "seconds", "300");
+
   parser.addOption(portOpt);
   parser.addOption(passOpt);
   parser.addOption(webOpt);
+  // storage
+  parser.addOption(dbBackendOpt);
+  parser.addOption(dbPoolOpt);
+  parser.addOption(sqlitePathOpt);
   // pg
   parser.addOption(pgHostOpt);
   parser.addOption(pgPortOpt);
@@ -72,11 +100,34 @@ int main(int argc, char *argv[]) {
   parser.addOption(msPortOpt);
   parser.addOption(msApiKeyOpt);
 
+  parser.addOption(lazyLoadOpt);
+  parser.addOption(lazyTTLOpt);
+
+  parser.addOption(msgQueueOpt);
+  parser.addOption(msgBatchOpt);
+  parser.addOption(msgFlushOpt);
+  parser.addOption(msgOverflowOpt);
+  parser.addOption(msgAtMostOnceOpt);
+  parser.addOption(messageStoreOpt);
+  parser.addOption(messageRetentionOpt);
+  parser.addOption(messageArchiveOpt);
+  parser.addOption(historySizeOpt);
+  parser.addOption(backlogSizeOpt);
+  parser.addOption(backlogReplayOpt);
+  parser.addOption(snapshotIntervalOpt);
+  parser.addOption(authThreadsOpt);
+  parser.addOption(authQueueOpt);
+  parser.addOption(statsIntervalOpt);
+
   parser.process(app);
 
   g::ircServerListeningPort = parser.value(portOpt).toUShort();
   g::irc_motd = parser.value(passOpt).toUtf8();
   g::wsServerListeningPort = parser.value(webOpt).toUShort();
+  // storage
+  g::dbBackend = parser.value(dbBackendOpt).toLower();
+  g::dbPoolSize = std::max(2, parser.value(dbPoolOpt).toInt());
+  g::sqlitePath = parser.value(sqlitePathOpt);
   // pg
   g::pgHost = parser.value(pgHostOpt);
   g::pgPort = parser.value(pgPortOpt).toUShort();
@@ -90,6 +141,28 @@ int main(int argc, char *argv[]) {
   g::msApiKey = parser.value(msApiKeyOpt);
   g::msApiKey = parser.value(msApiKeyOpt);
 
+  g::lazyLoad = parser.isSet(lazyLoadOpt);
+  g::lazyTTL = std::max(60, parser.value(lazyTTLOpt).toInt());
+
+  g::msgQueueSize = std::max(1024, parser.value(msgQueueOpt).toInt());
+  // 11 parameters per row; SQLite takes up to 32766 per statement
+  g::msgBatchSize = std::clamp(parser.value(msgBatchOpt).toInt(), 1, g::dbBackend == "sqlite" ? 2000 : 4000);
+  g::msgFlushInterval = std::max(1, parser.value(msgFlushOpt).toInt());
+  g::msgDropWhenFull = parser.value(msgOverflowOpt) == "drop";
+  g::msgAtLeastOnce = !parser.isSet(msgAtMostOnceOpt);
+  g::messageStore = parser.value(messageStoreOpt).toLower();
+  g::messageRetentionDays = std::max(0, parser.value(messageRetentionOpt).toInt());
+  g::messageArchive = parser.isSet(messageArchiveOpt);
+  g::historySize = std::max(1, parser.value(historySizeOpt).toInt());
+  g::backlogSize = std::max(1, parser.value(backlogSizeOpt).toInt());
+  g::backlogReplay = std::max(0, parser.value(backlogReplayOpt).toInt());
+  g::snapshotInterval = std::max(0, parser.value(snapshotIntervalOpt).toInt());
+  g::authThreads = parser.value(authThreadsOpt).toInt();
+  if (g::authThreads <= 0)
+    g::authThreads = std::max(1, QThread::idealThreadCount() / 2);
+  g::authQueue = std::max(0, parser.value(authQueueOpt).toInt());
+  g::statsInterval = std::max(0, parser.value(statsIntervalOpt).toInt());
+
   globals::logger_std_init();
 
 #ifdef DEBUG
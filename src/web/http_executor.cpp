@@ -0,0 +1,110 @@
+#include <QElapsedTimer>
+#include <QHttpHeaders>
+#include <QPromise>
+#include <QDebug>
+
+#include <algorithm>
+#include <exception>
+
+#include "web/http_executor.h"
+
+HttpExecutor::HttpExecutor(const int light_threads, const int heavy_threads, const int queue_limit) {
+  const int threads[] = {std::max(1, light_threads), std::max(1, heavy_threads)};
+  const char *names[] = {"http-light", "http-heavy"};
+  for (int i = 0; i < 2; ++i) {
+    m_lanes[i].pool.setMaxThreadCount(threads[i]);
+    m_lanes[i].pool.setObjectName(names[i]);
+    m_lanes[i].limit = threads[i] + std::max(0, queue_limit);
+  }
+}
+
+HttpExecutor::~HttpExecutor() {
+  for (auto &lane: m_lanes)
+    lane.pool.waitForDone();
+}
+
+QFuture<QHttpServerResponse> HttpExecutor::ready(QHttpServerResponse &&response) {
+  QPromise<QHttpServerResponse> promise;
+  promise.start();
+  promise.addResult(std::move(response));
+  promise.finish();
+  return promise.future();
+}
+
+qint64 HttpExecutor::retry_after(const LaneState &lane) {
+  const quint64 done = std::max<quint64>(1, lane.submitted - lane.queued);
+  const qint64 avg_us = static_cast<qint64>(lane.busy_us / done);
+  const qint64 backlog_us = avg_us * lane.queued / std::max(1, lane.pool.maxThreadCount());
+  return std::clamp<qint64>((backlog_us + 999999) / 1000000, 1, 60);
+}
+
+QFuture<QHttpServerResponse> HttpExecutor::run(const Lane lane, Job job) {
+  auto &state = m_lanes[static_cast<int>(lane)];
+
+  // reserve a slot first; the check and the increment are one step
+  if (state.queued.fetch_add(1) >= state.limit) {
+    --state.queued;
+    ++state.rejected;
+
+    QHttpHeaders headers;
+    headers.append("Retry-After", QByteArray::number(retry_after(state)));
+    QHttpServerResponse res("server busy, try again later", QHttpServerResponder::StatusCode::ServiceUnavailable);
+    res.setHeaders(std::move(headers));
+    return ready(std::move(res));
+  }
+  ++state.submitted;
+
+  auto promise = std::make_shared<QPromise<QHttpServerResponse>>();
+  promise->start();
+  QFuture<QHttpServerResponse> future = promise->future();
+
+  QElapsedTimer queued;
+  queued.start();
+  state.pool.start([&state, promise, job = std::move(job), queued] {
+    const quint64 wait = queued.nsecsElapsed() / 1000;
+    state.wait_us += wait;
+    quint64 max = state.wait_max_us;
+    while (wait > max && !state.wait_max_us.compare_exchange_weak(max, wait)) {}
+
+    QElapsedTimer timer;
+    timer.start();
+    // a throwing handler must not leave the slot taken or the client hanging
+    try {
+      promise->addResult(job());
+    } catch (const std::exception &ex) {
+      qCritical() << "http: handler failed:" << ex.what();
+      promise->addResult(QHttpServerResponse(QHttpServerResponder::StatusCode::InternalServerError));
+    } catch (...) {
+      qCritical() << "http: handler failed";
+      promise->addResult(QHttpServerResponse(QHttpServerResponder::StatusCode::InternalServerError));
+    }
+    state.busy_us += timer.nsecsElapsed() / 1000;
+
+    --state.queued;
+    promise->finish();
+  });
+  return future;
+}
+
+HttpExecutor::Stats HttpExecutor::stats(const Lane lane) const {
+  const auto &state = m_lanes[static_cast<int>(lane)];
+  Stats s;
+  s.threads = state.pool.maxThreadCount();
+  s.queued = state.queued;
+  s.submitted = state.submitted;
+  s.rejected = state.rejected;
+  s.wait_us = state.wait_us;
+  s.wait_max_us = state.wait_max_us;
+  s.busy_us = state.busy_us;
+  return s;
+}
+
+void HttpExecutor::log_stats() const {
+  for (const auto lane: {Lane::Light, Lane::Heavy}) {
+    const auto s = stats(lane);
+    const quint64 done = std::max<quint64>(1, s.submitted);
+    qInfo() << "http" << (lane == Lane::Light ? "light:" : "heavy:") << s.submitted << "requests,"
+            << s.rejected << "rejected as overloaded; avg queue wait" << s.wait_us / done / 1000 << "ms (max"
+            << s.wait_max_us / 1000 << "ms), avg handler" << s.busy_us / done / 1000 << "ms," << s.threads << "threads";
+  }
+}
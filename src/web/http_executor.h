@@ -0,0 +1,60 @@
+#pragma once
+#include <QFuture>
+#include <QHttpServerResponse>
+#include <QThreadPool>
+
+#include <array>
+#include <atomic>
+#include <functional>
+
+// runs REST handlers off the HTTP thread, on pools of its own instead of
+// the global one (bcrypt, snapshots and warm start use that).
+//
+// two lanes, so a burst of uploads cannot starve logins: Light for auth
+// and small bounded reads, Heavy for uploads, file serving and full
+// listings. Each lane has its own threads and a bounded queue; past that
+// run() answers 503 with Retry-After right away instead of queueing a
+// request the client gives up on anyway.
+class HttpExecutor {
+public:
+  enum class Lane { Light, Heavy };
+  using Job = std::function<QHttpServerResponse()>;
+
+  HttpExecutor(int light_threads, int heavy_threads, int queue_limit);
+  ~HttpExecutor();
+
+  // thread-safe; `job` must not hold on to the QHttpServerRequest
+  QFuture<QHttpServerResponse> run(Lane lane, Job job);
+  // an answer that needs no lane, e.g. a refusal decided on the HTTP thread
+  static QFuture<QHttpServerResponse> ready(QHttpServerResponse &&response);
+
+  struct Stats {
+    int threads = 0;
+    int queued = 0;       // waiting or running
+    quint64 submitted = 0;
+    quint64 rejected = 0;
+    quint64 wait_us = 0;  // run() -> start, summed
+    quint64 wait_max_us = 0;
+    quint64 busy_us = 0;
+  };
+  [[nodiscard]] Stats stats(Lane lane) const;
+  void log_stats() const;
+
+private:
+  struct LaneState {
+    QThreadPool pool;
+    int limit = 0;
+
+    std::atomic<int> queued = 0;
+    std::atomic<quint64> submitted = 0;
+    std::atomic<quint64> rejected = 0;
+    std::atomic<quint64> wait_us = 0;
+    std::atomic<quint64> wait_max_us = 0;
+    std::atomic<quint64> busy_us = 0;
+  };
+
+  // seconds until a slot is likely free, from the lane's average job time
+  [[nodiscard]] static qint64 retry_after(const LaneState &lane);
+
+  std::array<LaneState, 2> m_lanes;
+};
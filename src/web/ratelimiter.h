@@ -1,27 +0,0 @@
-#pragma once
-#include <QHostAddress>
-#include <QDateTime>
-#include <QMutex>
-#include <QHash>
-
-struct RateLimitResult {
-  bool allowed;
-  QDateTime retryAfter;
-  QString msg;
-};
-
-class RateLimiter {
-public:
-  RateLimiter(int max_requests = 5, int window_seconds = 60);
-  RateLimitResult check(const QHostAddress &addr, const QString &msg);
-private:
-  struct Entry {
-    int count = 0;
-    QDateTime windowStart;
-  };
-
-  QHash<QString, Entry> m_table;
-  int m_maxRequests;
-  int m_windowSeconds;
-  QMutex m_mutex;
-};
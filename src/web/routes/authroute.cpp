@@ -2,17 +2,17 @@
 #include <QJsonObject>
 #include <QHttpServerResponse>
 #include <QHttpHeaders>
-#include <QtConcurrent>
 #include <QHostAddress>
 #include <QJsonParseError>
 
 #include "web/routes/authroute.h"
-#include "web/ratelimiter.h"
+#include "lib/rate_limiter.h"
 #include "web/sessionstore.h"
 #include "web/routes/utils.h"
+#include "web/http_executor.h"
 
 #include "core/qtypes.h"
-#include "lib/bcrypt/bcrypt.h"
+#include "lib/password_verifier.h"
 #include "ctx.h"
 
 namespace AuthRoute {
@@ -34,17 +34,17 @@ QHttpServerResponse create_session(const QString& username) {
   return res;
 }
 
-void install(QHttpServer *server, RateLimiter *limiter) {
+void install(QHttpServer *server, HttpExecutor *executor, RateLimiter *limiter) {
   // POST /api/1/login
-  server->route("/api/1/login", QHttpServerRequest::Method::Post, [limiter](const QHttpServerRequest &request) {
+  server->route("/api/1/login", QHttpServerRequest::Method::Post, [executor, limiter](const QHttpServerRequest &request) {
+    // refused before it takes a slot in the lane
     const QHostAddress ip = ipFromRequest(request);
+    if (auto [allowed, retryAfter, msg] = limiter->check(ip, "Too many logins, retry after %1 seconds"); !allowed)
+      return HttpExecutor::ready(QHttpServerResponse(msg, QHttpServerResponder::StatusCode::TooManyRequests));
 
-    QFuture<QHttpServerResponse> future = QtConcurrent::run([&request, ip, limiter]() {
-      if (auto [allowed, retryAfter, msg] = limiter->check(ip, "Too many logins, retry after %1 seconds"); !allowed)
-        return QHttpServerResponse(msg, QHttpServerResponder::StatusCode::TooManyRequests);
-
+    const QByteArray body = request.body();
+    return executor->run(HttpExecutor::Lane::Light, [body, ip]() {
       // expect JSON body
-      const QByteArray body = request.body();
       QJsonParseError err;
       const QJsonDocument doc = QJsonDocument::fromJson(body, &err);
       if (err.error != QJsonParseError::NoError || !doc.isObject())
@@ -76,17 +76,38 @@ void install(QHttpServer *server, RateLimiter *limiter) {
       if (account.isNull())
         return QHttpServerResponse("invalid credentials", QHttpServerResponder::StatusCode::Unauthorized);
 
-      const std::string candidateStr = password.toStdString();
-      const std::string pw = account->password().toStdString();
-      const bool result = bcrypt::validatePassword(candidateStr, pw);
-
-      if (!result)
+      // on the verifier's threads; this one only waits
+      const auto result = g::ctx->password_verifier->verify(password.toUtf8(), account->password());
+      if (result == PasswordVerifier::Result::Overloaded)
+        return QHttpServerResponse("server busy, try again later", QHttpServerResponder::StatusCode::ServiceUnavailable);
+      if (result != PasswordVerifier::Result::Ok)
         return QHttpServerResponse("invalid credentials", QHttpServerResponder::StatusCode::Unauthorized);
 
       return create_session(username);
     });
+  });
+
+  // POST /api/1/logout, {"everywhere": true} to end every session of the account
+  server->route("/api/1/logout", QHttpServerRequest::Method::Post, [executor](const QHttpServerRequest &request) {
+    const QString token = tokenFromRequest(request);
+    const QByteArray body = request.body();
 
-    return future;
+    // the revocation is written to the database
+    return executor->run(HttpExecutor::Lane::Light, [token, body]() {
+      if (token.isEmpty())
+        return QHttpServerResponse("Unauthorized", QHttpServerResponder::StatusCode::Unauthorized);
+
+      const QJsonDocument doc = QJsonDocument::fromJson(body);
+      const bool everywhere = doc.isObject() && doc.object().value("everywhere").toBool();
+      g::webSessions->destroySession(token, everywhere);
+
+      QHttpHeaders headers;
+      headers.insert(0, "Set-Cookie", "session=; Path=/; HttpOnly; SameSite=Lax; Max-Age=0");
+
+      QHttpServerResponse res("application/json", QJsonDocument(QJsonObject{{"ok", true}}).toJson(), QHttpServerResponder::StatusCode::Ok);
+      res.setHeaders(std::move(headers));
+      return res;
+    });
   });
 }
 
@@ -4,7 +4,8 @@
 
 class RateLimiter;
 class WebSessionStore;
+class HttpExecutor;
 
 namespace AuthRoute {
-  void install(QHttpServer *server, RateLimiter *limiter);
+  void install(QHttpServer *server, HttpExecutor *executor, RateLimiter *limiter);
 }
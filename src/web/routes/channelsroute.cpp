@@ -1,24 +1,26 @@
 #include <QHttpServerResponse>
-#include <QtConcurrent>
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QJsonDocument>
+#include <QUrlQuery>
 
 #include "web/routes/channelsroute.h"
 #include "web/sessionstore.h"
 #include "web/routes/utils.h"
+#include "web/http_executor.h"
 
 #include "ctx.h"
 #include "core/channel.h"
+#include "irc/threaded_server.h"
 #include "lib/utils.h"
 #include "lib/logger_std/logger_std.h"
 
 namespace ChannelsRoute {
 
-void install(QHttpServer *server) {
-  server->route("/api/1/channels", QHttpServerRequest::Method::Get, [](const QHttpServerRequest &request) {
-    QFuture<QHttpServerResponse> future = QtConcurrent::run([&request] {
-      const auto current_user = g::webSessions->get_user(request);
+void install(QHttpServer *server, HttpExecutor *executor) {
+  server->route("/api/1/channels", QHttpServerRequest::Method::Get, [executor](const QHttpServerRequest &request) {
+    return executor->run(HttpExecutor::Lane::Heavy, [token = tokenFromRequest(request)] {
+      const auto current_user = g::webSessions->get_user(token);
       if (current_user.isNull())
         return QHttpServerResponse("Unauthorized", QHttpServerResponder::StatusCode::Unauthorized);
 
@@ -42,7 +44,64 @@ void install(QHttpServer *server) {
       QByteArray jsonData(buffer.GetString(), static_cast<int>(buffer.GetSize()));
       return QHttpServerResponse("application/json", jsonData, QHttpServerResponder::StatusCode::Ok);
     });
-    return future;
+  });
+
+  // delta sync: the channel's events after ?since=<seq>, see SYNC on IRC;
+  // at most SYNC_MAX of them, so the light lane
+  server->route("/api/1/channels/<arg>/events", QHttpServerRequest::Method::Get, [executor](const QString &name, const QHttpServerRequest &request) {
+    const QString token = tokenFromRequest(request);
+    const QUrlQuery query = request.query();
+
+    return executor->run(HttpExecutor::Lane::Light, [name, token, query] {
+      const auto current_user = g::webSessions->get_user(token);
+      if (current_user.isNull())
+        return QHttpServerResponse("Unauthorized", QHttpServerResponder::StatusCode::Unauthorized);
+
+      const auto channel = Channel::get(name.toUtf8());
+      if (channel.isNull() || !current_user->channel_handles().contains(channel->handle()))
+        return QHttpServerResponse("Not Found", QHttpServerResponder::StatusCode::NotFound);
+
+      bool ok = false;
+      const quint64 since = query.queryItemValue("since").toULongLong(&ok);
+      if (!ok)
+        return QHttpServerResponse("Bad Request", QHttpServerResponder::StatusCode::BadRequest);
+
+      int limit = ThreadedServer::SYNC_MAX;
+      if (query.hasQueryItem("limit"))
+        limit = std::clamp(query.queryItemValue("limit").toInt(), 1, ThreadedServer::SYNC_MAX);
+
+      const auto events = channel->events_since(since, limit);
+      const quint64 head = channel->seq();
+
+      rapidjson::Document root;
+      root.SetObject();
+      auto& allocator = root.GetAllocator();
+
+      rapidjson::Value arr(rapidjson::kArrayType);
+      for (const auto &event : events) {
+        rapidjson::Value obj(rapidjson::kObjectType);
+        obj.AddMember("seq", static_cast<uint64_t>(event.seq), allocator);
+        obj.AddMember("type", event.type, allocator);
+        obj.AddMember("id", rapidjson::Value(event.id.constData(), allocator), allocator);
+        obj.AddMember("time", rapidjson::Value(event.time.constData(), allocator), allocator);
+        obj.AddMember("account", rapidjson::Value(event.account.constData(), allocator), allocator);
+        obj.AddMember("line", rapidjson::Value(event.line.constData(), allocator), allocator);
+        arr.PushBack(obj, allocator);
+      }
+
+      const quint64 last = events.isEmpty() ? std::max(since, head) : events.last().seq;
+      root.AddMember("events", arr, allocator);
+      root.AddMember("last", static_cast<uint64_t>(last), allocator);
+      root.AddMember("head", static_cast<uint64_t>(head), allocator);
+
+      // serialize
+      rapidjson::StringBuffer buffer;
+      rapidjson::Writer writer(buffer);
+      root.Accept(writer);
+
+      QByteArray jsonData(buffer.GetString(), static_cast<int>(buffer.GetSize()));
+      return QHttpServerResponse("application/json", jsonData, QHttpServerResponder::StatusCode::Ok);
+    });
   });
 }
 
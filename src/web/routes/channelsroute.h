@@ -2,7 +2,8 @@
 #include <QHttpServer>
 
 class WebSessionStore;
+class HttpExecutor;
 
 namespace ChannelsRoute {
-  void install(QHttpServer *server);
+  void install(QHttpServer *server, HttpExecutor *executor);
 }
@@ -1,9 +1,8 @@
 #include "web/routes/static.h"
-#include "web/ratelimiter.h"
+#include "lib/rate_limiter.h"
 
 #include <QHttpServerResponse>
 #include <QHttpHeaders>
-#include <QtConcurrent>
 #include <QFileInfo>
 #include <QFile>
 #include <QMimeDatabase>
@@ -11,21 +10,23 @@
 
 #include "lib/globals.h"
 #include "web/routes/utils.h"
+#include "web/http_executor.h"
 #include "ctx.h"
 
 namespace StaticRoute {
 
-  void install(QHttpServer *server, RateLimiter *limiter) {
-    server->route("/static/<arg>", [limiter] (const QUrl &url, const QHttpServerRequest &request) {
+  void install(QHttpServer *server, HttpExecutor *executor, RateLimiter *limiter) {
+    server->route("/static/<arg>", [executor, limiter] (const QUrl &url, const QHttpServerRequest &request) {
       // return QHttpServerResponse::fromFile(QStringLiteral(":/assets/%1").arg(url.path()));
+      // refused before it takes a slot in the lane
       const QHostAddress ip = ipFromRequest(request);
-      auto path = url.path();
+      if (auto [allowed, retryAfter, msg] = limiter->check(ip, "Too many requests, retry after %1 seconds"); !allowed)
+        return HttpExecutor::ready(QHttpServerResponse(msg, QHttpServerResponder::StatusCode::TooManyRequests));
 
-      QFuture<QHttpServerResponse> future = QtConcurrent::run([path, ip, limiter]() {
-        // rate limit
-        if (auto [allowed, retryAfter, msg] = limiter->check(ip, "Too many requests, retry after %1 seconds"); !allowed)
-          return QHttpServerResponse(msg, QHttpServerResponder::StatusCode::TooManyRequests);
+      auto path = url.path();
 
+      // reads the whole file
+      return executor->run(HttpExecutor::Lane::Heavy, [path]() {
         // sanitize path
         QString safePath;
         if (!sanitizePath(path, safePath))
@@ -39,8 +40,6 @@ namespace StaticRoute {
 
         return QHttpServerResponse::fromFile(filePath);
       });
-
-      return future;
     });
   }
 
@@ -2,7 +2,8 @@
 #include <QHttpServer>
 
 class RateLimiter;
+class HttpExecutor;
 
 namespace StaticRoute {
-  void install(QHttpServer *server, RateLimiter *limiter);
+  void install(QHttpServer *server, HttpExecutor *executor, RateLimiter *limiter);
 }
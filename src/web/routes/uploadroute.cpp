@@ -1,10 +1,9 @@
 #include "web/routes/uploadroute.h"
 #include "web/sessionstore.h"
-#include "web/ratelimiter.h"
+#include "lib/rate_limiter.h"
 
 #include <QHttpServerResponse>
 #include <QHttpHeaders>
-#include <QtConcurrent>
 #include <QDir>
 #include <QFile>
 #include <QJsonDocument>
@@ -17,6 +16,7 @@
 
 #include "lib/globals.h"
 #include "web/routes/utils.h"
+#include "web/http_executor.h"
 #include "ctx.h"
 
 // https://codeberg.org/emersion/soju/src/branch/master/doc/ext/filehost.md
@@ -47,7 +47,7 @@ static QString safeFileName(const QString &filename) {
   return base;
 }
 
-void install(QHttpServer *server, RateLimiter *limiter) {
+void install(QHttpServer *server, HttpExecutor *executor, RateLimiter *limiter) {
   // OPTIONS /api/1/file/upload
   server->route("/api/1/file/upload", QHttpServerRequest::Method::Options, [](const QHttpServerRequest &) {
     QHttpHeaders headers;
@@ -59,9 +59,13 @@ void install(QHttpServer *server, RateLimiter *limiter) {
   });
 
   // POST /api/1/file/upload
-  server->route("/api/1/file/upload", QHttpServerRequest::Method::Post, [limiter](const QHttpServerRequest &request) {
-    const QByteArray body = request.body();
+  server->route("/api/1/file/upload", QHttpServerRequest::Method::Post, [executor, limiter](const QHttpServerRequest &request) {
+    // refused before it takes a slot in the lane
     const QHostAddress ip = ipFromRequest(request);
+    if (auto [allowed, retryAfter, msg] = limiter->check(ip, "Too many requests, retry after %1 seconds"); !allowed)
+      return HttpExecutor::ready(QHttpServerResponse(msg, QHttpServerResponder::StatusCode::TooManyRequests));
+
+    const QByteArray body = request.body();
 
     // copy cookies
     QStringList cookieHeaders;
@@ -72,12 +76,8 @@ void install(QHttpServer *server, RateLimiter *limiter) {
     const QString contentType = QString::fromUtf8(request.headers().value("Content-Type"));
     const QString contentDisposition = QString::fromUtf8(request.headers().value("Content-Disposition"));
 
-    QFuture<QHttpServerResponse> future = QtConcurrent::run([body, limiter, ip, cookieHeaders, contentType, contentDisposition, &request]() {
-      // rate limit
-      if (auto [allowed, retryAfter, msg] = limiter->check(ip, "Too many requests, retry after %1 seconds"); !allowed)
-        return QHttpServerResponse(msg, QHttpServerResponder::StatusCode::TooManyRequests);
-
-      const auto current_user = g::webSessions->get_user(request);
+    return executor->run(HttpExecutor::Lane::Heavy, [body, cookieHeaders, contentType, contentDisposition]() {
+      const auto current_user = g::webSessions->get_user(tokenFromCookies(cookieHeaders));
       if (current_user.isNull())
         return QHttpServerResponse("Unauthorized", QHttpServerResponder::StatusCode::Unauthorized);
 
@@ -125,13 +125,11 @@ void install(QHttpServer *server, RateLimiter *limiter) {
       res.setHeaders(std::move(headers));
       return res;
     });
-
-    return future;
   });
 
   // GET /files/<arg> - serve uploaded file
-  server->route("/files/<arg>", QHttpServerRequest::Method::Get, [](QString arg) {
-    QFuture<QHttpServerResponse> future = QtConcurrent::run([arg]() {
+  server->route("/files/<arg>", QHttpServerRequest::Method::Get, [executor](QString arg) {
+    return executor->run(HttpExecutor::Lane::Heavy, [arg]() {
       QString safePath;
       if (!sanitizePath(arg, safePath))
         return QHttpServerResponse("Invalid filename", QHttpServerResponder::StatusCode::BadRequest);
@@ -147,13 +145,11 @@ void install(QHttpServer *server, RateLimiter *limiter) {
 
       return QHttpServerResponse::fromFile(filePath);
     });
-
-    return future;
   });
 
   // HEAD /files/<arg> - describe uploaded file
-  server->route("/files/<arg>", QHttpServerRequest::Method::Head, [](QString arg) {
-    QFuture<QHttpServerResponse> future = QtConcurrent::run([arg]() {
+  server->route("/files/<arg>", QHttpServerRequest::Method::Head, [executor](QString arg) {
+    return executor->run(HttpExecutor::Lane::Light, [arg]() {
       QString safePath;
       if (!sanitizePath(arg, safePath))
         return QHttpServerResponse("Invalid filename", QHttpServerResponder::StatusCode::BadRequest);
@@ -171,8 +167,6 @@ void install(QHttpServer *server, RateLimiter *limiter) {
       res.setHeaders(std::move(headers));
       return res;
     });
-
-    return future;
   });
 }
 
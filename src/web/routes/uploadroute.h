@@ -3,7 +3,8 @@
 
 class WebSessionStore;
 class RateLimiter;
+class HttpExecutor;
 
 namespace UploadRoute {
-  void install(QHttpServer *server, RateLimiter *limiter);
+  void install(QHttpServer *server, HttpExecutor *executor, RateLimiter *limiter);
 }
@@ -1,5 +1,4 @@
 #include <QHttpServerResponse>
-#include <QtConcurrent>
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QJsonDocument>
@@ -7,6 +6,7 @@
 #include "web/routes/user.h"
 #include "web/sessionstore.h"
 #include "web/routes/utils.h"
+#include "web/http_executor.h"
 
 #include "ctx.h"
 #include "core/account.h"
@@ -15,10 +15,11 @@
 
 namespace UsersRoute {
 
-  void install(QHttpServer *server) {
-    server->route("/api/1/users", QHttpServerRequest::Method::Get, [](const QHttpServerRequest &request) {
-      QFuture<QHttpServerResponse> future = QtConcurrent::run([&request] {
-        const auto current_user = g::webSessions->get_user(request);
+  void install(QHttpServer *server, HttpExecutor *executor) {
+    // every account; a full listing, so the heavy lane
+    server->route("/api/1/users", QHttpServerRequest::Method::Get, [executor](const QHttpServerRequest &request) {
+      return executor->run(HttpExecutor::Lane::Heavy, [token = tokenFromRequest(request)] {
+        const auto current_user = g::webSessions->get_user(token);
         if (current_user.isNull())
           return QHttpServerResponse("Unauthorized", QHttpServerResponder::StatusCode::Unauthorized);
 
@@ -42,7 +43,6 @@ namespace UsersRoute {
         QByteArray jsonData(buffer.GetString(), static_cast<int>(buffer.GetSize()));
         return QHttpServerResponse("application/json", jsonData, QHttpServerResponder::StatusCode::Ok);
       });
-      return future;
     });
   }
 
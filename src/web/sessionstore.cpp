@@ -1,6 +1,4 @@
 #include "sessionstore.h"
-#include <QRandomGenerator>
-#include <QCryptographicHash>
 #include <QHttpServerRequest>
 
 #include "ctx.h"
@@ -8,60 +6,51 @@
 
 WebSessionStore::WebSessionStore() = default;
 
-static QString randomToken(int length = 32) {
-  QByteArray bytes;
-  bytes.resize(length);
-  for (int i = 0; i < length; ++i)
-    bytes[i] = char(QRandomGenerator::global()->bounded(33, 127));
-  return QCryptographicHash::hash(bytes, QCryptographicHash::Sha256).toHex();
-}
-
 QString WebSessionStore::createSession(const QString &username, int ttlSeconds) {
-  QMutexLocker locker(&m_mutex);
-  const QString token = randomToken(32);
-  SessionEntry e;
-  e.username = username;
-  e.expires = QDateTime::currentDateTimeUtc().addSecs(ttlSeconds);
-  m_sessions.insert(token, e);
-  return token;
+  // same format as SASL TOKEN; the cookie is one of those tokens
+  QUuid account_id;
+  if (const auto account = Account::get_by_name(username.toUtf8()); !account.isNull())
+    account_id = account->uid();
+  return g::ctx->session_tokens->issue(account_id, SessionTokens::new_device(), ttlSeconds);
 }
 
 bool WebSessionStore::validateToken(const QString &token) {
-  QMutexLocker locker(&m_mutex);
-  auto it = m_sessions.find(token);
-  if (it == m_sessions.end())
-    return false;
-  if (it->expires < QDateTime::currentDateTimeUtc()) {
-    m_sessions.erase(it);
-    return false;
-  }
-  // refresh TTL (sliding)
-  it->expires = QDateTime::currentDateTimeUtc().addSecs(3600);
-  return true;
+  return g::ctx->session_tokens->verify(token.toUtf8()).has_value();
 }
 
 QString WebSessionStore::usernameForToken(const QString &token) {
-  QMutexLocker locker(&m_mutex);
-  auto it = m_sessions.find(token);
-  if (it == m_sessions.end())
+  const auto claims = g::ctx->session_tokens->verify(token.toUtf8());
+  if (!claims)
+    return {};
+
+  const auto account = Account::get_by_uid(claims->account);
+  if (account.isNull())
     return {};
-  return it->username;
+  return account->name();
 }
 
 QSharedPointer<Account> WebSessionStore::get_user(const QHttpServerRequest &request) {
-  QReadLocker locker(&g::ctx->mtx_cache);
-  const QString token = tokenFromRequest(request);
-  if (token.isEmpty() || !g::webSessions->validateToken(token))
+  return get_user(tokenFromRequest(request));
+}
+
+QSharedPointer<Account> WebSessionStore::get_user(const QString &token) {
+  if (token.isEmpty())
     return {};
 
-  const auto username = usernameForToken(token);
-  if (username.isEmpty())
+  const auto claims = g::ctx->session_tokens->verify(token.toUtf8());
+  if (!claims || claims->account.isNull())
     return {};
 
-  return g::ctx->accounts_lookup_name.value(username.toUtf8());
+  return Account::get_by_uid(claims->account);
 }
 
-void WebSessionStore::destroySession(const QString &token) {
-  QMutexLocker locker(&m_mutex);
-  m_sessions.remove(token);
+void WebSessionStore::destroySession(const QString &token, const bool everywhere) {
+  const auto claims = g::ctx->session_tokens->verify(token.toUtf8());
+  if (!claims)
+    return;
+
+  if (everywhere)
+    g::ctx->session_tokens->revoke_all(claims->account);
+  else
+    g::ctx->session_tokens->revoke(*claims);
 }
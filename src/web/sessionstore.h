@@ -1,38 +1,33 @@
 #pragma once
 #include <QString>
-#include <QHash>
-#include <QMutex>
-#include <QDateTime>
+#include <QSharedPointer>
 
 #include "web/routes/utils.h"
+#include "lib/session_tokens.h"
 
 class Account;
 
+// web sessions are SessionTokens in a cookie; nothing is kept per session,
+// so any thread (or node sharing the key) checks one without a lock and
+// sessions survive a restart
 class WebSessionStore {
 public:
   WebSessionStore();
   ~WebSessionStore() = default;
 
-  // create a session token for a user (returns token)
-  QString createSession(const QString &username, int ttlSeconds = 3600);
+  // create a session token for a user (returns token), see SessionTokens
+  QString createSession(const QString &username, int ttlSeconds = SessionTokens::WEB_TTL_SECS);
 
-  // validate token: returns true if valid and refreshes TTL
+  // validate token: signature, expiry and revocation
   bool validateToken(const QString &token);
 
   // get username for token (empty if invalid)
   QString usernameForToken(const QString &token);
 
-  // destroy a session
-  void destroySession(const QString &token);
+  // destroy a session; with `everywhere`, every session of its account
+  void destroySession(const QString &token, bool everywhere = false);
 
   QSharedPointer<Account> get_user(const QHttpServerRequest &request);
-
-private:
-  struct SessionEntry {
-    QString username;
-    QDateTime expires;
-  };
-
-  QHash<QString, SessionEntry> m_sessions;
-  QMutex m_mutex;
+  // for handlers running after the request is gone, see HttpExecutor
+  QSharedPointer<Account> get_user(const QString &token);
 };
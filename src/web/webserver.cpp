@@ -9,7 +9,9 @@
 #include <QStandardPaths>
 #include <QDir>
 #include <QTemporaryFile>
-#include <QtConcurrent>
+#include <QThread>
+
+#include <algorithm>
 
 #include "web/routes/authroute.h"
 #include "web/routes/channelsroute.h"
@@ -25,6 +27,10 @@ WebServer::WebServer(QObject *parent) : QObject(parent),
   m_loginRateLimiter = new RateLimiter(3, 5);
   m_uploadRateLimiter = new RateLimiter(3, 5);
   m_webRateLimiter = new RateLimiter(10, 1);
+
+  // the light lane gets the larger share; logins wait on bcrypt threads
+  const int cores = std::max(2, QThread::idealThreadCount());
+  m_executor = new HttpExecutor(cores, std::max(2, cores / 2), 128);
   if (g::webSessions == nullptr)
     g::webSessions = new WebSessionStore();
   registerRoutes();
@@ -52,11 +58,11 @@ void WebServer::registerRoutes() {
     return QStringLiteral("Hello from QHttpServer (Qt6)");
   });
 
-  AuthRoute::install(m_server, m_loginRateLimiter);
-  ChannelsRoute::install(m_server);
-  UsersRoute::install(m_server);
-  UploadRoute::install(m_server, m_uploadRateLimiter);
-  StaticRoute::install(m_server, m_uploadRateLimiter);
+  AuthRoute::install(m_server, m_executor, m_loginRateLimiter);
+  ChannelsRoute::install(m_server, m_executor);
+  UsersRoute::install(m_server, m_executor);
+  UploadRoute::install(m_server, m_executor, m_uploadRateLimiter);
+  StaticRoute::install(m_server, m_executor, m_uploadRateLimiter);
 }
 
 void WebServer::stop() {
@@ -67,4 +73,5 @@ void WebServer::stop() {
 
 WebServer::~WebServer() {
   stop();
+  delete m_executor;
 }
\ No newline at end of file
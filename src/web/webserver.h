@@ -4,8 +4,9 @@
 #include <QTcpServer>
 #include <QSharedPointer>
 
-#include "ratelimiter.h"
+#include "lib/rate_limiter.h"
 #include "sessionstore.h"
+#include "http_executor.h"
 
 class WebServer : public QObject {
   Q_OBJECT
@@ -18,6 +19,8 @@ public:
   void setHost(const QString &host);
   void setPort(quint16 port);
 
+  [[nodiscard]] HttpExecutor* executor() const { return m_executor; }
+
 public slots:
   bool start();
   void stop();
@@ -35,6 +38,7 @@ private:
   RateLimiter* m_loginRateLimiter = nullptr;
   RateLimiter* m_uploadRateLimiter = nullptr;
   RateLimiter* m_webRateLimiter = nullptr;
+  HttpExecutor* m_executor = nullptr;
 
   void registerRoutes();
 };